@@ -3,7 +3,11 @@
 //
 
 #include "Activation.h"
-#include <math.h>
+#include "Simd.h"
+#include "Softmax.h"
+#include "SparseInput.h"
+#include "Trace.h"
+#include <utility>
 
 /**
  * @brief Constructor for Activation Object
@@ -18,83 +22,99 @@ Activation::Activation(ActivationType actType)
  * @brief Getter for the ActivationType struct
  * @return Activation Type (Relu or Softmax)
  */
-ActivationType Activation::getActivationType()
+ActivationType Activation::getActivationType() const
 {
     return _myActivationType;
 }
 
 /**
  * @brief () Operator overload for the activation
- * @param input an input matrix
+ * @param input an input matrix or view, copied into the result
  * @return a ref to a vector representing the result of Activation(input);
  */
-Matrix Activation::operator()(const Matrix &input)
+Matrix Activation::operator()(const MatrixView &input) const
 {
-    if (_myActivationType == Relu)
-    {
-        Matrix result = _reluFunc(input);
-        return result;
-
-    }
-
-    // else: if (_myActivationType == Softmax)
-    Matrix result = _softMaxFunc(input);
-    return result;
+    Matrix result = input;
+    return (*this)(std::move(result));
 
 }
 
 /**
- * @brief Helper function that calcs Relu:Real Numbers -> Real numbers
- * @param input a float
- * @return Relu(float)
+ * @brief () Operator overload for a temporary input. The activation is computed in place in
+ * its buffer
+ * @param input an input matrix about to expire
+ * @return a vector representing the result of Activation(input) (input's buffer)
  */
-float Activation::_reluHelperRealNumbers(float input)
+Matrix Activation::operator()(Matrix &&input) const
 {
-    if (input >= 0)
-    {
-        return input;
-    }
+    apply(input.data(), input.getRows(), input.getCols());
+    return std::move(input);
 
-    return 0;
 }
 
 /**
- * @brief Helper function that calculates Relu: Rn-cols -> Rn-cols
- * @param input a vector
- * @return Relu on the vector
+ * @brief Applies the activation in place on a raw row-major rows × cols buffer, every
+ * column being a separate vector
+ * @param values the buffer, replaced by Activation(values)
+ * @param rows rows of the buffer
+ * @param cols cols of the buffer
  */
-Matrix Activation::_reluFunc(const Matrix &input)
+void Activation::apply(float *values, const int rows, const int cols) const
 {
-    Matrix result = Matrix(input.getRows(), input.getCols());
-
-    for (int i = 0; i < result.getRows(); i++)
+    TRACE_SCOPE("op", _myActivationType == Relu ? "relu" : "softmax", -1, (double) rows * cols,
+                2.0 * sizeof(float) * rows * cols);
+    if (_myActivationType == Relu)
     {
-        result(i, 0) = _reluHelperRealNumbers(input(i, 0));
+        _reluFunc(values, rows, cols);
+        return;
     }
 
-    return result;
+    // else: if (_myActivationType == Softmax)
+    _softMaxFunc(values, rows, cols);
 }
 
 /**
- * @brief Helper function that calculates Softmax: Rn-cols -> Rn-cols
- * @param input a vector
- * @return Softmax on the vector
+ * @brief apply() on a single vector that also lists the entries left non-zero, for a next
+ * layer that only reads the weight columns of those. Relu does both in one pass
+ * (reluCompact())
+ * @param values the vector, replaced by Activation(values)
+ * @param rows length of values
+ * @param indices output, room for rows indices
+ * @return the number of indices written
  */
-Matrix Activation::_softMaxFunc(const Matrix &input)
+int Activation::applyIndexed(float *values, const int rows, int32_t *indices) const
 {
-    float sum = 0;
-    Matrix vec(input.getRows(), input.getCols());
-    for (int i = 0; i < input.getRows(); i++)
+    TRACE_SCOPE("op", _myActivationType == Relu ? "relu" : "softmax", -1, rows,
+                (2.0 * sizeof(float) + sizeof(int32_t)) * rows);
+    if (_myActivationType == Relu)
     {
-        sum += std::exp(input(i, 0));
-        vec(i, 0) = exp(input(i, 0));
+        return reluCompact(values, rows, indices);
     }
 
-    float scalar = 1 / sum;
-    // Matrix &result = *new Matrix(input.getRows(), input.getCols());
-
-    Matrix result = vec * scalar;
+    _softMaxFunc(values, rows, 1);
+    return compactNonZeros(values, rows, indices);
+}
 
-    return result;
+/**
+ * @brief Helper function that calculates Relu: Rn-cols -> Rn-cols, in place. Elementwise,
+ * using the vectorized kernel of this CPU (see Simd.h)
+ * @param values a vector, replaced by Relu on the vector
+ * @param rows rows of values
+ * @param cols cols of values
+ */
+void Activation::_reluFunc(float *values, const int rows, const int cols)
+{
+    simdKernels().relu(values, values, rows * cols);
 }
 
+/**
+ * @brief Helper function that calculates Softmax: Rn-cols -> Rn-cols, in place. Each column
+ * is a separate vector (a batch). Max subtracted and SIMD exponentials (see softmax())
+ * @param values a vector, replaced by Softmax on the vector
+ * @param rows rows of values
+ * @param cols cols of values
+ */
+void Activation::_softMaxFunc(float *values, const int rows, const int cols)
+{
+    softmax(values, rows, cols);
+}
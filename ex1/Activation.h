@@ -2,7 +2,10 @@
 #ifndef ACTIVATION_H
 #define ACTIVATION_H
 
+#include <cstdint>
+
 #include "Matrix.h"
+#include "MatrixView.h"
 
 /**
  * @enum ActivationType
@@ -31,39 +34,64 @@ public:
      * @brief Getter for the ActivationType struct
      * @return Activation Type (Relu or Softmax)
      */
-    ActivationType getActivationType();
+    ActivationType getActivationType() const;
 
     /**
      * @brief () Operator overload for the activation
-     * @param input an input matrix
+     * @param input an input matrix or view, copied into the result
      * @return a ref to a vector representing the result of Activation(input);
      */
-    Matrix operator()(const Matrix &input);
+    Matrix operator()(const MatrixView &input) const;
 
+    /**
+     * @brief () Operator overload for a temporary input. The activation is computed in place in
+     * its buffer
+     * @param input an input matrix about to expire
+     * @return a vector representing the result of Activation(input) (input's buffer)
+     */
+    Matrix operator()(Matrix &&input) const;
 
-private:
-    ActivationType _myActivationType;
+    /**
+     * @brief Applies the activation in place on a raw row-major rows × cols buffer, every
+     * column being a separate vector
+     * @param values the buffer, replaced by Activation(values)
+     * @param rows rows of the buffer
+     * @param cols cols of the buffer
+     */
+    void apply(float *values, int rows, int cols) const;
 
     /**
-     * @brief Helper function that calcs Relu:Real Numbers -> Real numbers
-     * @param input a float
-     * @return Relu(float)
+     * @brief apply() on a single vector that also lists the entries left non-zero, for a next
+     * layer that only reads the weight columns of those. Relu does both in one pass
+     * (reluCompact())
+     * @param values the vector, replaced by Activation(values)
+     * @param rows length of values
+     * @param indices output, room for rows indices
+     * @return the number of indices written
      */
-    static float _reluHelperRealNumbers(float input);
+    int applyIndexed(float *values, int rows, int32_t *indices) const;
+
+
+private:
+    ActivationType _myActivationType;
 
     /**
-     * @brief Helper function that calculates Relu: Rn-cols -> Rn-cols
-     * @param input a vector
-     * @return Relu on the vector
+     * @brief Helper function that calculates Relu: Rn-cols -> Rn-cols, in place. Elementwise,
+     * using the vectorized kernel of this CPU (see Simd.h)
+     * @param values a vector, replaced by Relu on the vector
+     * @param rows rows of values
+     * @param cols cols of values
      */
-    static Matrix _reluFunc(const Matrix &input);
+    static void _reluFunc(float *values, int rows, int cols);
 
     /**
-     * @brief Helper function that calculates Softmax: Rn-cols -> Rn-cols
-     * @param input a vector
-     * @return Softmax on the vector
+     * @brief Helper function that calculates Softmax: Rn-cols -> Rn-cols, in place. Each column
+     * is a separate vector (a batch). Max subtracted and SIMD exponentials (see softmax())
+     * @param values a vector, replaced by Softmax on the vector
+     * @param rows rows of values
+     * @param cols cols of values
      */
-    static Matrix _softMaxFunc(const Matrix &input);
+    static void _softMaxFunc(float *values, int rows, int cols);
 
 };
 
@@ -0,0 +1,63 @@
+//AlignedBuffer.h
+#ifndef ALIGNEDBUFFER_H
+#define ALIGNEDBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief Alignment (in bytes) of every scratch buffer: one cache line, one AVX-512 register
+ */
+#define BUFFER_ALIGNMENT 64
+
+/**
+ * @brief 64 byte aligned float buffer that only grows, so steady state users don't allocate
+ */
+class AlignedBuffer
+{
+public:
+    /**
+     * @brief returns a buffer of at least size floats. Previous content is not preserved when
+     * the buffer has to grow
+     * @param size number of floats needed
+     * @return an aligned pointer
+     */
+    float *reserve(size_t size)
+    {
+        if (size > _size)
+        {
+            _raw.reset(new float[size + BUFFER_ALIGNMENT / sizeof(float)]);
+            auto address = reinterpret_cast<uintptr_t>(_raw.get());
+            address = (address + BUFFER_ALIGNMENT - 1) & ~(uintptr_t) (BUFFER_ALIGNMENT - 1);
+            _aligned = reinterpret_cast<float *>(address);
+            _size = size;
+        }
+        return _aligned;
+    }
+
+    /**
+     * @brief the current buffer
+     * @return an aligned pointer (nullptr before the first reserve())
+     */
+    float *data() const
+    {
+        return _aligned;
+    }
+
+    /**
+     * @brief capacity getter
+     * @return number of floats available at data()
+     */
+    size_t size() const
+    {
+        return _size;
+    }
+
+private:
+    std::unique_ptr<float[]> _raw;
+    float *_aligned = nullptr;
+    size_t _size = 0;
+};
+
+#endif //ALIGNEDBUFFER_H
@@ -0,0 +1,70 @@
+//
+// Created by user on 06/01/2020.
+//
+
+#include "BatchScorer.h"
+
+#include <algorithm>
+#include <chrono>
+
+/**
+ * @brief Constructor. Starts the worker threads
+ * @param network the model, shared (not copied) by all threads. Must outlive the scorer
+ * @param threads threads to use, the caller included (default: all hardware threads)
+ */
+BatchScorer::BatchScorer(const MlpNetwork &network, int threads) :
+        _network(network), _pool(threads)
+{
+
+}
+
+/**
+ * @brief Classifies every image and times the run. Exits (code 1) if an image doesn't
+ * have 784 elements
+ * @param images the images (28 × 28 or already vectorized)
+ * @return the digits and the throughput
+ */
+ScoreReport BatchScorer::score(const std::vector<Matrix> &images)
+{
+    const int count = (int) images.size();
+    ScoreReport report;
+    report.digits.resize(count);
+    report.threads = _pool.getThreadCount();
+
+    const auto start = std::chrono::steady_clock::now();
+
+    const int shards = (count + SCORER_SHARD - 1) / SCORER_SHARD;
+    _pool.parallelFor(shards, [&](int shard)
+    {
+        const int first = shard * SCORER_SHARD;
+        const int size = std::min(SCORER_SHARD, count - first);
+        _network.classifyBatch(images.data() + first, size, report.digits.data() + first);
+    });
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+    report.imagesPerSecond = report.seconds > 0 ? count / report.seconds : 0;
+    return report;
+}
+
+/**
+ * @brief thread count getter
+ * @return threads the work is shared between
+ */
+int BatchScorer::getThreadCount() const
+{
+    return _pool.getThreadCount();
+}
+
+/**
+ * @brief Output stream operator: one line summary of a run (images, threads, time, throughput)
+ * @param os an output stream
+ * @param report a report
+ * @return ref for os
+ */
+std::ostream &operator<<(std::ostream &os, const ScoreReport &report)
+{
+    os << report.digits.size() << " images, " << report.threads << " threads: "
+       << report.seconds * 1e3 << " ms (" << report.imagesPerSecond << " images/s)";
+    return os;
+}
@@ -0,0 +1,76 @@
+//BatchScorer.h
+#ifndef BATCHSCORER_H
+#define BATCHSCORER_H
+
+#include <iostream>
+#include <vector>
+
+#include "MlpNetwork.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief Images per pool task: one classifyBatch() chunk, so every task is a batched forward
+ * pass of its own and there are still enough tasks to balance the threads
+ */
+#define SCORER_SHARD MLP_BATCH_CHUNK
+
+/**
+ * @struct ScoreReport
+ * @brief Result of BatchScorer::score()
+ * @var digits - one Digit per image, in input order
+ * @var threads - threads that shared the work
+ * @var seconds - wall time of the whole run
+ * @var imagesPerSecond - throughput
+ */
+typedef struct ScoreReport
+{
+    std::vector<Digit> digits;
+    int threads;
+    double seconds;
+    double imagesPerSecond;
+} ScoreReport;
+
+/**
+ * @brief Output stream operator: one line summary of a run (images, threads, time, throughput)
+ * @param os an output stream
+ * @param report a report
+ * @return ref for os
+ */
+std::ostream &operator<<(std::ostream &os, const ScoreReport &report);
+
+/**
+ * @brief Classifies large image sets on every core: the set is cut into shards of SCORER_SHARD
+ * images that the pool's threads run through one shared, read-only network (each thread using
+ * its own workspace).
+ */
+class BatchScorer
+{
+public:
+    /**
+     * @brief Constructor. Starts the worker threads
+     * @param network the model, shared (not copied) by all threads. Must outlive the scorer
+     * @param threads threads to use, the caller included (default: all hardware threads)
+     */
+    explicit BatchScorer(const MlpNetwork &network,
+                         int threads = ThreadPool::hardwareThreads());
+
+    /**
+     * @brief Classifies every image and times the run. Exits (code 1) if an image doesn't
+     * have 784 elements
+     * @param images the images (28 × 28 or already vectorized)
+     * @return the digits and the throughput
+     */
+    ScoreReport score(const std::vector<Matrix> &images);
+
+    /**
+     * @brief thread count getter
+     * @return threads the work is shared between
+     */
+    int getThreadCount() const;
+
+private:
+    const MlpNetwork &_network;
+    ThreadPool _pool;
+};
+
+#endif //BATCHSCORER_H
@@ -0,0 +1,15 @@
+//CompiledModel.h
+#ifndef COMPILEDMODEL_H
+#define COMPILEDMODEL_H
+
+#include "FixedMlpNetwork.h"
+
+/**
+ * @brief The network built into the program: defined by the translation unit model_compiler
+ * generates, whose weights, biases and transposed weights are constexpr arrays. Nothing is
+ * read at startup and every layer runs the kernels of its constant shape
+ * @return the network, read-only and thread safe
+ */
+const FixedMlpNetwork &compiledMlpNetwork();
+
+#endif //COMPILEDMODEL_H
@@ -3,26 +3,153 @@
 //
 
 #include "Dense.h"
+#include "Gemm.h"
+#include "GemmHalf.h"
+#include "Simd.h"
+#include "SparseInput.h"
+#include "Spmm.h"
+#include "Trace.h"
+
+#include <cstddef>
+#include <vector>
 
 /**
- * @brief Constructor
+ * @brief Constructor. The layer only reads the matrices: any number of threads may run it
+ * at once
  * @param weights matrix representing the weights of this layer
  * @param bias the biad vector of this layer
  * @param actType activationType (Relu or Softmax)
+ * @param columns the transpose of weights, or nullptr. When given, single vectors with few
+ * non-zeros (see usesSparseInput()) only read the columns of the weights
+ * their non-zeros meet, through gemvSparseInput()
+ * @param packed weights packed by gemmPackA(), or nullptr. When given, batches read the
+ * weights' panels from it instead of packing them on every product
  */
-Dense::Dense(Matrix &weights, Matrix &bias, ActivationType actType) :
-        _weights(weights), _bias(bias), _layerActivation(*new Activation(actType))
+Dense::Dense(const Matrix &weights, const Matrix &bias, ActivationType actType,
+             const Matrix *columns, const float *packed) :
+        _weights(&weights), _columns(columns), _packed(packed), _quantized(nullptr),
+        _half(nullptr), _sparse(nullptr), _inputQuantization{0, 0},
+        _bias(bias), _layerActivation(actType)
 {
 
 }
 
 /**
- * @brief Getter function for weights
+ * @brief Constructor of an int8 layer: the input vectors are quantized to uint8, multiplied
+ * by gemmInt8() and the int32 results scaled back to float before the bias and activation
+ * @param weights the quantized weights of this layer
+ * @param bias the bias vector of this layer
+ * @param actType activationType (Relu or Softmax)
+ * @param input how the input vectors are quantized
+ */
+Dense::Dense(const QuantizedMatrix &weights, const Matrix &bias, ActivationType actType,
+             const InputQuantization &input) :
+        _weights(nullptr), _columns(nullptr), _packed(nullptr), _quantized(&weights),
+        _half(nullptr), _sparse(nullptr), _inputQuantization(input),
+        _bias(bias), _layerActivation(actType)
+{
+
+}
+
+/**
+ * @brief Constructor of a layer with 16 bit weights: products run through gemmHalf(),
+ * accumulating in float
+ * @param weights the fp16 or bf16 weights of this layer
+ * @param bias the bias vector of this layer
+ * @param actType activationType (Relu or Softmax)
+ */
+Dense::Dense(const HalfMatrix &weights, const Matrix &bias, ActivationType actType) :
+        _weights(nullptr), _columns(nullptr), _packed(nullptr), _quantized(nullptr),
+        _half(&weights), _sparse(nullptr), _inputQuantization{0, 0},
+        _bias(bias), _layerActivation(actType)
+{
+
+}
+
+/**
+ * @brief Constructor of a layer with sparse (CSR) weights: products run through spmm(),
+ * skipping the zeros
+ * @param weights the sparse weights of this layer
+ * @param bias the bias vector of this layer
+ * @param actType activationType (Relu or Softmax)
+ */
+Dense::Dense(const SparseMatrix &weights, const Matrix &bias, ActivationType actType) :
+        _weights(nullptr), _columns(nullptr), _packed(nullptr), _quantized(nullptr),
+        _half(nullptr), _sparse(&weights), _inputQuantization{0, 0},
+        _bias(bias), _layerActivation(actType)
+{
+
+}
+
+/**
+ * @brief Getter function for weights. Float layers only (see isQuantized(), isHalf(),
+ * isSparse())
  * @return ref for the weights matrix
  */
 const Matrix &Dense::getWeights() const
 {
-    return _weights;
+    return *_weights;
+}
+
+/**
+ * @brief Whether the layer runs on int8 weights
+ * @return true for layers built from a QuantizedMatrix
+ */
+bool Dense::isQuantized() const
+{
+    return _quantized != nullptr;
+}
+
+/**
+ * @brief Whether the layer runs on 16 bit weights
+ * @return true for layers built from a HalfMatrix
+ */
+bool Dense::isHalf() const
+{
+    return _half != nullptr;
+}
+
+/**
+ * @brief Whether the layer runs on sparse weights
+ * @return true for layers built from a SparseMatrix
+ */
+bool Dense::isSparse() const
+{
+    return _sparse != nullptr;
+}
+
+/**
+ * @brief input size getter
+ * @return elements of an input vector (cols of the weights)
+ */
+int Dense::getInputSize() const
+{
+    if (_quantized != nullptr)
+    {
+        return _quantized->getCols();
+    }
+    if (_sparse != nullptr)
+    {
+        return _sparse->getCols();
+    }
+    return _half != nullptr ? _half->getCols() : _weights->getCols();
+}
+
+/**
+ * @brief output size getter
+ * @return elements of an output vector (rows of the weights)
+ */
+int Dense::getOutputSize() const
+{
+    if (_quantized != nullptr)
+    {
+        return _quantized->getRows();
+    }
+    if (_sparse != nullptr)
+    {
+        return _sparse->getRows();
+    }
+    return _half != nullptr ? _half->getRows() : _weights->getRows();
 }
 
 /**
@@ -45,15 +172,253 @@ const Activation &Dense::getActivation() const
 
 /**
  * @brief Operator() overload
- * @param input a vector (represented by a matrix)
- * @return ref to the vector that is the calculation of: Activation(Weights * input + bias)
+ * @param input a vector (represented by a matrix), or a batch of column vectors: a matrix or
+ * any view, e.g. a column slice of a larger batch (strided, nothing is copied)
+ * @return the vector that is the calculation of: Activation(Weights * input + bias)
  * means layer(input) = Activation(weights * input + bias)
  */
-Matrix &Dense::operator()(Matrix &input) const
+Matrix Dense::operator()(const MatrixView &input) const
 {
-    Matrix &result = *new Matrix(input.getRows(), input.getCols());
-    result = _layerActivation((_weights * input) + _bias);
-
+    if (input.getRows() != getInputSize())
+    {
+        std::cerr << MULTIPLY_ERROR << std::endl;
+        std::exit(1);
+    }
+    // one fused pass instead of a product, a sum and an activation matrix
+    Matrix result(getOutputSize(), input.getCols());
+    forward(input.data(), input.getStride(), result.data(), input.getCols());
     return result;
 }
 
+/**
+ * @brief Allocation free layer evaluation on raw buffers, for a batch of cols column
+ * vectors at once: output = Activation(weights * input + bias), bias added to every column.
+ * A single cols == 1 vector runs through gemv(), larger batches through one gemm() (their
+ * gemmHalf(), gemmInt8() and spmm() counterparts for 16 bit, int8 and sparse layers). The
+ * bias and Relu are the epilogue of the kernel (GemmEpilogue), applied before the results
+ * leave the registers; a Softmax layer gets its logits that way and normalizes them after
+ * @param input row-major getInputSize() × cols matrix
+ * @param inputStride distance (in floats) between consecutive rows of input
+ * @param output contiguous row-major getOutputSize() × cols matrix. Must not alias
+ * input
+ * @param cols number of column vectors in the batch
+ * @param logits true to stop a Softmax layer at its logits, weights * input + bias, for a
+ * caller that only needs softmaxTop(). No effect on Relu layers
+ */
+void Dense::forward(const float *input, const int inputStride, float *output,
+                    const int cols, const bool logits) const
+{
+    const bool relu = _layerActivation.getActivationType() == Relu;
+    _product(input, inputStride, output, cols, nullptr, 0, relu);
+    if (!relu && !logits)
+    {
+        _layerActivation.apply(output, getOutputSize(), cols);
+    }
+}
+
+/**
+ * @brief forward() of a single contiguous vector whose non-zero entries are already listed
+ * (by the previous layer's activation), that can list the non-zeros of its own output for
+ * the next layer in the same pass as the activation
+ * @param input contiguous getInputSize() vector
+ * @param indices the non-zero entries of input, or nullptr (read only by layers that
+ * takesIndexedInput())
+ * @param count number of indices
+ * @param output contiguous getOutputSize() vector. Must not alias input
+ * @param outputIndices nullptr, or room for getOutputSize() indices: receives the non-zero
+ * entries of output
+ * @param logits true to stop a Softmax layer at its logits (see forward())
+ * @return the number of outputIndices written (0 for nullptr)
+ */
+int Dense::forwardIndexed(const float *input, const int32_t *indices, const int count,
+                          float *output, int32_t *outputIndices, const bool logits) const
+{
+    if (outputIndices != nullptr)
+    {
+        // Relu and the list of its non-zeros come out of one pass (applyIndexed())
+        _product(input, 1, output, 1, indices, count, false);
+        return _layerActivation.applyIndexed(output, getOutputSize(), outputIndices);
+    }
+
+    const bool relu = _layerActivation.getActivationType() == Relu;
+    _product(input, 1, output, 1, indices, count, relu);
+    if (!relu && !logits)
+    {
+        _layerActivation.apply(output, getOutputSize(), 1);
+    }
+    return 0;
+}
+
+/**
+ * @brief Whether single vectors may skip their zero inputs: float layers built with the
+ * transpose of their weights
+ * @return true if forwardIndexed() reads the indices
+ */
+bool Dense::takesIndexedInput() const
+{
+    return _columns != nullptr;
+}
+
+/**
+ * @brief The automatic choice of forwardIndexed(): the columns of the non-zero inputs when
+ * there are at most sparseInputMaxDensity() of them, else the dense gemv()
+ * @param count number of non-zero inputs
+ * @return true if a vector with count non-zeros only reads their columns
+ */
+bool Dense::usesSparseInput(const int count) const
+{
+    return _columns != nullptr && count <= getInputSize() * sparseInputMaxDensity();
+}
+
+/**
+ * @brief output = weights * input + bias, followed by Relu when relu is set: forward()
+ * without a softmax. The bias and Relu are the epilogue of the multiply kernel when it has
+ * one (float, 16 bit and int8 weights), a pass over output otherwise
+ */
+void Dense::_product(const float *input, const int inputStride, float *output, const int cols,
+                     const int32_t *indices, const int count, const bool relu) const
+{
+    if (_quantized != nullptr)
+    {
+        _forwardInt8(input, inputStride, output, cols, relu);
+        return;
+    }
+
+    const int rows = getOutputSize();
+    const GemmEpilogue epilogue = {_bias.data(), relu ? EpilogueRelu : EpilogueNone};
+    if (_half != nullptr)
+    {
+        TRACE_SCOPE("op", "gemmHalf", -1, 2.0 * rows * cols * _half->getCols(),
+                    sizeof(uint16_t) * (double) rows * _half->getCols() +
+                    sizeof(float) * ((double) _half->getCols() * cols + (double) rows * cols));
+        gemmHalf(_half->getFormat(), rows, cols, _half->getCols(), _half->data(),
+                 _half->getStride(), input, inputStride, output, cols, false, &epilogue);
+        return;
+    }
+    if (_columns != nullptr && cols == 1 && inputStride == 1)
+    {
+        _productSparseInput(input, indices, count, output, epilogue);
+        return;
+    }
+    if (_sparse == nullptr)
+    {
+        TRACE_SCOPE("op", "gemm", -1, 2.0 * rows * cols * _weights->getCols(),
+                    sizeof(float) * ((double) rows * _weights->getCols() +
+                                     (double) _weights->getCols() * cols + (double) rows * cols));
+        gemm(rows, cols, _weights->getCols(), _weights->data(), _weights->getCols(), input,
+             inputStride, output, cols, false, &epilogue, _packed);
+        return;
+    }
+
+    // spmm() has no epilogue: every column starts as the bias, the product accumulates on top
+    TRACE_SCOPE("op", "spmm", -1, 2.0 * _sparse->getNonZeros() * cols,
+                (sizeof(float) + sizeof(int32_t)) * (double) _sparse->getNonZeros() +
+                sizeof(float) * ((double) _sparse->getCols() * cols + (double) rows * cols));
+    const SimdKernels &kernels = simdKernels();
+    for (int i = 0; i < rows; i++)
+    {
+        kernels.fill(output + i * cols, _bias.data()[i], cols);
+    }
+    spmm(rows, cols, _sparse->rowOffsets(), _sparse->columns(), _sparse->values(), input,
+         inputStride, output, cols, true);
+    if (relu)
+    {
+        kernels.relu(output, output, rows * cols);
+    }
+}
+
+/**
+ * @brief _product() of an int8 layer
+ */
+void Dense::_forwardInt8(const float *input, const int inputStride, float *output,
+                         const int cols, const bool relu) const
+{
+    // per-thread scratch, grown on demand like gemm()'s packing buffers
+    static thread_local std::vector<uint8_t> packed;
+    static thread_local std::vector<int32_t> products;
+    static thread_local std::vector<float> inputScales;
+    static thread_local std::vector<int32_t> zeroPoints;
+
+    const QuantizedMatrix &weights = *_quantized;
+    const int rows = weights.getRows();
+    const int stride = weights.getStride();
+    TRACE_SCOPE("op", "gemmInt8", -1, 2.0 * rows * cols * weights.getCols(),
+                (double) rows * stride +
+                sizeof(float) * ((double) weights.getCols() * cols + (double) rows * cols));
+    if (packed.size() < (size_t) stride * cols)
+    {
+        packed.resize((size_t) stride * cols);
+    }
+    if (products.size() < (size_t) rows * cols)
+    {
+        products.resize((size_t) rows * cols);
+    }
+    if (inputScales.size() < (size_t) cols)
+    {
+        inputScales.resize(cols);
+        zeroPoints.resize(cols);
+    }
+
+    quantizeColumns(input, inputStride, weights.getCols(), cols, _inputQuantization,
+                    packed.data(), stride, inputScales.data(), zeroPoints.data());
+    gemmInt8(rows, cols, stride, weights.data(), stride, packed.data(), stride, products.data(),
+             cols);
+
+    // W x ≈ sw * sx * (Wq (xq - zero point)), the zero point term being zero point * row sum
+    for (int i = 0; i < rows; i++)
+    {
+        const float weightScale = weights.scales()[i];
+        const int32_t rowSum = weights.rowSums()[i];
+        const float bias = _bias.data()[i];
+        const int32_t *product = products.data() + (ptrdiff_t) i * cols;
+        float *out = output + (ptrdiff_t) i * cols;
+        for (int j = 0; j < cols; j++)
+        {
+            const int32_t dot = product[j] - zeroPoints[j] * rowSum;
+            const float value = weightScale * inputScales[j] * (float) dot + bias;
+            out[j] = !relu || value >= 0 ? value : 0.0f;
+        }
+    }
+}
+
+/**
+ * @brief _product() of a single contiguous input vector, through the columns of the non-zero
+ * inputs when there are few enough of them (usesSparseInput())
+ */
+void Dense::_productSparseInput(const float *input, const int32_t *indices, int count,
+                                float *output, const GemmEpilogue &epilogue) const
+{
+    static thread_local std::vector<int32_t> scratch;
+
+    const int rows = _weights->getRows();
+    const int inputSize = _weights->getCols();
+    if (indices == nullptr)
+    {
+        if (scratch.size() < (size_t) inputSize)
+        {
+            scratch.resize(inputSize);
+        }
+        count = compactNonZeros(input, inputSize, scratch.data());
+        indices = scratch.data();
+    }
+
+    if (!usesSparseInput(count))
+    {
+        TRACE_SCOPE("op", "gemv", -1, 2.0 * rows * inputSize,
+                    sizeof(float) * ((double) rows * inputSize + inputSize + rows));
+        gemv(rows, inputSize, _weights->data(), inputSize, input, output, 1, false, &epilogue);
+        return;
+    }
+
+    // the columns accumulate on top of the bias, Relu is a pass over the short output
+    TRACE_SCOPE("op", "gemvSparseInput", -1, 2.0 * rows * count,
+                sizeof(float) * ((double) rows * count + rows) +
+                (sizeof(float) + sizeof(int32_t)) * count);
+    const SimdKernels &kernels = simdKernels();
+    kernels.copy(output, _bias.data(), rows);
+    gemvSparseInput(rows, _columns->data(), rows, input, indices, count, output, true);
+    if (epilogue.activation == EpilogueRelu)
+    {
+        kernels.relu(output, output, rows);
+    }
+}
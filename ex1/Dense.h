@@ -6,7 +6,12 @@
 #define EX1_DENSE_H
 
 #include "Matrix.h"
+#include "MatrixView.h"
 #include "Activation.h"
+#include "Gemm.h"
+#include "HalfMatrix.h"
+#include "QuantizedMatrix.h"
+#include "SparseMatrix.h"
 
 /**
  * @brief This class represents a Dense in the model
@@ -15,19 +20,109 @@ class Dense
 {
 public:
     /**
-     * @brief Constructor
+     * @brief Constructor. The layer only reads the matrices: any number of threads may run it
+     * at once
      * @param weights matrix representing the weights of this layer
      * @param bias the biad vector of this layer
      * @param actType activationType (Relu or Softmax)
+     * @param columns the transpose of weights, or nullptr. When given, single vectors with few
+     * non-zeros (see usesSparseInput()) only read the columns of the weights
+     * their non-zeros meet, through gemvSparseInput()
+     * @param packed weights packed by gemmPackA(), or nullptr. When given, batches read the
+     * weights' panels from it instead of packing them on every product
      */
-    Dense(Matrix &weights, Matrix &bias, ActivationType actType);
+    Dense(const Matrix &weights, const Matrix &bias, ActivationType actType,
+          const Matrix *columns = nullptr, const float *packed = nullptr);
 
     /**
-     * @brief Getter function for weights
+     * @brief Constructor of an int8 layer: the input vectors are quantized to uint8, multiplied
+     * by gemmInt8() and the int32 results scaled back to float before the bias and activation
+     * @param weights the quantized weights of this layer
+     * @param bias the bias vector of this layer
+     * @param actType activationType (Relu or Softmax)
+     * @param input how the input vectors are quantized
+     */
+    Dense(const QuantizedMatrix &weights, const Matrix &bias, ActivationType actType,
+          const InputQuantization &input);
+
+    /**
+     * @brief Constructor of a layer with 16 bit weights: products run through gemmHalf(),
+     * accumulating in float
+     * @param weights the fp16 or bf16 weights of this layer
+     * @param bias the bias vector of this layer
+     * @param actType activationType (Relu or Softmax)
+     */
+    Dense(const HalfMatrix &weights, const Matrix &bias, ActivationType actType);
+
+    /**
+     * @brief Constructor of a layer with sparse (CSR) weights: products run through spmm(),
+     * skipping the zeros
+     * @param weights the sparse weights of this layer
+     * @param bias the bias vector of this layer
+     * @param actType activationType (Relu or Softmax)
+     */
+    Dense(const SparseMatrix &weights, const Matrix &bias, ActivationType actType);
+
+    /**
+     * @brief The layer keeps references to its weights and bias: temporaries would be gone
+     * before the first forward pass, so they don't compile
+     */
+    Dense(Matrix &&weights, const Matrix &bias, ActivationType actType,
+          const Matrix *columns = nullptr, const float *packed = nullptr) = delete;
+    Dense(const Matrix &weights, Matrix &&bias, ActivationType actType,
+          const Matrix *columns = nullptr, const float *packed = nullptr) = delete;
+    Dense(Matrix &&weights, Matrix &&bias, ActivationType actType,
+          const Matrix *columns = nullptr, const float *packed = nullptr) = delete;
+    Dense(QuantizedMatrix &&weights, const Matrix &bias, ActivationType actType,
+          const InputQuantization &input) = delete;
+    Dense(const QuantizedMatrix &weights, Matrix &&bias, ActivationType actType,
+          const InputQuantization &input) = delete;
+    Dense(QuantizedMatrix &&weights, Matrix &&bias, ActivationType actType,
+          const InputQuantization &input) = delete;
+    Dense(HalfMatrix &&weights, const Matrix &bias, ActivationType actType) = delete;
+    Dense(const HalfMatrix &weights, Matrix &&bias, ActivationType actType) = delete;
+    Dense(HalfMatrix &&weights, Matrix &&bias, ActivationType actType) = delete;
+    Dense(SparseMatrix &&weights, const Matrix &bias, ActivationType actType) = delete;
+    Dense(const SparseMatrix &weights, Matrix &&bias, ActivationType actType) = delete;
+    Dense(SparseMatrix &&weights, Matrix &&bias, ActivationType actType) = delete;
+
+    /**
+     * @brief Getter function for weights. Float layers only (see isQuantized(), isHalf(),
+     * isSparse())
      * @return ref for the weights matrix
      */
     const Matrix &getWeights() const;
 
+    /**
+     * @brief Whether the layer runs on int8 weights
+     * @return true for layers built from a QuantizedMatrix
+     */
+    bool isQuantized() const;
+
+    /**
+     * @brief Whether the layer runs on 16 bit weights
+     * @return true for layers built from a HalfMatrix
+     */
+    bool isHalf() const;
+
+    /**
+     * @brief Whether the layer runs on sparse weights
+     * @return true for layers built from a SparseMatrix
+     */
+    bool isSparse() const;
+
+    /**
+     * @brief input size getter
+     * @return elements of an input vector (cols of the weights)
+     */
+    int getInputSize() const;
+
+    /**
+     * @brief output size getter
+     * @return elements of an output vector (rows of the weights)
+     */
+    int getOutputSize() const;
+
     /**
      * @brief Getter function for bias
      * @return ref for the bias vector
@@ -42,17 +137,94 @@ public:
 
     /**
      * @brief Operator() overload
-     * @param input a vector (represented by a matrix)
-     * @return ref to the vector that is the calculation of: Activation(Weights * input + bias)
+     * @param input a vector (represented by a matrix), or a batch of column vectors: a matrix or
+     * any view, e.g. a column slice of a larger batch (strided, nothing is copied)
+     * @return the vector that is the calculation of: Activation(Weights * input + bias)
      * means layer(input) = Activation(weights * input + bias)
      */
-    Matrix &operator()(Matrix &input) const;
+    Matrix operator()(const MatrixView &input) const;
+
+    /**
+     * @brief Allocation free layer evaluation on raw buffers, for a batch of cols column
+     * vectors at once: output = Activation(weights * input + bias), bias added to every column.
+     * A single cols == 1 vector runs through gemv(), larger batches through one gemm() (their
+     * gemmHalf(), gemmInt8() and spmm() counterparts for 16 bit, int8 and sparse layers). The
+     * bias and Relu are the epilogue of the kernel (GemmEpilogue)
+     * @param input row-major getInputSize() × cols matrix
+     * @param inputStride distance (in floats) between consecutive rows of input
+     * @param output contiguous row-major getOutputSize() × cols matrix. Must not alias
+     * input
+     * @param cols number of column vectors in the batch
+     * @param logits true to stop a Softmax layer at its logits, weights * input + bias, for a
+     * caller that only needs softmaxTop(). No effect on Relu layers
+     */
+    void forward(const float *input, int inputStride, float *output, int cols,
+                 bool logits = false) const;
+
+    /**
+     * @brief forward() of a single contiguous vector whose non-zero entries are already listed
+     * (by the previous layer's activation), that can list the non-zeros of its own output for
+     * the next layer in the same pass as the activation
+     * @param input contiguous getInputSize() vector
+     * @param indices the non-zero entries of input, or nullptr (read only by layers that
+     * takesIndexedInput())
+     * @param count number of indices
+     * @param output contiguous getOutputSize() vector. Must not alias input
+     * @param outputIndices nullptr, or room for getOutputSize() indices: receives the non-zero
+     * entries of output
+     * @param logits true to stop a Softmax layer at its logits (see forward())
+     * @return the number of outputIndices written (0 for nullptr)
+     */
+    int forwardIndexed(const float *input, const int32_t *indices, int count, float *output,
+                       int32_t *outputIndices, bool logits = false) const;
+
+    /**
+     * @brief Whether single vectors may skip their zero inputs: float layers built with the
+     * transpose of their weights
+     * @return true if forwardIndexed() reads the indices
+     */
+    bool takesIndexedInput() const;
+
+    /**
+     * @brief The automatic choice of forwardIndexed(): the columns of the non-zero inputs when
+     * there are at most sparseInputMaxDensity() of them, else the dense gemv()
+     * @param count number of non-zero inputs
+     * @return true if a vector with count non-zeros only reads their columns
+     */
+    bool usesSparseInput(int count) const;
 
 private:
 
-    Matrix &_weights;
-    Matrix &_bias;
-    Activation &_layerActivation;
+    const Matrix *_weights;
+    const Matrix *_columns;
+    const float *_packed;
+    const QuantizedMatrix *_quantized;
+    const HalfMatrix *_half;
+    const SparseMatrix *_sparse;
+    InputQuantization _inputQuantization;
+    const Matrix &_bias;
+    Activation _layerActivation;
+
+    /**
+     * @brief output = weights * input + bias, followed by Relu when relu is set: forward()
+     * without a softmax. The bias and Relu are the epilogue of the multiply kernel when it
+     * has one (float, 16 bit and int8 weights), a pass over output otherwise
+     */
+    void _product(const float *input, int inputStride, float *output, int cols,
+                  const int32_t *indices, int count, bool relu) const;
+
+    /**
+     * @brief _product() of an int8 layer
+     */
+    void _forwardInt8(const float *input, int inputStride, float *output, int cols,
+                      bool relu) const;
+
+    /**
+     * @brief _product() of a single contiguous input vector, through the columns of the
+     * non-zero inputs when there are few enough of them (usesSparseInput())
+     */
+    void _productSparseInput(const float *input, const int32_t *indices, int count,
+                             float *output, const GemmEpilogue &epilogue) const;
 
 
 };
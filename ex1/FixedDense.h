@@ -0,0 +1,556 @@
+//FixedDense.h
+#ifndef FIXEDDENSE_H
+#define FIXEDDENSE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Activation.h"
+#include "AlignedBuffer.h"
+#include "FixedMatrix.h"
+#include "Simd.h"
+#include "SimdReduce.h"
+#include "Softmax.h"
+#include "SparseInput.h"
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Rows of the weights the fixed shape gemv kernels stream together, each with 2
+ * accumulators
+ */
+#define FIXED_GEMV_ROWS 4
+
+/**
+ * @brief Partial sums of the portable fixed shape gemv, so the compiler can vectorize the dot
+ * products without reassociating them
+ */
+#define FIXED_PARTIAL_SUMS 8
+
+/**
+ * @brief A fixed shape layer product: y = Relu?(A * x + bias), A being M×K row-major and the
+ * shape a template argument of the kernel
+ */
+typedef void (*FixedGemvKernel)(const float *a, const float *x, const float *bias, float *y,
+                                bool relu);
+
+/**
+ * @brief Accumulator registers of a fixed shape column kernel: it keeps 8 vectors of the
+ * output (128 floats with AVX-512, 64 with AVX2) in registers while the columns stream through
+ */
+#define FIXED_COLUMN_REGISTERS 8
+
+/**
+ * @brief A fixed shape layer product that only reads the columns of the non-zero inputs (see
+ * gemvSparseInput()): y = Relu?(A * x + bias), A being M×K given as its K×M transpose and M a
+ * template argument of the kernel
+ */
+typedef void (*FixedColumnsKernel)(const float *columns, const float *x, const int32_t *indices,
+                                   int count, const float *bias, float *y, bool relu);
+
+/**
+ * @brief The epilogue of count dot products, as gemm()'s: dot + bias, then Relu
+ * @param dots the dot products
+ * @param count number of dot products
+ * @param bias their biases
+ * @param y output, count values
+ * @param relu whether to apply Relu
+ */
+inline void fixedEpilogue(const float *dots, const int count, const float *bias, float *y,
+                          const bool relu)
+{
+    for (int r = 0; r < count; r++)
+    {
+        const float value = dots[r] + bias[r];
+        y[r] = !relu || value >= 0 ? value : 0.0f;
+    }
+}
+
+/**
+ * @brief Portable fixed shape gemv: FIXED_PARTIAL_SUMS independent sums per row, over a
+ * compile-time K the compiler unrolls
+ */
+template <int M, int K>
+void portableFixedGemv(const float *a, const float *x, const float *bias, float *y,
+                       const bool relu)
+{
+    constexpr int blocked = K / FIXED_PARTIAL_SUMS * FIXED_PARTIAL_SUMS;
+    for (int i = 0; i < M; i++)
+    {
+        const float *row = a + (ptrdiff_t) i * K;
+        float sum[FIXED_PARTIAL_SUMS] = {};
+        for (int p = 0; p < blocked; p += FIXED_PARTIAL_SUMS)
+        {
+            for (int u = 0; u < FIXED_PARTIAL_SUMS; u++)
+            {
+                sum[u] += row[p + u] * x[p + u];
+            }
+        }
+        float dot = 0.0f;
+        for (int u = 0; u < FIXED_PARTIAL_SUMS; u++)
+        {
+            dot += sum[u];
+        }
+        for (int p = blocked; p < K; p++)
+        {
+            dot += row[p] * x[p];
+        }
+        fixedEpilogue(&dot, 1, bias + i, y + i, relu);
+    }
+}
+
+/**
+ * @brief Portable fixed shape column kernel: y accumulates x[j] times column j for every listed
+ * j, over a compile-time M the compiler vectorizes
+ */
+template <int M>
+void portableFixedColumns(const float *columns, const float *x, const int32_t *indices,
+                          const int count, const float *bias, float *y, const bool relu)
+{
+    float sums[M] = {};
+    for (int n = 0; n < count; n++)
+    {
+        const float xj = x[indices[n]];
+        const float *column = columns + (ptrdiff_t) indices[n] * M;
+        for (int i = 0; i < M; i++)
+        {
+            sums[i] += xj * column[i];
+        }
+    }
+    fixedEpilogue(sums, M, bias, y, relu);
+}
+
+#if SIMD_X86
+
+/**
+ * @brief Rows dot products of consecutive rows of A against x, 16 entries per step with 2
+ * accumulators per row. K is known, so the loop has a fixed trip count and the tail is
+ * resolved at compile time
+ */
+template <int Rows, int K>
+__attribute__((target("avx2,fma")))
+inline void avx2FixedDots(const float *a, const float *x, float *dots)
+{
+    __m256 acc0[Rows];
+    __m256 acc1[Rows];
+    for (int r = 0; r < Rows; r++)
+    {
+        acc0[r] = _mm256_setzero_ps();
+        acc1[r] = _mm256_setzero_ps();
+    }
+
+    constexpr int pairs = K / 16 * 16;
+    for (int p = 0; p < pairs; p += 16)
+    {
+        const __m256 x0 = _mm256_loadu_ps(x + p);
+        const __m256 x1 = _mm256_loadu_ps(x + p + 8);
+        for (int r = 0; r < Rows; r++)
+        {
+            const float *row = a + (ptrdiff_t) r * K + p;
+            acc0[r] = _mm256_fmadd_ps(_mm256_loadu_ps(row), x0, acc0[r]);
+            acc1[r] = _mm256_fmadd_ps(_mm256_loadu_ps(row + 8), x1, acc1[r]);
+        }
+    }
+    if (K - pairs >= 8)
+    {
+        const __m256 x0 = _mm256_loadu_ps(x + pairs);
+        for (int r = 0; r < Rows; r++)
+        {
+            acc0[r] = _mm256_fmadd_ps(_mm256_loadu_ps(a + (ptrdiff_t) r * K + pairs), x0,
+                                      acc0[r]);
+        }
+    }
+
+    constexpr int vectors = K / 8 * 8;
+    for (int r = 0; r < Rows; r++)
+    {
+        float dot = horizontalSum(_mm256_add_ps(acc0[r], acc1[r]));
+        for (int p = vectors; p < K; p++)
+        {
+            dot += a[(ptrdiff_t) r * K + p] * x[p];
+        }
+        dots[r] = dot;
+    }
+}
+
+/**
+ * @brief AVX2/FMA fixed shape gemv: FIXED_GEMV_ROWS rows at a time, then the M %
+ * FIXED_GEMV_ROWS last rows together
+ */
+template <int M, int K>
+__attribute__((target("avx2,fma")))
+void avx2FixedGemv(const float *a, const float *x, const float *bias, float *y, const bool relu)
+{
+    constexpr int grouped = M / FIXED_GEMV_ROWS * FIXED_GEMV_ROWS;
+    constexpr int rest = M - grouped;
+    float dots[FIXED_GEMV_ROWS];
+    for (int i = 0; i < grouped; i += FIXED_GEMV_ROWS)
+    {
+        avx2FixedDots<FIXED_GEMV_ROWS, K>(a + (ptrdiff_t) i * K, x, dots);
+        fixedEpilogue(dots, FIXED_GEMV_ROWS, bias + i, y + i, relu);
+    }
+    if (rest > 0)
+    {
+        avx2FixedDots<(rest > 0 ? rest : 1), K>(a + (ptrdiff_t) grouped * K, x, dots);
+        fixedEpilogue(dots, rest, bias + grouped, y + grouped, relu);
+    }
+}
+
+/**
+ * @brief avx2FixedDots() with 16 lane registers and a masked tail, its mask a constant
+ */
+template <int Rows, int K>
+__attribute__((target("avx512f")))
+inline void avx512FixedDots(const float *a, const float *x, float *dots)
+{
+    __m512 acc0[Rows];
+    __m512 acc1[Rows];
+    for (int r = 0; r < Rows; r++)
+    {
+        acc0[r] = _mm512_setzero_ps();
+        acc1[r] = _mm512_setzero_ps();
+    }
+
+    constexpr int pairs = K / 32 * 32;
+    for (int p = 0; p < pairs; p += 32)
+    {
+        const __m512 x0 = _mm512_loadu_ps(x + p);
+        const __m512 x1 = _mm512_loadu_ps(x + p + 16);
+        for (int r = 0; r < Rows; r++)
+        {
+            const float *row = a + (ptrdiff_t) r * K + p;
+            acc0[r] = _mm512_fmadd_ps(_mm512_loadu_ps(row), x0, acc0[r]);
+            acc1[r] = _mm512_fmadd_ps(_mm512_loadu_ps(row + 16), x1, acc1[r]);
+        }
+    }
+    constexpr int vectors = K / 16 * 16;
+    if (vectors > pairs)
+    {
+        const __m512 x0 = _mm512_loadu_ps(x + pairs);
+        for (int r = 0; r < Rows; r++)
+        {
+            acc0[r] = _mm512_fmadd_ps(_mm512_loadu_ps(a + (ptrdiff_t) r * K + pairs), x0,
+                                      acc0[r]);
+        }
+    }
+    if (K > vectors)
+    {
+        const __mmask16 tail = (__mmask16) ((1u << (K - vectors)) - 1u);
+        const __m512 x0 = _mm512_maskz_loadu_ps(tail, x + vectors);
+        for (int r = 0; r < Rows; r++)
+        {
+            const __m512 ar = _mm512_maskz_loadu_ps(tail, a + (ptrdiff_t) r * K + vectors);
+            acc1[r] = _mm512_fmadd_ps(ar, x0, acc1[r]);
+        }
+    }
+
+    for (int r = 0; r < Rows; r++)
+    {
+        dots[r] = horizontalSum(_mm512_add_ps(acc0[r], acc1[r]));
+    }
+}
+
+/**
+ * @brief AVX-512 fixed shape gemv, avx2FixedGemv() on avx512FixedDots()
+ */
+template <int M, int K>
+__attribute__((target("avx512f")))
+void avx512FixedGemv(const float *a, const float *x, const float *bias, float *y,
+                     const bool relu)
+{
+    constexpr int grouped = M / FIXED_GEMV_ROWS * FIXED_GEMV_ROWS;
+    constexpr int rest = M - grouped;
+    float dots[FIXED_GEMV_ROWS];
+    for (int i = 0; i < grouped; i += FIXED_GEMV_ROWS)
+    {
+        avx512FixedDots<FIXED_GEMV_ROWS, K>(a + (ptrdiff_t) i * K, x, dots);
+        fixedEpilogue(dots, FIXED_GEMV_ROWS, bias + i, y + i, relu);
+    }
+    if (rest > 0)
+    {
+        avx512FixedDots<(rest > 0 ? rest : 1), K>(a + (ptrdiff_t) grouped * K, x, dots);
+        fixedEpilogue(dots, rest, bias + grouped, y + grouped, relu);
+    }
+}
+
+/**
+ * @brief Rows sums of the columns of A listed in indices, scaled by x, Rows consecutive entries
+ * of each column at a time: one register per 8 of them, the last one under a constant mask
+ */
+template <int Rows, int M>
+__attribute__((target("avx2,fma")))
+inline void avx2FixedColumnBlock(const float *columns, const float *x, const int32_t *indices,
+                                 const int count, float *sums)
+{
+    constexpr int vectors = (Rows + 7) / 8;
+    const __m256i tail = _mm256_cmpgt_epi32(_mm256_set1_epi32(Rows - (vectors - 1) * 8),
+                                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256 acc[vectors];
+    for (int v = 0; v < vectors; v++)
+    {
+        acc[v] = _mm256_setzero_ps();
+    }
+    for (int n = 0; n < count; n++)
+    {
+        const __m256 xj = _mm256_set1_ps(x[indices[n]]);
+        const float *column = columns + (ptrdiff_t) indices[n] * M;
+        for (int v = 0; v < vectors - 1; v++)
+        {
+            acc[v] = _mm256_fmadd_ps(_mm256_loadu_ps(column + v * 8), xj, acc[v]);
+        }
+        const __m256 last = _mm256_maskload_ps(column + (vectors - 1) * 8, tail);
+        acc[vectors - 1] = _mm256_fmadd_ps(last, xj, acc[vectors - 1]);
+    }
+    for (int v = 0; v < vectors; v++)
+    {
+        _mm256_store_ps(sums + v * 8, acc[v]);
+    }
+}
+
+/**
+ * @brief AVX2/FMA fixed shape column kernel: FIXED_COLUMN_REGISTERS vectors of y at a time,
+ * then the rest of y together
+ */
+template <int M>
+__attribute__((target("avx2,fma")))
+void avx2FixedColumns(const float *columns, const float *x, const int32_t *indices,
+                      const int count, const float *bias, float *y, const bool relu)
+{
+    constexpr int block = FIXED_COLUMN_REGISTERS * 8;
+    constexpr int blocked = M / block * block;
+    constexpr int rest = M - blocked;
+    alignas(BUFFER_ALIGNMENT) float sums[block];
+    for (int i = 0; i < blocked; i += block)
+    {
+        avx2FixedColumnBlock<block, M>(columns + i, x, indices, count, sums);
+        fixedEpilogue(sums, block, bias + i, y + i, relu);
+    }
+    if (rest > 0)
+    {
+        avx2FixedColumnBlock<(rest > 0 ? rest : 1), M>(columns + blocked, x, indices, count,
+                                                       sums);
+        fixedEpilogue(sums, rest, bias + blocked, y + blocked, relu);
+    }
+}
+
+/**
+ * @brief avx2FixedColumnBlock() with 16 lane registers
+ */
+template <int Rows, int M>
+__attribute__((target("avx512f")))
+inline void avx512FixedColumnBlock(const float *columns, const float *x, const int32_t *indices,
+                                   const int count, float *sums)
+{
+    constexpr int vectors = (Rows + 15) / 16;
+    constexpr __mmask16 tail = (__mmask16) ((1u << (Rows - (vectors - 1) * 16)) - 1u);
+    __m512 acc[vectors];
+    for (int v = 0; v < vectors; v++)
+    {
+        acc[v] = _mm512_setzero_ps();
+    }
+    for (int n = 0; n < count; n++)
+    {
+        const __m512 xj = _mm512_set1_ps(x[indices[n]]);
+        const float *column = columns + (ptrdiff_t) indices[n] * M;
+        for (int v = 0; v < vectors - 1; v++)
+        {
+            acc[v] = _mm512_fmadd_ps(_mm512_loadu_ps(column + v * 16), xj, acc[v]);
+        }
+        const __m512 last = _mm512_maskz_loadu_ps(tail, column + (vectors - 1) * 16);
+        acc[vectors - 1] = _mm512_fmadd_ps(last, xj, acc[vectors - 1]);
+    }
+    for (int v = 0; v < vectors; v++)
+    {
+        _mm512_store_ps(sums + v * 16, acc[v]);
+    }
+}
+
+/**
+ * @brief AVX-512 fixed shape column kernel, avx2FixedColumns() on avx512FixedColumnBlock()
+ */
+template <int M>
+__attribute__((target("avx512f")))
+void avx512FixedColumns(const float *columns, const float *x, const int32_t *indices,
+                        const int count, const float *bias, float *y, const bool relu)
+{
+    constexpr int block = FIXED_COLUMN_REGISTERS * 16;
+    constexpr int blocked = M / block * block;
+    constexpr int rest = M - blocked;
+    alignas(BUFFER_ALIGNMENT) float sums[block];
+    for (int i = 0; i < blocked; i += block)
+    {
+        avx512FixedColumnBlock<block, M>(columns + i, x, indices, count, sums);
+        fixedEpilogue(sums, block, bias + i, y + i, relu);
+    }
+    if (rest > 0)
+    {
+        avx512FixedColumnBlock<(rest > 0 ? rest : 1), M>(columns + blocked, x, indices, count,
+                                                         sums);
+        fixedEpilogue(sums, rest, bias + blocked, y + blocked, relu);
+    }
+}
+
+#endif // SIMD_X86
+
+/**
+ * @brief The fixed shape gemv for simdIsa(), selected once per shape
+ * @tparam M rows of the weights
+ * @tparam K cols of the weights
+ * @return the kernel
+ */
+template <int M, int K>
+FixedGemvKernel fixedGemvKernel()
+{
+    static const FixedGemvKernel kernel = []() -> FixedGemvKernel
+    {
+        switch (simdIsa())
+        {
+#if SIMD_X86
+            case SimdAvx512:
+                return avx512FixedGemv<M, K>;
+            case SimdAvx2:
+                return avx2FixedGemv<M, K>;
+#endif
+            default:
+                return portableFixedGemv<M, K>;
+        }
+    }();
+    return kernel;
+}
+
+/**
+ * @brief The fixed shape column kernel for simdIsa(), selected once per shape
+ * @tparam M rows of the weights
+ * @return the kernel
+ */
+template <int M>
+FixedColumnsKernel fixedColumnsKernel()
+{
+    static const FixedColumnsKernel kernel = []() -> FixedColumnsKernel
+    {
+        switch (simdIsa())
+        {
+#if SIMD_X86
+            case SimdAvx512:
+                return avx512FixedColumns<M>;
+            case SimdAvx2:
+                return avx2FixedColumns<M>;
+#endif
+            default:
+                return portableFixedColumns<M>;
+        }
+    }();
+    return kernel;
+}
+
+/**
+ * @brief A Dense layer whose shape is part of its type: Out × In weights. Chaining layers of
+ * mismatched shapes, or feeding one the wrong input, doesn't compile. The layer only reads
+ * the weights and bias it is given, which must outlive it
+ * @tparam Out rows of the weights, length of the output
+ * @tparam In cols of the weights, length of the input
+ */
+template <int Out, int In>
+class FixedDense
+{
+public:
+    typedef FixedMatrix<Out, In> Weights;
+    typedef FixedMatrix<Out, 1> Bias;
+    typedef FixedMatrix<In, Out> Columns;
+
+    /**
+     * @brief Constructor over row-major arrays, typically compiled into the program
+     * @param weights Out * In weights
+     * @param bias Out biases
+     * @param actType activationType (Relu or Softmax)
+     * @param columns nullptr, or the transpose of weights: lets single vectors with few
+     * non-zeros read only the columns of their non-zeros (see Dense::usesSparseInput())
+     */
+    FixedDense(const float (&weights)[Out * In], const float (&bias)[Out],
+               const ActivationType actType, const float (*columns)[In * Out] = nullptr) :
+            _weights(weights), _bias(bias), _columns(columns != nullptr ? *columns : nullptr),
+            _actType(actType)
+    {
+
+    }
+
+    /**
+     * @brief Constructor over fixed shape matrices
+     * @param weights the weights of this layer
+     * @param bias the bias vector of this layer
+     * @param actType activationType (Relu or Softmax)
+     * @param columns nullptr, or the transpose of weights (see the array constructor)
+     */
+    FixedDense(const Weights &weights, const Bias &bias, const ActivationType actType,
+               const Columns *columns = nullptr) :
+            FixedDense(weights.values(), bias.values(), actType,
+                       columns != nullptr ? &columns->values() : nullptr)
+    {
+
+    }
+
+    /**
+     * @brief input size getter
+     * @return In
+     */
+    static constexpr int getInputSize()
+    {
+        return In;
+    }
+
+    /**
+     * @brief output size getter
+     * @return Out
+     */
+    static constexpr int getOutputSize()
+    {
+        return Out;
+    }
+
+    /**
+     * @brief Getter for the activation type
+     * @return Relu or Softmax
+     */
+    ActivationType getActivationType() const
+    {
+        return _actType;
+    }
+
+    /**
+     * @brief output = Activation(weights * input + bias) through the kernels of this shape, the
+     * bias and Relu fused in their epilogue (see Dense::forward()): the column kernel when the
+     * layer has its columns and input has at most sparseInputMaxDensity() non-zeros, else the
+     * gemv
+     * @param input the input vector
+     * @param output the output vector. Must not alias input
+     * @param logits true to stop a Softmax layer at its logits (see softmaxTop())
+     */
+    void forward(const float (&input)[In], float (&output)[Out], const bool logits = false) const
+    {
+        const bool relu = _actType == Relu;
+        int32_t indices[In];
+        const int count = _columns != nullptr ? compactNonZeros(input, In, indices) : In;
+        if (_columns != nullptr && count <= In * sparseInputMaxDensity())
+        {
+            fixedColumnsKernel<Out>()(_columns, input, indices, count, _bias, output, relu);
+        }
+        else
+        {
+            fixedGemvKernel<Out, In>()(_weights, input, _bias, output, relu);
+        }
+        if (_actType == Softmax && !logits)
+        {
+            softmax(output, Out, 1);
+        }
+    }
+
+private:
+    const float *_weights;
+    const float *_bias;
+    const float *_columns;
+    ActivationType _actType;
+};
+
+#endif //FIXEDDENSE_H
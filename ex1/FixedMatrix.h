@@ -0,0 +1,201 @@
+//FixedMatrix.h
+#ifndef FIXEDMATRIX_H
+#define FIXEDMATRIX_H
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "AlignedBuffer.h"
+#include "Matrix.h"
+#include "Transpose.h"
+
+#define FIXED_SHAPE_ERROR "Error: the matrix doesn't have the fixed shape"
+
+/**
+ * @brief A rows × cols float matrix whose shape is part of its type. The elements live inline
+ * (no heap, BUFFER_ALIGNMENT aligned), every loop over them has a compile-time trip count and
+ * operands of the wrong shape are compile errors instead of runtime exits. Large instances
+ * (a layer's weights) belong in static storage or on the heap, not on the stack
+ * @tparam R rows
+ * @tparam C cols
+ */
+template <int R, int C>
+class FixedMatrix
+{
+public:
+    static_assert(R > 0 && C > 0, "a FixedMatrix has at least one element");
+
+    /**
+     * @brief The elements as a sized array: functions taking a const Values & only accept
+     * matrices of this exact shape
+     */
+    typedef float Values[R * C];
+
+    /**
+     * @brief Constructor of an all zero matrix
+     */
+    FixedMatrix() : _mat{}
+    {
+
+    }
+
+    /**
+     * @brief Constructor copying a runtime shaped Matrix. Exits (code 1) if its shape isn't
+     * R × C
+     * @param matrix the matrix to copy
+     */
+    explicit FixedMatrix(const Matrix &matrix)
+    {
+        if (matrix.getRows() != R || matrix.getCols() != C)
+        {
+            std::cerr << FIXED_SHAPE_ERROR << std::endl;
+            std::exit(1);
+        }
+        std::memcpy(_mat, matrix.data(), sizeof(_mat));
+    }
+
+    /**
+     * @brief rows getter
+     * @return R
+     */
+    static constexpr int getRows()
+    {
+        return R;
+    }
+
+    /**
+     * @brief cols getter
+     * @return C
+     */
+    static constexpr int getCols()
+    {
+        return C;
+    }
+
+    /**
+     * @brief The elements, row-major, with their size in the type
+     * @return ref to the R * C elements
+     */
+    const Values &values() const
+    {
+        return _mat;
+    }
+
+    /**
+     * @brief The elements, row-major, with their size in the type
+     * @return ref to the R * C elements
+     */
+    Values &values()
+    {
+        return _mat;
+    }
+
+    /**
+     * @brief Raw row-major elements
+     * @return pointer to element (0, 0)
+     */
+    const float *data() const
+    {
+        return _mat;
+    }
+
+    /**
+     * @brief Raw row-major elements
+     * @return pointer to element (0, 0)
+     */
+    float *data()
+    {
+        return _mat;
+    }
+
+    /**
+     * @brief Element at a compile-time position: out of range indices don't compile
+     * @tparam I row
+     * @tparam J col
+     * @return matrix[I][J]
+     */
+    template <int I, int J>
+    float at() const
+    {
+        static_assert(I >= 0 && I < R && J >= 0 && J < C, "FixedMatrix index out of range");
+        return _mat[I * C + J];
+    }
+
+    /**
+     * @brief Element at a compile-time position: out of range indices don't compile
+     * @tparam I row
+     * @tparam J col
+     * @return ref to matrix[I][J]
+     */
+    template <int I, int J>
+    float &at()
+    {
+        static_assert(I >= 0 && I < R && J >= 0 && J < C, "FixedMatrix index out of range");
+        return _mat[I * C + J];
+    }
+
+    /**
+     * @brief Matrix () operator, checked like Matrix's. Exits (code 1) if (i, j) is outside
+     * the matrix, under MATRIX_CHECKED_ACCESS (the default)
+     * @param i row
+     * @param j col
+     * @return matrix[i][j]
+     */
+    float operator()(const int i, const int j) const
+    {
+        _checkIndex(i, j);
+        return _mat[i * C + j];
+    }
+
+    /**
+     * @brief Matrix () operator, checked like Matrix's. Exits (code 1) if (i, j) is outside
+     * the matrix, under MATRIX_CHECKED_ACCESS (the default)
+     * @param i row
+     * @param j col
+     * @return ref to matrix[i][j]
+     */
+    float &operator()(const int i, const int j)
+    {
+        _checkIndex(i, j);
+        return _mat[i * C + j];
+    }
+
+    /**
+     * @brief Writes the transpose of this matrix, whose shape is C × R (see transposeMatrix())
+     * @param transposed output, must not be this matrix
+     */
+    void transpose(FixedMatrix<C, R> &transposed) const
+    {
+        transposeMatrix(R, C, _mat, C, transposed.data(), R);
+    }
+
+    /**
+     * @brief A runtime shaped, non-owning view of this matrix (see Matrix::borrow()), e.g. for
+     * printing. Must not outlive this matrix
+     * @return a Matrix viewing the elements
+     */
+    Matrix borrow() const
+    {
+        return Matrix::borrow(_mat, R, C);
+    }
+
+private:
+    alignas(BUFFER_ALIGNMENT) float _mat[R * C];
+
+    /**
+     * @brief Exits (code 1) if (i, j) is outside the matrix, under MATRIX_CHECKED_ACCESS
+     * @param i row
+     * @param j col
+     */
+    static void _checkIndex(const int i, const int j)
+    {
+        if (MATRIX_CHECKED_ACCESS && (i < 0 || i >= R || j < 0 || j >= C))
+        {
+            std::cerr << FIXED_SHAPE_ERROR << std::endl;
+            std::exit(1);
+        }
+    }
+};
+
+#endif //FIXEDMATRIX_H
@@ -0,0 +1,143 @@
+//
+// Created by user on 13/01/2020.
+//
+
+#include "FixedMlpNetwork.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include "AlignedBuffer.h"
+#include "Softmax.h"
+
+/**
+ * @brief Constructor copying runtime shaped matrices and transposing the weights. Exits
+ * (code 1) if one of them doesn't have its weightsDims / biasDims shape
+ * @param weightsArr an array of Matrices representing weights
+ * @param biasArr an array of Matrices representing biases
+ */
+FixedMlpWeights::FixedMlpWeights(const Matrix weightsArr[], const Matrix biasArr[]) :
+        weights0(weightsArr[0]), weights1(weightsArr[1]), weights2(weightsArr[2]),
+        weights3(weightsArr[3]), bias0(biasArr[0]), bias1(biasArr[1]), bias2(biasArr[2]),
+        bias3(biasArr[3])
+{
+    weights0.transpose(columns0);
+    weights1.transpose(columns1);
+    weights2.transpose(columns2);
+    weights3.transpose(columns3);
+}
+
+/**
+ * @brief BUFFER_ALIGNMENT aligned allocation: before C++17 new ignores the alignment of the
+ * members
+ * @param size bytes to allocate
+ * @return the memory. Throws std::bad_alloc if there is none
+ */
+void *FixedMlpWeights::operator new(const size_t size)
+{
+    void *memory = nullptr;
+    if (posix_memalign(&memory, BUFFER_ALIGNMENT, size) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+/**
+ * @brief Frees memory from operator new()
+ * @param pointer the memory
+ */
+void FixedMlpWeights::operator delete(void *pointer)
+{
+    std::free(pointer);
+}
+
+/**
+ * @brief Constructor
+ * @param layer0 first layer, takes the image
+ * @param layer1 second layer
+ * @param layer2 third layer
+ * @param layer3 last layer, gives the digit
+ */
+FixedMlpNetwork::FixedMlpNetwork(const FixedLayer0 &layer0, const FixedLayer1 &layer1,
+                                 const FixedLayer2 &layer2, const FixedLayer3 &layer3) :
+        _layer0(layer0), _layer1(layer1), _layer2(layer2), _layer3(layer3)
+{
+
+}
+
+/**
+ * @brief Constructor of the MlpNetwork layers (Relu, Relu, Relu, Softmax) on fixed shape
+ * weights, every layer skipping its zero inputs like MlpNetwork's float layers
+ * @param weights the weights and biases, must outlive the network
+ */
+FixedMlpNetwork::FixedMlpNetwork(const FixedMlpWeights &weights) :
+        FixedMlpNetwork(FixedLayer0(weights.weights0, weights.bias0, Relu, &weights.columns0),
+                        FixedLayer1(weights.weights1, weights.bias1, Relu, &weights.columns1),
+                        FixedLayer2(weights.weights2, weights.bias2, Relu, &weights.columns2),
+                        FixedLayer3(weights.weights3, weights.bias3, Softmax, &weights.columns3))
+{
+
+}
+
+/**
+ * @brief Classifies an image: the four layers on stack activations, the last one stopping at
+ * its logits when it is Softmax (softmaxTop() gives the digit, see MlpNetwork::_digits())
+ * @param image the FIXED_IMAGE_SIZE pixels, row-major
+ * @return a Digit object
+ */
+Digit FixedMlpNetwork::operator()(const float (&image)[FIXED_IMAGE_SIZE]) const
+{
+    alignas(BUFFER_ALIGNMENT) float hidden0[FixedLayer0::getOutputSize()];
+    alignas(BUFFER_ALIGNMENT) float hidden1[FixedLayer1::getOutputSize()];
+    alignas(BUFFER_ALIGNMENT) float hidden2[FixedLayer2::getOutputSize()];
+    alignas(BUFFER_ALIGNMENT) float output[FixedLayer3::getOutputSize()];
+    _layer0.forward(image, hidden0);
+    _layer1.forward(hidden0, hidden1);
+    _layer2.forward(hidden1, hidden2);
+    _layer3.forward(hidden2, output, true);
+
+    Digit result;
+    if (_layer3.getActivationType() == Softmax)
+    {
+        softmaxTop(output, FixedLayer3::getOutputSize(), 1, &result);
+        return result;
+    }
+
+    unsigned int maxIndex = 0;
+    for (int i = 1; i < FixedLayer3::getOutputSize(); i++)
+    {
+        if (output[i] > output[maxIndex])
+        {
+            maxIndex = i;
+        }
+    }
+    result = {maxIndex, output[maxIndex]};
+    return result;
+}
+
+/**
+ * @brief Classifies an image. Exits (code 1) if img isn't a FIXED_IMAGE_SIZE × 1 column vector
+ * (see MlpNetwork::operator()). A strided column (of a batch) is gathered first
+ * @param img a matrix or view representing the image (a column vector)
+ * @return a Digit object
+ */
+Digit FixedMlpNetwork::operator()(const MatrixView &img) const
+{
+    if (img.getRows() != FIXED_IMAGE_SIZE || img.getCols() != 1)
+    {
+        std::cerr << MULTIPLY_ERROR << std::endl;
+        std::exit(1);
+    }
+    if (!img.isContiguous())
+    {
+        alignas(BUFFER_ALIGNMENT) float image[FIXED_IMAGE_SIZE];
+        for (int i = 0; i < FIXED_IMAGE_SIZE; i++)
+        {
+            image[i] = *img.row(i);
+        }
+        return (*this)(image);
+    }
+    return (*this)(*reinterpret_cast<const float (*)[FIXED_IMAGE_SIZE]>(img.data()));
+}
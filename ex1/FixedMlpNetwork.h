@@ -0,0 +1,129 @@
+//FixedMlpNetwork.h
+#ifndef FIXEDMLPNETWORK_H
+#define FIXEDMLPNETWORK_H
+
+#include <cstddef>
+
+#include "Digit.h"
+#include "FixedDense.h"
+#include "FixedMatrix.h"
+#include "Matrix.h"
+#include "MatrixView.h"
+#include "MlpNetwork.h"
+
+/**
+ * @brief Elements of an image, the input of the first layer
+ */
+#define FIXED_IMAGE_SIZE (imgDims.rows * imgDims.cols)
+
+typedef FixedDense<weightsDims[0].rows, weightsDims[0].cols> FixedLayer0;
+typedef FixedDense<weightsDims[1].rows, weightsDims[1].cols> FixedLayer1;
+typedef FixedDense<weightsDims[2].rows, weightsDims[2].cols> FixedLayer2;
+typedef FixedDense<weightsDims[3].rows, weightsDims[3].cols> FixedLayer3;
+
+static_assert(FixedLayer0::getInputSize() == FIXED_IMAGE_SIZE,
+              "the first layer must take an image");
+static_assert(FixedLayer1::getInputSize() == FixedLayer0::getOutputSize() &&
+              FixedLayer2::getInputSize() == FixedLayer1::getOutputSize() &&
+              FixedLayer3::getInputSize() == FixedLayer2::getOutputSize(),
+              "every layer must take the output of the previous one");
+static_assert(biasDims[0].rows == weightsDims[0].rows &&
+              biasDims[1].rows == weightsDims[1].rows &&
+              biasDims[2].rows == weightsDims[2].rows &&
+              biasDims[3].rows == weightsDims[3].rows,
+              "every bias must have a row per output");
+
+/**
+ * @brief Fixed shape copies of the weights and biases of the MlpNetwork topology, with the
+ * transpose of every weights matrix for the column kernels (about 880KB: allocate it on the
+ * heap or in static storage). FixedMlpNetwork runs on them
+ */
+class FixedMlpWeights
+{
+public:
+    /**
+     * @brief Constructor copying runtime shaped matrices and transposing the weights. Exits
+     * (code 1) if one of them doesn't have its weightsDims / biasDims shape
+     * @param weightsArr an array of Matrices representing weights
+     * @param biasArr an array of Matrices representing biases
+     */
+    FixedMlpWeights(const Matrix weightsArr[], const Matrix biasArr[]);
+
+    /**
+     * @brief BUFFER_ALIGNMENT aligned allocation: before C++17 new ignores the alignment of the
+     * members
+     * @param size bytes to allocate
+     * @return the memory. Throws std::bad_alloc if there is none
+     */
+    static void *operator new(size_t size);
+
+    /**
+     * @brief Frees memory from operator new()
+     * @param pointer the memory
+     */
+    static void operator delete(void *pointer);
+
+    FixedLayer0::Weights weights0;
+    FixedLayer1::Weights weights1;
+    FixedLayer2::Weights weights2;
+    FixedLayer3::Weights weights3;
+    FixedLayer0::Bias bias0;
+    FixedLayer1::Bias bias1;
+    FixedLayer2::Bias bias2;
+    FixedLayer3::Bias bias3;
+    FixedLayer0::Columns columns0;
+    FixedLayer1::Columns columns1;
+    FixedLayer2::Columns columns2;
+    FixedLayer3::Columns columns3;
+};
+
+/**
+ * @brief MlpNetwork with the topology in its type: every layer is a FixedDense of its
+ * weightsDims shape, so each one runs a gemv specialized for that shape (fixed trip counts,
+ * tails resolved at compile time), the activations live on the stack and a layer chain that
+ * doesn't fit doesn't compile. Float weights only, read in place; thread safe, no heap
+ * allocation
+ */
+class FixedMlpNetwork
+{
+public:
+    /**
+     * @brief Constructor
+     * @param layer0 first layer, takes the image
+     * @param layer1 second layer
+     * @param layer2 third layer
+     * @param layer3 last layer, gives the digit
+     */
+    FixedMlpNetwork(const FixedLayer0 &layer0, const FixedLayer1 &layer1,
+                    const FixedLayer2 &layer2, const FixedLayer3 &layer3);
+
+    /**
+     * @brief Constructor of the MlpNetwork layers (Relu, Relu, Relu, Softmax) on fixed shape
+     * weights, every layer skipping its zero inputs like MlpNetwork's float layers
+     * @param weights the weights and biases, must outlive the network
+     */
+    explicit FixedMlpNetwork(const FixedMlpWeights &weights);
+
+    /**
+     * @brief Classifies an image
+     * @param image the FIXED_IMAGE_SIZE pixels, row-major
+     * @return a Digit object
+     */
+    Digit operator()(const float (&image)[FIXED_IMAGE_SIZE]) const;
+
+    /**
+     * @brief Classifies an image. Exits (code 1) if img isn't a FIXED_IMAGE_SIZE × 1 column
+     * vector (see MlpNetwork::operator())
+     * @param img a matrix or view representing the image (a column vector)
+     * @return a Digit object
+     */
+    Digit operator()(const MatrixView &img) const;
+
+private:
+    FixedLayer0 _layer0;
+    FixedLayer1 _layer1;
+    FixedLayer2 _layer2;
+    FixedLayer3 _layer3;
+};
+
+#endif //FIXEDMLPNETWORK_H
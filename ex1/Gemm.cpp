@@ -0,0 +1,981 @@
+//
+// Created by user on 02/01/2020.
+//
+
+#include "Gemm.h"
+#include "AlignedBuffer.h"
+#include "Simd.h"
+#include "SimdReduce.h"
+#include "ThreadPool.h"
+#include "Transpose.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define GEMM_MAX_MR 8
+#define GEMM_MAX_NR 32
+
+#define PORTABLE_MR 4
+#define PORTABLE_NR 8
+#define AVX2_MR 6
+#define AVX2_NR 16
+#define AVX512_MR 8
+#define AVX512_NR 32
+
+static_assert(GEMM_MC % PORTABLE_MR == 0 && GEMM_MC % AVX2_MR == 0 && GEMM_MC % AVX512_MR == 0,
+              "the blocks of gemmPackA() start on a panel boundary");
+
+// tasks gemmParallel() cuts per pool thread, so that faster threads can take over the rest
+#define GEMM_TASKS_PER_THREAD 4
+
+#define GEMV_ROWS 4
+#define GEMV_PARTIAL_SUMS 4
+
+/**
+ * @brief A register-tiled micro-kernel: computes the MR×NR tile of C from an MR-row panel of A
+ * and an NR-col panel of B, both packed kc deep.
+ * @param kc depth of the packed panels
+ * @param a packed A panel (kc groups of MR floats)
+ * @param b packed B panel (kc groups of NR floats)
+ * @param c top-left element of the tile in C
+ * @param ldc leading dimension of C
+ * @param accumulate true: tile += A*B, false: tile = A*B
+ * @param bias bias of the first row of the tile (one per row), or nullptr
+ * @param relu whether the tile ends with Relu
+ */
+typedef void (*GemmMicroKernel)(int kc, const float *a, const float *b, float *c, int ldc,
+                                bool accumulate, const float *bias, bool relu);
+
+/**
+ * @struct GemmKernel
+ * @brief A micro-kernel together with the register tile it computes
+ */
+typedef struct GemmKernel
+{
+    int mr, nr;
+    GemmMicroKernel run;
+} GemmKernel;
+
+/**
+ * @brief The epilogue of a single element: value + bias[row], then Relu. Shared by every
+ * scalar path so the SIMD kernels (add, compare, and) agree with them bit for bit
+ * @param value the product
+ * @param bias one value per row, or nullptr
+ * @param row row of the element
+ * @param relu whether to apply Relu
+ * @return the finished element
+ */
+static inline float epilogueScalar(float value, const float *bias, int row, bool relu)
+{
+    if (bias != nullptr)
+    {
+        value += bias[row];
+    }
+    return !relu || value >= 0 ? value : 0.0f;
+}
+
+/**
+ * @brief Portable MR×NR micro-kernel. The accumulator tile is small enough to live in SSE
+ * registers and the inner loop is written so the compiler vectorizes it over NR.
+ */
+static void portableMicroKernel(int kc, const float *a, const float *b, float *c, int ldc,
+                                bool accumulate, const float *bias, bool relu)
+{
+    float acc[PORTABLE_MR][PORTABLE_NR] = {};
+
+    for (int p = 0; p < kc; p++)
+    {
+        for (int i = 0; i < PORTABLE_MR; i++)
+        {
+            const float ai = a[i];
+            for (int j = 0; j < PORTABLE_NR; j++)
+            {
+                acc[i][j] += ai * b[j];
+            }
+        }
+        a += PORTABLE_MR;
+        b += PORTABLE_NR;
+    }
+
+    for (int i = 0; i < PORTABLE_MR; i++)
+    {
+        float *cRow = c + (ptrdiff_t) i * ldc;
+        for (int j = 0; j < PORTABLE_NR; j++)
+        {
+            cRow[j] = epilogueScalar(accumulate ? cRow[j] + acc[i][j] : acc[i][j], bias, i,
+                                     relu);
+        }
+    }
+}
+
+#if SIMD_X86
+
+/**
+ * @brief AVX2/FMA 6×16 micro-kernel: 12 ymm accumulators, 2 ymm for the B row, 1 broadcast
+ */
+__attribute__((target("avx2,fma")))
+static void avx2MicroKernel(int kc, const float *a, const float *b, float *c, int ldc,
+                            bool accumulate, const float *bias, bool relu)
+{
+    __m256 acc[AVX2_MR][2];
+    for (int i = 0; i < AVX2_MR; i++)
+    {
+        acc[i][0] = _mm256_setzero_ps();
+        acc[i][1] = _mm256_setzero_ps();
+    }
+
+    for (int p = 0; p < kc; p++)
+    {
+        const __m256 b0 = _mm256_load_ps(b);
+        const __m256 b1 = _mm256_load_ps(b + 8);
+        for (int i = 0; i < AVX2_MR; i++)
+        {
+            const __m256 ai = _mm256_broadcast_ss(a + i);
+            acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+        }
+        a += AVX2_MR;
+        b += AVX2_NR;
+    }
+
+    for (int i = 0; i < AVX2_MR; i++)
+    {
+        float *cRow = c + (ptrdiff_t) i * ldc;
+        if (accumulate)
+        {
+            acc[i][0] = _mm256_add_ps(acc[i][0], _mm256_loadu_ps(cRow));
+            acc[i][1] = _mm256_add_ps(acc[i][1], _mm256_loadu_ps(cRow + 8));
+        }
+        if (bias != nullptr)
+        {
+            const __m256 bi = _mm256_set1_ps(bias[i]);
+            acc[i][0] = _mm256_add_ps(acc[i][0], bi);
+            acc[i][1] = _mm256_add_ps(acc[i][1], bi);
+        }
+        if (relu)
+        {
+            const __m256 zero = _mm256_setzero_ps();
+            acc[i][0] = _mm256_and_ps(_mm256_cmp_ps(acc[i][0], zero, _CMP_GE_OQ), acc[i][0]);
+            acc[i][1] = _mm256_and_ps(_mm256_cmp_ps(acc[i][1], zero, _CMP_GE_OQ), acc[i][1]);
+        }
+        _mm256_storeu_ps(cRow, acc[i][0]);
+        _mm256_storeu_ps(cRow + 8, acc[i][1]);
+    }
+}
+
+/**
+ * @brief AVX-512 8×32 micro-kernel: 16 zmm accumulators, 2 zmm for the B row, 1 broadcast
+ */
+__attribute__((target("avx512f")))
+static void avx512MicroKernel(int kc, const float *a, const float *b, float *c, int ldc,
+                              bool accumulate, const float *bias, bool relu)
+{
+    __m512 acc[AVX512_MR][2];
+    for (int i = 0; i < AVX512_MR; i++)
+    {
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+
+    for (int p = 0; p < kc; p++)
+    {
+        const __m512 b0 = _mm512_load_ps(b);
+        const __m512 b1 = _mm512_load_ps(b + 16);
+        for (int i = 0; i < AVX512_MR; i++)
+        {
+            const __m512 ai = _mm512_set1_ps(a[i]);
+            acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+        }
+        a += AVX512_MR;
+        b += AVX512_NR;
+    }
+
+    for (int i = 0; i < AVX512_MR; i++)
+    {
+        float *cRow = c + (ptrdiff_t) i * ldc;
+        if (accumulate)
+        {
+            acc[i][0] = _mm512_add_ps(acc[i][0], _mm512_loadu_ps(cRow));
+            acc[i][1] = _mm512_add_ps(acc[i][1], _mm512_loadu_ps(cRow + 16));
+        }
+        if (bias != nullptr)
+        {
+            const __m512 bi = _mm512_set1_ps(bias[i]);
+            acc[i][0] = _mm512_add_ps(acc[i][0], bi);
+            acc[i][1] = _mm512_add_ps(acc[i][1], bi);
+        }
+        if (relu)
+        {
+            const __m512 zero = _mm512_setzero_ps();
+            acc[i][0] = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(acc[i][0], zero, _CMP_GE_OQ),
+                                            acc[i][0]);
+            acc[i][1] = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(acc[i][1], zero, _CMP_GE_OQ),
+                                            acc[i][1]);
+        }
+        _mm512_storeu_ps(cRow, acc[i][0]);
+        _mm512_storeu_ps(cRow + 16, acc[i][1]);
+    }
+}
+
+#endif // SIMD_X86
+
+/**
+ * @brief Picks the widest micro-kernel the CPU supports (see simdIsa())
+ */
+static GemmKernel selectKernel()
+{
+    switch (simdIsa())
+    {
+#if SIMD_X86
+        case SimdAvx512:
+            return {AVX512_MR, AVX512_NR, avx512MicroKernel};
+        case SimdAvx2:
+            return {AVX2_MR, AVX2_NR, avx2MicroKernel};
+#endif
+        default:
+            return {PORTABLE_MR, PORTABLE_NR, portableMicroKernel};
+    }
+}
+
+/**
+ * @brief The micro-kernel used by gemm(), selected once
+ */
+static const GemmKernel &activeKernel()
+{
+    static const GemmKernel kernel = selectKernel();
+    return kernel;
+}
+
+/**
+ * @brief A matrix-vector kernel: y = A * x, or y += A * x. A is m×k (leading dimension lda), x is
+ * a contiguous k vector and y has stride incy. Every y[i] ends as epilogueScalar(y[i], bias, i,
+ * relu)
+ */
+typedef void (*GemvKernel)(int m, int k, const float *a, int lda, const float *x, float *y,
+                           int incy, bool accumulate, const float *bias, bool relu);
+
+/**
+ * @brief Portable gemv: one dot product per row with 4 independent partial sums
+ */
+static void portableGemv(int m, int k, const float *a, int lda, const float *x, float *y,
+                         int incy, bool accumulate, const float *bias, bool relu)
+{
+    for (int i = 0; i < m; i++)
+    {
+        const float *aRow = a + (ptrdiff_t) i * lda;
+        float sum[GEMV_PARTIAL_SUMS] = {};
+        int p = 0;
+        for (; p + GEMV_PARTIAL_SUMS <= k; p += GEMV_PARTIAL_SUMS)
+        {
+            for (int u = 0; u < GEMV_PARTIAL_SUMS; u++)
+            {
+                sum[u] += aRow[p + u] * x[p + u];
+            }
+        }
+        float dot = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+        for (; p < k; p++)
+        {
+            dot += aRow[p] * x[p];
+        }
+
+        float &yi = y[(ptrdiff_t) i * incy];
+        yi = epilogueScalar(accumulate ? yi + dot : dot, bias, i, relu);
+    }
+}
+
+#if SIMD_X86
+
+/**
+ * @brief AVX2/FMA gemv. Streams GEMV_ROWS rows of A at once against the same slice of x, with 2
+ * accumulators per row (8 independent FMA chains) to cover the FMA latency.
+ */
+__attribute__((target("avx2,fma")))
+static void avx2Gemv(int m, int k, const float *a, int lda, const float *x, float *y, int incy,
+                     bool accumulate, const float *bias, bool relu)
+{
+    int i = 0;
+    for (; i + GEMV_ROWS <= m; i += GEMV_ROWS)
+    {
+        const float *rows[GEMV_ROWS];
+        __m256 acc0[GEMV_ROWS];
+        __m256 acc1[GEMV_ROWS];
+        for (int r = 0; r < GEMV_ROWS; r++)
+        {
+            rows[r] = a + (ptrdiff_t) (i + r) * lda;
+            acc0[r] = _mm256_setzero_ps();
+            acc1[r] = _mm256_setzero_ps();
+        }
+
+        int p = 0;
+        for (; p + 16 <= k; p += 16)
+        {
+            const __m256 x0 = _mm256_loadu_ps(x + p);
+            const __m256 x1 = _mm256_loadu_ps(x + p + 8);
+            for (int r = 0; r < GEMV_ROWS; r++)
+            {
+                acc0[r] = _mm256_fmadd_ps(_mm256_loadu_ps(rows[r] + p), x0, acc0[r]);
+                acc1[r] = _mm256_fmadd_ps(_mm256_loadu_ps(rows[r] + p + 8), x1, acc1[r]);
+            }
+        }
+        for (; p + 8 <= k; p += 8)
+        {
+            const __m256 x0 = _mm256_loadu_ps(x + p);
+            for (int r = 0; r < GEMV_ROWS; r++)
+            {
+                acc0[r] = _mm256_fmadd_ps(_mm256_loadu_ps(rows[r] + p), x0, acc0[r]);
+            }
+        }
+
+        for (int r = 0; r < GEMV_ROWS; r++)
+        {
+            float dot = horizontalSum(_mm256_add_ps(acc0[r], acc1[r]));
+            for (int q = p; q < k; q++)
+            {
+                dot += rows[r][q] * x[q];
+            }
+            float &yi = y[(ptrdiff_t) (i + r) * incy];
+            yi = epilogueScalar(accumulate ? yi + dot : dot, bias, i + r, relu);
+        }
+    }
+
+    portableGemv(m - i, k, a + (ptrdiff_t) i * lda, lda, x, y + (ptrdiff_t) i * incy, incy,
+                 accumulate, bias != nullptr ? bias + i : nullptr, relu);
+}
+
+/**
+ * @brief AVX-512 gemv. Same structure as avx2Gemv with 16 lane registers and a masked tail
+ */
+__attribute__((target("avx512f")))
+static void avx512Gemv(int m, int k, const float *a, int lda, const float *x, float *y,
+                       int incy, bool accumulate, const float *bias, bool relu)
+{
+    const int tail = k % 16;
+    const __mmask16 tailMask = (__mmask16) ((1u << tail) - 1u);
+
+    for (int i = 0; i < m; i += GEMV_ROWS)
+    {
+        const int rowCount = std::min(GEMV_ROWS, m - i);
+        const float *rows[GEMV_ROWS];
+        __m512 acc0[GEMV_ROWS];
+        __m512 acc1[GEMV_ROWS];
+        for (int r = 0; r < GEMV_ROWS; r++)
+        {
+            // missing rows of the last group re-read the last valid row and are dropped
+            rows[r] = a + (ptrdiff_t) (i + std::min(r, rowCount - 1)) * lda;
+            acc0[r] = _mm512_setzero_ps();
+            acc1[r] = _mm512_setzero_ps();
+        }
+
+        int p = 0;
+        for (; p + 32 <= k; p += 32)
+        {
+            const __m512 x0 = _mm512_loadu_ps(x + p);
+            const __m512 x1 = _mm512_loadu_ps(x + p + 16);
+            for (int r = 0; r < GEMV_ROWS; r++)
+            {
+                acc0[r] = _mm512_fmadd_ps(_mm512_loadu_ps(rows[r] + p), x0, acc0[r]);
+                acc1[r] = _mm512_fmadd_ps(_mm512_loadu_ps(rows[r] + p + 16), x1, acc1[r]);
+            }
+        }
+        if (p + 16 <= k)
+        {
+            const __m512 x0 = _mm512_loadu_ps(x + p);
+            for (int r = 0; r < GEMV_ROWS; r++)
+            {
+                acc0[r] = _mm512_fmadd_ps(_mm512_loadu_ps(rows[r] + p), x0, acc0[r]);
+            }
+            p += 16;
+        }
+        if (tail != 0)
+        {
+            const __m512 x0 = _mm512_maskz_loadu_ps(tailMask, x + p);
+            for (int r = 0; r < GEMV_ROWS; r++)
+            {
+                const __m512 ar = _mm512_maskz_loadu_ps(tailMask, rows[r] + p);
+                acc1[r] = _mm512_fmadd_ps(ar, x0, acc1[r]);
+            }
+        }
+
+        for (int r = 0; r < rowCount; r++)
+        {
+            const float dot = horizontalSum(_mm512_add_ps(acc0[r], acc1[r]));
+            float &yi = y[(ptrdiff_t) (i + r) * incy];
+            yi = epilogueScalar(accumulate ? yi + dot : dot, bias, i + r, relu);
+        }
+    }
+}
+
+#endif // SIMD_X86
+
+/**
+ * @brief The gemv kernel for simdIsa(), selected once
+ */
+static GemvKernel activeGemv()
+{
+    static const GemvKernel kernel = []() -> GemvKernel
+    {
+        switch (simdIsa())
+        {
+#if SIMD_X86
+            case SimdAvx512:
+                return avx512Gemv;
+            case SimdAvx2:
+                return avx2Gemv;
+#endif
+            default:
+                return portableGemv;
+        }
+    }();
+    return kernel;
+}
+
+/**
+ * @brief Packs an mc×kc block of A into ceil(mc/mr) row panels. Inside a panel element (i, p)
+ * is at p*mr + i; rows past mc are zero padded.
+ */
+static void packA(int mc, int kc, const float *a, int lda, int mr, float *packed)
+{
+    for (int ir = 0; ir < mc; ir += mr)
+    {
+        const int rows = std::min(mr, mc - ir);
+        for (int p = 0; p < kc; p++)
+        {
+            for (int i = 0; i < rows; i++)
+            {
+                packed[i] = a[(ptrdiff_t) (ir + i) * lda + p];
+            }
+            for (int i = rows; i < mr; i++)
+            {
+                packed[i] = 0.0f;
+            }
+            packed += mr;
+        }
+    }
+}
+
+/**
+ * @brief packA() of a block of A^T, A being stored transposed (element (i, p) at p*lda + i):
+ * every kc step of a panel is mr contiguous elements
+ */
+static void packATransposed(int mc, int kc, const float *a, int lda, int mr, float *packed)
+{
+    for (int ir = 0; ir < mc; ir += mr)
+    {
+        const int rows = std::min(mr, mc - ir);
+        for (int p = 0; p < kc; p++)
+        {
+            std::memcpy(packed, a + (ptrdiff_t) p * lda + ir, rows * sizeof(float));
+            for (int i = rows; i < mr; i++)
+            {
+                packed[i] = 0.0f;
+            }
+            packed += mr;
+        }
+    }
+}
+
+/**
+ * @brief Packs a kc×nc block of B into ceil(nc/nr) col panels. Inside a panel element (p, j)
+ * is at p*nr + j; cols past nc are zero padded.
+ */
+static void packB(int kc, int nc, const float *b, int ldb, int nr, float *packed)
+{
+    for (int jr = 0; jr < nc; jr += nr)
+    {
+        const int cols = std::min(nr, nc - jr);
+        for (int p = 0; p < kc; p++)
+        {
+            const float *bRow = b + (ptrdiff_t) p * ldb + jr;
+            std::memcpy(packed, bRow, cols * sizeof(float));
+            for (int j = cols; j < nr; j++)
+            {
+                packed[j] = 0.0f;
+            }
+            packed += nr;
+        }
+    }
+}
+
+/**
+ * @brief packB() of a block of B^T, B being stored transposed (element (p, j) at j*ldb + p):
+ * a panel is the transpose of nr stored rows, done by transposeMatrix()
+ */
+static void packBTransposed(int kc, int nc, const float *b, int ldb, int nr, float *packed)
+{
+    for (int jr = 0; jr < nc; jr += nr)
+    {
+        const int cols = std::min(nr, nc - jr);
+        transposeMatrix(cols, kc, b + (ptrdiff_t) jr * ldb, ldb, packed, nr);
+        if (cols < nr)
+        {
+            for (int p = 0; p < kc; p++)
+            {
+                std::fill(packed + (ptrdiff_t) p * nr + cols, packed + (ptrdiff_t) (p + 1) * nr,
+                          0.0f);
+            }
+        }
+        packed += (ptrdiff_t) kc * nr;
+    }
+}
+
+/**
+ * @brief Element (row, col) of an operand, stored as is or transposed
+ */
+static inline const float *operandAt(const float *x, int ld, bool transposed, int row, int col)
+{
+    return transposed ? x + (ptrdiff_t) col * ld + row : x + (ptrdiff_t) row * ld + col;
+}
+
+/**
+ * @brief Packs the mc×kc block of A at (ic, pc), A being stored as is or transposed
+ */
+static void packABlock(bool transposed, int mc, int kc, const float *a, int lda, int ic, int pc,
+                       int mr, float *packed)
+{
+    const float *block = operandAt(a, lda, transposed, ic, pc);
+    if (transposed)
+    {
+        packATransposed(mc, kc, block, lda, mr, packed);
+        return;
+    }
+    packA(mc, kc, block, lda, mr, packed);
+}
+
+/**
+ * @brief Packs the kc×nc block of B at (pc, jc), B being stored as is or transposed
+ */
+static void packBBlock(bool transposed, int kc, int nc, const float *b, int ldb, int pc, int jc,
+                       int nr, float *packed)
+{
+    const float *block = operandAt(b, ldb, transposed, pc, jc);
+    if (transposed)
+    {
+        packBTransposed(kc, nc, block, ldb, nr, packed);
+        return;
+    }
+    packB(kc, nc, block, ldb, nr, packed);
+}
+
+/**
+ * @brief Plain i-k-j product for operands too small to amortize packing. Every inner loop is a
+ * contiguous axpy over a row of B and a row of C, the epilogue runs on the row while it is
+ * still in L1.
+ */
+template <bool TransA, bool TransB>
+static void gemmSmall(int m, int n, int k, const float *a, int lda, const float *b, int ldb,
+                      float *c, int ldc, bool accumulate, const float *bias, bool relu)
+{
+    for (int i = 0; i < m; i++)
+    {
+        float *cRow = c + (ptrdiff_t) i * ldc;
+        if (!accumulate)
+        {
+            std::fill(cRow, cRow + n, 0.0f);
+        }
+
+        for (int p = 0; p < k; p++)
+        {
+            const float aip = *operandAt(a, lda, TransA, i, p);
+            if (TransB)
+            {
+                // B^T is only walked down its stored cols here: small products only
+                for (int j = 0; j < n; j++)
+                {
+                    cRow[j] += aip * b[(ptrdiff_t) j * ldb + p];
+                }
+                continue;
+            }
+            const float *bRow = b + (ptrdiff_t) p * ldb;
+            for (int j = 0; j < n; j++)
+            {
+                cRow[j] += aip * bRow[j];
+            }
+        }
+
+        if (bias != nullptr || relu)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                cRow[j] = epilogueScalar(cRow[j], bias, i, relu);
+            }
+        }
+    }
+}
+
+/**
+ * @brief The micro-kernel over an mc×nc block of C: every MR×NR tile of a packed A block times
+ * the packed B panels. Edge tiles are computed into a scratch tile and then copied into the
+ * valid part of C.
+ */
+static void macroKernel(const GemmKernel &kernel, int mc, int nc, int kc, const float *blockA,
+                        const float *packedB, float *c, int ldc, bool accumulate,
+                        const float *bias, bool relu)
+{
+    const int mr = kernel.mr;
+    const int nr = kernel.nr;
+    alignas(BUFFER_ALIGNMENT) float edge[GEMM_MAX_MR * GEMM_MAX_NR];
+
+    for (int jr = 0; jr < nc; jr += nr)
+    {
+        const int cols = std::min(nr, nc - jr);
+        const float *bPanel = packedB + (ptrdiff_t) jr * kc;
+
+        for (int ir = 0; ir < mc; ir += mr)
+        {
+            const int rows = std::min(mr, mc - ir);
+            const float *aPanel = blockA + (ptrdiff_t) ir * kc;
+            float *cTile = c + (ptrdiff_t) ir * ldc + jr;
+            const float *tileBias = bias != nullptr ? bias + ir : nullptr;
+
+            if (rows == mr && cols == nr)
+            {
+                kernel.run(kc, aPanel, bPanel, cTile, ldc, accumulate, tileBias, relu);
+                continue;
+            }
+
+            kernel.run(kc, aPanel, bPanel, edge, nr, false, nullptr, false);
+            for (int i = 0; i < rows; i++)
+            {
+                float *cRow = cTile + (ptrdiff_t) i * ldc;
+                for (int j = 0; j < cols; j++)
+                {
+                    const float value = accumulate ? cRow[j] + edge[i * nr + j] : edge[i * nr + j];
+                    cRow[j] = epilogueScalar(value, tileBias, i, relu);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief The packed A block of the calling thread (GEMM_MC × GEMM_KC floats), kept across
+ * calls
+ */
+static float *threadABlock()
+{
+    static thread_local AlignedBuffer aBuffer;
+    return aBuffer.reserve((size_t) GEMM_MC * GEMM_KC);
+}
+
+/**
+ * @brief Threads the pool is created with when gemmSetThreads() wasn't called:
+ * GEMM_THREADS_ENV_VAR if set to a positive count, else every hardware thread
+ */
+static int defaultGemmThreads()
+{
+    const char *value = std::getenv(GEMM_THREADS_ENV_VAR);
+    if (value != nullptr)
+    {
+        char *end = nullptr;
+        const long parsed = std::strtol(value, &end, 10);
+        if (end != value && *end == '\0' && parsed >= 1 && parsed <= GEMM_MAX_THREADS)
+        {
+            return (int) parsed;
+        }
+    }
+    return std::min(ThreadPool::hardwareThreads(), GEMM_MAX_THREADS);
+}
+
+static std::mutex gemmPoolMutex;
+static std::unique_ptr<ThreadPool> gemmPoolInstance;
+
+/**
+ * @brief The process wide pool of gemm(), started on first use
+ */
+static ThreadPool &gemmPool()
+{
+    std::lock_guard<std::mutex> lock(gemmPoolMutex);
+    if (gemmPoolInstance == nullptr)
+    {
+        gemmPoolInstance.reset(new ThreadPool(defaultGemmThreads()));
+    }
+    return *gemmPoolInstance;
+}
+
+/**
+ * @brief Sets the threads large gemm() calls run on, the caller included. The pool is only
+ * restarted if the count changes. Not while another thread is in gemm()
+ */
+void gemmSetThreads(int threads)
+{
+    threads = threads < 1 ? defaultGemmThreads() : std::min(threads, GEMM_MAX_THREADS);
+    std::lock_guard<std::mutex> lock(gemmPoolMutex);
+    if (gemmPoolInstance == nullptr || gemmPoolInstance->getThreadCount() != threads)
+    {
+        gemmPoolInstance.reset(new ThreadPool(threads));
+    }
+}
+
+/**
+ * @brief Threads large gemm() calls run on, the caller included
+ */
+int gemmThreads()
+{
+    return gemmPool().getThreadCount();
+}
+
+/**
+ * @brief The blocked product split across the pool. For every (jc, pc) block B is packed by
+ * all the threads, a panel range each, then the C block is cut into tasks of one GEMM_MC row
+ * block × a range of B panels, several per thread. The threads take the next task as soon as
+ * they finish one, so those with ragged edge tiles or less CPU time simply take fewer. A
+ * thread packs the A blocks of its tasks itself, unless A comes pre-packed.
+ */
+static void gemmParallel(ThreadPool &pool, bool transA, bool transB, int m, int n, int k,
+                         const float *a, int lda, const float *b, int ldb, float *c, int ldc,
+                         bool accumulate, const float *bias, bool relu, const float *packedA)
+{
+    const GemmKernel &kernel = activeKernel();
+    const int mr = kernel.mr;
+    const int nr = kernel.nr;
+
+    static thread_local AlignedBuffer bBuffer;
+    float *packedB = bBuffer.reserve((size_t) GEMM_KC * GEMM_NC);
+    const int paddedM = (m + mr - 1) / mr * mr;
+    const int rowBlocks = (m + GEMM_MC - 1) / GEMM_MC;
+    const int wantedTasks = pool.getThreadCount() * GEMM_TASKS_PER_THREAD;
+
+    for (int jc = 0; jc < n; jc += GEMM_NC)
+    {
+        const int nc = std::min(GEMM_NC, n - jc);
+        const int panels = (nc + nr - 1) / nr;
+        const int colChunks = std::min(panels, std::max(1, wantedTasks / rowBlocks));
+        const int chunkPanels = (panels + colChunks - 1) / colChunks;
+        const int chunks = (panels + chunkPanels - 1) / chunkPanels;
+
+        for (int pc = 0; pc < k; pc += GEMM_KC)
+        {
+            const int kc = std::min(GEMM_KC, k - pc);
+            const bool accumulateBlock = accumulate || pc > 0;
+            const bool lastBlock = pc + kc == k;
+
+            pool.parallelFor(chunks, [&](int chunk)
+            {
+                const int first = chunk * chunkPanels * nr;
+                const int cols = std::min(chunkPanels * nr, nc - first);
+                packBBlock(transB, kc, cols, b, ldb, pc, jc + first, nr,
+                           packedB + (ptrdiff_t) first * kc);
+            });
+
+            pool.parallelFor(rowBlocks * chunks, [&](int task)
+            {
+                const int ic = task / chunks * GEMM_MC;
+                const int mc = std::min(GEMM_MC, m - ic);
+                const int first = task % chunks * chunkPanels * nr;
+                const int cols = std::min(chunkPanels * nr, nc - first);
+
+                const float *blockA;
+                if (packedA != nullptr)
+                {
+                    blockA = packedA + (ptrdiff_t) pc * paddedM + (ptrdiff_t) ic * kc;
+                }
+                else
+                {
+                    float *aBlock = threadABlock();
+                    packABlock(transA, mc, kc, a, lda, ic, pc, mr, aBlock);
+                    blockA = aBlock;
+                }
+
+                macroKernel(kernel, mc, cols, kc, blockA, packedB + (ptrdiff_t) first * kc,
+                            c + (ptrdiff_t) ic * ldc + jc + first, ldc, accumulateBlock,
+                            lastBlock && bias != nullptr ? bias + ic : nullptr,
+                            lastBlock && relu);
+            });
+        }
+    }
+}
+
+/**
+ * @brief gemm() past its gemv() shortcut, with either operand stored transposed: the small
+ * products, the parallel ones and the single threaded blocked loop
+ */
+static void gemmDriver(bool transA, bool transB, int m, int n, int k, const float *a, int lda,
+                       const float *b, int ldb, float *c, int ldc, bool accumulate,
+                       const GemmEpilogue *epilogue, const float *packedA)
+{
+    const float *bias = epilogue != nullptr ? epilogue->bias : nullptr;
+    const bool relu = epilogue != nullptr && epilogue->activation == EpilogueRelu;
+
+    // also covers k == 0, where C = A * B is all zeros
+    if ((long) m * n * k <= GEMM_SMALL_THRESHOLD)
+    {
+        if (transA)
+        {
+            transB ? gemmSmall<true, true>(m, n, k, a, lda, b, ldb, c, ldc, accumulate, bias, relu)
+                   : gemmSmall<true, false>(m, n, k, a, lda, b, ldb, c, ldc, accumulate, bias,
+                                            relu);
+            return;
+        }
+        transB ? gemmSmall<false, true>(m, n, k, a, lda, b, ldb, c, ldc, accumulate, bias, relu)
+               : gemmSmall<false, false>(m, n, k, a, lda, b, ldb, c, ldc, accumulate, bias, relu);
+        return;
+    }
+
+    // inside a pool task (e.g. a BatchScorer worker) the other threads are busy already
+    if ((long) m * n * k >= GEMM_PARALLEL_THRESHOLD && !ThreadPool::insideTask())
+    {
+        ThreadPool &pool = gemmPool();
+        if (pool.getThreadCount() > 1)
+        {
+            gemmParallel(pool, transA, transB, m, n, k, a, lda, b, ldb, c, ldc, accumulate, bias,
+                         relu, packedA);
+            return;
+        }
+    }
+
+    const GemmKernel &kernel = activeKernel();
+    const int mr = kernel.mr;
+    const int nr = kernel.nr;
+
+    static thread_local AlignedBuffer bBuffer;
+    float *aBlock = packedA == nullptr ? threadABlock() : nullptr;
+    float *packedB = bBuffer.reserve((size_t) GEMM_KC * GEMM_NC);
+    const int paddedM = (m + mr - 1) / mr * mr;
+
+    for (int jc = 0; jc < n; jc += GEMM_NC)
+    {
+        const int nc = std::min(GEMM_NC, n - jc);
+
+        for (int pc = 0; pc < k; pc += GEMM_KC)
+        {
+            const int kc = std::min(GEMM_KC, k - pc);
+            const bool accumulateBlock = accumulate || pc > 0;
+            const bool lastBlock = pc + kc == k;
+
+            packBBlock(transB, kc, nc, b, ldb, pc, jc, nr, packedB);
+
+            for (int ic = 0; ic < m; ic += GEMM_MC)
+            {
+                const int mc = std::min(GEMM_MC, m - ic);
+
+                const float *blockA = aBlock;
+                if (packedA != nullptr)
+                {
+                    blockA = packedA + (ptrdiff_t) pc * paddedM + (ptrdiff_t) ic * kc;
+                }
+                else
+                {
+                    packABlock(transA, mc, kc, a, lda, ic, pc, mr, aBlock);
+                }
+
+                macroKernel(kernel, mc, nc, kc, blockA, packedB, c + (ptrdiff_t) ic * ldc + jc,
+                            ldc, accumulateBlock,
+                            lastBlock && bias != nullptr ? bias + ic : nullptr,
+                            lastBlock && relu);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Row-major single precision matrix multiplication: C = A * B, or C += A * B.
+ * A is m×k with leading dimension lda, B is k×n with leading dimension ldb and C is m×n with
+ * leading dimension ldc. Large products are cache blocked (GEMM_MC/KC/NC), both operands are
+ * packed into contiguous panels and every MR×NR tile of C is produced by a register-tiled
+ * micro-kernel, which also runs the epilogue on the last KC block of the product. With packedA
+ * (see gemmPackA()) the A blocks are read in place instead of packed. Products of at least
+ * GEMM_PARALLEL_THRESHOLD multiply-adds are split across the gemm pool (gemmParallel()).
+ */
+void gemm(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c,
+          int ldc, bool accumulate, const GemmEpilogue *epilogue, const float *packedA)
+{
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+
+    // matrix times column vector: stream each row of A once against the contiguous vector
+    if (n == 1 && ldb == 1)
+    {
+        gemv(m, k, a, lda, b, c, ldc, accumulate, epilogue);
+        return;
+    }
+
+    gemmDriver(false, false, m, n, k, a, lda, b, ldb, c, ldc, accumulate, epilogue, packedA);
+}
+
+/**
+ * @brief C = op(A) * op(B), or C += op(A) * op(B), op being the identity or the transpose: the
+ * transposed operands are read in place by the packing (see gemm())
+ */
+void gemm(GemmOperand opA, GemmOperand opB, int m, int n, int k, const float *a, int lda,
+          const float *b, int ldb, float *c, int ldc, bool accumulate,
+          const GemmEpilogue *epilogue)
+{
+    if (opA == GemmPlain && opB == GemmPlain)
+    {
+        gemm(m, n, k, a, lda, b, ldb, c, ldc, accumulate, epilogue);
+        return;
+    }
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+
+    // a transposed 1 × k row is the same contiguous vector
+    if (opA == GemmPlain && n == 1)
+    {
+        gemv(m, k, a, lda, b, c, ldc, accumulate, epilogue);
+        return;
+    }
+
+    gemmDriver(opA == GemmTransposed, opB == GemmTransposed, m, n, k, a, lda, b, ldb, c, ldc,
+               accumulate, epilogue, nullptr);
+}
+
+/**
+ * @brief Floats gemmPackA() writes for an m×k matrix: every row panel of the micro-kernel
+ * simdIsa() selects, rows zero padded to a whole panel
+ */
+size_t gemmPackedSize(int m, int k)
+{
+    const int mr = activeKernel().mr;
+    return (size_t) ((m + mr - 1) / mr * mr) * k;
+}
+
+/**
+ * @brief Packs all of A once, in the order gemm() reads it: for every GEMM_KC block of cols the
+ * GEMM_MC blocks of rows, each one as packA() lays it out. Block (pc, ic) starts at
+ * pc * paddedM + ic * kc, the blocks before it holding paddedM rows of GEMM_KC cols and ic rows
+ * of kc cols.
+ */
+void gemmPackA(int m, int k, const float *a, int lda, float *packed)
+{
+    const int mr = activeKernel().mr;
+    for (int pc = 0; pc < k; pc += GEMM_KC)
+    {
+        const int kc = std::min(GEMM_KC, k - pc);
+        for (int ic = 0; ic < m; ic += GEMM_MC)
+        {
+            const int mc = std::min(GEMM_MC, m - ic);
+            packA(mc, kc, a + (ptrdiff_t) ic * lda + pc, lda, mr, packed);
+            packed += (ptrdiff_t) (mc + mr - 1) / mr * mr * kc;
+        }
+    }
+}
+
+/**
+ * @brief Row-major matrix times contiguous vector: y = A * x, or y += A * x.
+ * Each row of A is streamed once as a SIMD dot product against x; GEMV_ROWS rows are processed
+ * together, each with several accumulators, so the loads of x are shared and FMA latency hidden.
+ */
+void gemv(int m, int k, const float *a, int lda, const float *x, float *y, int incy,
+          bool accumulate, const GemmEpilogue *epilogue)
+{
+    if (m <= 0)
+    {
+        return;
+    }
+    activeGemv()(m, k, a, lda, x, y, incy, accumulate,
+                 epilogue != nullptr ? epilogue->bias : nullptr,
+                 epilogue != nullptr && epilogue->activation == EpilogueRelu);
+}
@@ -0,0 +1,189 @@
+//Gemm.h
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <cstddef>
+
+/**
+ * @brief Below this amount of multiply-adds (m * n * k) the packing overhead is not worth it and
+ * gemm() runs a plain contiguous i-k-j loop instead.
+ */
+#define GEMM_SMALL_THRESHOLD (32 * 32 * 32)
+
+/**
+ * @brief Rows of A packed per L2 block (multiple of every micro-kernel's MR)
+ */
+#define GEMM_MC 144
+
+/**
+ * @brief Depth of a packed A/B block, sized so an MR x KC sliver of A and a KC x NR sliver of B
+ * stay in L1 while the micro-kernel runs
+ */
+#define GEMM_KC 256
+
+/**
+ * @brief Cols of B packed per L3 block (multiple of every micro-kernel's NR)
+ */
+#define GEMM_NC 2048
+
+/**
+ * @brief From this amount of multiply-adds (m * n * k) on, gemm() splits the product across a
+ * pool of threads (gemmSetThreads()). Below it waking the threads costs more than they save,
+ * e.g. on a layer's single image or on the 10 × 20 last layer
+ */
+#define GEMM_PARALLEL_THRESHOLD (128 * 128 * 128)
+
+/**
+ * @brief Most threads the gemm() pool runs on
+ */
+#define GEMM_MAX_THREADS 256
+
+/**
+ * @brief Environment variable setting the threads of the gemm() pool when gemmSetThreads()
+ * isn't called: a count from 1 (single threaded) to GEMM_MAX_THREADS. Read when the pool starts,
+ * every hardware thread being used by default
+ */
+#define GEMM_THREADS_ENV_VAR "MLP_GEMM_THREADS"
+
+/**
+ * @enum EpilogueActivation
+ * @brief Elementwise activation of a GemmEpilogue. Softmax needs a whole column and is not
+ * one: a softmax layer fuses only its bias (the logits) and normalizes afterwards
+ */
+enum EpilogueActivation
+{
+    EpilogueNone,
+    EpilogueRelu
+};
+
+/**
+ * @enum GemmOperand
+ * @brief How an operand of gemm() is stored: as the matrix of the product, or as its transpose
+ * (A^T * B with A stored k×m, A * B^T with B stored n×k)
+ */
+enum GemmOperand
+{
+    GemmPlain,
+    GemmTransposed
+};
+
+/**
+ * @struct GemmEpilogue
+ * @brief Work gemm() and gemv() do on every element of C right after its last product, while
+ * it is still in registers: c = activation(c + bias[row])
+ * @var bias - one value per row of C, or nullptr for none
+ * @var activation - EpilogueNone, or EpilogueRelu (x >= 0 ? x : 0, bit for bit Activation's)
+ */
+typedef struct GemmEpilogue
+{
+    const float *bias;
+    EpilogueActivation activation;
+} GemmEpilogue;
+
+/**
+ * @brief Row-major single precision matrix multiplication: C = A * B, or C += A * B.
+ * A is m×k with leading dimension lda, B is k×n with leading dimension ldb and C is m×n with
+ * leading dimension ldc. Large products are cache blocked (GEMM_MC/KC/NC), both operands are
+ * packed into contiguous panels and every MR×NR tile of C is produced by a register-tiled
+ * micro-kernel. Products with a single contiguous column (n == 1, ldb == 1) are handed to
+ * gemv(). An epilogue (bias, Relu) is applied by the micro-kernels to the tiles of the last KC
+ * block before they are stored, so C is written once instead of once per layer step.
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param k cols of A, rows of B
+ * @param a pointer to A
+ * @param lda distance (in floats) between consecutive rows of A
+ * @param b pointer to B
+ * @param ldb distance (in floats) between consecutive rows of B
+ * @param c pointer to C. Must not alias A or B
+ * @param ldc distance (in floats) between consecutive rows of C
+ * @param accumulate true: C += A * B, false: C = A * B (C doesn't have to be initialized)
+ * @param epilogue bias and activation applied to C on top of the product, or nullptr
+ * @param packedA A already packed by gemmPackA(), or nullptr. Blocked products read their
+ * panels from it instead of packing a, the others still read a
+ */
+void gemm(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c,
+          int ldc, bool accumulate, const GemmEpilogue *epilogue = nullptr,
+          const float *packedA = nullptr);
+
+/**
+ * @brief gemm() with transposed operands, without materializing the transposes: C = op(A) *
+ * op(B), or C += op(A) * op(B), op(X) being X (GemmPlain) or X^T (GemmTransposed). The stored
+ * matrices are read straight into the packed panels, which are the same whatever the layout,
+ * so the product runs the same blocked, threaded engine
+ * @param opA whether A is stored transposed
+ * @param opB whether B is stored transposed
+ * @param m rows of op(A) and C
+ * @param n cols of op(B) and C
+ * @param k cols of op(A), rows of op(B)
+ * @param a pointer to A: m×k, or k×m when transposed
+ * @param lda distance (in floats) between consecutive rows of A as stored
+ * @param b pointer to B: k×n, or n×k when transposed
+ * @param ldb distance (in floats) between consecutive rows of B as stored
+ * @param c pointer to C. Must not alias A or B
+ * @param ldc distance (in floats) between consecutive rows of C
+ * @param accumulate true: C += op(A) * op(B), false: C = op(A) * op(B)
+ * @param epilogue bias and activation applied to C on top of the product, or nullptr
+ */
+void gemm(GemmOperand opA, GemmOperand opB, int m, int n, int k, const float *a, int lda,
+          const float *b, int ldb, float *c, int ldc, bool accumulate,
+          const GemmEpilogue *epilogue = nullptr);
+
+/**
+ * @brief Sets the threads large gemm() calls (see GEMM_PARALLEL_THRESHOLD) run on, the calling
+ * thread included. The pool is started once per process, on first use, and only restarted if
+ * the count changes. Must not be called while another thread is in gemm()
+ * @param threads thread count, 1 for single threaded; values below 1 restore the default
+ * (GEMM_THREADS_ENV_VAR, else every hardware thread)
+ */
+void gemmSetThreads(int threads);
+
+/**
+ * @brief Threads large gemm() calls run on, the calling thread included. Starts the pool if it
+ * isn't running yet
+ * @return the thread count
+ */
+int gemmThreads();
+
+/**
+ * @brief Floats gemmPackA() writes for an m×k matrix: every row panel of the micro-kernel
+ * simdIsa() selects, rows zero padded to a whole panel
+ * @param m rows of A
+ * @param k cols of A
+ * @return size of the packed A
+ */
+size_t gemmPackedSize(int m, int k);
+
+/**
+ * @brief Packs all of A once, block by block (GEMM_KC cols × GEMM_MC rows) in the order and
+ * panel layout gemm() packs it into on every call, so that a matrix multiplied many times (a
+ * layer's weights) is packed at construction and gemm() walks its panels linearly
+ * @param m rows of A
+ * @param k cols of A
+ * @param a pointer to A
+ * @param lda distance (in floats) between consecutive rows of A
+ * @param packed output, gemmPackedSize(m, k) floats, BUFFER_ALIGNMENT aligned for the
+ * micro-kernel loads to stay within cache lines
+ */
+void gemmPackA(int m, int k, const float *a, int lda, float *packed);
+
+/**
+ * @brief Row-major matrix times contiguous vector: y = A * x, or y += A * x.
+ * Each row of A is streamed once as a SIMD dot product against x; several rows are processed
+ * together, each with several accumulators. gemm() uses it whenever B is a single contiguous
+ * column (n == 1, ldb == 1). An epilogue finishes every y[i] as soon as its dot product is
+ * reduced.
+ * @param m rows of A, length of y
+ * @param k cols of A, length of x
+ * @param a pointer to A
+ * @param lda distance (in floats) between consecutive rows of A
+ * @param x pointer to the contiguous vector x
+ * @param y pointer to y. Must not alias A or x
+ * @param incy distance (in floats) between consecutive elements of y
+ * @param accumulate true: y += A * x, false: y = A * x (y doesn't have to be initialized)
+ * @param epilogue bias and activation applied to y on top of the product, or nullptr
+ */
+void gemv(int m, int k, const float *a, int lda, const float *x, float *y, int incy,
+          bool accumulate, const GemmEpilogue *epilogue = nullptr);
+
+#endif //GEMM_H
@@ -0,0 +1,158 @@
+//
+// Created by user on 02/01/2020.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "Matrix.h"
+
+#define USAGE_MSG "Usage:\n" \
+                  "\t./gemm_bench [m k n]\n" \
+                  "\twithout arguments runs the built-in list of shapes\n" \
+                  "\tMLP_GEMM_THREADS sets the threads of the large products"
+#define MIN_BENCH_SECONDS 0.2
+
+/**
+ * @struct BenchShape
+ * @brief A product (m×k) * (k×n) to time
+ */
+typedef struct BenchShape
+{
+    int m, k, n;
+} BenchShape;
+
+const BenchShape benchShapes[] = {{10,   20,   1},
+                                  {128,  784,  1},
+                                  {128,  784,  128},
+                                  {128,  784,  1024},
+                                  {512,  512,  512},
+                                  {1024, 1024, 1024},
+                                  {2048, 2048, 2048}};
+
+/**
+ * The i-j-k loop Matrix::operator* used before the gemm engine, kept as the reference.
+ * @param a left operand
+ * @param b right operand
+ * @return a * b
+ */
+Matrix naiveMultiply(const Matrix &a, const Matrix &b)
+{
+    Matrix result(a.getRows(), b.getCols());
+    for (int i = 0; i < a.getRows(); ++i)
+    {
+        for (int j = 0; j < b.getCols(); ++j)
+        {
+            for (int k = 0; k < a.getCols(); ++k)
+            {
+                result(i, j) += a(i, k) * b(k, j);
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * Fills a matrix with pseudo random values in [-1, 1].
+ * @param mat matrix to fill
+ */
+void randomFill(Matrix &mat)
+{
+    for (int k = 0; k < mat.getRows() * mat.getCols(); k++)
+    {
+        mat[k] = (float) std::rand() / (float) RAND_MAX * 2.0f - 1.0f;
+    }
+}
+
+/**
+ * Runs func until at least MIN_BENCH_SECONDS passed.
+ * @param func the code to time
+ * @return average seconds per call
+ */
+template <typename Func>
+double timeIt(Func func)
+{
+    auto start = std::chrono::steady_clock::now();
+    int calls = 0;
+    double elapsed = 0;
+    do
+    {
+        func();
+        calls++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    return elapsed / calls;
+}
+
+/**
+ * Times the naive loop against Matrix::operator* for one shape and prints a result row.
+ * @param shape the product to time
+ */
+void benchShape(const BenchShape &shape)
+{
+    Matrix a(shape.m, shape.k);
+    Matrix b(shape.k, shape.n);
+    randomFill(a);
+    randomFill(b);
+
+    Matrix fast = a * b;
+    const double flops = 2.0 * shape.m * shape.n * shape.k;
+    const double fastSeconds = timeIt([&]() { fast = a * b; });
+
+    // the naive loop needs minutes on the largest shapes, those only report the new engine
+    const bool runNaive = flops <= 2.0 * 512 * 512 * 512;
+    double naiveSeconds = 0;
+    float maxError = 0;
+    if (runNaive)
+    {
+        Matrix naive = naiveMultiply(a, b);
+        naiveSeconds = timeIt([&]() { naive = naiveMultiply(a, b); });
+        for (int k = 0; k < naive.getRows() * naive.getCols(); k++)
+        {
+            maxError = std::fmax(maxError, std::fabs(naive[k] - fast[k]));
+        }
+    }
+
+    std::cout << shape.m << "x" << shape.k << " * " << shape.k << "x" << shape.n << "\t"
+              << "gemm: " << fastSeconds * 1e3 << " ms (" << flops / fastSeconds * 1e-9
+              << " GFLOP/s)";
+    if (runNaive)
+    {
+        std::cout << "\tnaive: " << naiveSeconds * 1e3 << " ms (" << flops / naiveSeconds * 1e-9
+                  << " GFLOP/s)\tspeedup: " << naiveSeconds / fastSeconds << "x\tmax error: "
+                  << maxError;
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * Benchmark's main
+ * @param argc count of args
+ * @param argv args values
+ * @return program exit status code
+ */
+int main(int argc, char **argv)
+{
+    if (argc != 1 && argc != 4)
+    {
+        std::cout << USAGE_MSG << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "gemm threads: " << gemmThreads() << std::endl;
+
+    if (argc == 4)
+    {
+        benchShape({std::atoi(argv[1]), std::atoi(argv[2]), std::atoi(argv[3])});
+        return EXIT_SUCCESS;
+    }
+
+    for (const BenchShape &shape : benchShapes)
+    {
+        benchShape(shape);
+    }
+
+    return EXIT_SUCCESS;
+}
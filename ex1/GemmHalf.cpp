@@ -0,0 +1,587 @@
+//
+// Created by user on 09/01/2020.
+//
+
+#include "GemmHalf.h"
+#include "AlignedBuffer.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include "SimdReduce.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Rows of A converted to float per gemm() call by the wide products (one L2 block)
+ */
+#define HALF_PANEL_ROWS GEMM_MC
+
+/**
+ * @brief Rows of A streamed together by the gemv kernels, each with 2 accumulators
+ */
+#define HALF_GEMV_ROWS 4
+
+/**
+ * @brief A gemv with 16 bit weights: y = A * x, or y += A * x, every y[i] finished by
+ * epilogueScalar() (see gemmHalf())
+ */
+typedef void (*GemvHalfKernel)(int m, int k, const uint16_t *a, int lda, const float *x,
+                               float *y, int incy, bool accumulate, const float *bias, bool relu);
+
+/**
+ * @brief A halfToFloat() implementation for one format
+ */
+typedef void (*ToFloatKernel)(const uint16_t *src, int n, float *dst);
+
+/**
+ * @brief A floatToHalf() implementation for one format
+ */
+typedef void (*ToHalfKernel)(const float *src, int n, uint16_t *dst);
+
+/**
+ * @struct HalfKernels
+ * @brief The kernels of one instruction set, indexed by HalfFormat, and their name
+ */
+typedef struct HalfKernels
+{
+    const char *name;
+    GemvHalfKernel gemv[2];
+    ToFloatKernel toFloat[2];
+    ToHalfKernel toHalf[2];
+} HalfKernels;
+
+/**
+ * @brief Bits of a float
+ */
+static inline uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+/**
+ * @brief Float of some bits
+ */
+static inline float bitsFloat(uint32_t bits)
+{
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief IEEE half to float, denormals, infinities and NaN included (bit for bit what
+ * vcvtph2ps does)
+ */
+static inline float fp16ToFloat(uint16_t half)
+{
+    const uint32_t sign = (uint32_t) (half & 0x8000u) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1Fu;
+    uint32_t mantissa = half & 0x3FFu;
+    if (exponent == 0x1F)
+    {
+        // infinity, or a NaN made quiet
+        const uint32_t quiet = mantissa != 0 ? 0x400000u : 0;
+        return bitsFloat(sign | 0x7F800000u | quiet | (mantissa << 13));
+    }
+    if (exponent != 0)
+    {
+        return bitsFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+    }
+    if (mantissa == 0)
+    {
+        return bitsFloat(sign);
+    }
+
+    // denormal half, normal float: shift the mantissa up to its implicit bit
+    uint32_t floatExponent = 113;
+    while ((mantissa & 0x400u) == 0)
+    {
+        mantissa <<= 1;
+        floatExponent--;
+    }
+    return bitsFloat(sign | (floatExponent << 23) | ((mantissa & 0x3FFu) << 13));
+}
+
+/**
+ * @brief Drops the low bits of value (shift of them), rounding to nearest even
+ */
+static inline uint32_t roundShift(uint32_t value, int shift)
+{
+    const uint32_t result = value >> shift;
+    const uint32_t rest = value & ((1u << shift) - 1);
+    const uint32_t half = 1u << (shift - 1);
+    return rest > half || (rest == half && (result & 1)) ? result + 1 : result;
+}
+
+/**
+ * @brief Float to IEEE half, rounding to nearest even (what vcvtps2ph does): overflow goes to
+ * infinity, small values to half denormals, NaN stays a quiet NaN
+ */
+static inline uint16_t floatToFp16(float value)
+{
+    const uint32_t bits = floatBits(value);
+    const auto sign = (uint16_t) ((bits >> 16) & 0x8000u);
+    const uint32_t magnitude = bits & 0x7FFFFFFFu;
+    if (magnitude > 0x7F800000u)
+    {
+        return (uint16_t) (sign | 0x7E00u | ((magnitude >> 13) & 0x3FFu));
+    }
+    if (magnitude >= 0x477FF000u)
+    {
+        // 65520 and up round past the largest half
+        return (uint16_t) (sign | 0x7C00u);
+    }
+    if (magnitude >= 0x38800000u)
+    {
+        // normal half: rebias the exponent, the carry of the rounding may bump it
+        return (uint16_t) (sign | roundShift(magnitude - 0x38000000u, 13));
+    }
+    if (magnitude <= 0x33000000u)
+    {
+        // up to 2^-25, half of the smallest denormal: rounds to zero
+        return sign;
+    }
+    // denormal half, in units of 2^-24
+    const uint32_t mantissa = (magnitude & 0x7FFFFFu) | 0x800000u;
+    return (uint16_t) (sign | roundShift(mantissa, 126 - (int) (magnitude >> 23)));
+}
+
+/**
+ * @brief bfloat16 to float: the 16 bits are the upper half of the float
+ */
+static inline float bf16ToFloat(uint16_t half)
+{
+    return bitsFloat((uint32_t) half << 16);
+}
+
+/**
+ * @brief Float to bfloat16, rounding to nearest even. Denormals become a signed zero and NaN
+ * stays a quiet NaN, as with vcvtneps2bf16
+ */
+static inline uint16_t floatToBf16(float value)
+{
+    const uint32_t bits = floatBits(value);
+    if ((bits & 0x7F800000u) == 0)
+    {
+        return (uint16_t) ((bits >> 16) & 0x8000u);
+    }
+    if ((bits & 0x7FFFFFFFu) > 0x7F800000u)
+    {
+        return (uint16_t) ((bits >> 16) | 0x40u);
+    }
+    return (uint16_t) ((bits + 0x7FFFu + ((bits >> 16) & 1u)) >> 16);
+}
+
+/**
+ * @brief Portable halfToFloat() for format
+ */
+template <HalfFormat format>
+static void portableToFloat(const uint16_t *src, int n, float *dst)
+{
+    for (int i = 0; i < n; i++)
+    {
+        dst[i] = format == HalfFp16 ? fp16ToFloat(src[i]) : bf16ToFloat(src[i]);
+    }
+}
+
+/**
+ * @brief Portable floatToHalf() for format
+ */
+template <HalfFormat format>
+static void portableToHalf(const float *src, int n, uint16_t *dst)
+{
+    for (int i = 0; i < n; i++)
+    {
+        dst[i] = format == HalfFp16 ? floatToFp16(src[i]) : floatToBf16(src[i]);
+    }
+}
+
+/**
+ * @brief The epilogue of a single element, as gemm()'s: value + bias[row], then Relu
+ * @param value the product
+ * @param bias one value per row, or nullptr
+ * @param row row of the element
+ * @param relu whether to apply Relu
+ * @return the finished element
+ */
+static inline float epilogueScalar(float value, const float *bias, int row, bool relu)
+{
+    if (bias != nullptr)
+    {
+        value += bias[row];
+    }
+    return !relu || value >= 0 ? value : 0.0f;
+}
+
+/**
+ * @brief Portable gemv: every weight converted on its own, then a plain dot product
+ */
+template <HalfFormat format>
+static void portableGemvHalf(int m, int k, const uint16_t *a, int lda, const float *x, float *y,
+                             int incy, bool accumulate, const float *bias, bool relu)
+{
+    for (int i = 0; i < m; i++)
+    {
+        const uint16_t *row = a + (ptrdiff_t) i * lda;
+        float dot = 0.0f;
+        for (int p = 0; p < k; p++)
+        {
+            dot += (format == HalfFp16 ? fp16ToFloat(row[p]) : bf16ToFloat(row[p])) * x[p];
+        }
+        float &yi = y[(ptrdiff_t) i * incy];
+        yi = epilogueScalar(accumulate ? yi + dot : dot, bias, i, relu);
+    }
+}
+
+#if SIMD_X86
+
+/**
+ * @brief 8 weights to float: vcvtph2ps for fp16, a 16 bit shift for bf16
+ */
+template <HalfFormat format>
+__attribute__((target("avx2,fma,f16c")))
+static inline __m256 loadHalf8(const uint16_t *src)
+{
+    const __m128i values = _mm_loadu_si128((const __m128i *) src);
+    if (format == HalfFp16)
+    {
+        return _mm256_cvtph_ps(values);
+    }
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(values), 16));
+}
+
+/**
+ * @brief 16 weights to float. Zero-masked forms: the plain ones start from an undefined
+ * register, which GCC 12 reports as maybe-uninitialized
+ */
+template <HalfFormat format>
+__attribute__((target("avx512f")))
+static inline __m512 loadHalf16(const uint16_t *src)
+{
+    const __m256i values = _mm256_loadu_si256((const __m256i *) src);
+    if (format == HalfFp16)
+    {
+        return _mm512_maskz_cvtph_ps((__mmask16) 0xFFFF, values);
+    }
+    const __m512i wide = _mm512_maskz_cvtepu16_epi32((__mmask16) 0xFFFF, values);
+    return _mm512_castsi512_ps(_mm512_maskz_slli_epi32((__mmask16) 0xFFFF, wide, 16));
+}
+
+/**
+ * @brief AVX2/F16C halfToFloat()
+ */
+template <HalfFormat format>
+__attribute__((target("avx2,fma,f16c")))
+static void avx2ToFloat(const uint16_t *src, int n, float *dst)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(dst + i, loadHalf8<format>(src + i));
+    }
+    portableToFloat<format>(src + i, n - i, dst + i);
+}
+
+/**
+ * @brief F16C floatToHalf() for fp16 (vcvtps2ph, round to nearest even)
+ */
+__attribute__((target("avx2,fma,f16c")))
+static void f16cToFp16(const float *src, int n, uint16_t *dst)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                             _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128((__m128i *) (dst + i), half);
+    }
+    portableToHalf<HalfFp16>(src + i, n - i, dst + i);
+}
+
+/**
+ * @brief AVX-512 BF16 floatToHalf() for bf16 (vcvtneps2bf16)
+ */
+__attribute__((target("avx512f,avx512bf16")))
+static void avx512ToBf16(const float *src, int n, uint16_t *dst)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m256bh half = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+        _mm256_storeu_si256((__m256i *) (dst + i), (__m256i) half);
+    }
+    portableToHalf<HalfBf16>(src + i, n - i, dst + i);
+}
+
+/**
+ * @brief AVX2/FMA gemv on 16 bit weights, the structure of avx2Gemv in Gemm.cpp: the weights
+ * are converted in registers and the tail of x is loaded masked (the rows are padded with
+ * zeros, so their tail is read whole)
+ */
+template <HalfFormat format>
+__attribute__((target("avx2,fma,f16c")))
+static void avx2GemvHalf(int m, int k, const uint16_t *a, int lda, const float *x, float *y,
+                         int incy, bool accumulate, const float *bias, bool relu)
+{
+    const int tail = k % 8;
+    const __m256i tailMask = _mm256_cmpgt_epi32(_mm256_set1_epi32(tail),
+                                                _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+    for (int i = 0; i < m; i += HALF_GEMV_ROWS)
+    {
+        const int rowCount = std::min(HALF_GEMV_ROWS, m - i);
+        const uint16_t *rows[HALF_GEMV_ROWS];
+        __m256 acc0[HALF_GEMV_ROWS];
+        __m256 acc1[HALF_GEMV_ROWS];
+        for (int r = 0; r < HALF_GEMV_ROWS; r++)
+        {
+            // missing rows of the last group re-read the last valid row and are dropped
+            rows[r] = a + (ptrdiff_t) (i + std::min(r, rowCount - 1)) * lda;
+            acc0[r] = _mm256_setzero_ps();
+            acc1[r] = _mm256_setzero_ps();
+        }
+
+        int p = 0;
+        for (; p + 16 <= k; p += 16)
+        {
+            const __m256 x0 = _mm256_loadu_ps(x + p);
+            const __m256 x1 = _mm256_loadu_ps(x + p + 8);
+            for (int r = 0; r < HALF_GEMV_ROWS; r++)
+            {
+                acc0[r] = _mm256_fmadd_ps(loadHalf8<format>(rows[r] + p), x0, acc0[r]);
+                acc1[r] = _mm256_fmadd_ps(loadHalf8<format>(rows[r] + p + 8), x1, acc1[r]);
+            }
+        }
+        if (p + 8 <= k)
+        {
+            const __m256 x0 = _mm256_loadu_ps(x + p);
+            for (int r = 0; r < HALF_GEMV_ROWS; r++)
+            {
+                acc0[r] = _mm256_fmadd_ps(loadHalf8<format>(rows[r] + p), x0, acc0[r]);
+            }
+            p += 8;
+        }
+        if (tail != 0)
+        {
+            const __m256 x0 = _mm256_maskload_ps(x + p, tailMask);
+            for (int r = 0; r < HALF_GEMV_ROWS; r++)
+            {
+                acc1[r] = _mm256_fmadd_ps(loadHalf8<format>(rows[r] + p), x0, acc1[r]);
+            }
+        }
+
+        for (int r = 0; r < rowCount; r++)
+        {
+            const float dot = horizontalSum(_mm256_add_ps(acc0[r], acc1[r]));
+            float &yi = y[(ptrdiff_t) (i + r) * incy];
+            yi = epilogueScalar(accumulate ? yi + dot : dot, bias, i + r, relu);
+        }
+    }
+}
+
+/**
+ * @brief AVX-512 gemv on 16 bit weights, avx2GemvHalf with 16 lane registers
+ */
+template <HalfFormat format>
+__attribute__((target("avx512f")))
+static void avx512GemvHalf(int m, int k, const uint16_t *a, int lda, const float *x, float *y,
+                           int incy, bool accumulate, const float *bias, bool relu)
+{
+    const int tail = k % 16;
+    const __mmask16 tailMask = (__mmask16) ((1u << tail) - 1u);
+
+    for (int i = 0; i < m; i += HALF_GEMV_ROWS)
+    {
+        const int rowCount = std::min(HALF_GEMV_ROWS, m - i);
+        const uint16_t *rows[HALF_GEMV_ROWS];
+        __m512 acc0[HALF_GEMV_ROWS];
+        __m512 acc1[HALF_GEMV_ROWS];
+        for (int r = 0; r < HALF_GEMV_ROWS; r++)
+        {
+            rows[r] = a + (ptrdiff_t) (i + std::min(r, rowCount - 1)) * lda;
+            acc0[r] = _mm512_setzero_ps();
+            acc1[r] = _mm512_setzero_ps();
+        }
+
+        int p = 0;
+        for (; p + 32 <= k; p += 32)
+        {
+            const __m512 x0 = _mm512_loadu_ps(x + p);
+            const __m512 x1 = _mm512_loadu_ps(x + p + 16);
+            for (int r = 0; r < HALF_GEMV_ROWS; r++)
+            {
+                acc0[r] = _mm512_fmadd_ps(loadHalf16<format>(rows[r] + p), x0, acc0[r]);
+                acc1[r] = _mm512_fmadd_ps(loadHalf16<format>(rows[r] + p + 16), x1, acc1[r]);
+            }
+        }
+        if (p + 16 <= k)
+        {
+            const __m512 x0 = _mm512_loadu_ps(x + p);
+            for (int r = 0; r < HALF_GEMV_ROWS; r++)
+            {
+                acc0[r] = _mm512_fmadd_ps(loadHalf16<format>(rows[r] + p), x0, acc0[r]);
+            }
+            p += 16;
+        }
+        if (tail != 0)
+        {
+            const __m512 x0 = _mm512_maskz_loadu_ps(tailMask, x + p);
+            for (int r = 0; r < HALF_GEMV_ROWS; r++)
+            {
+                acc1[r] = _mm512_fmadd_ps(loadHalf16<format>(rows[r] + p), x0, acc1[r]);
+            }
+        }
+
+        for (int r = 0; r < rowCount; r++)
+        {
+            const float dot = horizontalSum(_mm512_add_ps(acc0[r], acc1[r]));
+            float &yi = y[(ptrdiff_t) (i + r) * incy];
+            yi = epilogueScalar(accumulate ? yi + dot : dot, bias, i + r, relu);
+        }
+    }
+}
+
+#endif // SIMD_X86
+
+/**
+ * @brief Picks the widest kernels the CPU supports, within the simdIsa() cap
+ */
+static HalfKernels selectHalfKernels()
+{
+    HalfKernels kernels = {"portable",
+                           {portableGemvHalf<HalfFp16>, portableGemvHalf<HalfBf16>},
+                           {portableToFloat<HalfFp16>, portableToFloat<HalfBf16>},
+                           {portableToHalf<HalfFp16>, portableToHalf<HalfBf16>}};
+#if SIMD_X86
+    const SimdIsa isa = simdIsa();
+    if (isa >= SimdAvx2 && __builtin_cpu_supports("f16c"))
+    {
+        kernels.name = "avx2-f16c";
+        kernels.gemv[HalfFp16] = avx2GemvHalf<HalfFp16>;
+        kernels.gemv[HalfBf16] = avx2GemvHalf<HalfBf16>;
+        kernels.toFloat[HalfFp16] = avx2ToFloat<HalfFp16>;
+        kernels.toFloat[HalfBf16] = avx2ToFloat<HalfBf16>;
+        kernels.toHalf[HalfFp16] = f16cToFp16;
+    }
+    if (isa >= SimdAvx512)
+    {
+        kernels.name = "avx512";
+        kernels.gemv[HalfFp16] = avx512GemvHalf<HalfFp16>;
+        kernels.gemv[HalfBf16] = avx512GemvHalf<HalfBf16>;
+        if (__builtin_cpu_supports("avx512bf16"))
+        {
+            kernels.toHalf[HalfBf16] = avx512ToBf16;
+        }
+    }
+#endif
+    return kernels;
+}
+
+/**
+ * @brief The kernels used by gemmHalf() and the conversions, selected once
+ */
+static const HalfKernels &activeHalfKernels()
+{
+    static const HalfKernels kernels = selectHalfKernels();
+    return kernels;
+}
+
+/**
+ * @brief Matrix multiplication with 16 bit weights and fp32 accumulation: C = A * B, or
+ * C += A * B. A is m×k in format (rows padded to HALF_ROW_ALIGNMENT), B and C are row-major
+ * floats. A single contiguous column (n == 1, ldb == 1) is a gemv that converts the weights in
+ * registers (F16C or AVX-512 for fp16, a shift for bf16), so A is read from memory at half the
+ * float size. Wider products convert panels of A to float and run gemm() on them. The epilogue
+ * is fused as in gemm().
+ * @param format how A is stored
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param k cols of A, rows of B
+ * @param a pointer to A
+ * @param lda distance (in 16 bit values) between consecutive rows of A, a multiple of
+ * HALF_ROW_ALIGNMENT
+ * @param b pointer to B
+ * @param ldb distance (in floats) between consecutive rows of B
+ * @param c pointer to C. Must not alias B
+ * @param ldc distance (in floats) between consecutive rows of C
+ * @param accumulate true: C += A * B, false: C = A * B (C doesn't have to be initialized)
+ * @param epilogue bias and activation applied to C on top of the product, or nullptr
+ */
+void gemmHalf(HalfFormat format, int m, int n, int k, const uint16_t *a, int lda, const float *b,
+              int ldb, float *c, int ldc, bool accumulate, const GemmEpilogue *epilogue)
+{
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+
+    const HalfKernels &kernels = activeHalfKernels();
+    if (n == 1 && ldb == 1)
+    {
+        kernels.gemv[format](m, k, a, lda, b, c, ldc, accumulate,
+                             epilogue != nullptr ? epilogue->bias : nullptr,
+                             epilogue != nullptr && epilogue->activation == EpilogueRelu);
+        return;
+    }
+
+    // a batch is compute bound: convert a block of rows once, then the float kernels
+    static thread_local AlignedBuffer panelBuffer;
+    float *panel = panelBuffer.reserve((size_t) HALF_PANEL_ROWS * k);
+    for (int i = 0; i < m; i += HALF_PANEL_ROWS)
+    {
+        const int rows = std::min(HALF_PANEL_ROWS, m - i);
+        for (int r = 0; r < rows; r++)
+        {
+            kernels.toFloat[format](a + (ptrdiff_t) (i + r) * lda, k, panel + (ptrdiff_t) r * k);
+        }
+        GemmEpilogue panelEpilogue = {nullptr, EpilogueNone};
+        if (epilogue != nullptr)
+        {
+            panelEpilogue = *epilogue;
+            panelEpilogue.bias = epilogue->bias != nullptr ? epilogue->bias + i : nullptr;
+        }
+        gemm(rows, n, k, panel, k, b, ldb, c + (ptrdiff_t) i * ldc, ldc, accumulate,
+             &panelEpilogue);
+    }
+}
+
+/**
+ * @brief Converts n floats to format, rounding to nearest even (F16C or AVX-512 BF16 when the
+ * CPU has them, same bits without). bf16 flushes denormals to zero, like vcvtneps2bf16
+ * @param format the output format
+ * @param src n floats
+ * @param n number of values
+ * @param dst output, n 16 bit values
+ */
+void floatToHalf(HalfFormat format, const float *src, int n, uint16_t *dst)
+{
+    activeHalfKernels().toHalf[format](src, n, dst);
+}
+
+/**
+ * @brief Converts n values in format to float (exact)
+ * @param format the input format
+ * @param src n 16 bit values
+ * @param n number of values
+ * @param dst output, n floats
+ */
+void halfToFloat(HalfFormat format, const uint16_t *src, int n, float *dst)
+{
+    activeHalfKernels().toFloat[format](src, n, dst);
+}
+
+/**
+ * @brief Name of the kernels gemmHalf() runs on this CPU (for reports)
+ * @return one of avx512, avx2-f16c, portable
+ */
+const char *gemmHalfKernel()
+{
+    return activeHalfKernels().name;
+}
@@ -0,0 +1,78 @@
+//GemmHalf.h
+#ifndef GEMMHALF_H
+#define GEMMHALF_H
+
+#include <cstdint>
+
+#include "Gemm.h"
+
+/**
+ * @brief Rows of every gemmHalf() A operand are padded (with zeros) to a multiple of this many
+ * 16 bit values: one cache line, so the kernels load whole registers of weights past the last
+ * column without a tail
+ */
+#define HALF_ROW_ALIGNMENT 32
+
+/**
+ * @enum HalfFormat
+ * @brief 16 bit float formats the weights can be stored in
+ * HalfFp16 - IEEE half precision: 10 bit mantissa, range up to 65504
+ * HalfBf16 - bfloat16, the upper half of a float: 7 bit mantissa, the full float range
+ */
+enum HalfFormat
+{
+    HalfFp16,
+    HalfBf16
+};
+
+/**
+ * @brief Matrix multiplication with 16 bit weights and fp32 accumulation: C = A * B, or
+ * C += A * B. A is m×k in format (rows padded to HALF_ROW_ALIGNMENT), B and C are row-major
+ * floats. A single contiguous column (n == 1, ldb == 1) is a gemv that converts the weights in
+ * registers (F16C or AVX-512 for fp16, a shift for bf16), so A is read from memory at half the
+ * float size. Wider products convert panels of A to float and run gemm() on them. The epilogue
+ * is fused as in gemm().
+ * @param format how A is stored
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param k cols of A, rows of B
+ * @param a pointer to A
+ * @param lda distance (in 16 bit values) between consecutive rows of A, a multiple of
+ * HALF_ROW_ALIGNMENT
+ * @param b pointer to B
+ * @param ldb distance (in floats) between consecutive rows of B
+ * @param c pointer to C. Must not alias B
+ * @param ldc distance (in floats) between consecutive rows of C
+ * @param accumulate true: C += A * B, false: C = A * B (C doesn't have to be initialized)
+ * @param epilogue bias and activation applied to C on top of the product, or nullptr
+ */
+void gemmHalf(HalfFormat format, int m, int n, int k, const uint16_t *a, int lda, const float *b,
+              int ldb, float *c, int ldc, bool accumulate,
+              const GemmEpilogue *epilogue = nullptr);
+
+/**
+ * @brief Converts n floats to format, rounding to nearest even (F16C or AVX-512 BF16 when the
+ * CPU has them, same bits without). bf16 flushes denormals to zero, like vcvtneps2bf16
+ * @param format the output format
+ * @param src n floats
+ * @param n number of values
+ * @param dst output, n 16 bit values
+ */
+void floatToHalf(HalfFormat format, const float *src, int n, uint16_t *dst);
+
+/**
+ * @brief Converts n values in format to float (exact)
+ * @param format the input format
+ * @param src n 16 bit values
+ * @param n number of values
+ * @param dst output, n floats
+ */
+void halfToFloat(HalfFormat format, const uint16_t *src, int n, float *dst);
+
+/**
+ * @brief Name of the kernels gemmHalf() runs on this CPU (for reports)
+ * @return one of avx512, avx2-f16c, portable
+ */
+const char *gemmHalfKernel();
+
+#endif //GEMMHALF_H
@@ -0,0 +1,511 @@
+//
+// Created by user on 08/01/2020.
+//
+
+#include "GemmInt8.h"
+#include "AlignedBuffer.h"
+#include "Simd.h"
+#include "SimdReduce.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Register tile of the kernels: rows of A by rows of B whose dot products are computed
+ * together, so every load of B is reused INT8_TILE_ROWS times. One column, since the layers
+ * mostly run on a single image: a wider tile would compute clamped duplicate columns there, and
+ * the rows of A stay in L1 between the columns of a batch anyway
+ */
+#define INT8_TILE_ROWS 8
+#define INT8_TILE_COLS 1
+
+/**
+ * @brief A gemmInt8() implementation (see GemmInt8.h)
+ */
+typedef void (*GemmInt8Kernel)(int m, int n, int k, const int8_t *a, int lda, const uint8_t *b,
+                               int ldb, int32_t *c, int ldc);
+
+/**
+ * @brief A quantizeUint8() implementation (see GemmInt8.h)
+ */
+typedef void (*QuantizeKernel)(uint8_t *dst, const float *src, int n, float inverse,
+                               float zeroPoint);
+
+/**
+ * @brief A valueRange() implementation (see GemmInt8.h)
+ */
+typedef void (*RangeKernel)(const float *src, int n, float *min, float *max);
+
+/**
+ * @struct Int8Kernel
+ * @brief The kernels of one instruction set and their name
+ */
+typedef struct Int8Kernel
+{
+    const char *name;
+    GemmInt8Kernel run;
+    QuantizeKernel quantize;
+    RangeKernel range;
+} Int8Kernel;
+
+/**
+ * @brief One value of quantizeUint8(). std::max(0, q) first: a NaN becomes 0, like with the
+ * max instructions of the SIMD versions
+ */
+static inline uint8_t quantizeScalar(float value, float inverse, float zeroPoint)
+{
+    const float q = std::min(std::max(0.0f, value * inverse + zeroPoint), (float) UINT8_MAX);
+    return (uint8_t) (int) (q + 0.5f);
+}
+
+/**
+ * @brief Portable quantizeUint8()
+ */
+static void portableQuantize(uint8_t *dst, const float *src, int n, float inverse,
+                             float zeroPoint)
+{
+    for (int i = 0; i < n; i++)
+    {
+        dst[i] = quantizeScalar(src[i], inverse, zeroPoint);
+    }
+}
+
+/**
+ * @brief Portable version: plain dot products, vectorized by the compiler if it can
+ */
+static void portableGemmInt8(int m, int n, int k, const int8_t *a, int lda, const uint8_t *b,
+                             int ldb, int32_t *c, int ldc)
+{
+    for (int i = 0; i < m; i++)
+    {
+        const int8_t *row = a + (ptrdiff_t) i * lda;
+        for (int j = 0; j < n; j++)
+        {
+            const uint8_t *col = b + (ptrdiff_t) j * ldb;
+            int32_t dot = 0;
+            for (int p = 0; p < k; p++)
+            {
+                dot += (int32_t) row[p] * (int32_t) col[p];
+            }
+            c[(ptrdiff_t) i * ldc + j] = dot;
+        }
+    }
+}
+
+/**
+ * @brief Portable valueRange()
+ */
+static void portableRange(const float *src, int n, float *min, float *max)
+{
+    float low = src[0];
+    float high = src[0];
+    for (int i = 1; i < n; i++)
+    {
+        low = std::min(low, src[i]);
+        high = std::max(high, src[i]);
+    }
+    *min = low;
+    *max = high;
+}
+
+#if SIMD_X86
+
+/**
+ * @brief All lanes of the AVX-512 kernels below. The zero-masked forms of min, max and cvtt are
+ * used with it: the plain ones start from an undefined register, which GCC 12 reports as
+ * maybe-uninitialized
+ */
+#define INT8_ALL_LANES ((__mmask16) 0xFFFF)
+
+/**
+ * @brief AVX2 quantizeUint8(): multiply, add, clamp and round exactly like quantizeScalar()
+ */
+__attribute__((target("avx2")))
+static void avx2Quantize(uint8_t *dst, const float *src, int n, float inverse, float zeroPoint)
+{
+    const __m256 scale = _mm256_set1_ps(inverse);
+    const __m256 shift = _mm256_set1_ps(zeroPoint);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 top = _mm256_set1_ps(UINT8_MAX);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 q = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale), shift);
+        const __m256i values = _mm256_cvttps_epi32(
+                _mm256_add_ps(_mm256_min_ps(_mm256_max_ps(q, zero), top), half));
+        // 4 values in the low bytes of each 128-bit lane
+        const __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(values, values),
+                                                  _mm256_setzero_si256());
+        const int32_t low = _mm_cvtsi128_si32(_mm256_castsi256_si128(bytes));
+        const int32_t high = _mm_cvtsi128_si32(_mm256_extracti128_si256(bytes, 1));
+        std::memcpy(dst + i, &low, sizeof(low));
+        std::memcpy(dst + i + 4, &high, sizeof(high));
+    }
+    portableQuantize(dst + i, src + i, n - i, inverse, zeroPoint);
+}
+
+/**
+ * @brief AVX-512 quantizeUint8(), the narrowing store (vpmovusdb) handles the tail too
+ */
+__attribute__((target("avx512f")))
+static void avx512Quantize(uint8_t *dst, const float *src, int n, float inverse,
+                           float zeroPoint)
+{
+    const __m512 scale = _mm512_set1_ps(inverse);
+    const __m512 shift = _mm512_set1_ps(zeroPoint);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 top = _mm512_set1_ps(UINT8_MAX);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    for (int i = 0; i < n; i += 16)
+    {
+        const __mmask16 mask = n - i >= 16 ? INT8_ALL_LANES : (__mmask16) ((1u << (n - i)) - 1u);
+        const __m512 x = _mm512_maskz_loadu_ps(mask, src + i);
+        const __m512 q = _mm512_add_ps(_mm512_mul_ps(x, scale), shift);
+        const __m512 clamped = _mm512_maskz_min_ps(INT8_ALL_LANES,
+                                                   _mm512_maskz_max_ps(INT8_ALL_LANES, q, zero),
+                                                   top);
+        const __m512i values = _mm512_maskz_cvttps_epi32(INT8_ALL_LANES,
+                                                         _mm512_add_ps(clamped, half));
+        _mm512_mask_cvtusepi32_storeu_epi8(dst + i, mask, values);
+    }
+}
+
+/**
+ * @brief AVX2 valueRange(): 8 running minima and maxima, folded at the end
+ */
+__attribute__((target("avx2")))
+static void avx2Range(const float *src, int n, float *min, float *max)
+{
+    if (n < 8)
+    {
+        portableRange(src, n, min, max);
+        return;
+    }
+    __m256 low = _mm256_loadu_ps(src);
+    __m256 high = low;
+    int i = 8;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(src + i);
+        low = _mm256_min_ps(low, x);
+        high = _mm256_max_ps(high, x);
+    }
+    alignas(BUFFER_ALIGNMENT) float lows[8];
+    alignas(BUFFER_ALIGNMENT) float highs[8];
+    _mm256_store_ps(lows, low);
+    _mm256_store_ps(highs, high);
+    portableRange(src + i - 1, n - i + 1, min, max);
+    for (int lane = 0; lane < 8; lane++)
+    {
+        *min = std::min(*min, lows[lane]);
+        *max = std::max(*max, highs[lane]);
+    }
+}
+
+/**
+ * @brief AVX-512 valueRange(), the tail re-reads the last 16 values
+ */
+__attribute__((target("avx512f")))
+static void avx512Range(const float *src, int n, float *min, float *max)
+{
+    if (n < 16)
+    {
+        avx2Range(src, n, min, max);
+        return;
+    }
+    __m512 low = _mm512_loadu_ps(src);
+    __m512 high = low;
+    for (int i = 16; i < n; i += 16)
+    {
+        const __m512 x = _mm512_loadu_ps(src + std::min(i, n - 16));
+        low = _mm512_maskz_min_ps(INT8_ALL_LANES, low, x);
+        high = _mm512_maskz_max_ps(INT8_ALL_LANES, high, x);
+    }
+    alignas(BUFFER_ALIGNMENT) float lows[16];
+    alignas(BUFFER_ALIGNMENT) float highs[16];
+    _mm512_store_ps(lows, low);
+    _mm512_store_ps(highs, high);
+    *min = *std::min_element(lows, lows + 16);
+    *max = *std::max_element(highs, highs + 16);
+}
+
+/**
+ * @brief AVX2 version without dot product instructions: the bytes are widened to int16 and
+ * multiplied with vpmaddwd, which adds pairs into int32 lanes without saturating (vpmaddubsw
+ * would saturate at 255 * 127 * 2)
+ */
+__attribute__((target("avx2")))
+static void avx2GemmInt8(int m, int n, int k, const int8_t *a, int lda, const uint8_t *b,
+                         int ldb, int32_t *c, int ldc)
+{
+    for (int i = 0; i < m; i += INT8_TILE_ROWS)
+    {
+        const int rowCount = std::min(INT8_TILE_ROWS, m - i);
+        const int8_t *rows[INT8_TILE_ROWS];
+        for (int r = 0; r < INT8_TILE_ROWS; r++)
+        {
+            // missing rows of the last tile re-read the last valid row and are dropped
+            rows[r] = a + (ptrdiff_t) (i + std::min(r, rowCount - 1)) * lda;
+        }
+
+        for (int j = 0; j < n; j += INT8_TILE_COLS)
+        {
+            const int colCount = std::min(INT8_TILE_COLS, n - j);
+            const uint8_t *cols[INT8_TILE_COLS];
+            __m256i acc[INT8_TILE_ROWS][INT8_TILE_COLS];
+            for (int s = 0; s < INT8_TILE_COLS; s++)
+            {
+                cols[s] = b + (ptrdiff_t) (j + std::min(s, colCount - 1)) * ldb;
+                for (int r = 0; r < INT8_TILE_ROWS; r++)
+                {
+                    acc[r][s] = _mm256_setzero_si256();
+                }
+            }
+
+            for (int p = 0; p < k; p += 16)
+            {
+                __m256i x[INT8_TILE_COLS];
+                for (int s = 0; s < INT8_TILE_COLS; s++)
+                {
+                    x[s] = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (cols[s] + p)));
+                }
+                for (int r = 0; r < INT8_TILE_ROWS; r++)
+                {
+                    const __m256i w = _mm256_cvtepi8_epi16(
+                            _mm_loadu_si128((const __m128i *) (rows[r] + p)));
+                    for (int s = 0; s < INT8_TILE_COLS; s++)
+                    {
+                        acc[r][s] = _mm256_add_epi32(acc[r][s], _mm256_madd_epi16(x[s], w));
+                    }
+                }
+            }
+
+            for (int r = 0; r < rowCount; r++)
+            {
+                for (int s = 0; s < colCount; s++)
+                {
+                    c[(ptrdiff_t) (i + r) * ldc + j + s] = horizontalSum(acc[r][s]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief AVX-VNNI version: vpdpbusd multiplies 4 unsigned by 4 signed bytes and adds them into
+ * an int32 lane in one instruction
+ */
+__attribute__((target("avx2,avxvnni")))
+static void avxVnniGemmInt8(int m, int n, int k, const int8_t *a, int lda, const uint8_t *b,
+                            int ldb, int32_t *c, int ldc)
+{
+    for (int i = 0; i < m; i += INT8_TILE_ROWS)
+    {
+        const int rowCount = std::min(INT8_TILE_ROWS, m - i);
+        const int8_t *rows[INT8_TILE_ROWS];
+        for (int r = 0; r < INT8_TILE_ROWS; r++)
+        {
+            rows[r] = a + (ptrdiff_t) (i + std::min(r, rowCount - 1)) * lda;
+        }
+
+        for (int j = 0; j < n; j += INT8_TILE_COLS)
+        {
+            const int colCount = std::min(INT8_TILE_COLS, n - j);
+            const uint8_t *cols[INT8_TILE_COLS];
+            __m256i acc[INT8_TILE_ROWS][INT8_TILE_COLS];
+            for (int s = 0; s < INT8_TILE_COLS; s++)
+            {
+                cols[s] = b + (ptrdiff_t) (j + std::min(s, colCount - 1)) * ldb;
+                for (int r = 0; r < INT8_TILE_ROWS; r++)
+                {
+                    acc[r][s] = _mm256_setzero_si256();
+                }
+            }
+
+            for (int p = 0; p < k; p += 32)
+            {
+                __m256i x[INT8_TILE_COLS];
+                for (int s = 0; s < INT8_TILE_COLS; s++)
+                {
+                    x[s] = _mm256_loadu_si256((const __m256i *) (cols[s] + p));
+                }
+                for (int r = 0; r < INT8_TILE_ROWS; r++)
+                {
+                    const __m256i w = _mm256_loadu_si256((const __m256i *) (rows[r] + p));
+                    for (int s = 0; s < INT8_TILE_COLS; s++)
+                    {
+                        acc[r][s] = _mm256_dpbusd_avx_epi32(acc[r][s], x[s], w);
+                    }
+                }
+            }
+
+            for (int r = 0; r < rowCount; r++)
+            {
+                for (int s = 0; s < colCount; s++)
+                {
+                    c[(ptrdiff_t) (i + r) * ldc + j + s] = horizontalSum(acc[r][s]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief AVX-512 VNNI version: same tile as avxVnniGemmInt8 with 64 bytes per instruction
+ */
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void avx512VnniGemmInt8(int m, int n, int k, const int8_t *a, int lda, const uint8_t *b,
+                               int ldb, int32_t *c, int ldc)
+{
+    for (int i = 0; i < m; i += INT8_TILE_ROWS)
+    {
+        const int rowCount = std::min(INT8_TILE_ROWS, m - i);
+        const int8_t *rows[INT8_TILE_ROWS];
+        for (int r = 0; r < INT8_TILE_ROWS; r++)
+        {
+            rows[r] = a + (ptrdiff_t) (i + std::min(r, rowCount - 1)) * lda;
+        }
+
+        for (int j = 0; j < n; j += INT8_TILE_COLS)
+        {
+            const int colCount = std::min(INT8_TILE_COLS, n - j);
+            const uint8_t *cols[INT8_TILE_COLS];
+            __m512i acc[INT8_TILE_ROWS][INT8_TILE_COLS];
+            for (int s = 0; s < INT8_TILE_COLS; s++)
+            {
+                cols[s] = b + (ptrdiff_t) (j + std::min(s, colCount - 1)) * ldb;
+                for (int r = 0; r < INT8_TILE_ROWS; r++)
+                {
+                    acc[r][s] = _mm512_setzero_si512();
+                }
+            }
+
+            for (int p = 0; p < k; p += 64)
+            {
+                __m512i x[INT8_TILE_COLS];
+                for (int s = 0; s < INT8_TILE_COLS; s++)
+                {
+                    x[s] = _mm512_loadu_si512(cols[s] + p);
+                }
+                for (int r = 0; r < INT8_TILE_ROWS; r++)
+                {
+                    const __m512i w = _mm512_loadu_si512(rows[r] + p);
+                    for (int s = 0; s < INT8_TILE_COLS; s++)
+                    {
+                        acc[r][s] = _mm512_dpbusd_epi32(acc[r][s], x[s], w);
+                    }
+                }
+            }
+
+            for (int r = 0; r < rowCount; r++)
+            {
+                for (int s = 0; s < colCount; s++)
+                {
+                    c[(ptrdiff_t) (i + r) * ldc + j + s] = horizontalSum(acc[r][s]);
+                }
+            }
+        }
+    }
+}
+
+#endif // SIMD_X86
+
+/**
+ * @brief Picks the best kernel the CPU supports, within the simdIsa() cap
+ */
+static Int8Kernel selectInt8Kernel()
+{
+#if SIMD_X86
+    const SimdIsa isa = simdIsa();
+    if (isa >= SimdAvx512 && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vnni"))
+    {
+        return {"avx512-vnni", avx512VnniGemmInt8, avx512Quantize, avx512Range};
+    }
+    if (isa >= SimdAvx2 && __builtin_cpu_supports("avxvnni"))
+    {
+        return {"avx-vnni", avxVnniGemmInt8, avx2Quantize, avx2Range};
+    }
+    if (isa >= SimdAvx2)
+    {
+        return {"avx2", avx2GemmInt8, avx2Quantize, avx2Range};
+    }
+#endif
+    return {"portable", portableGemmInt8, portableQuantize, portableRange};
+}
+
+/**
+ * @brief The kernel used by gemmInt8(), selected once
+ */
+static const Int8Kernel &activeInt8Kernel()
+{
+    static const Int8Kernel kernel = selectInt8Kernel();
+    return kernel;
+}
+
+/**
+ * @brief Integer matrix multiplication with int32 accumulation, in dot product form:
+ * C[i][j] = sum over p of A[i][p] * B[j][p]. A holds m signed int8 rows (the weights), B holds n
+ * unsigned int8 rows (the quantized input vectors, one per column of the product). Uses the
+ * VNNI dot product instructions (AVX-512 or AVX) when the CPU has them. Sums are exact, so
+ * every instruction set gives the same result.
+ * @param m rows of A and C
+ * @param n rows of B, cols of C
+ * @param k elements per row of A and B, a multiple of INT8_ROW_ALIGNMENT
+ * @param a pointer to A
+ * @param lda distance (in bytes) between consecutive rows of A
+ * @param b pointer to B
+ * @param ldb distance (in bytes) between consecutive rows of B
+ * @param c pointer to C
+ * @param ldc distance (in int32) between consecutive rows of C
+ */
+void gemmInt8(int m, int n, int k, const int8_t *a, int lda, const uint8_t *b, int ldb,
+              int32_t *c, int ldc)
+{
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+    activeInt8Kernel().run(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+/**
+ * @brief Quantizes n contiguous floats to uint8: dst[i] = round(src[i] * inverse + zeroPoint)
+ * clamped to [0, 255] (rounded half up). Same bytes on every instruction set
+ * @param dst output, n bytes
+ * @param src input, n floats
+ * @param n number of values
+ * @param inverse 1 / scale of the quantization
+ * @param zeroPoint the quantized value of 0
+ */
+void quantizeUint8(uint8_t *dst, const float *src, int n, float inverse, float zeroPoint)
+{
+    activeInt8Kernel().quantize(dst, src, n, inverse, zeroPoint);
+}
+
+/**
+ * @brief Smallest and largest of n > 0 contiguous floats (for the dynamic input quantization)
+ * @param src the values
+ * @param n number of values
+ * @param min output, the smallest value
+ * @param max output, the largest value
+ */
+void valueRange(const float *src, int n, float *min, float *max)
+{
+    activeInt8Kernel().range(src, n, min, max);
+}
+
+/**
+ * @brief Name of the kernel gemmInt8() runs on this CPU (for reports)
+ * @return one of avx512-vnni, avx-vnni, avx2, portable
+ */
+const char *gemmInt8Kernel()
+{
+    return activeInt8Kernel().name;
+}
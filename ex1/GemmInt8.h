@@ -0,0 +1,58 @@
+//GemmInt8.h
+#ifndef GEMMINT8_H
+#define GEMMINT8_H
+
+#include <cstdint>
+
+/**
+ * @brief The depth k of every gemmInt8() operand is padded (with zeros) to a multiple of this
+ * many bytes: one AVX-512 register, so the kernels never need a tail
+ */
+#define INT8_ROW_ALIGNMENT 64
+
+/**
+ * @brief Integer matrix multiplication with int32 accumulation, in dot product form:
+ * C[i][j] = sum over p of A[i][p] * B[j][p]. A holds m signed int8 rows (the weights), B holds n
+ * unsigned int8 rows (the quantized input vectors, one per column of the product). Uses the
+ * VNNI dot product instructions (AVX-512 or AVX) when the CPU has them. Sums are exact, so
+ * every instruction set gives the same result.
+ * @param m rows of A and C
+ * @param n rows of B, cols of C
+ * @param k elements per row of A and B, a multiple of INT8_ROW_ALIGNMENT
+ * @param a pointer to A
+ * @param lda distance (in bytes) between consecutive rows of A
+ * @param b pointer to B
+ * @param ldb distance (in bytes) between consecutive rows of B
+ * @param c pointer to C
+ * @param ldc distance (in int32) between consecutive rows of C
+ */
+void gemmInt8(int m, int n, int k, const int8_t *a, int lda, const uint8_t *b, int ldb,
+              int32_t *c, int ldc);
+
+/**
+ * @brief Quantizes n contiguous floats to uint8: dst[i] = round(src[i] * inverse + zeroPoint)
+ * clamped to [0, 255] (rounded half up). Same bytes on every instruction set
+ * @param dst output, n bytes
+ * @param src input, n floats
+ * @param n number of values
+ * @param inverse 1 / scale of the quantization
+ * @param zeroPoint the quantized value of 0
+ */
+void quantizeUint8(uint8_t *dst, const float *src, int n, float inverse, float zeroPoint);
+
+/**
+ * @brief Smallest and largest of n > 0 contiguous floats (for the dynamic input quantization)
+ * @param src the values
+ * @param n number of values
+ * @param min output, the smallest value
+ * @param max output, the largest value
+ */
+void valueRange(const float *src, int n, float *min, float *max);
+
+/**
+ * @brief Name of the kernel gemmInt8() runs on this CPU (for reports)
+ * @return one of avx512-vnni, avx-vnni, avx2, portable
+ */
+const char *gemmInt8Kernel();
+
+#endif //GEMMINT8_H
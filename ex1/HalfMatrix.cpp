@@ -0,0 +1,129 @@
+//
+// Created by user on 09/01/2020.
+//
+
+#include "HalfMatrix.h"
+
+#include <cstddef>
+
+/**
+ * @brief Constructs an empty 0×0 matrix
+ */
+HalfMatrix::HalfMatrix() : _rows(0), _cols(0), _stride(0), _format(HalfFp16), _values(nullptr)
+{
+
+}
+
+/**
+ * @brief Converts a float matrix, rounding every value to nearest even
+ * @param weights the float matrix
+ * @param format the storage format
+ * @return an owning 16 bit matrix
+ */
+HalfMatrix HalfMatrix::convert(const Matrix &weights, HalfFormat format)
+{
+    HalfMatrix result;
+    result._rows = weights.getRows();
+    result._cols = weights.getCols();
+    result._stride = strideFor(result._cols);
+    result._format = format;
+    result._ownedValues.assign((size_t) result._rows * result._stride, 0);
+
+    for (int i = 0; i < result._rows; i++)
+    {
+        floatToHalf(format, weights.data() + (ptrdiff_t) i * result._cols, result._cols,
+                    result._ownedValues.data() + (ptrdiff_t) i * result._stride);
+    }
+
+    result._values = result._ownedValues.data();
+    return result;
+}
+
+/**
+ * @brief Non-owning matrix over existing values, which must outlive it
+ * @param values rows × stride values, stride = strideFor(cols)
+ * @param format the storage format of values
+ * @param rows rows of the matrix
+ * @param cols cols of the matrix
+ * @return a matrix viewing the values
+ */
+HalfMatrix HalfMatrix::borrow(const uint16_t *values, HalfFormat format, int rows, int cols)
+{
+    HalfMatrix result;
+    result._rows = rows;
+    result._cols = cols;
+    result._stride = strideFor(cols);
+    result._format = format;
+    result._values = values;
+    return result;
+}
+
+/**
+ * @brief Row stride of a rows × cols 16 bit matrix
+ * @param cols cols of the matrix
+ * @return cols rounded up to HALF_ROW_ALIGNMENT
+ */
+int HalfMatrix::strideFor(int cols)
+{
+    return (cols + HALF_ROW_ALIGNMENT - 1) / HALF_ROW_ALIGNMENT * HALF_ROW_ALIGNMENT;
+}
+
+/**
+ * @brief rows getter
+ * @return rows of the matrix
+ */
+int HalfMatrix::getRows() const
+{
+    return _rows;
+}
+
+/**
+ * @brief cols getter
+ * @return cols of the matrix (without padding)
+ */
+int HalfMatrix::getCols() const
+{
+    return _cols;
+}
+
+/**
+ * @brief stride getter
+ * @return distance (in values) between consecutive rows
+ */
+int HalfMatrix::getStride() const
+{
+    return _stride;
+}
+
+/**
+ * @brief format getter
+ * @return how the values are stored
+ */
+HalfFormat HalfMatrix::getFormat() const
+{
+    return _format;
+}
+
+/**
+ * @brief values getter
+ * @return rows × getStride() values
+ */
+const uint16_t *HalfMatrix::data() const
+{
+    return _values;
+}
+
+/**
+ * @brief Back to float (exact), e.g. to measure the rounding error
+ * @return rows × cols float matrix
+ */
+Matrix HalfMatrix::toFloat() const
+{
+    Matrix result(_rows, _cols);
+    for (int i = 0; i < _rows; i++)
+    {
+        halfToFloat(_format, _values + (ptrdiff_t) i * _stride, _cols,
+                    result.data() + (ptrdiff_t) i * _cols);
+    }
+    return result;
+}
@@ -0,0 +1,105 @@
+//HalfMatrix.h
+#ifndef HALFMATRIX_H
+#define HALFMATRIX_H
+
+#include <cstdint>
+#include <vector>
+
+#include "GemmHalf.h"
+#include "Matrix.h"
+
+/**
+ * @brief Weight matrix stored as 16 bit floats (fp16 or bf16), half the memory traffic of a
+ * float Matrix. Rows are padded with zeros to a multiple of HALF_ROW_ALIGNMENT values, the
+ * layout gemmHalf() takes. The values are either owned (convert()) or borrowed from a model
+ * file (borrow()).
+ */
+class HalfMatrix
+{
+public:
+    /**
+     * @brief Constructs an empty 0×0 matrix
+     */
+    HalfMatrix();
+
+    /**
+     * @brief Converts a float matrix, rounding every value to nearest even
+     * @param weights the float matrix
+     * @param format the storage format
+     * @return an owning 16 bit matrix
+     */
+    static HalfMatrix convert(const Matrix &weights, HalfFormat format);
+
+    /**
+     * @brief Non-owning matrix over existing values, which must outlive it
+     * @param values rows × stride values, stride = strideFor(cols)
+     * @param format the storage format of values
+     * @param rows rows of the matrix
+     * @param cols cols of the matrix
+     * @return a matrix viewing the values
+     */
+    static HalfMatrix borrow(const uint16_t *values, HalfFormat format, int rows, int cols);
+
+    /**
+     * @brief Row stride of a rows × cols 16 bit matrix
+     * @param cols cols of the matrix
+     * @return cols rounded up to HALF_ROW_ALIGNMENT
+     */
+    static int strideFor(int cols);
+
+    /**
+     * @brief The owned values move with the matrix, views into them stay valid
+     */
+    HalfMatrix(HalfMatrix &&other) noexcept = default;
+
+    /**
+     * @brief The owned values move with the matrix, views into them stay valid
+     */
+    HalfMatrix &operator=(HalfMatrix &&other) noexcept = default;
+
+    /**
+     * @brief rows getter
+     * @return rows of the matrix
+     */
+    int getRows() const;
+
+    /**
+     * @brief cols getter
+     * @return cols of the matrix (without padding)
+     */
+    int getCols() const;
+
+    /**
+     * @brief stride getter
+     * @return distance (in values) between consecutive rows
+     */
+    int getStride() const;
+
+    /**
+     * @brief format getter
+     * @return how the values are stored
+     */
+    HalfFormat getFormat() const;
+
+    /**
+     * @brief values getter
+     * @return rows × getStride() values
+     */
+    const uint16_t *data() const;
+
+    /**
+     * @brief Back to float (exact), e.g. to measure the rounding error
+     * @return rows × cols float matrix
+     */
+    Matrix toFloat() const;
+
+private:
+    int _rows;
+    int _cols;
+    int _stride;
+    HalfFormat _format;
+    std::vector<uint16_t> _ownedValues;
+    const uint16_t *_values;
+};
+
+#endif //HALFMATRIX_H
@@ -3,13 +3,15 @@
 //
 
 #include "Matrix.h"
+#include "Simd.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <utility>
 
 
-#define MULTIPLY_ERROR "Please validate your matrices size"
-#define ADD_ERROR "Please validate your matrices size - must be same size"
 #define SMALL_INPUT_ERROR "The entered Data is smaller than the size of the matrix."
 #define BIG_INPUT_ERROR "The entered Data is bigger than the size of the matrix."
 #define ACCESS_ERROR "Cannot access matrix in this index."
@@ -17,14 +19,11 @@
 /**
  * @brief Constructs Matrix rows × cols. Inits all elements to 0
  */
-Matrix::Matrix(int rows, int cols) : _rows(rows), _cols(cols)
+Matrix::Matrix(int rows, int cols) : _rows(rows), _cols(cols), _owner(true)
 {
 
-    auto *matrix = new float[_rows * _cols];
-    for (int i = 0; i < _rows * _cols; i++)
-    {
-        matrix[i] = 0.0f;
-    }
+    auto *matrix = _buffer(_rows * _cols);
+    simdKernels().fill(matrix, 0.0f, _rows * _cols);
 
     _mat = matrix;
 }
@@ -32,9 +31,9 @@ Matrix::Matrix(int rows, int cols) : _rows(rows), _cols(cols)
 /**
  * @brief Constructs 1×1 Matrix Inits the single element to 0
  */
-Matrix::Matrix() : _rows(1), _cols(1)
+Matrix::Matrix() : _rows(1), _cols(1), _owner(true)
 {
-    auto *matrix = new float[1];
+    auto *matrix = _buffer(1);
     matrix[0] = 0;
 
     _mat = matrix;
@@ -44,16 +43,50 @@ Matrix::Matrix() : _rows(1), _cols(1)
  * @brief Constructs matrix from another Matrix m
  * @param m another matrix to construct from
  */
-Matrix::Matrix(const Matrix &m) : _rows(m.getRows()), _cols(m.getCols())
+Matrix::Matrix(const Matrix &m) : _rows(m.getRows()), _cols(m.getCols()), _owner(true)
 {
 
-    _mat = new float[m.getCols() * m.getRows()];
-    for (int i = 0; i < m.getRows() * m.getCols(); i++)
-    {
-        (*this)[i] = m[i];
-    }
+    _mat = _buffer(m.getCols() * m.getRows());
+    simdKernels().copy(_mat, m._mat, _rows * _cols);
+}
+
+/**
+ * @brief Constructs matrix by taking over the buffer of m (inline elements are copied). m is left
+ * an empty 0×0 matrix
+ * @param m a matrix about to expire
+ */
+Matrix::Matrix(Matrix &&m) noexcept: _rows(0), _cols(0), _mat(_inline), _owner(true)
+{
+    _takeOver(m);
+}
+
+/**
+ * @brief Constructs a matrix around an existing buffer
+ * @param data the elements
+ * @param rows rows of the matrix
+ * @param cols cols of the matrix
+ * @param owner whether the matrix frees data
+ */
+Matrix::Matrix(float *data, int rows, int cols, bool owner) :
+        _rows(rows), _cols(cols), _mat(data), _owner(owner)
+{
 
+}
 
+/**
+ * @brief Non-owning rows × cols matrix over existing row-major elements (e.g. weights
+ * mapped from a model file). Nothing is copied and the elements are never freed, so they
+ * must outlive the matrix. Borrowed elements are never written: the first non-const access
+ * (data(), row(), [], (), +=, >> ...) copies them into a buffer of the matrix's own, so
+ * the elements may be read-only memory (e.g. a PROT_READ mapping)
+ * @param data the elements
+ * @param rows rows of the matrix
+ * @param cols cols of the matrix
+ * @return a matrix viewing data
+ */
+Matrix Matrix::borrow(const float *data, int rows, int cols)
+{
+    return Matrix(const_cast<float *>(data), rows, cols, false);
 }
 
 /**
@@ -61,7 +94,7 @@ Matrix::Matrix(const Matrix &m) : _rows(m.getRows()), _cols(m.getCols())
  */
 Matrix::~Matrix()
 {
-    delete[] _mat;
+    _release();
 }
 
 /**
@@ -82,6 +115,43 @@ int Matrix::getCols() const
     return _cols;
 }
 
+/**
+ * @brief stride getter: rows are contiguous, so this is getCols() (see MatrixView)
+ * @return distance (in floats) between consecutive rows
+ */
+int Matrix::getStride() const
+{
+    return _cols;
+}
+
+/**
+ * @brief Raw row-major elements, const version
+ * @return pointer to element (0, 0)
+ */
+const float *Matrix::data() const
+{
+    return _mat;
+}
+
+/**
+ * @brief Raw row-major elements. Gives borrowed elements a buffer of their own first
+ * @return pointer to element (0, 0)
+ */
+float *Matrix::data()
+{
+    _own();
+    return _mat;
+}
+
+/**
+ * @brief ownership getter
+ * @return false if the elements are borrowed (see borrow())
+ */
+bool Matrix::ownsData() const
+{
+    return _owner;
+}
+
 /**
  * @brief Transforms a matrix into a column vector. Supports function calling concatenation
  * @return a ref to a vectorized object
@@ -100,11 +170,13 @@ Matrix &Matrix::vectorize()
  */
 void Matrix::plainPrint()
 {
+    // read only: a borrowed matrix keeps its elements
+    const Matrix &matrix = *this;
     for (int i = 0; i < _rows; i++)
     {
-        for (int j = 0; j < _cols; j++)
+        for (const float value : matrix.rowSpan(i))
         {
-            std::cout << (*this)(i, j) << " ";
+            std::cout << value << " ";
         }
 
         std::cout << std::endl;
@@ -125,113 +197,120 @@ Matrix &Matrix::operator=(const Matrix &other)
         return *this;
     }
 
-    // delete mat
-    delete[] _mat;
-
-    _rows = other.getRows();
-    _cols = other.getCols();
-
-
-    //re-create mat
-    _mat = new float[_rows * _cols];
-    for (int i = 0; i < _rows * _cols; i++)
-    {
-        _mat[i] = other[i];
-    }
+    // same amount of elements: the current buffer is reused as is
+    _reshape(other.getRows(), other.getCols());
+    simdKernels().copy(_mat, other._mat, _rows * _cols);
 
+    return *this;
 
-    return *this;       //TODO NOT SURE ABOUT THIS
+}
 
+/**
+ * @brief Move assignment: takes over the buffer of other, which gets the old buffer of this
+ * @param other a matrix about to expire
+ * @return a ref to this matrix
+ */
+Matrix &Matrix::operator=(Matrix &&other) noexcept
+{
+    swap(other);
+    return *this;
 }
 
 /**
- * @brief Implementation of the * operator (override). act as Matrix multiplication.
- * this * other
+ * @brief Exchanges the content (dims and buffer) of this and other. Heap buffers are swapped
+ * without copying, inline elements are copied
  * @param other the other matrix
- * @return a ref to result
  */
-Matrix Matrix::operator*(const Matrix &other) const
+void Matrix::swap(Matrix &other) noexcept
 {
-    // must assure when multiplying matrices
-    if (_cols != other.getRows())
-    {
-        std::cerr << MULTIPLY_ERROR << std::endl;
-        std::exit(1);
-    }
-
-    // if A size is nxm and B is mxp then result is nxp
-    Matrix result = Matrix(_rows, other.getCols());
-
-    for (int i = 0; i < _rows; ++i)
+    if (this == &other)
     {
-        for (int j = 0; j < other.getCols(); ++j)
-        {
-            for (int k = 0; k < _cols; ++k)
-            {
-                result(i, j) += (*this)(i, k) * other(k, j);
-            }
-        }
+        return;
     }
+    Matrix temp(std::move(other));
+    other._takeOver(*this);
+    _takeOver(temp);
+}
 
-    return result;
-
-
+/**
+ * @brief Exchanges the content of two matrices, heap buffers without copying
+ * @param left a matrix
+ * @param right a matrix
+ */
+void swap(Matrix &left, Matrix &right) noexcept
+{
+    left.swap(right);
 }
 
 /**
- * @brief Implementation of the * operator (override). act as scalar multiplication from the
- * right
- * this  * scalar
+ * @brief scalar multiplication from the right of a temporary. Reuses its buffer
+ * @param left a matrix about to expire
  * @param c a scalar
- * @return a ref to the result
+ * @return the result (left's buffer)
  */
-Matrix Matrix::operator*(const float c) const
+Matrix operator*(Matrix &&left, const float c)
 {
-    Matrix result{_rows, _cols}; // if A size is nxm and B is mxp then result is nxp
-
-    for (int i = 0; i < _rows; ++i)
-    {
-        for (int j = 0; j < _cols; ++j)
-        {
-            result(i, j) = c * (*this)(i, j);
-        }
-    }
-
-    return result;
+    left._own();
+    simdKernels().scale(left._mat, left._mat, c, left._rows * left._cols);
+    return std::move(left);
 }
 
 /**
- * @brief Implementation of the * operator. act as scalar multiplication from the left
- * @param left a const float (scalar)
- * @param right our matrix
- * @return a ref to the result
+ * @brief scalar multiplication from the left of a temporary. Reuses its buffer
+ * @param left a scalar
+ * @param right a matrix about to expire
+ * @return the result (right's buffer)
  */
-Matrix operator*(const float left, const Matrix &right)
+Matrix operator*(const float left, Matrix &&right)
 {
+    right._own();
+    simdKernels().scale(right._mat, right._mat, left, right._rows * right._cols);
+    return std::move(right);
+}
 
-    Matrix result = Matrix(right.getRows(), right.getCols());
-    // if A's size is nxm and B is mxp then result is nxp
-
-    for (int i = 0; i < right.getRows(); ++i)
-    {
-        for (int j = 0; j < right.getCols(); ++j)
-        {
-            result(i, j) = left * right(i, j);
-        }
-    }
+/**
+ * @brief Matrix + operator with two temporaries. Reuses the buffer of left
+ * @param left a matrix about to expire
+ * @param right a matrix about to expire
+ * @return the result (left's buffer)
+ */
+Matrix operator+(Matrix &&left, Matrix &&right)
+{
+    left += right;
+    return std::move(left);
+}
 
-    return result;
+/**
+ * @brief Matrix * operator with two temporaries, evaluated at once
+ * @param left a matrix about to expire
+ * @param right a matrix about to expire, with as many rows as left has cols
+ * @return the product
+ */
+Matrix operator*(Matrix &&left, Matrix &&right)
+{
+    const Matrix &a = left;
+    const Matrix &b = right;
+    return a * b;
+}
 
+/**
+ * @brief Transpose of a temporary, evaluated at once
+ * @param matrix a matrix about to expire
+ * @return matrix^T
+ */
+Matrix transpose(Matrix &&matrix)
+{
+    const Matrix &operand = matrix;
+    return transpose(operand);
 }
 
 /**
- * @brief Matrix + operator
+ * @brief Matrix += operator. Adds in place, no new buffer
  * @param other a matrix to add
- * @return a ref to the result
+ * @return a ref to the result (this)
  */
-Matrix Matrix::operator+(const Matrix &other) const
+Matrix &Matrix::operator+=(const Matrix &other)
 {
-
     // must assure when adding matrices
     if (_cols != other.getCols() || _rows != other.getRows())
     {
@@ -239,97 +318,105 @@ Matrix Matrix::operator+(const Matrix &other) const
         std::exit(1);
     }
 
-    Matrix result(_rows, _cols);
-    // if A size is nxm and B is mxp then result is nxp
-
-    for (int i = 0; i < _rows; ++i)
-    {
-        for (int j = 0; j < _cols; ++j)
-        {
-            (result)(i, j) = (*this)(i, j) + (other)(i, j);
-        }
-    }
-
-    return result;
-
+    _own();
+    simdKernels().add(_mat, _mat, other._mat, _rows * _cols);
+    return *this;
 }
 
 /**
- * @brief Matrix += operator
- * @param other a matrix to add
- * @return a ref to the result (this)
+ * @brief dst = this (expression template protocol)
+ * @param dst a matrix of the same size
  */
-Matrix &Matrix::operator+=(const Matrix &other)
+void Matrix::assignTo(Matrix &dst) const
 {
-    *this = *this + other;
-    return *this;
+    simdKernels().copy(dst.data(), _mat, _rows * _cols);
 }
 
 /**
- * @brief Matrix () operator
- * @param i rows
- * @param j cols
- * @return matrix[i][j]
+ * @brief dst += this (expression template protocol)
+ * @param dst a matrix of the same size
  */
-float Matrix::operator()(const int i, const int j) const
+void Matrix::addTo(Matrix &dst) const
 {
-
-    if (i >= _rows || j >= _cols || i < 0 || j < 0)
-    {
-        std::cerr << ACCESS_ERROR << std::endl;
-        std::exit(1);
-    }
-    return _mat[i * _cols + j];
-
+    float *out = dst.data();
+    simdKernels().add(out, out, _mat, _rows * _cols);
 }
 
 /**
- * @brief Matrix () operator
- * @param i rows
- * @param j cols
- * @return matrix[i][j]
+ * @brief Changes the dims, reallocating only if the element count changes or the elements are
+ * borrowed. Content is undefined afterwards
+ * @param rows new rows
+ * @param cols new cols
  */
-float &Matrix::operator()(const int i, const int j)
+void Matrix::_reshape(const int rows, const int cols)
 {
-    if (i >= _rows || j >= _cols || i < 0 || j < 0)
+    if (rows * cols != _rows * _cols || !_owner)
     {
-        std::cerr << ACCESS_ERROR << std::endl;
-        std::exit(1);
+        _release();
+        _mat = _buffer(rows * cols);
+        _owner = true;
     }
-    return _mat[(i * _cols) + j];
-
+    _rows = rows;
+    _cols = cols;
 }
 
 /**
- * @brief Matrix [] operator const version
- * @param k
- * @return matrix[i][j] == matrix[i*cols + j];
+ * @brief Frees the elements if they are on the heap and owned. Borrowed and inline elements are
+ * left alone
  */
-float &Matrix::operator[](const int k)
+void Matrix::_release() noexcept
 {
-    if (k >= _rows * _cols || k < 0)
+    if (_owner && _mat != _inline)
     {
-        std::cerr << ACCESS_ERROR << std::endl;
-        std::exit(1);
+        delete[] _mat;
     }
-    return _mat[k];
+}
 
+/**
+ * @brief The copy of _own(), out of line: borrowed elements into a buffer of this matrix
+ */
+void Matrix::_detach()
+{
+    float *own = _buffer(_rows * _cols);
+    simdKernels().copy(own, _mat, _rows * _cols);
+    _mat = own;
+    _owner = true;
 }
 
 /**
- * @brief Matrix [] operator const version
- * @param k
- * @return matrix[i][j] == matrix[i*cols + j];
+ * @brief Takes over the content of m: inline elements are copied into the inline buffer of this
+ * matrix, heap and borrowed ones are stolen. m is left an empty 0×0 matrix. This matrix must
+ * hold nothing to free
+ * @param m the matrix to take from
  */
-float &Matrix::operator[](const int k) const
+void Matrix::_takeOver(Matrix &m) noexcept
 {
-    if (k >= _rows * _cols || k < 0)
+    _rows = m._rows;
+    _cols = m._cols;
+    _owner = m._owner;
+    if (m._mat == m._inline)
     {
-        std::cerr << ACCESS_ERROR << std::endl;
-        std::exit(1);
+        std::copy(m._inline, m._inline + _rows * _cols, _inline);
+        _mat = _inline;
     }
-    return _mat[k];
+    else
+    {
+        _mat = m._mat;
+    }
+    m._rows = 0;
+    m._cols = 0;
+    m._mat = m._inline;
+    m._owner = true;
+}
 
+/**
+ * @brief The out of range path of the accessors, kept out of line so the inlined checks stay a
+ * compare and a branch: prints the access error and exits (code 1)
+ */
+void Matrix::_accessError()
+{
+    std::cerr << ACCESS_ERROR << std::endl;
+    std::exit(1);
 }
 
 /**
@@ -346,12 +433,9 @@ std::ifstream &operator>>(std::ifstream &is, Matrix &matrix)
     }
     is.seekg(0, std::ios::beg);
 
-    float f = 0;
-    for (int k = 0; k < (matrix.getRows() * matrix.getCols()); k++)
-    {
-        is.read((char *) (&f), sizeof(float));
-        matrix[k] = f;
-    }
+    matrix._reshape(matrix.getRows(), matrix.getCols());
+    is.read((char *) matrix._mat, (std::streamsize) (matrix.getRows() * matrix.getCols()
+                                                     * sizeof(float)));
 
     return is;
 
@@ -368,9 +452,9 @@ std::ostream &operator<<(std::ostream &os, const Matrix &matrix)
 {
     for (int i = 0; i < matrix.getRows(); i++)
     {
-        for (int j = 0; j < matrix.getCols(); j++)
+        for (const float value : matrix.rowSpan(i))
         {
-            if (matrix(i, j) <= 0.1)
+            if (value <= 0.1)
             {
                 os << "  ";
             }
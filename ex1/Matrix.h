@@ -3,8 +3,32 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <cstddef>
 #include <fstream>
 #include <iostream>
+#include <utility>
+
+#include "MatrixExpr.h"
+#include "Span.h"
+
+/**
+ * @brief Bounds checking of Matrix::operator() and Matrix::operator[]: 1 (the default) exits
+ * (code 1) on out of range indices, 0 leaves them unchecked. Kernels don't depend on it, they
+ * go through data(), row() and rowSpan()
+ */
+#ifndef MATRIX_CHECKED_ACCESS
+#define MATRIX_CHECKED_ACCESS 1
+#endif
+
+/**
+ * @brief Matrices of up to this many elements keep them inline, in the Matrix object itself, so
+ * making, copying or reshaping them never touches the heap. The default covers the network's
+ * activations and biases (at most 128 rows); bigger matrices (images, weights) are allocated.
+ * Can be set beforehand (e.g. -DMATRIX_INLINE_CAPACITY=0 to allocate every matrix)
+ */
+#ifndef MATRIX_INLINE_CAPACITY
+#define MATRIX_INLINE_CAPACITY 128
+#endif
 
 /**
  * @struct MatrixDims
@@ -20,7 +44,7 @@ typedef struct MatrixDims
 /**
  * @brief Class representing a matrix object in the program
  */
-class Matrix
+class Matrix : public MatrixExpr<Matrix>
 {
 public:
     /**
@@ -39,6 +63,26 @@ public:
      */
     Matrix(const Matrix &m);
 
+    /**
+     * @brief Constructs matrix by taking over the buffer of m (inline elements are copied). m is
+     * left an empty 0×0 matrix
+     * @param m a matrix about to expire
+     */
+    Matrix(Matrix &&m) noexcept;
+
+    /**
+     * @brief Non-owning rows × cols matrix over existing row-major elements (e.g. weights
+     * mapped from a model file). Nothing is copied and the elements are never freed, so they
+     * must outlive the matrix. Borrowed elements are never written: the first non-const access
+     * (data(), row(), [], (), +=, >> ...) copies them into a buffer of the matrix's own, so
+     * the elements may be read-only memory (e.g. a PROT_READ mapping)
+     * @param data the elements
+     * @param rows rows of the matrix
+     * @param cols cols of the matrix
+     * @return a matrix viewing data
+     */
+    static Matrix borrow(const float *data, int rows, int cols);
+
     /**
      * @brief Destructor
      */
@@ -57,6 +101,93 @@ public:
      */
     int getCols() const;
 
+    /**
+     * @brief stride getter: rows are contiguous, so this is getCols() (see MatrixView)
+     * @return distance (in floats) between consecutive rows
+     */
+    int getStride() const;
+
+    /**
+     * @brief Raw row-major elements, const version
+     * @return pointer to element (0, 0)
+     */
+    const float *data() const;
+
+    /**
+     * @brief Raw row-major elements. Gives borrowed elements a buffer of their own first
+     * @return pointer to element (0, 0)
+     */
+    float *data();
+
+    /**
+     * @brief Raw row, const version. Checked only under MATRIX_CHECKED_ROWS
+     * @param i row
+     * @return pointer to element (i, 0), the getCols() elements of row i follow it
+     */
+    const float *row(const int i) const
+    {
+        _checkRow(i);
+        return _mat + (ptrdiff_t) i * _cols;
+    }
+
+    /**
+     * @brief Raw row. Checked only under MATRIX_CHECKED_ROWS. Gives borrowed elements a buffer
+     * of their own first
+     * @param i row
+     * @return pointer to element (i, 0), the getCols() elements of row i follow it
+     */
+    float *row(const int i)
+    {
+        _checkRow(i);
+        _own();
+        return _mat + (ptrdiff_t) i * _cols;
+    }
+
+    /**
+     * @brief Row i as a span, const version. Checked only under MATRIX_CHECKED_ROWS
+     * @param i row
+     * @return the getCols() elements of row i
+     */
+    Span<const float> rowSpan(const int i) const
+    {
+        return Span<const float>(row(i), _cols);
+    }
+
+    /**
+     * @brief Row i as a span. Checked only under MATRIX_CHECKED_ROWS
+     * @param i row
+     * @return the getCols() elements of row i
+     */
+    Span<float> rowSpan(const int i)
+    {
+        return Span<float>(row(i), _cols);
+    }
+
+    /**
+     * @brief All the elements as a span, const version
+     * @return the getRows() * getCols() elements, row-major
+     */
+    Span<const float> elements() const
+    {
+        return Span<const float>(_mat, _rows * _cols);
+    }
+
+    /**
+     * @brief All the elements as a span
+     * @return the getRows() * getCols() elements, row-major
+     */
+    Span<float> elements()
+    {
+        _own();
+        return Span<float>(_mat, _rows * _cols);
+    }
+
+    /**
+     * @brief ownership getter
+     * @return false if the elements are borrowed (see borrow())
+     */
+    bool ownsData() const;
+
     /**
      * @brief Transforms a matrix into a column vector. Supports function calling concatenation
      * @return a ref to a vectorized object
@@ -77,76 +208,157 @@ public:
     Matrix &operator=(const Matrix &other);
 
     /**
-     * @brief Implementation of the * operator (override). act as Matrix multiplication.
-     * this * other
+     * @brief Move assignment: takes over the buffer of other, which gets the old buffer of this
+     * @param other a matrix about to expire
+     * @return a ref to this matrix
+     */
+    Matrix &operator=(Matrix &&other) noexcept;
+
+    /**
+     * @brief Exchanges the content (dims and buffer) of this and other. Heap buffers are swapped
+     * without copying, inline elements are copied
      * @param other the other matrix
-     * @return a ref to result
      */
-    Matrix operator*(const Matrix &other) const;
+    void swap(Matrix &other) noexcept;
+
+    /**
+     * @brief Exchanges the content of two matrices, heap buffers without copying
+     * @param left a matrix
+     * @param right a matrix
+     */
+    friend void swap(Matrix &left, Matrix &right) noexcept;
 
+    /**
+     * @brief Constructs matrix by evaluating an expression (see MatrixExpr.h) straight into the
+     * new buffer
+     * @param expr e.g. W * x + b
+     */
+    template <typename E>
+    Matrix(const MatrixExpr<E> &expr);
+
+    /**
+     * @brief Evaluates an expression into this matrix. The buffer is reused when the element
+     * count matches; if the expression reads this matrix where it would be overwritten (as a
+     * product operand, through a view) or freed (by a new buffer) it is evaluated into a
+     * temporary first
+     * @param expr e.g. W * x + b
+     * @return a ref to this matrix
+     */
+    template <typename E>
+    Matrix &operator=(const MatrixExpr<E> &expr);
 
     /**
-     * @brief Implementation of the * operator (override). act as scalar multiplication from the
-     * right
-     * this  * scalar
+     * @brief scalar multiplication from the right of a temporary. Reuses its buffer
+     * @param left a matrix about to expire
      * @param c a scalar
-     * @return a ref to the result
+     * @return the result (left's buffer)
      */
-    Matrix operator*(float c) const;
+    friend Matrix operator*(Matrix &&left, float c);
 
     /**
-     * @brief Implementation of the * operator. act as scalar multiplication from the left
-     * @param left a const float (scalar)
-     * @param right our matrix
-     * @return a ref to the result
+     * @brief scalar multiplication from the left of a temporary. Reuses its buffer
+     * @param left a scalar
+     * @param right a matrix about to expire
+     * @return the result (right's buffer)
      */
-    friend Matrix operator*(float left, const Matrix &right);
+    friend Matrix operator*(float left, Matrix &&right);
 
+    /**
+     * @brief Matrix + operator with two temporaries. Reuses the buffer of left
+     * @param left a matrix about to expire
+     * @param right a matrix about to expire
+     * @return the result (left's buffer)
+     */
+    friend Matrix operator+(Matrix &&left, Matrix &&right);
 
     /**
-     * @brief Matrix + operator
-     * @param other a matrix to add
-     * @return a ref to the result
+     * @brief Matrix * operator with two temporaries, evaluated at once (a lazy product would
+     * reference them after they expire)
+     * @param left a matrix about to expire
+     * @param right a matrix about to expire, with as many rows as left has cols
+     * @return the product
      */
-    Matrix operator+(const Matrix &other) const;
+    friend Matrix operator*(Matrix &&left, Matrix &&right);
 
     /**
-     * @brief Matrix += operator
+     * @brief Matrix += operator. Adds in place, no new buffer
      * @param other a matrix to add
      * @return a ref to the result (this)
      */
     Matrix &operator+=(const Matrix &other);
 
     /**
-     * @brief Matrix () operator
+     * @brief Matrix += operator for an expression, evaluated straight into this matrix
+     * @param expr an expression of the same size
+     * @return a ref to the result (this)
+     */
+    template <typename E>
+    Matrix &operator+=(const MatrixExpr<E> &expr);
+
+    /**
+     * @brief Matrix () operator. Exits (code 1) on an index outside the matrix under
+     * MATRIX_CHECKED_ACCESS (the default)
      * @param i rows
      * @param j cols
      * @return matrix[i][j]
      */
-    float operator()(int i, int j) const;
+    float operator()(const int i, const int j) const
+    {
+        if (MATRIX_CHECKED_ACCESS && (i >= _rows || j >= _cols || i < 0 || j < 0))
+        {
+            _accessError();
+        }
+        return _mat[i * _cols + j];
+    }
 
     /**
-    * @brief Matrix () operator
+    * @brief Matrix () operator. Exits (code 1) on an index outside the matrix under
+    * MATRIX_CHECKED_ACCESS (the default)
     * @param i rows
     * @param j cols
     * @return matrix[i][j]
     */
-    float &operator()(int i, int j);
+    float &operator()(const int i, const int j)
+    {
+        if (MATRIX_CHECKED_ACCESS && (i >= _rows || j >= _cols || i < 0 || j < 0))
+        {
+            _accessError();
+        }
+        _own();
+        return _mat[i * _cols + j];
+    }
 
 
     /**
-     * @brief Matrix [] operator const version
+     * @brief Matrix [] operator const version. Exits (code 1) on an index outside the matrix
+     * under MATRIX_CHECKED_ACCESS (the default)
      * @param k
      * @return matrix[i][j] == matrix[i*cols + j];
      */
-    float &operator[](int k) const;
+    const float &operator[](const int k) const
+    {
+        if (MATRIX_CHECKED_ACCESS && (k >= _rows * _cols || k < 0))
+        {
+            _accessError();
+        }
+        return _mat[k];
+    }
 
     /**
-     * @brief Matrix [] operator
+     * @brief Matrix [] operator. Exits (code 1) on an index outside the matrix under
+     * MATRIX_CHECKED_ACCESS (the default)
      * @param k
      * @return matrix[i][j] == matrix[i*cols + j];
      */
-    float &operator[](int k);
+    float &operator[](const int k)
+    {
+        if (MATRIX_CHECKED_ACCESS && (k >= _rows * _cols || k < 0))
+        {
+            _accessError();
+        }
+        _own();
+        return _mat[k];
+    }
 
 
     /**
@@ -163,12 +375,340 @@ public:
      */
     friend std::ostream &operator<<(std::ostream &os, const Matrix &matrix);
 
+    // ------------------------- expression template protocol (see MatrixExpr.h) -------------
+
+    static constexpr bool isLeaf = true;
+    static constexpr bool isElementwise = true;
+
+    /**
+     * @brief element k, unchecked
+     */
+    float coeff(int k) const
+    {
+        return _mat[k];
+    }
+
+    /**
+     * @brief whether any element of this matrix is in [first, last)
+     */
+    bool reads(const float *first, const float *last) const
+    {
+        return _rows * _cols > 0 && _mat < last && first < _mat + _rows * _cols;
+    }
+
+    /**
+     * @brief a plain matrix is only read at the index being written, no hazard when it is the
+     * destination itself. Elements borrowed from inside the destination at an offset are one
+     */
+    bool aliases(const float *first, const float *last) const
+    {
+        return _mat != first && reads(first, last);
+    }
+
+    /**
+     * @brief dst = this
+     */
+    void assignTo(Matrix &dst) const;
+
+    /**
+     * @brief dst += this
+     */
+    void addTo(Matrix &dst) const;
+
 private:
     int _rows;
     int _cols;
     float *_mat;
+    bool _owner;
+    float _inline[MATRIX_INLINE_CAPACITY > 0 ? MATRIX_INLINE_CAPACITY : 1];
+
+    /**
+     * @brief Constructs a matrix around an existing buffer
+     * @param data the elements
+     * @param rows rows of the matrix
+     * @param cols cols of the matrix
+     * @param owner whether the matrix frees data
+     */
+    Matrix(float *data, int rows, int cols, bool owner);
+
+    /**
+     * @brief Changes the dims, reallocating only if the element count changes or the elements
+     * are borrowed. Content is undefined afterwards
+     * @param rows new rows
+     * @param cols new cols
+     */
+    void _reshape(int rows, int cols);
+
+    /**
+     * @brief A buffer of this matrix for count elements (uninitialized): the inline one up to
+     * MATRIX_INLINE_CAPACITY, else a new heap block
+     * @param count number of elements
+     * @return the buffer
+     */
+    float *_buffer(const int count)
+    {
+        return count <= MATRIX_INLINE_CAPACITY ? _inline : new float[count];
+    }
+
+    /**
+     * @brief Frees the elements if they are on the heap and owned
+     */
+    void _release() noexcept;
+
+    /**
+     * @brief Before a write: gives borrowed elements a buffer of the matrix's own
+     */
+    void _own()
+    {
+        if (!_owner)
+        {
+            _detach();
+        }
+    }
+
+    /**
+     * @brief The copy of _own(), out of line
+     */
+    void _detach();
+
+    /**
+     * @brief Takes over the content of m, whose elements are copied if they are inline and
+     * stolen otherwise. m is left an empty 0×0 matrix. This matrix must hold nothing to free
+     * @param m the matrix to take from
+     */
+    void _takeOver(Matrix &m) noexcept;
+
+    /**
+     * @brief Exits (code 1) if row i isn't in the matrix, under MATRIX_CHECKED_ROWS
+     * @param i row
+     */
+    void _checkRow(const int i) const
+    {
+        if (MATRIX_CHECKED_ROWS && (i < 0 || i >= _rows))
+        {
+            _accessError();
+        }
+    }
+
+    /**
+     * @brief The out of range path of the accessors, kept out of line so the inlined checks
+     * stay a compare and a branch: prints the access error and exits (code 1)
+     */
+    [[noreturn]] static void _accessError();
+
+    // the element accessors of the expressions report errors like the matrix ones
+    template <typename E>
+    friend class MatrixExpr;
 
 };
 
+/**
+ * @brief Constructs matrix by evaluating an expression straight into the new buffer
+ */
+template <typename E>
+Matrix::Matrix(const MatrixExpr<E> &expr) :
+        _rows(expr.self().getRows()), _cols(expr.self().getCols()),
+        _mat(_buffer(_rows * _cols)), _owner(true)
+{
+    expr.self().assignTo(*this);
+}
+
+/**
+ * @brief Evaluates an expression into this matrix
+ */
+template <typename E>
+Matrix &Matrix::operator=(const MatrixExpr<E> &expr)
+{
+    const E &value = expr.self();
+
+    // _reshape() frees the elements (or leaves borrowed ones for a new buffer) when the count
+    // changes or they are borrowed: the expression must not read any of them then
+    const float *last = _mat + _rows * _cols;
+    const bool reallocates = !_owner || value.getRows() * value.getCols() != _rows * _cols;
+    if (value.aliases(_mat, last) || (reallocates && value.reads(_mat, last)))
+    {
+        Matrix result(value);
+        swap(result);
+        return *this;
+    }
+
+    _reshape(value.getRows(), value.getCols());
+    value.assignTo(*this);
+    return *this;
+}
+
+/**
+ * @brief Matrix += operator for an expression, evaluated straight into this matrix
+ */
+template <typename E>
+Matrix &Matrix::operator+=(const MatrixExpr<E> &expr)
+{
+    const E &value = expr.self();
+
+    // must assure when adding matrices
+    if (_cols != value.getCols() || _rows != value.getRows())
+    {
+        std::cerr << ADD_ERROR << std::endl;
+        std::exit(1);
+    }
+
+    if (value.aliases(_mat, _mat + _rows * _cols))
+    {
+        const Matrix result(value);
+        return *this += result;
+    }
+
+    value.addTo(*this);
+    return *this;
+}
+
+/**
+ * @brief Evaluates the expression into a new Matrix
+ */
+template <typename E>
+Matrix MatrixExpr<E>::eval() const
+{
+    return Matrix(self());
+}
+
+/**
+ * @brief Element (i, j) of the result
+ */
+template <typename E>
+float MatrixExpr<E>::operator()(const int i, const int j) const
+{
+    const E &value = self();
+    if (MATRIX_CHECKED_ACCESS && (i >= value.getRows() || j >= value.getCols() || i < 0 ||
+                                  j < 0))
+    {
+        Matrix::_accessError();
+    }
+    return _at(i * value.getCols() + j, std::integral_constant<bool, E::isElementwise>());
+}
+
+/**
+ * @brief Element k of the result, row-major
+ */
+template <typename E>
+float MatrixExpr<E>::operator[](const int k) const
+{
+    const E &value = self();
+    if (MATRIX_CHECKED_ACCESS && (k >= value.getRows() * value.getCols() || k < 0))
+    {
+        Matrix::_accessError();
+    }
+    return _at(k, std::integral_constant<bool, E::isElementwise>());
+}
+
+/**
+ * @brief The result as a column vector
+ */
+template <typename E>
+Matrix MatrixExpr<E>::vectorize() const
+{
+    Matrix result(self());
+    result.vectorize();
+    return result;
+}
+
+/**
+ * @brief Matrix::plainPrint() of the result
+ */
+template <typename E>
+void MatrixExpr<E>::plainPrint() const
+{
+    eval().plainPrint();
+}
+
+/**
+ * @brief element k of an elementwise expression, computed alone
+ */
+template <typename E>
+float MatrixExpr<E>::_at(const int k, std::true_type) const
+{
+    return self().coeff(k);
+}
+
+/**
+ * @brief element k of a product or transpose, from the evaluated result
+ */
+template <typename E>
+float MatrixExpr<E>::_at(const int k, std::false_type) const
+{
+    return eval().data()[k];
+}
+
+/**
+ * @brief send the evaluated expression to os (see the Matrix operator<<)
+ * @param os a stream
+ * @param expr an expression
+ * @return a ref for an ostream
+ */
+template <typename E>
+std::ostream &operator<<(std::ostream &os, const MatrixExpr<E> &expr)
+{
+    return os << expr.eval();
+}
+
+/**
+ * @brief Matrix * operator with a temporary left operand, evaluated at once (a lazy product
+ * would reference it after it expires)
+ * @param left a matrix about to expire
+ * @param right an expression with as many rows as left has cols
+ * @return the product
+ */
+template <typename R>
+Matrix operator*(Matrix &&left, const MatrixExpr<R> &right)
+{
+    const Matrix &operand = left;
+    return Matrix(operand * right);
+}
+
+/**
+ * @brief Matrix * operator with a temporary right operand, evaluated at once
+ * @param left an expression
+ * @param right a matrix about to expire, with as many rows as left has cols
+ * @return the product
+ */
+template <typename L>
+Matrix operator*(const MatrixExpr<L> &left, Matrix &&right)
+{
+    const Matrix &operand = right;
+    return Matrix(left * operand);
+}
+
+/**
+ * @brief Transpose of a temporary, evaluated at once
+ * @param matrix a matrix about to expire
+ * @return matrix^T
+ */
+Matrix transpose(Matrix &&matrix);
+
+/**
+ * @brief Matrix + operator with a temporary left operand: right is added into its buffer
+ * @param left a matrix about to expire
+ * @param right an expression of the same size
+ * @return the result (left's buffer)
+ */
+template <typename R>
+Matrix operator+(Matrix &&left, const MatrixExpr<R> &right)
+{
+    left += right;
+    return std::move(left);
+}
+
+/**
+ * @brief Matrix + operator with a temporary right operand: left is added into its buffer
+ * @param left an expression of the same size
+ * @param right a matrix about to expire
+ * @return the result (right's buffer)
+ */
+template <typename L>
+Matrix operator+(const MatrixExpr<L> &left, Matrix &&right)
+{
+    right += left;
+    return std::move(right);
+}
+
 #endif //MATRIX_H
 
@@ -0,0 +1,622 @@
+//MatrixExpr.h
+#ifndef MATRIXEXPR_H
+#define MATRIXEXPR_H
+
+#include <cstdlib>
+#include <iostream>
+#include <type_traits>
+
+#include "Gemm.h"
+#include "Simd.h"
+#include "Transpose.h"
+
+#define MULTIPLY_ERROR "Please validate your matrices size"
+#define ADD_ERROR "Please validate your matrices size - must be same size"
+
+class Matrix;
+
+/*
+ * Lazy Matrix arithmetic. a + b, a * b, c * a and a * c don't compute anything: they return a
+ * small node that remembers the operands. The whole tree is evaluated when it is assigned to a
+ * Matrix (construction, operator=, operator+=) or through eval(), straight into the
+ * destination:
+ *  - elementwise trees (sums and scalings) run as one fused loop,
+ *  - W * x + b initializes the destination with b and lets gemm()/gemv() accumulate W * x on top,
+ *  - transpose(a) is only materialized (by transposeMatrix()) when it is assigned: as a product
+ *    operand, transpose(a) * b and a * transpose(b) read a and b in place (gemm() with
+ *    GemmTransposed operands).
+ *
+ * Every expression type E (Matrix included) provides:
+ *  - isLeaf, isElementwise (static constexpr bool), getRows(), getCols()
+ *  - data(), getStride(): the elements and the distance between their rows (only leaves)
+ *  - coeff(k): element k of the result (only when isElementwise)
+ *  - assignTo(dst) / addTo(dst): dst = E / dst += E, dst already has the right dims
+ *  - reads(first, last): whether evaluation reads any element in [first, last). It must report
+ *    every overlap, not only a shared first element: Matrix::operator= lets _reshape() free or
+ *    replace the destination's buffer before evaluating, unless this says the expression reads it
+ *  - aliases(first, last): whether evaluating into [first, last) would overwrite an operand
+ *    before it is read (products and transposes read other indices than the one being written,
+ *    views and offset leaves other elements)
+ *
+ * Nodes hold Matrix leaves by reference and everything else (views, nested nodes) by value, so
+ * an expression kept in an auto variable stays valid as long as the matrices it names. A
+ * temporary Matrix operand is never referenced: a + tmp, tmp * b, transpose(tmp) etc. are
+ * evaluated at once into a Matrix (see the Matrix && overloads in Matrix.h).
+ *
+ * Nodes can also be used like the Matrix they evaluate to: (i, j), [k], plainPrint(),
+ * vectorize() and << work on them directly.
+ */
+
+/**
+ * @brief How a node stores an operand: matrices by reference, views and nested nodes by value
+ */
+template <typename E>
+struct ExprStorage
+{
+    typedef typename std::conditional<std::is_same<E, Matrix>::value, const E &, const E>::type
+            type;
+};
+
+/**
+ * @brief CRTP base of every Matrix expression, Matrix included
+ */
+template <typename E>
+class MatrixExpr
+{
+public:
+    /**
+     * @brief the concrete expression
+     * @return ref to this as E
+     */
+    const E &self() const
+    {
+        return static_cast<const E &>(*this);
+    }
+
+    /**
+     * @brief Evaluates the expression into a new Matrix
+     * @return the result
+     */
+    Matrix eval() const;
+
+    /**
+     * @brief Element (i, j) of the result. Elementwise expressions compute that element alone,
+     * the others are evaluated first. Exits (code 1) on an index outside the result under
+     * MATRIX_CHECKED_ACCESS (the default)
+     * @param i row
+     * @param j col
+     * @return result[i][j]
+     */
+    float operator()(int i, int j) const;
+
+    /**
+     * @brief Element k of the result, row-major (see operator()(i, j))
+     * @param k index
+     * @return result[i][j] == result[i*cols + j]
+     */
+    float operator[](int k) const;
+
+    /**
+     * @brief The result as a column vector (Matrix::vectorize() of eval())
+     * @return the evaluated getRows() * getCols() × 1 matrix
+     */
+    Matrix vectorize() const;
+
+    /**
+     * @brief Matrix::plainPrint() of the result
+     */
+    void plainPrint() const;
+
+private:
+    float _at(int k, std::true_type) const;
+
+    float _at(int k, std::false_type) const;
+};
+
+/**
+ * @brief Lazy left + right
+ */
+template <typename L, typename R>
+class MatrixSum : public MatrixExpr<MatrixSum<L, R>>
+{
+public:
+    static constexpr bool isLeaf = false;
+    static constexpr bool isElementwise = L::isElementwise && R::isElementwise;
+
+    /**
+     * @brief Constructor. Exits (code 1) if the operands differ in size
+     * @param left an expression
+     * @param right an expression of the same size
+     */
+    MatrixSum(const L &left, const R &right) : _left(left), _right(right)
+    {
+        // must assure when adding matrices
+        if (left.getRows() != right.getRows() || left.getCols() != right.getCols())
+        {
+            std::cerr << ADD_ERROR << std::endl;
+            std::exit(1);
+        }
+    }
+
+    int getRows() const
+    {
+        return _left.getRows();
+    }
+
+    int getCols() const
+    {
+        return _left.getCols();
+    }
+
+    float coeff(int k) const
+    {
+        return _left.coeff(k) + _right.coeff(k);
+    }
+
+    bool reads(const float *first, const float *last) const
+    {
+        return _left.reads(first, last) || _right.reads(first, last);
+    }
+
+    bool aliases(const float *first, const float *last) const
+    {
+        return _left.aliases(first, last) || _right.aliases(first, last);
+    }
+
+    template <typename Dst>
+    void assignTo(Dst &dst) const
+    {
+        _assignTo(dst, std::integral_constant<bool, isElementwise>());
+    }
+
+    template <typename Dst>
+    void addTo(Dst &dst) const
+    {
+        _addTo(dst, std::integral_constant<bool, isElementwise>());
+    }
+
+private:
+    typename ExprStorage<L>::type _left;
+    typename ExprStorage<R>::type _right;
+
+    /**
+     * @brief single fused loop
+     */
+    template <typename Dst>
+    void _assignTo(Dst &dst, std::true_type) const
+    {
+        float *out = dst.data();
+        const int size = getRows() * getCols();
+        for (int k = 0; k < size; k++)
+        {
+            out[k] = coeff(k);
+        }
+    }
+
+    /**
+     * @brief at least one side is a product: the elementwise side (if any) initializes dst and
+     * the product accumulates on top of it
+     */
+    template <typename Dst>
+    void _assignTo(Dst &dst, std::false_type) const
+    {
+        _initThenAccumulate(dst, std::integral_constant<bool, R::isElementwise>());
+    }
+
+    template <typename Dst>
+    void _initThenAccumulate(Dst &dst, std::true_type) const
+    {
+        _right.assignTo(dst);
+        _left.addTo(dst);
+    }
+
+    template <typename Dst>
+    void _initThenAccumulate(Dst &dst, std::false_type) const
+    {
+        _left.assignTo(dst);
+        _right.addTo(dst);
+    }
+
+    template <typename Dst>
+    void _addTo(Dst &dst, std::true_type) const
+    {
+        float *out = dst.data();
+        const int size = getRows() * getCols();
+        for (int k = 0; k < size; k++)
+        {
+            out[k] += coeff(k);
+        }
+    }
+
+    template <typename Dst>
+    void _addTo(Dst &dst, std::false_type) const
+    {
+        _left.addTo(dst);
+        _right.addTo(dst);
+    }
+};
+
+/**
+ * @brief Lazy scalar * inner
+ */
+template <typename E>
+class MatrixScale : public MatrixExpr<MatrixScale<E>>
+{
+public:
+    static constexpr bool isLeaf = false;
+    static constexpr bool isElementwise = E::isElementwise;
+
+    /**
+     * @brief Constructor
+     * @param inner an expression
+     * @param scalar the factor
+     */
+    MatrixScale(const E &inner, float scalar) : _inner(inner), _scalar(scalar)
+    {
+    }
+
+    int getRows() const
+    {
+        return _inner.getRows();
+    }
+
+    int getCols() const
+    {
+        return _inner.getCols();
+    }
+
+    float coeff(int k) const
+    {
+        return _scalar * _inner.coeff(k);
+    }
+
+    bool reads(const float *first, const float *last) const
+    {
+        return _inner.reads(first, last);
+    }
+
+    bool aliases(const float *first, const float *last) const
+    {
+        return _inner.aliases(first, last);
+    }
+
+    template <typename Dst>
+    void assignTo(Dst &dst) const
+    {
+        _assignTo(dst, std::integral_constant<bool, isElementwise>());
+    }
+
+    template <typename Dst>
+    void addTo(Dst &dst) const
+    {
+        _addTo(dst, std::integral_constant<bool, isElementwise>());
+    }
+
+private:
+    typename ExprStorage<E>::type _inner;
+    float _scalar;
+
+    template <typename Dst>
+    void _assignTo(Dst &dst, std::true_type) const
+    {
+        float *out = dst.data();
+        const int size = getRows() * getCols();
+        for (int k = 0; k < size; k++)
+        {
+            out[k] = coeff(k);
+        }
+    }
+
+    template <typename Dst>
+    void _assignTo(Dst &dst, std::false_type) const
+    {
+        _inner.assignTo(dst);
+        simdKernels().scale(dst.data(), dst.data(), _scalar, getRows() * getCols());
+    }
+
+    template <typename Dst>
+    void _addTo(Dst &dst, std::true_type) const
+    {
+        float *out = dst.data();
+        const int size = getRows() * getCols();
+        for (int k = 0; k < size; k++)
+        {
+            out[k] += coeff(k);
+        }
+    }
+
+    template <typename Dst>
+    void _addTo(Dst &dst, std::false_type) const
+    {
+        const Dst inner(_inner);
+        const float *in = inner.data();
+        float *out = dst.data();
+        const int size = getRows() * getCols();
+        for (int k = 0; k < size; k++)
+        {
+            out[k] += _scalar * in[k];
+        }
+    }
+};
+
+/**
+ * @brief Lazy transpose of inner
+ */
+template <typename E>
+class MatrixTransposed : public MatrixExpr<MatrixTransposed<E>>
+{
+public:
+    static constexpr bool isLeaf = false;
+    static constexpr bool isElementwise = false;
+
+    /**
+     * @brief Constructor
+     * @param inner an expression
+     */
+    explicit MatrixTransposed(const E &inner) : _inner(inner)
+    {
+    }
+
+    int getRows() const
+    {
+        return _inner.getCols();
+    }
+
+    int getCols() const
+    {
+        return _inner.getRows();
+    }
+
+    /**
+     * @brief the expression being transposed
+     */
+    const E &inner() const
+    {
+        return _inner;
+    }
+
+    bool reads(const float *first, const float *last) const
+    {
+        return _inner.reads(first, last);
+    }
+
+    /**
+     * @brief element (i, j) comes from (j, i): any read operand is a hazard
+     */
+    bool aliases(const float *first, const float *last) const
+    {
+        return reads(first, last);
+    }
+
+    template <typename Dst>
+    void assignTo(Dst &dst) const
+    {
+        _assignTo(dst, std::integral_constant<bool, E::isLeaf>());
+    }
+
+    template <typename Dst>
+    void addTo(Dst &dst) const
+    {
+        const Dst transposed(*this);
+        simdKernels().add(dst.data(), dst.data(), transposed.data(), getRows() * getCols());
+    }
+
+private:
+    typename ExprStorage<E>::type _inner;
+
+    template <typename Dst>
+    void _assignTo(Dst &dst, std::true_type) const
+    {
+        transposeMatrix(_inner.getRows(), _inner.getCols(), _inner.data(), _inner.getStride(),
+                        dst.data(), dst.getStride());
+    }
+
+    template <typename Dst>
+    void _assignTo(Dst &dst, std::false_type) const
+    {
+        const Dst inner(_inner);
+        transposeMatrix(inner.getRows(), inner.getCols(), inner.data(), inner.getStride(),
+                        dst.data(), dst.getStride());
+    }
+};
+
+/**
+ * @brief How MatrixProduct reads an operand: the expression itself, stored as is
+ */
+template <typename E>
+struct ProductOperand
+{
+    typedef E Source;
+    static constexpr GemmOperand layout = GemmPlain;
+
+    static const E &source(const E &operand)
+    {
+        return operand;
+    }
+};
+
+/**
+ * @brief How MatrixProduct reads an operand: a transposed one is its inner expression, read
+ * transposed by gemm()
+ */
+template <typename E>
+struct ProductOperand<MatrixTransposed<E>>
+{
+    typedef E Source;
+    static constexpr GemmOperand layout = GemmTransposed;
+
+    static const E &source(const MatrixTransposed<E> &operand)
+    {
+        return operand.inner();
+    }
+};
+
+/**
+ * @brief Lazy left * right (matrix multiplication). Evaluated by gemm(), which accumulates
+ * directly into the destination. Operands that are expressions themselves are evaluated into a
+ * temporary first, transposed ones (transpose(a)) are read transposed instead.
+ */
+template <typename L, typename R>
+class MatrixProduct : public MatrixExpr<MatrixProduct<L, R>>
+{
+public:
+    static constexpr bool isLeaf = false;
+    static constexpr bool isElementwise = false;
+
+    /**
+     * @brief Constructor. Exits (code 1) if left's cols don't match right's rows
+     * @param left an expression
+     * @param right an expression
+     */
+    MatrixProduct(const L &left, const R &right) : _left(left), _right(right)
+    {
+        // must assure when multiplying matrices
+        if (left.getCols() != right.getRows())
+        {
+            std::cerr << MULTIPLY_ERROR << std::endl;
+            std::exit(1);
+        }
+    }
+
+    int getRows() const
+    {
+        return _left.getRows();
+    }
+
+    int getCols() const
+    {
+        return _right.getCols();
+    }
+
+    bool reads(const float *first, const float *last) const
+    {
+        return _left.reads(first, last) || _right.reads(first, last);
+    }
+
+    bool aliases(const float *first, const float *last) const
+    {
+        return reads(first, last);
+    }
+
+    template <typename Dst>
+    void assignTo(Dst &dst) const
+    {
+        _withLeft(dst, false, std::integral_constant<bool, LeftSource::isLeaf>());
+    }
+
+    template <typename Dst>
+    void addTo(Dst &dst) const
+    {
+        _withLeft(dst, true, std::integral_constant<bool, LeftSource::isLeaf>());
+    }
+
+private:
+    typedef typename ProductOperand<L>::Source LeftSource;
+    typedef typename ProductOperand<R>::Source RightSource;
+
+    typename ExprStorage<L>::type _left;
+    typename ExprStorage<R>::type _right;
+
+    template <typename Dst>
+    void _withLeft(Dst &dst, bool accumulate, std::true_type) const
+    {
+        const LeftSource &left = ProductOperand<L>::source(_left);
+        _withRight(dst, accumulate, left.data(), left.getStride(),
+                   std::integral_constant<bool, RightSource::isLeaf>());
+    }
+
+    template <typename Dst>
+    void _withLeft(Dst &dst, bool accumulate, std::false_type) const
+    {
+        const Dst left(ProductOperand<L>::source(_left));
+        _withRight(dst, accumulate, left.data(), left.getStride(),
+                   std::integral_constant<bool, RightSource::isLeaf>());
+    }
+
+    template <typename Dst>
+    void _withRight(Dst &dst, bool accumulate, const float *left, int lda, std::true_type) const
+    {
+        const RightSource &right = ProductOperand<R>::source(_right);
+        _run(dst, accumulate, left, lda, right.data(), right.getStride());
+    }
+
+    template <typename Dst>
+    void _withRight(Dst &dst, bool accumulate, const float *left, int lda,
+                    std::false_type) const
+    {
+        const Dst right(ProductOperand<R>::source(_right));
+        _run(dst, accumulate, left, lda, right.data(), right.getStride());
+    }
+
+    template <typename Dst>
+    void _run(Dst &dst, bool accumulate, const float *left, int lda, const float *right,
+              int ldb) const
+    {
+        const int m = getRows();
+        const int n = getCols();
+        const int k = _left.getCols();
+        gemm(ProductOperand<L>::layout, ProductOperand<R>::layout, m, n, k, left, lda, right, ldb,
+             dst.data(), n, accumulate);
+    }
+};
+
+/**
+ * @brief Lazy Matrix + operator
+ * @param left an expression
+ * @param right an expression of the same size
+ * @return node representing left + right
+ */
+template <typename L, typename R>
+MatrixSum<L, R> operator+(const MatrixExpr<L> &left, const MatrixExpr<R> &right)
+{
+    return MatrixSum<L, R>(left.self(), right.self());
+}
+
+/**
+ * @brief Lazy Matrix * operator, act as Matrix multiplication
+ * @param left an expression
+ * @param right an expression with as many rows as left has cols
+ * @return node representing left * right
+ */
+template <typename L, typename R>
+MatrixProduct<L, R> operator*(const MatrixExpr<L> &left, const MatrixExpr<R> &right)
+{
+    return MatrixProduct<L, R>(left.self(), right.self());
+}
+
+/**
+ * @brief Lazy transpose
+ * @param expr an expression
+ * @return node representing expr^T, rows and cols swapped
+ */
+template <typename E>
+MatrixTransposed<E> transpose(const MatrixExpr<E> &expr)
+{
+    return MatrixTransposed<E>(expr.self());
+}
+
+/**
+ * @brief Lazy scalar multiplication from the right
+ * @param left an expression
+ * @param c a scalar
+ * @return node representing left * c
+ */
+template <typename E>
+MatrixScale<E> operator*(const MatrixExpr<E> &left, float c)
+{
+    return MatrixScale<E>(left.self(), c);
+}
+
+/**
+ * @brief Lazy scalar multiplication from the left
+ * @param c a scalar
+ * @param right an expression
+ * @return node representing c * right
+ */
+template <typename E>
+MatrixScale<E> operator*(float c, const MatrixExpr<E> &right)
+{
+    return MatrixScale<E>(right.self(), c);
+}
+
+#endif //MATRIXEXPR_H
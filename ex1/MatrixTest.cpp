@@ -0,0 +1,806 @@
+//
+// Created by user on 18/01/2020.
+//
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "AlignedBuffer.h"
+#include "Gemm.h"
+#include "GemmHalf.h"
+#include "GemmInt8.h"
+#include "HalfMatrix.h"
+#include "Matrix.h"
+#include "MatrixView.h"
+#include "QuantizedMatrix.h"
+#include "Simd.h"
+#include "Softmax.h"
+
+#define USAGE_MSG "Usage:\n" \
+                  "\t./matrix_test\n" \
+                  "\tchecks the kernels and Matrix on the instruction set MLP_SIMD caps"
+#define TEST_SEED 2020
+#define GEMM_TEST_ROUNDS 300
+#define EXP_TEST_SAMPLES 100000
+
+// sizes the random products pick their dims from: edge tiles of every micro-kernel, more rows
+// than a GEMM_MC block, a deeper k than GEMM_KC
+const int gemmTestDims[] = {1, 2, 3, 7, 16, 17, 33, 64, 150, 300};
+
+// extra floats between the rows of an operand, so strides aren't always the row length
+const int gemmTestPads[] = {0, 0, 1, 5, 16};
+
+/**
+ * @brief Checks that failed so far
+ */
+static int failures = 0;
+
+/**
+ * @brief Counts and reports a failed check
+ * @param ok the checked condition
+ * @param what what was checked
+ * @return ok
+ */
+static bool check(const bool ok, const char *what)
+{
+    if (!ok)
+    {
+        failures++;
+        std::cerr << "FAILED: " << what << std::endl;
+    }
+    return ok;
+}
+
+/**
+ * @brief A pseudo random value in [-1, 1]
+ */
+static float randomFloat()
+{
+    return (float) std::rand() / (float) RAND_MAX * 2.0f - 1.0f;
+}
+
+/**
+ * @brief A pseudo random element of a non-empty array
+ */
+template <typename T, size_t N>
+static T randomOf(const T (&values)[N])
+{
+    return values[std::rand() % N];
+}
+
+/**
+ * @brief count pseudo random values in [-1, 1]
+ */
+static std::vector<float> randomFloats(const size_t count)
+{
+    std::vector<float> values(count);
+    for (float &value : values)
+    {
+        value = randomFloat();
+    }
+    return values;
+}
+
+/**
+ * @brief A matrix of pseudo random values in [-1, 1]
+ */
+static Matrix randomMatrix(const int rows, const int cols)
+{
+    Matrix matrix(rows, cols);
+    for (float &value : matrix.elements())
+    {
+        value = randomFloat();
+    }
+    return matrix;
+}
+
+/**
+ * @brief Whether two matrices have the same dims and elements, bit for bit
+ */
+static bool sameMatrix(const Matrix &left, const Matrix &right)
+{
+    return left.getRows() == right.getRows() && left.getCols() == right.getCols() &&
+           std::memcmp(left.data(), right.data(),
+                       (size_t) left.getRows() * left.getCols() * sizeof(float)) == 0;
+}
+
+/**
+ * @brief Whether two matrices have the same dims and elements, up to the rounding of a float
+ * product of depth k: each element within (k + 2) epsilons of the sum of magnitudes it adds up
+ */
+static bool closeMatrix(const Matrix &left, const Matrix &right, const int k)
+{
+    if (left.getRows() != right.getRows() || left.getCols() != right.getCols())
+    {
+        return false;
+    }
+    for (int i = 0; i < left.getRows() * left.getCols(); i++)
+    {
+        if (std::fabs(left[i] - right[i]) > (k + 2) * FLT_EPSILON * (float) (k + 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief left * right by the i-k-j definition, in double
+ */
+static Matrix naiveProduct(const MatrixView &left, const MatrixView &right)
+{
+    Matrix result(left.getRows(), right.getCols());
+    for (int i = 0; i < left.getRows(); i++)
+    {
+        for (int j = 0; j < right.getCols(); j++)
+        {
+            double sum = 0;
+            for (int p = 0; p < left.getCols(); p++)
+            {
+                sum += (double) left(i, p) * right(p, j);
+            }
+            result(i, j) = (float) sum;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief matrix^T by the definition
+ */
+static Matrix naiveTranspose(const MatrixView &matrix)
+{
+    Matrix result(matrix.getCols(), matrix.getRows());
+    for (int i = 0; i < matrix.getRows(); i++)
+    {
+        for (int j = 0; j < matrix.getCols(); j++)
+        {
+            result(j, i) = matrix(i, j);
+        }
+    }
+    return result;
+}
+
+// ------------------------------------------------ gemm ------------------------------------------
+
+/**
+ * @struct GemmCase
+ * @brief A product of gemm()'s full interface: dims, layouts, strides, accumulation, epilogue
+ */
+typedef struct GemmCase
+{
+    int m, n, k;
+    GemmOperand opA, opB;
+    int lda, ldb, ldc;
+    bool accumulate;
+    bool bias;
+    EpilogueActivation activation;
+} GemmCase;
+
+/**
+ * @brief A random GemmCase (dims from gemmTestDims, pads from gemmTestPads)
+ */
+static GemmCase randomGemmCase()
+{
+    GemmCase test;
+    test.m = randomOf(gemmTestDims);
+    test.n = randomOf(gemmTestDims);
+    test.k = randomOf(gemmTestDims);
+    test.opA = std::rand() % 2 ? GemmTransposed : GemmPlain;
+    test.opB = std::rand() % 2 ? GemmTransposed : GemmPlain;
+    test.lda = (test.opA == GemmPlain ? test.k : test.m) + randomOf(gemmTestPads);
+    test.ldb = (test.opB == GemmPlain ? test.n : test.k) + randomOf(gemmTestPads);
+    test.ldc = test.n + randomOf(gemmTestPads);
+    test.accumulate = std::rand() % 2;
+    test.bias = std::rand() % 2;
+    test.activation = std::rand() % 2 ? EpilogueRelu : EpilogueNone;
+    return test;
+}
+
+/**
+ * @brief Element (row, col) of an operand stored as is or transposed
+ */
+static float operandAt(const std::vector<float> &x, const int ld, const GemmOperand op,
+                       const int row, const int col)
+{
+    return op == GemmPlain ? x[(size_t) row * ld + col] : x[(size_t) col * ld + row];
+}
+
+/**
+ * @brief Runs one GemmCase through gemm() and checks every element of C against the definition
+ * in double, within the rounding of its depth. The padding of C must be left alone
+ */
+static void checkGemm(const GemmCase &test)
+{
+    const int aRows = test.opA == GemmPlain ? test.m : test.k;
+    const int bRows = test.opB == GemmPlain ? test.k : test.n;
+    const std::vector<float> a = randomFloats((size_t) aRows * test.lda);
+    const std::vector<float> b = randomFloats((size_t) bRows * test.ldb);
+    const std::vector<float> bias = randomFloats(test.m);
+    const std::vector<float> initial = randomFloats((size_t) test.m * test.ldc);
+    std::vector<float> c = initial;
+
+    const GemmEpilogue epilogue = {test.bias ? bias.data() : nullptr, test.activation};
+    const bool plain = test.opA == GemmPlain && test.opB == GemmPlain;
+    if (plain && std::rand() % 2)
+    {
+        gemm(test.m, test.n, test.k, a.data(), test.lda, b.data(), test.ldb, c.data(), test.ldc,
+             test.accumulate, &epilogue);
+    }
+    else
+    {
+        gemm(test.opA, test.opB, test.m, test.n, test.k, a.data(), test.lda, b.data(), test.ldb,
+             c.data(), test.ldc, test.accumulate, &epilogue);
+    }
+
+    bool ok = true;
+    for (int i = 0; i < test.m && ok; i++)
+    {
+        for (int j = 0; j < test.ldc && ok; j++)
+        {
+            const size_t at = (size_t) i * test.ldc + j;
+            if (j >= test.n)
+            {
+                ok = c[at] == initial[at];
+                continue;
+            }
+            double sum = test.accumulate ? initial[at] : 0.0;
+            double magnitude = std::fabs(sum);
+            for (int p = 0; p < test.k; p++)
+            {
+                const double term = (double) operandAt(a, test.lda, test.opA, i, p) *
+                                    operandAt(b, test.ldb, test.opB, p, j);
+                sum += term;
+                magnitude += std::fabs(term);
+            }
+            if (test.bias)
+            {
+                sum += bias[i];
+                magnitude += std::fabs(bias[i]);
+            }
+            if (test.activation == EpilogueRelu && sum < 0)
+            {
+                sum = 0;
+            }
+            ok = std::fabs(c[at] - sum) <= (test.k + 2) * FLT_EPSILON * magnitude + FLT_MIN;
+        }
+    }
+    if (!ok)
+    {
+        std::cerr << "gemm " << test.m << "x" << test.n << "x" << test.k << " op " << test.opA
+                  << test.opB << " ld " << test.lda << "/" << test.ldb << "/" << test.ldc
+                  << " accumulate " << test.accumulate << " bias " << test.bias
+                  << " activation " << test.activation << std::endl;
+    }
+    check(ok, "gemm() matches the naive product");
+}
+
+/**
+ * @brief Random products over shapes, strides, transposes and epilogues
+ */
+static void testGemm()
+{
+    for (int round = 0; round < GEMM_TEST_ROUNDS; round++)
+    {
+        checkGemm(randomGemmCase());
+    }
+}
+
+/**
+ * @brief gemm() with a gemmPackA() operand gives the same bits as packing on every call, on
+ * blocked products and on small ones (which read a)
+ */
+static void testPackedA()
+{
+    const int shapes[][3] = {{10, 1, 20}, {20, 9, 30}, {128, 64, 784}, {150, 300, 300}};
+    for (const auto &shape : shapes)
+    {
+        const int m = shape[0], n = shape[1], k = shape[2];
+        const std::vector<float> a = randomFloats((size_t) m * k);
+        const std::vector<float> b = randomFloats((size_t) k * n);
+        const std::vector<float> bias = randomFloats(m);
+        AlignedBuffer packed;
+        gemmPackA(m, k, a.data(), k, packed.reserve(gemmPackedSize(m, k)));
+
+        const GemmEpilogue epilogue = {bias.data(), EpilogueRelu};
+        std::vector<float> fresh((size_t) m * n);
+        std::vector<float> prepacked((size_t) m * n);
+        gemm(m, n, k, a.data(), k, b.data(), n, fresh.data(), n, false, &epilogue);
+        gemm(m, n, k, a.data(), k, b.data(), n, prepacked.data(), n, false, &epilogue,
+             packed.data());
+        check(fresh == prepacked, "gemm() with packedA is bit-identical");
+    }
+}
+
+/**
+ * @brief A product split across the pool gives the same bits as on the calling thread alone
+ */
+static void testGemmThreads()
+{
+    const int m = 300, n = 260, k = 300;
+    const std::vector<float> a = randomFloats((size_t) m * k);
+    const std::vector<float> b = randomFloats((size_t) k * n);
+    std::vector<float> serial((size_t) m * n);
+    std::vector<float> parallel((size_t) m * n);
+
+    gemmSetThreads(1);
+    gemm(m, n, k, a.data(), k, b.data(), n, serial.data(), n, false);
+    gemmSetThreads(4);
+    gemm(m, n, k, a.data(), k, b.data(), n, parallel.data(), n, false);
+    gemmSetThreads(0);
+    check(serial == parallel, "threaded gemm() is bit-identical to the serial one");
+}
+
+/**
+ * @brief gemv() against the naive product, with a strided y and an epilogue, and gemm() of a
+ * single contiguous column giving gemv()'s bits
+ */
+static void testGemv()
+{
+    const int shapes[][2] = {{1, 1}, {3, 5}, {10, 20}, {17, 33}, {128, 784}, {150, 300}};
+    for (const auto &shape : shapes)
+    {
+        const int m = shape[0], k = shape[1];
+        const Matrix a = randomMatrix(m, k);
+        const Matrix x = randomMatrix(k, 1);
+        const std::vector<float> bias = randomFloats(m);
+        const Matrix expected = naiveProduct(a, x);
+
+        std::vector<float> y((size_t) m * 3, 7.0f);
+        gemv(m, k, a.data(), k, x.data(), y.data(), 3, false);
+        bool ok = true;
+        for (int i = 0; i < m; i++)
+        {
+            ok = ok && std::fabs(y[(size_t) i * 3] - expected[i]) <= (k + 2) * FLT_EPSILON * k &&
+                 y[(size_t) i * 3 + 1] == 7.0f;
+        }
+        check(ok, "gemv() matches the naive product");
+
+        const GemmEpilogue epilogue = {bias.data(), EpilogueRelu};
+        std::vector<float> byGemv(m);
+        std::vector<float> byGemm(m);
+        gemv(m, k, a.data(), k, x.data(), byGemv.data(), 1, false, &epilogue);
+        gemm(m, 1, k, a.data(), k, x.data(), 1, byGemm.data(), 1, false, &epilogue);
+        check(byGemv == byGemm, "gemm() of one column is gemv()");
+    }
+}
+
+// ------------------------------------------------ softmax ---------------------------------------
+
+/**
+ * @brief softmaxExp() within SOFTMAX_EXP_MAX_ERROR of exp over its whole range
+ */
+static void testSoftmaxExp()
+{
+    double worst = 0;
+    for (int i = 0; i <= EXP_TEST_SAMPLES; i++)
+    {
+        const float x = SOFTMAX_EXP_MIN + (SOFTMAX_EXP_MAX - SOFTMAX_EXP_MIN) * i /
+                                          EXP_TEST_SAMPLES;
+        const double exact = std::exp((double) x);
+        worst = std::fmax(worst, std::fabs(softmaxExp(x) - exact) / exact);
+    }
+    check(worst <= SOFTMAX_EXP_MAX_ERROR, "softmaxExp() within SOFTMAX_EXP_MAX_ERROR");
+}
+
+/**
+ * @brief The SIMD exponentials of softmax() within SOFTMAX_EXP_MAX_ERROR (p_i / p_max is
+ * exp(x_i - max) rounded once more), the probabilities summing to 1, and softmaxTop() giving
+ * softmax()'s class and probability. Single vectors and batches take different kernels
+ */
+static void testSoftmax()
+{
+    const int shapes[][2] = {{10, 1}, {37, 1}, {10, 3}, {10, 16}, {10, 37}};
+    for (const auto &shape : shapes)
+    {
+        const int rows = shape[0], cols = shape[1];
+        std::vector<float> logits = randomFloats((size_t) rows * cols);
+        for (float &logit : logits)
+        {
+            logit *= 20.0f;
+        }
+        std::vector<float> probabilities = logits;
+        softmax(probabilities.data(), rows, cols);
+        std::vector<Digit> top(cols);
+        softmaxTop(logits.data(), rows, cols, top.data());
+
+        bool expOk = true;
+        bool sumOk = true;
+        bool topOk = true;
+        for (int j = 0; j < cols; j++)
+        {
+            int best = 0;
+            for (int i = 1; i < rows; i++)
+            {
+                best = logits[(size_t) i * cols + j] > logits[(size_t) best * cols + j] ? i : best;
+            }
+            const float max = logits[(size_t) best * cols + j];
+            const double pMax = probabilities[(size_t) best * cols + j];
+            double sum = 0;
+            for (int i = 0; i < rows; i++)
+            {
+                const double p = probabilities[(size_t) i * cols + j];
+                const double exact = std::exp((double) (logits[(size_t) i * cols + j] - max));
+                expOk = expOk &&
+                        std::fabs(p / pMax - exact) <= (SOFTMAX_EXP_MAX_ERROR + FLT_EPSILON) * exact;
+                sum += p;
+            }
+            sumOk = sumOk && std::fabs(sum - 1.0) <= SOFTMAX_EXP_MAX_ERROR + (rows + 1) * FLT_EPSILON;
+            topOk = topOk && top[j].value == (unsigned int) best && top[j].probability == pMax;
+        }
+        check(expOk, "softmax() exponentials within SOFTMAX_EXP_MAX_ERROR");
+        check(sumOk, "softmax() probabilities sum to 1");
+        check(topOk, "softmaxTop() gives softmax()'s class and probability");
+    }
+}
+
+// ------------------------------------------------ int8 and 16 bit -------------------------------
+
+/**
+ * @brief Per-row quantization within half a step of every weight, gemmInt8() exact against the
+ * integer definition
+ */
+static void testInt8()
+{
+    const Matrix weights = randomMatrix(20, 100);
+    const QuantizedMatrix quantized = QuantizedMatrix::quantize(weights);
+    const Matrix restored = quantized.dequantize();
+    bool ok = true;
+    for (int i = 0; i < weights.getRows(); i++)
+    {
+        // half a step, and the rounding of w / scale
+        const float halfStep = quantized.scales()[i] * (0.5f + 1e-4f);
+        for (int p = 0; p < weights.getCols(); p++)
+        {
+            ok = ok && std::fabs(weights(i, p) - restored(i, p)) <= halfStep;
+        }
+    }
+    check(ok, "int8 weights within half a quantization step");
+
+    const int m = 19, n = 7, k = 2 * INT8_ROW_ALIGNMENT;
+    const int lda = k + INT8_ROW_ALIGNMENT, ldb = k, ldc = n + 3;
+    std::vector<int8_t> a((size_t) m * lda);
+    std::vector<uint8_t> b((size_t) n * ldb);
+    for (int8_t &value : a)
+    {
+        value = (int8_t) (std::rand() % (2 * INT8_WEIGHT_MAX + 1) - INT8_WEIGHT_MAX);
+    }
+    for (uint8_t &value : b)
+    {
+        value = (uint8_t) (std::rand() % (UINT8_INPUT_MAX + 1));
+    }
+    std::vector<int32_t> c((size_t) m * ldc);
+    gemmInt8(m, n, k, a.data(), lda, b.data(), ldb, c.data(), ldc);
+    ok = true;
+    for (int i = 0; i < m; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            int32_t sum = 0;
+            for (int p = 0; p < k; p++)
+            {
+                sum += (int32_t) a[(size_t) i * lda + p] * b[(size_t) j * ldb + p];
+            }
+            ok = ok && c[(size_t) i * ldc + j] == sum;
+        }
+    }
+    check(ok, "gemmInt8() is exact");
+}
+
+/**
+ * @brief fp16 and bf16 weights within half an ulp of their format, gemmHalf() (gemv and panel
+ * paths) matching the float product of the rounded weights
+ */
+static void testHalf()
+{
+    const HalfFormat formats[] = {HalfFp16, HalfBf16};
+    // half an ulp relative: 10 and 7 bit mantissas
+    const float roundings[] = {1.0f / 2048, 1.0f / 256};
+    for (int f = 0; f < 2; f++)
+    {
+        const Matrix weights = randomMatrix(21, 70);
+        const HalfMatrix half = HalfMatrix::convert(weights, formats[f]);
+        const Matrix rounded = half.toFloat();
+        bool ok = true;
+        for (int i = 0; i < weights.getRows() * weights.getCols(); i++)
+        {
+            ok = ok && (std::fabs(weights[i]) < 1e-4f ||
+                        std::fabs(weights[i] - rounded[i]) <= roundings[f] * std::fabs(weights[i]));
+        }
+        check(ok, "16 bit weights within half an ulp");
+
+        for (const int n : {1, 5})
+        {
+            const Matrix x = randomMatrix(weights.getCols(), n);
+            const Matrix expected = naiveProduct(rounded, x);
+            Matrix result(weights.getRows(), n);
+            gemmHalf(formats[f], weights.getRows(), n, weights.getCols(), half.data(),
+                     half.getStride(), x.data(), n, result.data(), n, false);
+            check(closeMatrix(result, expected, weights.getCols()),
+                  "gemmHalf() matches the float product of the rounded weights");
+        }
+    }
+}
+
+// ------------------------------------------------ Matrix ----------------------------------------
+
+/**
+ * @brief Floats in pages mapped read-only, like the weights of a model file: a write segfaults
+ */
+class ReadOnlyFloats
+{
+public:
+    explicit ReadOnlyFloats(const std::vector<float> &values) :
+            _bytes(values.size() * sizeof(float)),
+            _data(mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                       0))
+    {
+        if (_data == MAP_FAILED)
+        {
+            std::cerr << "mmap failed" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        std::memcpy(_data, values.data(), _bytes);
+        mprotect(_data, _bytes, PROT_READ);
+    }
+
+    ReadOnlyFloats(const ReadOnlyFloats &) = delete;
+    ReadOnlyFloats &operator=(const ReadOnlyFloats &) = delete;
+
+    ~ReadOnlyFloats()
+    {
+        munmap(_data, _bytes);
+    }
+
+    const float *data() const
+    {
+        return static_cast<const float *>(_data);
+    }
+
+private:
+    size_t _bytes;
+    void *_data;
+};
+
+/**
+ * @brief Every write to a matrix borrowing read-only elements goes to a copy of its own; the
+ * mapping (which would fault) and every other borrower keep the original values. Small and
+ * heap sized matrices alike
+ */
+static void testBorrowing()
+{
+    const int shapes[][2] = {{4, 5}, {40, 40}};
+    for (const auto &shape : shapes)
+    {
+        const int rows = shape[0], cols = shape[1];
+        const std::vector<float> values = randomFloats((size_t) rows * cols);
+        const ReadOnlyFloats mapped(values);
+        const Matrix original = Matrix::borrow(mapped.data(), rows, cols);
+        const Matrix twice = original * 2.0f;
+
+        Matrix m = Matrix::borrow(mapped.data(), rows, cols);
+        m.data()[0] = 1.0f;
+        check(m.ownsData() && m[0] == 1.0f && m[1] == values[1], "data() copies borrowed elements");
+
+        m = Matrix::borrow(mapped.data(), rows, cols);
+        m[1] = 2.0f;
+        m(1, 0) = 3.0f;
+        m.row(1)[1] = 4.0f;
+        m.elements()[2] = 5.0f;
+        check(m[1] == 2.0f && m(1, 0) == 3.0f && m(1, 1) == 4.0f && m[2] == 5.0f,
+              "[], (), row() and elements() write a copy of borrowed elements");
+
+        m = Matrix::borrow(mapped.data(), rows, cols);
+        m += original;
+        check(sameMatrix(m, twice), "+= on borrowed elements");
+
+        m = Matrix::borrow(mapped.data(), rows, cols);
+        m = m + m;
+        check(sameMatrix(m, twice), "a sum of a borrowed matrix assigned to it");
+
+        m = Matrix::borrow(mapped.data(), rows, cols);
+        m = m * 2.0f;
+        check(sameMatrix(m, twice), "a scaling of a borrowed matrix assigned to it");
+
+        Matrix copy(original);
+        copy[0] = -1.0f;
+        check(copy.ownsData() && copy[1] == values[1], "a copy of a borrowed matrix owns its elements");
+
+        check(!original.ownsData() && original.data() == mapped.data() &&
+              std::memcmp(mapped.data(), values.data(), values.size() * sizeof(float)) == 0,
+              "borrowed elements are never written");
+    }
+}
+
+/**
+ * @brief Expressions reading the matrix they are assigned to: products and transposes go
+ * through a temporary, elementwise trees run in place
+ */
+static void testAliasing()
+{
+    for (const int size : {6, 40})
+    {
+        const Matrix a = randomMatrix(size, size);
+        const Matrix b = randomMatrix(size, size + 3);
+
+        Matrix m = a;
+        m = m * m;
+        check(closeMatrix(m, naiveProduct(a, a), size), "m = m * m");
+
+        m = a;
+        m = m * b;
+        check(closeMatrix(m, naiveProduct(a, b), size), "m = m * b, resized");
+
+        m = a;
+        m += m * m;
+        check(closeMatrix(m, naiveProduct(a, a) + a, size), "m += m * m");
+
+        m = b;
+        m = transpose(m);
+        check(sameMatrix(m, naiveTranspose(b)), "m = transpose(m), not square");
+
+        m = a;
+        m = transpose(m) * m;
+        check(closeMatrix(m, naiveProduct(naiveTranspose(a), a), size), "m = transpose(m) * m");
+
+        m = a;
+        m = m + m * 2.0f;
+        check(sameMatrix(m, a * 3.0f), "m = m + m * 2, in place");
+
+        m = a;
+        m += m;
+        check(sameMatrix(m, a * 2.0f), "m += m");
+    }
+}
+
+/**
+ * @brief Views as operands: strided slices read in place, expressions kept in auto variables
+ * holding them by value
+ */
+static void testViews()
+{
+    const Matrix m = randomMatrix(30, 20);
+    const MatrixView columns = MatrixView(m).colSlice(3, 7);
+    const Matrix columnsCopy = columns;
+    const Matrix right = randomMatrix(7, 5);
+
+    check(sameMatrix(Matrix(columns * right), Matrix(columnsCopy * right)),
+          "a product of a strided view");
+    check(sameMatrix(Matrix(transpose(columns)), naiveTranspose(columnsCopy)),
+          "transpose() of a strided view");
+
+    auto sum = MatrixView(m).rowSlice(2, 4) + MatrixView(m).rowSlice(10, 4) * 2.0f;
+    const Matrix expected = Matrix(MatrixView(m).rowSlice(2, 4)) +
+                            Matrix(MatrixView(m).rowSlice(10, 4)) * 2.0f;
+    check(sameMatrix(Matrix(sum), expected), "an expression kept over temporary views");
+}
+
+/**
+ * @brief A matrix assigned a slice of itself: the slice overlaps the elements _reshape() frees
+ * (or, for inline ones, overwrites), not only at their first element. Small and heap sized
+ * matrices alike
+ */
+static void testSliceSelfAssignment()
+{
+    for (const int size : {8, 20})
+    {
+        const Matrix original = randomMatrix(size, size);
+        const int first = size / 4, count = size / 2;
+        const Matrix rows = MatrixView(original).rowSlice(first, count);
+        const Matrix cols = MatrixView(original).colSlice(first, count);
+
+        Matrix m = original;
+        m = MatrixView(m).rowSlice(first, count);
+        check(sameMatrix(m, rows), "m = MatrixView(m).rowSlice()");
+
+        m = original;
+        m = MatrixView(m).colSlice(first, count);
+        check(sameMatrix(m, cols), "m = MatrixView(m).colSlice()");
+
+        m = original;
+        m = transpose(MatrixView(m).rowSlice(first, count));
+        check(sameMatrix(m, naiveTranspose(rows)), "m = transpose(MatrixView(m).rowSlice())");
+
+        m = original;
+        m = MatrixView(m).colSlice(first, count) * 2.0f;
+        check(sameMatrix(m, cols * 2.0f), "m = MatrixView(m).colSlice() * 2");
+    }
+}
+
+/**
+ * @brief Every node type reading the matrix it is assigned to while _reshape() gives that
+ * matrix a new buffer: borrowed elements are always replaced, owned ones when the element count
+ * changes. The node must report the read (reads()) for operator= to evaluate it first
+ */
+static void testReadsDestination()
+{
+    for (const int size : {4, 20})
+    {
+        const Matrix original = randomMatrix(size, size);
+        const Matrix other = randomMatrix(size, size);
+        const Matrix wide = randomMatrix(size, size + 3);
+        const std::vector<float> elements(original.data(), original.data() + size * size);
+
+        Matrix m = Matrix::borrow(elements.data(), size, size);
+        m = m + other;
+        check(sameMatrix(m, original + other), "MatrixSum reading its borrowed destination");
+
+        m = Matrix::borrow(elements.data(), size, size);
+        m = 2.0f * m;
+        check(sameMatrix(m, original * 2.0f), "MatrixScale reading its borrowed destination");
+
+        m = Matrix::borrow(elements.data(), size, size);
+        m = m * m;
+        check(sameMatrix(m, Matrix(original * original)),
+              "MatrixProduct reading its borrowed destination");
+
+        m = original;
+        m = m * wide;
+        check(sameMatrix(m, Matrix(original * wide)), "MatrixProduct reading a resized destination");
+
+        m = Matrix::borrow(elements.data(), size, size);
+        m = transpose(m);
+        check(sameMatrix(m, naiveTranspose(original)),
+              "MatrixTransposed reading its borrowed destination");
+
+        m = wide;
+        m = transpose(m) * 2.0f;
+        check(sameMatrix(m, naiveTranspose(wide) * 2.0f),
+              "MatrixTransposed reading a reshaped destination");
+
+        m = Matrix::borrow(elements.data(), size, size);
+        m = MatrixView(m).rowSlice(1, size - 1);
+        check(sameMatrix(m, Matrix(MatrixView(original).rowSlice(1, size - 1))),
+              "MatrixView reading its borrowed destination");
+
+        m = original;
+        m = MatrixView(m).colSlice(1, size - 1) + MatrixView(m).colSlice(0, size - 1);
+        check(sameMatrix(m, Matrix(MatrixView(original).colSlice(1, size - 1) +
+                                   MatrixView(original).colSlice(0, size - 1))),
+              "MatrixView reading a resized destination");
+    }
+}
+
+/**
+ * @brief Runs every check on the instruction set of this process
+ * @return EXIT_SUCCESS if they all passed
+ */
+int main(int argc, char **)
+{
+    if (argc != 1)
+    {
+        std::cout << USAGE_MSG << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::srand(TEST_SEED);
+    std::cout << "kernels: " << simdKernels().name << std::endl;
+
+    testGemm();
+    testPackedA();
+    testGemmThreads();
+    testGemv();
+    testSoftmaxExp();
+    testSoftmax();
+    testInt8();
+    testHalf();
+    testBorrowing();
+    testAliasing();
+    testViews();
+    testSliceSelfAssignment();
+    testReadsDestination();
+
+    if (failures != 0)
+    {
+        std::cout << failures << " checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+//
+// Created by user on 14/01/2020.
+//
+
+#include "MatrixView.h"
+
+#include <cstdlib>
+#include <iostream>
+
+#include "Simd.h"
+
+/**
+ * @brief Constructs a view of all the elements of a matrix
+ * @param matrix the matrix, must outlive the view
+ */
+MatrixView::MatrixView(const Matrix &matrix) :
+        _data(matrix.data()), _rows(matrix.getRows()), _cols(matrix.getCols()),
+        _stride(matrix.getCols())
+{
+
+}
+
+/**
+ * @brief Constructs a view of contiguous row-major elements
+ * @param data element (0, 0)
+ * @param rows rows of the view
+ * @param cols cols of the view
+ */
+MatrixView::MatrixView(const float *data, const int rows, const int cols) :
+        _data(data), _rows(rows), _cols(cols), _stride(cols)
+{
+
+}
+
+/**
+ * @brief Constructs a view of strided rows
+ * @param data element (0, 0)
+ * @param rows rows of the view
+ * @param cols cols of the view
+ * @param stride distance (in floats) between consecutive rows, at least cols
+ */
+MatrixView::MatrixView(const float *data, const int rows, const int cols, const int stride) :
+        _data(data), _rows(rows), _cols(cols), _stride(stride)
+{
+
+}
+
+/**
+ * @brief The same elements with other dims, e.g. a 28 × 28 image as a 784 × 1 vector.
+ * Exits (code 1) if the view isn't contiguous or the element count differs
+ * @param rows new rows
+ * @param cols new cols
+ * @return the reshaped view
+ */
+MatrixView MatrixView::reshaped(const int rows, const int cols) const
+{
+    if (!isContiguous() || rows < 0 || cols < 0 || rows * cols != _rows * _cols)
+    {
+        _viewError(VIEW_RESHAPE_ERROR);
+    }
+    return MatrixView(_data, rows, cols);
+}
+
+/**
+ * @brief The same elements as a column vector (Matrix::vectorize() without the copy).
+ * Exits (code 1) if the view isn't contiguous
+ * @return the getRows() * getCols() × 1 view
+ */
+MatrixView MatrixView::vectorized() const
+{
+    return reshaped(_rows * _cols, 1);
+}
+
+/**
+ * @brief Some consecutive rows. Exits (code 1) if they aren't all in the view
+ * @param first first row
+ * @param count number of rows
+ * @return count × getCols() view, same stride
+ */
+MatrixView MatrixView::rowSlice(const int first, const int count) const
+{
+    if (first < 0 || count < 0 || first + count > _rows)
+    {
+        _viewError(VIEW_SLICE_ERROR);
+    }
+    return MatrixView(_data + (ptrdiff_t) first * _stride, count, _cols, _stride);
+}
+
+/**
+ * @brief Some consecutive cols, e.g. a chunk of a batch whose images are the columns.
+ * Exits (code 1) if they aren't all in the view
+ * @param first first col
+ * @param count number of cols
+ * @return getRows() × count view, same stride
+ */
+MatrixView MatrixView::colSlice(const int first, const int count) const
+{
+    if (first < 0 || count < 0 || first + count > _cols)
+    {
+        _viewError(VIEW_SLICE_ERROR);
+    }
+    return MatrixView(_data + first, _rows, count, _stride);
+}
+
+/**
+ * @brief Whether the viewed rows overlap [first, last). The gaps between the rows count as
+ * viewed: a destination there is rare, and copying it first is only slower
+ * @param first first element of a buffer
+ * @param last one past its last element
+ * @return true if the view may read the buffer
+ */
+bool MatrixView::reads(const float *first, const float *last) const
+{
+    return _rows > 0 && _cols > 0 && _data < last &&
+           first < _data + (ptrdiff_t) (_rows - 1) * _stride + _cols;
+}
+
+/**
+ * @brief dst = this, row by row
+ * @param dst a matrix of the same size
+ */
+void MatrixView::assignTo(Matrix &dst) const
+{
+    const SimdKernels &kernels = simdKernels();
+    for (int i = 0; i < _rows; i++)
+    {
+        kernels.copy(dst.row(i), row(i), _cols);
+    }
+}
+
+/**
+ * @brief dst += this, row by row
+ * @param dst a matrix of the same size
+ */
+void MatrixView::addTo(Matrix &dst) const
+{
+    const SimdKernels &kernels = simdKernels();
+    for (int i = 0; i < _rows; i++)
+    {
+        kernels.add(dst.row(i), dst.row(i), row(i), _cols);
+    }
+}
+
+/**
+ * @brief The error path of the checks, out of line: prints message and exits (code 1)
+ * @param message the error
+ */
+void MatrixView::_viewError(const char *message)
+{
+    std::cerr << message << std::endl;
+    std::exit(1);
+}
@@ -0,0 +1,218 @@
+//MatrixView.h
+#ifndef MATRIXVIEW_H
+#define MATRIXVIEW_H
+
+#include <cstddef>
+
+#include "Matrix.h"
+#include "MatrixExpr.h"
+#include "Span.h"
+
+#define VIEW_ACCESS_ERROR "Cannot access view in this index."
+#define VIEW_SLICE_ERROR "Error: the slice isn't inside the view"
+#define VIEW_RESHAPE_ERROR "Error: only a contiguous view of as many elements can be reshaped"
+
+/**
+ * @brief A read-only rows × cols window on float elements that live elsewhere: a Matrix, a
+ * mapped file or any buffer. Row i starts getStride() floats after row i - 1, so column slices
+ * of a wider matrix (e.g. a chunk of a 784 × N batch) are views too. Making, reshaping and
+ * slicing a view never copies nor allocates; the elements must outlive it (and a Matrix
+ * viewed must not be moved or reshaped meanwhile, small ones keeping their elements inline).
+ * A Matrix converts to a view of itself, so functions taking a const MatrixView & accept both.
+ * Views are leaves of the lazy arithmetic (see MatrixExpr.h); one assigned to the matrix it
+ * views (m = MatrixView(m).rowSlice(...)) is evaluated through a temporary
+ */
+class MatrixView : public MatrixExpr<MatrixView>
+{
+public:
+    /**
+     * @brief Constructs a view of all the elements of a matrix
+     * @param matrix the matrix, must outlive the view
+     */
+    MatrixView(const Matrix &matrix);
+
+    /**
+     * @brief Constructs a view of contiguous row-major elements
+     * @param data element (0, 0)
+     * @param rows rows of the view
+     * @param cols cols of the view
+     */
+    MatrixView(const float *data, int rows, int cols);
+
+    /**
+     * @brief Constructs a view of strided rows
+     * @param data element (0, 0)
+     * @param rows rows of the view
+     * @param cols cols of the view
+     * @param stride distance (in floats) between consecutive rows, at least cols
+     */
+    MatrixView(const float *data, int rows, int cols, int stride);
+
+    /**
+     * @brief rows getter
+     * @return rows of the view
+     */
+    int getRows() const
+    {
+        return _rows;
+    }
+
+    /**
+     * @brief cols getter
+     * @return cols of the view
+     */
+    int getCols() const
+    {
+        return _cols;
+    }
+
+    /**
+     * @brief stride getter
+     * @return distance (in floats) between consecutive rows
+     */
+    int getStride() const
+    {
+        return _stride;
+    }
+
+    /**
+     * @brief Raw elements
+     * @return pointer to element (0, 0), row i at data() + i * getStride()
+     */
+    const float *data() const
+    {
+        return _data;
+    }
+
+    /**
+     * @brief Whether the elements are contiguous, row-major with no gap between the rows
+     * @return true if they are
+     */
+    bool isContiguous() const
+    {
+        return _stride == _cols || _rows <= 1;
+    }
+
+    /**
+     * @brief Raw row. Checked only under MATRIX_CHECKED_ROWS
+     * @param i row
+     * @return pointer to element (i, 0), the getCols() elements of row i follow it
+     */
+    const float *row(const int i) const
+    {
+        if (MATRIX_CHECKED_ROWS && (i < 0 || i >= _rows))
+        {
+            _viewError(VIEW_ACCESS_ERROR);
+        }
+        return _data + (ptrdiff_t) i * _stride;
+    }
+
+    /**
+     * @brief Row i as a span. Checked only under MATRIX_CHECKED_ROWS
+     * @param i row
+     * @return the getCols() elements of row i
+     */
+    Span<const float> rowSpan(const int i) const
+    {
+        return Span<const float>(row(i), _cols);
+    }
+
+    /**
+     * @brief View () operator. Exits (code 1) if (i, j) is outside the view, under
+     * MATRIX_CHECKED_ACCESS (the default)
+     * @param i row
+     * @param j col
+     * @return view[i][j]
+     */
+    float operator()(const int i, const int j) const
+    {
+        if (MATRIX_CHECKED_ACCESS && (i < 0 || i >= _rows || j < 0 || j >= _cols))
+        {
+            _viewError(VIEW_ACCESS_ERROR);
+        }
+        return _data[(ptrdiff_t) i * _stride + j];
+    }
+
+    /**
+     * @brief The same elements with other dims, e.g. a 28 × 28 image as a 784 × 1 vector.
+     * Exits (code 1) if the view isn't contiguous or the element count differs
+     * @param rows new rows
+     * @param cols new cols
+     * @return the reshaped view
+     */
+    MatrixView reshaped(int rows, int cols) const;
+
+    /**
+     * @brief The same elements as a column vector (Matrix::vectorize() without the copy).
+     * Exits (code 1) if the view isn't contiguous
+     * @return the getRows() * getCols() × 1 view
+     */
+    MatrixView vectorized() const;
+
+    /**
+     * @brief Some consecutive rows. Exits (code 1) if they aren't all in the view
+     * @param first first row
+     * @param count number of rows
+     * @return count × getCols() view, same stride
+     */
+    MatrixView rowSlice(int first, int count) const;
+
+    /**
+     * @brief Some consecutive cols, e.g. a chunk of a batch whose images are the columns.
+     * Exits (code 1) if they aren't all in the view
+     * @param first first col
+     * @param count number of cols
+     * @return getRows() × count view, same stride
+     */
+    MatrixView colSlice(int first, int count) const;
+
+    // ------------------------- expression template protocol (see MatrixExpr.h) -------------
+
+    static constexpr bool isLeaf = true;
+    static constexpr bool isElementwise = true;
+
+    /**
+     * @brief element k in row-major order, unchecked
+     */
+    float coeff(const int k) const
+    {
+        return isContiguous() ? _data[k] : _data[(ptrdiff_t) (k / _cols) * _stride + k % _cols];
+    }
+
+    /**
+     * @brief whether the viewed rows overlap [first, last)
+     */
+    bool reads(const float *first, const float *last) const;
+
+    /**
+     * @brief evaluating into elements this view reads could free or overwrite them
+     */
+    bool aliases(const float *first, const float *last) const
+    {
+        return reads(first, last);
+    }
+
+    /**
+     * @brief dst = this
+     */
+    void assignTo(Matrix &dst) const;
+
+    /**
+     * @brief dst += this
+     */
+    void addTo(Matrix &dst) const;
+
+private:
+    const float *_data;
+    int _rows;
+    int _cols;
+    int _stride;
+
+    /**
+     * @brief The error path of the checks, out of line: prints message and exits (code 1)
+     * @param message the error
+     */
+    [[noreturn]] static void _viewError(const char *message);
+};
+
+#endif //MATRIXVIEW_H
@@ -3,68 +3,515 @@
 //
 
 #include "MlpNetwork.h"
-#include "Dense.h"
+
+#include <algorithm>
+
+#include "Softmax.h"
+#include "SparseInput.h"
+#include "Trace.h"
+#include "Transpose.h"
 
 /**
  * @brief Constructor
  * @param weightsArr an array of Matrices representing weights
  * @param biasArr an array of Matrices representing biases
+ * @param storage how the network keeps the weights: ModelFp32 copies them, ModelFp16 and
+ * ModelBf16 convert them to 16 bit floats (half the memory traffic), ModelInt8 quantizes
+ * them with dynamic input scales, ModelCsr keeps their non-zeros (see SparseMatrix::prune()).
+ * The biases and the float weights, with their columns and gemm() panels, are laid out once in
+ * one aligned arena (see WeightArena)
  */
-MlpNetwork::MlpNetwork(Matrix weightsArr[], Matrix biasArr[])
+MlpNetwork::MlpNetwork(Matrix weightsArr[], Matrix biasArr[], ModelWeightsType storage) :
+        _activationSize(0)
 {
+    ArenaLayout layouts[MLP_SIZE];
     for (int i = 0; i < MLP_SIZE; i++)
     {
-        _weightsArr[i] = weightsArr[i];
-        _biasArr[i] = biasArr[i];
+        const MatrixDims dims = {weightsArr[i].getRows(), weightsArr[i].getCols()};
+        layouts[i] = _planLayer(dims, true, storage == ModelFp32, true);
     }
+    _arena.allocate();
 
+    _layers.reserve(MLP_SIZE);
+    for (int i = 0; i < MLP_SIZE; i++)
+    {
+        _biasArr[i] = _arenaCopy(layouts[i].bias, biasArr[i]);
+        const ActivationType activation = i == MLP_SIZE - 1 ? Softmax : Relu;
+        if (storage == ModelInt8)
+        {
+            _quantizedArr[i] = QuantizedMatrix::quantize(weightsArr[i]);
+            _layers.emplace_back(_quantizedArr[i], _biasArr[i], activation,
+                                 InputQuantization{0, 0});
+        }
+        else if (storage == ModelFp16 || storage == ModelBf16)
+        {
+            _halfArr[i] = HalfMatrix::convert(weightsArr[i],
+                                              storage == ModelBf16 ? HalfBf16 : HalfFp16);
+            _layers.emplace_back(_halfArr[i], _biasArr[i], activation);
+        }
+        else if (storage == ModelCsr)
+        {
+            _sparseArr[i] = SparseMatrix::fromDense(weightsArr[i]);
+            _layers.emplace_back(_sparseArr[i], _biasArr[i], activation);
+        }
+        else
+        {
+            _weightsArr[i] = _arenaCopy(layouts[i].weights, weightsArr[i]);
+            _layers.emplace_back(_weightsArr[i], _biasArr[i], activation,
+                                 _columnsFor(i, layouts[i]), _packedFor(i, layouts[i]));
+        }
+    }
 
+    _activationSize = _maxActivationSize();
+}
+
+/**
+ * @brief Constructor from a mapped model file: the layers use the file's weights (float,
+ * 16 bit, int8 or sparse) and activations in place, nothing is copied. The columns and
+ * gemm() panels of float weights are built once in the arena. Exits (code 1) if the model
+ * doesn't have MLP_SIZE layers
+ * @param model a model file, must outlive the network
+ */
+MlpNetwork::MlpNetwork(const ModelFile &model) : _activationSize(0)
+{
+    if (model.getLayerCount() != MLP_SIZE)
+    {
+        std::cerr << MODEL_LAYERS_ERROR << std::endl;
+        std::exit(1);
+    }
+
+    ArenaLayout layouts[MLP_SIZE];
+    for (int i = 0; i < MLP_SIZE; i++)
+    {
+        const bool columns = i == 0 || model.activation(i - 1) == Relu;
+        layouts[i] = _planLayer(model.layerDims(i), false, model.weightsType(i) == ModelFp32,
+                                columns);
+    }
+    _arena.allocate();
+
+    _layers.reserve(MLP_SIZE);
+    for (int i = 0; i < MLP_SIZE; i++)
+    {
+        _biasArr[i] = model.bias(i);
+        if (model.weightsType(i) == ModelInt8)
+        {
+            _quantizedArr[i] = model.quantizedWeights(i);
+            _layers.emplace_back(_quantizedArr[i], _biasArr[i], model.activation(i),
+                                 model.inputQuantization(i));
+        }
+        else if (model.weightsType(i) == ModelFp16 || model.weightsType(i) == ModelBf16)
+        {
+            _halfArr[i] = model.halfWeights(i);
+            _layers.emplace_back(_halfArr[i], _biasArr[i], model.activation(i));
+        }
+        else if (model.weightsType(i) == ModelCsr)
+        {
+            _sparseArr[i] = model.sparseWeights(i);
+            _layers.emplace_back(_sparseArr[i], _biasArr[i], model.activation(i));
+        }
+        else
+        {
+            _weightsArr[i] = model.weights(i);
+            _layers.emplace_back(_weightsArr[i], _biasArr[i], model.activation(i),
+                                 _columnsFor(i, layouts[i]), _packedFor(i, layouts[i]));
+        }
+    }
+
+    _activationSize = _maxActivationSize();
 }
 
 /**
  * @brief operator overriding the () operator. gets an image (matrix) and returns digit
- * representing the result of the network process
- * @param img a matrix representing the image
+ * representing the result of the network process. Runs in the calling thread's workspace:
+ * no heap allocation once that thread has warmed up, and safe to call from any number of
+ * threads at once. Exits (code 1) if img doesn't fit the first layer
+ * @param img a matrix or view representing the image (a column vector, e.g.
+ * MatrixView(image).vectorized() or a column of a batch)
  * @return a Digit object
  */
-Digit MlpNetwork::operator()(Matrix &img)
+Digit MlpNetwork::operator()(const MatrixView &img) const
 {
-    Dense dense0(_weightsArr[0], _biasArr[0], Relu);
-    Dense dense1(_weightsArr[1], _biasArr[1], Relu);
-    Dense dense2(_weightsArr[2], _biasArr[2], Relu);
-    Dense dense3(_weightsArr[3], _biasArr[3], Softmax);
+    if (img.getRows() != _layers.front().getInputSize() || img.getCols() != 1)
+    {
+        std::cerr << MULTIPLY_ERROR << std::endl;
+        std::exit(1);
+    }
 
-    Matrix &r1 = dense0(img);
-    Matrix &r2 = dense1(r1);
-    Matrix &r3 = dense2(r2);
-    Matrix &r4 = dense3(r3);
+    TRACE_SCOPE("network", "MlpNetwork::operator()", -1, 0, 0);
 
-    unsigned int maxIndex = _maxCoordinateIndex(r4);
-    float probability = r4((int) maxIndex, 0);
-    Digit result{maxIndex, probability};
+    // a column of a batch is strided: the batch path reads it in place
+    Workspace &workspace = _threadWorkspace(_activationSize);
+    const float *output = img.isContiguous()
+                          ? _forwardVector(workspace, img.data())
+                          : _forward(workspace, img.data(), img.getStride(), 1);
 
+    Digit result;
+    _digits(output, 1, &result);
     return result;
 
 }
+
+/**
+ * @brief Batch inference: classifies N images in one forward pass, every layer being a
+ * single matrix-matrix product (per chunk of MLP_BATCH_CHUNK images). Thread safe. Exits
+ * (code 1) if images doesn't have as many rows as the first layer has inputs
+ * @param images the images packed as columns: a 784 × N matrix or view (e.g. a column
+ * slice of a larger batch), image j in column j
+ * @return N Digit objects, one per column
+ */
+std::vector<Digit> MlpNetwork::classifyBatch(const MatrixView &images) const
+{
+    if (images.getRows() != _layers.front().getInputSize())
+    {
+        std::cerr << MULTIPLY_ERROR << std::endl;
+        std::exit(1);
+    }
+
+    TRACE_SCOPE("network", "MlpNetwork::classifyBatch", -1, 0, 0);
+    const int count = images.getCols();
+    std::vector<Digit> results(count);
+
+    Workspace &workspace = _threadWorkspace(_activationSize * std::min(count, MLP_BATCH_CHUNK));
+
+    for (int first = 0; first < count; first += MLP_BATCH_CHUNK)
+    {
+        // a chunk is a column slice of images: same rows, stride of the full batch
+        const int cols = std::min(MLP_BATCH_CHUNK, count - first);
+        const float *output = _forward(workspace, images.data() + first, images.getStride(),
+                                       cols);
+        _digits(output, cols, results.data() + first);
+    }
+
+    return results;
+}
+
+/**
+ * @brief Batch inference on separate images, packed chunk by chunk into the workspace (no
+ * full 784 × N copy). Thread safe. Exits (code 1) if an image doesn't have 784 elements
+ * (28 × 28 or already vectorized)
+ * @param images the images
+ * @return one Digit object per image
+ */
+std::vector<Digit> MlpNetwork::classifyBatch(const std::vector<Matrix> &images) const
+{
+    std::vector<Digit> results(images.size());
+    classifyBatch(images.data(), (int) images.size(), results.data());
+    return results;
+}
+
+/**
+ * @brief classifyBatch() on a range of images, writing into caller owned results (so
+ * several threads can fill disjoint parts of one array). Thread safe. Exits (code 1) if an
+ * image doesn't have 784 elements
+ * @param images first image
+ * @param count number of images
+ * @param results output, count Digit objects
+ */
+void MlpNetwork::classifyBatch(const Matrix *images, const int count, Digit *results) const
+{
+    const int inputSize = _layers.front().getInputSize();
+
+    for (int i = 0; i < count; i++)
+    {
+        if (images[i].getRows() * images[i].getCols() != inputSize)
+        {
+            std::cerr << MULTIPLY_ERROR << std::endl;
+            std::exit(1);
+        }
+    }
+
+    TRACE_SCOPE("network", "MlpNetwork::classifyBatch", -1, 0, 0);
+    const int chunk = std::min(count, MLP_BATCH_CHUNK);
+    Workspace &workspace = _threadWorkspace(_activationSize * chunk);
+    float *packed = workspace.staging((size_t) inputSize * chunk);
+
+    for (int first = 0; first < count; first += MLP_BATCH_CHUNK)
+    {
+        const int cols = std::min(MLP_BATCH_CHUNK, count - first);
+        _packColumns(images + first, cols, inputSize, packed);
+        const float *output = _forward(workspace, packed, cols, cols);
+        _digits(output, cols, results + first);
+    }
+}
+
+/**
+ * @brief _forward() of a single image: each layer that takesIndexedInput() gets the list of
+ * the non-zeros of its input, made by the previous layer's activation (compactNonZeros()
+ * on the image for the first one)
+ * @param workspace scratch the layers write to
+ * @param input the contiguous image
+ * @return the last layer's output (its logits if it is Softmax), in the workspace
+ */
+const float *MlpNetwork::_forwardVector(Workspace &workspace, const float *input) const
+{
+    const int32_t *indices = nullptr;
+    int count = 0;
+    if (_layers.front().takesIndexedInput())
+    {
+        int32_t *imageIndices = workspace.indices(-1, _layers.front().getInputSize());
+        count = compactNonZeros(input, _layers.front().getInputSize(), imageIndices);
+        indices = imageIndices;
+    }
+
+    for (int i = 0; i < MLP_SIZE; i++)
+    {
+        TRACE_SCOPE("layer", "dense", i, 0, 0);
+        const Dense &layer = _layers[i];
+        if (indices != nullptr)
+        {
+            SparsityCounters &counters = _sparsityCounters[i];
+            counters.vectors.fetch_add(1, std::memory_order_relaxed);
+            counters.nonZeros.fetch_add(count, std::memory_order_relaxed);
+            counters.sparseRuns.fetch_add(layer.usesSparseInput(count) ? 1 : 0,
+                                          std::memory_order_relaxed);
+        }
+
+        const bool nextIndexed = i + 1 < MLP_SIZE && _layers[i + 1].takesIndexedInput();
+        int32_t *outputIndices = nextIndexed ? workspace.indices(i, layer.getOutputSize())
+                                             : nullptr;
+        float *output = workspace.buffer(i);
+        count = layer.forwardIndexed(input, indices, count, output, outputIndices,
+                                     i == MLP_SIZE - 1);
+        input = output;
+        indices = outputIndices;
+    }
+
+    return input;
+}
+
+/**
+ * @brief Input sparsity counters of a layer, to tune SPARSE_INPUT_ENV_VAR. Counted on the
+ * single image path (operator()), for the float layers that can skip zero inputs: every
+ * one of them whose previous layer is Relu. Thread safe
+ * @param layer index of the layer
+ * @return the counters, all zeros for a layer that doesn't count
+ */
+LayerSparsity MlpNetwork::sparsity(const int layer) const
+{
+    const SparsityCounters &counters = _sparsityCounters[layer];
+    const uint64_t vectors = counters.vectors.load(std::memory_order_relaxed);
+    if (vectors == 0)
+    {
+        return {0, 0, 0};
+    }
+    const double inputs = (double) vectors * _layers[layer].getInputSize();
+    return {vectors, (double) counters.nonZeros.load(std::memory_order_relaxed) / inputs,
+            (double) counters.sparseRuns.load(std::memory_order_relaxed) / (double) vectors};
+}
+
+/**
+ * @brief Packs images as the columns of a row-major size × count matrix. Goes over the rows in
+ * blocks of one cache line so every line read from an image is used whole, while the writes
+ * stay contiguous along each row
+ * @param images first image of the chunk
+ * @param count number of images
+ * @param size elements per image
+ * @param packed output, size × count
+ */
+void MlpNetwork::_packColumns(const Matrix *images, const int count, const int size,
+                              float *packed)
+{
+    TRACE_SCOPE("op", "packColumns", -1, 0, 2.0 * sizeof(float) * size * count);
+    const int block = BUFFER_ALIGNMENT / sizeof(float);
+    for (int p0 = 0; p0 < size; p0 += block)
+    {
+        const int rows = std::min(block, size - p0);
+        for (int j = 0; j < count; j++)
+        {
+            const float *image = images[j].data() + p0;
+            for (int p = 0; p < rows; p++)
+            {
+                packed[(p0 + p) * count + j] = image[p];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Runs the layers on a row-major batch of cols column vectors
+ * @param workspace scratch the layers write to, holds cols outputs of the widest layer
+ * @param input first layer's input, inputs × cols
+ * @param inputStride distance (in floats) between consecutive rows of input
+ * @param cols number of column vectors
+ * @return the last layer's output (its logits if it is Softmax), a contiguous outputs × cols
+ * matrix in the workspace
+ */
+const float *MlpNetwork::_forward(Workspace &workspace, const float *input,
+                                  const int inputStride, const int cols) const
+{
+    for (int i = 0; i < MLP_SIZE; i++)
+    {
+        TRACE_SCOPE("layer", "dense", i, 0, 0);
+        float *output = workspace.buffer(i);
+        _layers[i].forward(input, i == 0 ? inputStride : cols, output, cols, i == MLP_SIZE - 1);
+        input = output;
+    }
+
+    return input;
+}
+
+/**
+ * @brief Per-thread scratch: every thread running a forward pass gets its own workspace,
+ * shared by all networks and grown on demand, so the network itself stays read-only
+ * @param bufferSize floats each buffer must hold
+ * @return the calling thread's workspace
+ */
+Workspace &MlpNetwork::_threadWorkspace(const int bufferSize)
+{
+    static thread_local Workspace workspace(0);
+    workspace.reserve(bufferSize);
+    return workspace;
+}
+
+/**
+ * @brief Plans the parts of a layer in the arena, one layer after the other so a forward pass
+ * walks it in order: the bias, then for float weights the weights, their columns and their
+ * panels
+ * @param dims dims of the layer's weights
+ * @param copies whether the arena holds the bias and the weights (else they are borrowed from
+ * a model file)
+ * @param floatWeights whether the weights are float (the others have their own layouts)
+ * @param columns whether the layer skips zero inputs: the first one, whose inputs are images,
+ * mostly zero pixels, and the ones after a Relu
+ * @return the offsets of the parts
+ */
+MlpNetwork::ArenaLayout MlpNetwork::_planLayer(const MatrixDims dims, const bool copies,
+                                               const bool floatWeights, const bool columns)
+{
+    const size_t size = (size_t) dims.rows * dims.cols;
+    ArenaLayout layout = {ARENA_NONE, ARENA_NONE, ARENA_NONE, ARENA_NONE};
+    if (copies)
+    {
+        layout.bias = _arena.reserve(dims.rows);
+    }
+    if (!floatWeights)
+    {
+        return layout;
+    }
+    if (copies)
+    {
+        layout.weights = _arena.reserve(size);
+    }
+    if (columns)
+    {
+        layout.columns = _arena.reserve(size);
+    }
+    layout.packed = _arena.reserve(gemmPackedSize(dims.rows, dims.cols));
+    return layout;
+}
+
+/**
+ * @brief Copies a matrix into its part of the arena
+ * @param offset the part, ARENA_NONE to keep the matrix where it is
+ * @param matrix the matrix
+ * @return a matrix borrowing the copy (or matrix itself for ARENA_NONE)
+ */
+Matrix MlpNetwork::_arenaCopy(const size_t offset, const Matrix &matrix)
+{
+    if (offset == ARENA_NONE)
+    {
+        return matrix;
+    }
+    float *copy = _arena.data(offset);
+    std::copy(matrix.data(), matrix.data() + matrix.getRows() * matrix.getCols(), copy);
+    return Matrix::borrow(copy, matrix.getRows(), matrix.getCols());
+}
+
+/**
+ * @brief Writes the column copy (transpose) of a float layer into the arena
+ * @param layer index of a layer whose weights are in _weightsArr
+ * @param layout the layer's parts
+ * @return the transpose, borrowed in _columnsArr, or nullptr if the layer runs dense
+ */
+const Matrix *MlpNetwork::_columnsFor(const int layer, const ArenaLayout &layout)
+{
+    if (layout.columns == ARENA_NONE)
+    {
+        return nullptr;
+    }
+
+    const Matrix &weights = _weightsArr[layer];
+    const int rows = weights.getRows();
+    const int cols = weights.getCols();
+    float *columns = _arena.data(layout.columns);
+    transposeMatrix(rows, cols, weights.data(), cols, columns, rows);
+    _columnsArr[layer] = Matrix::borrow(columns, cols, rows);
+    return &_columnsArr[layer];
+}
+
+/**
+ * @brief Writes the gemm() panels of a float layer into the arena (see gemmPackA())
+ * @param layer index of a layer whose weights are in _weightsArr
+ * @param layout the layer's parts
+ * @return the packed weights
+ */
+const float *MlpNetwork::_packedFor(const int layer, const ArenaLayout &layout)
+{
+    const Matrix &weights = _weightsArr[layer];
+    float *packed = _arena.data(layout.packed);
+    gemmPackA(weights.getRows(), weights.getCols(), weights.data(), weights.getCols(), packed);
+    return packed;
+}
+
+/**
+ * @brief Workspace planner: the widest activation any layer produces
+ * @return floats each workspace buffer needs
+ */
+int MlpNetwork::_maxActivationSize() const
+{
+    int maxSize = 0;
+    for (const Dense &layer : _layers)
+    {
+        maxSize = std::max(maxSize, layer.getOutputSize());
+    }
+    return maxSize;
+}
+
+/**
+ * @brief The Digit of every column of the last layer's output: softmaxTop() on the logits of
+ * a Softmax layer (no probability vector written), the largest coordinate of any other
+ * @param output the last layer's output, from _forward() or _forwardVector()
+ * @param cols number of column vectors in output
+ * @param results output, cols Digit objects
+ */
+void MlpNetwork::_digits(const float *output, const int cols, Digit *results) const
+{
+    const Dense &last = _layers.back();
+    if (last.getActivation().getActivationType() == Softmax)
+    {
+        TRACE_SCOPE("op", "softmaxTop", -1, (double) last.getOutputSize() * cols,
+                    sizeof(float) * (double) last.getOutputSize() * cols);
+        softmaxTop(output, last.getOutputSize(), cols, results);
+        return;
+    }
+
+    for (int j = 0; j < cols; j++)
+    {
+        const unsigned int maxIndex = _maxCoordinateIndex(output + j, last.getOutputSize(), cols);
+        results[j] = {maxIndex, output[maxIndex * cols + j]};
+    }
+}
+
 /**
  * @brief Helper function to calculate the index of the Maximum coordinate in the given vector
- * @param vec a Matrix representing a vector
+ * @param vec a vector
+ * @param size length of vec
+ * @param stride distance (in floats) between consecutive coordinates
  * @return integer: the index of the maximum coordinate value
  */
-unsigned int MlpNetwork::_maxCoordinateIndex(const Matrix &vec)
+unsigned int MlpNetwork::_maxCoordinateIndex(const float *vec, const int size,
+                                             const int stride)
 {
     float max = 0;
     unsigned int maxIndex = 0;
-    for (int i = 0; i < vec.getRows(); i++)
+    for (int i = 0; i < size; i++)
     {
-        if (vec(i, 0) > max)
+        if (vec[i * stride] > max)
         {
-            max = vec(i, 0);
+            max = vec[i * stride];
             maxIndex = i;
         }
     }
 
     return maxIndex;
 }
-
-
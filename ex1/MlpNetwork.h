@@ -3,20 +3,52 @@
 #ifndef MLPNETWORK_H
 #define MLPNETWORK_H
 
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
 #include "Matrix.h"
+#include "MatrixView.h"
+#include "Dense.h"
 #include "Digit.h"
+#include "ModelFile.h"
+#include "WeightArena.h"
+#include "Workspace.h"
 
 #define MLP_SIZE 4
 
-const MatrixDims imgDims = {28, 28};
-const MatrixDims weightsDims[] = {{128, 784},
-                                  {64,  128},
-                                  {20,  64},
-                                  {10,  20}};
-const MatrixDims biasDims[] = {{128, 1},
-                               {64,  1},
-                               {20,  1},
-                               {10,  1}};
+#define MODEL_LAYERS_ERROR "Error: the model must have 4 layers"
+
+/**
+ * @brief Images pushed through the layers together by classifyBatch(). Bounds the workspace
+ * (128 × 256 floats per buffer) while keeping every layer a wide matrix-matrix product
+ */
+#define MLP_BATCH_CHUNK 256
+
+/**
+ * @struct LayerSparsity
+ * @brief What a layer saw of its inputs on the single image path (see
+ * MlpNetwork::sparsity())
+ * @var vectors - input vectors counted
+ * @var density - mean fraction of non-zero entries in them
+ * @var sparseShare - fraction of them that only read the weight columns of their non-zeros
+ */
+typedef struct LayerSparsity
+{
+    uint64_t vectors;
+    double density;
+    double sparseShare;
+} LayerSparsity;
+
+constexpr MatrixDims imgDims = {28, 28};
+constexpr MatrixDims weightsDims[] = {{128, 784},
+                                      {64,  128},
+                                      {20,  64},
+                                      {10,  20}};
+constexpr MatrixDims biasDims[] = {{128, 1},
+                                   {64,  1},
+                                   {20,  1},
+                                   {10,  1}};
 
 // Insert MlpNetwork class here...
 
@@ -32,29 +64,227 @@ public:
      * @brief Constructor
      * @param weightsArr an array of Matrices representing weights
      * @param biasArr an array of Matrices representing biases
+     * @param storage how the network keeps the weights: ModelFp32 copies them, ModelFp16 and
+     * ModelBf16 convert them to 16 bit floats (half the memory traffic), ModelInt8 quantizes
+     * them with dynamic input scales, ModelCsr keeps their non-zeros (see
+     * SparseMatrix::prune()). The biases and the float weights, with their columns and gemm()
+     * panels, are laid out once in one aligned arena (see WeightArena)
+     */
+    MlpNetwork(Matrix weightsArr[], Matrix biasArr[],
+               ModelWeightsType storage = ModelFp32);
+
+    /**
+     * @brief Constructor from a mapped model file: the layers use the file's weights (float,
+     * 16 bit, int8 or sparse) and activations in place, nothing is copied. The columns and
+     * gemm() panels of float weights are built once in the arena. Exits (code 1) if the model
+     * doesn't have MLP_SIZE layers
+     * @param model a model file, must outlive the network
+     */
+    explicit MlpNetwork(const ModelFile &model);
+
+    /**
+     * @brief The layers refer to this network's own matrices, copies would share them
+     */
+    MlpNetwork(const MlpNetwork &) = delete;
+
+    /**
+     * @brief The layers refer to this network's own matrices, copies would share them
      */
-    MlpNetwork(Matrix weightsArr[], Matrix biasArr[]);
+    MlpNetwork &operator=(const MlpNetwork &) = delete;
 
     /**
      * @brief operator overriding the () operator. gets an image (matrix) and returns digit
-     * representing the result of the network process
-     * @param img a matrix representing the image
+     * representing the result of the network process. Runs in the calling thread's workspace:
+     * no heap allocation once that thread has warmed up, and safe to call from any number of
+     * threads at once. Exits (code 1) if img doesn't fit the first layer
+     * @param img a matrix or view representing the image (a column vector, e.g.
+     * MatrixView(image).vectorized() or a column of a batch)
      * @return a Digit object
      */
-    Digit operator()(Matrix &img);
+    Digit operator()(const MatrixView &img) const;
+
+    /**
+     * @brief Batch inference: classifies N images in one forward pass, every layer being a
+     * single matrix-matrix product (per chunk of MLP_BATCH_CHUNK images). Thread safe. Exits
+     * (code 1) if images doesn't have as many rows as the first layer has inputs
+     * @param images the images packed as columns: a 784 × N matrix or view (e.g. a column
+     * slice of a larger batch), image j in column j
+     * @return N Digit objects, one per column
+     */
+    std::vector<Digit> classifyBatch(const MatrixView &images) const;
+
+    /**
+     * @brief Batch inference on separate images, packed chunk by chunk into the workspace (no
+     * full 784 × N copy). Thread safe. Exits (code 1) if an image doesn't have 784 elements
+     * (28 × 28 or already vectorized)
+     * @param images the images
+     * @return one Digit object per image
+     */
+    std::vector<Digit> classifyBatch(const std::vector<Matrix> &images) const;
+
+    /**
+     * @brief classifyBatch() on a range of images, writing into caller owned results (so
+     * several threads can fill disjoint parts of one array). Thread safe. Exits (code 1) if an
+     * image doesn't have 784 elements
+     * @param images first image
+     * @param count number of images
+     * @param results output, count Digit objects
+     */
+    void classifyBatch(const Matrix *images, int count, Digit *results) const;
+
+    /**
+     * @brief Input sparsity counters of a layer, to tune SPARSE_INPUT_ENV_VAR. Counted on the
+     * single image path (operator()), for the float layers that can skip zero inputs: every
+     * one of them whose previous layer is Relu. Thread safe
+     * @param layer index of the layer
+     * @return the counters, all zeros for a layer that doesn't count
+     */
+    LayerSparsity sparsity(int layer) const;
 
 
 private:
 
     Matrix _weightsArr[MLP_SIZE];
+    Matrix _columnsArr[MLP_SIZE];
+    QuantizedMatrix _quantizedArr[MLP_SIZE];
+    HalfMatrix _halfArr[MLP_SIZE];
+    SparseMatrix _sparseArr[MLP_SIZE];
     Matrix _biasArr[MLP_SIZE];
+    WeightArena _arena;
+    std::vector<Dense> _layers;
+    int _activationSize;
+
+    /**
+     * @struct ArenaLayout
+     * @brief Where the parts of a layer are in the arena, ARENA_NONE for the ones it doesn't
+     * keep there
+     * @var bias - the bias
+     * @var weights - the float weights, row-major, for single vectors (gemv())
+     * @var columns - their transpose, for single vectors with few non-zeros
+     * @var packed - their gemm() panels (gemmPackA()), for batches
+     */
+    typedef struct ArenaLayout
+    {
+        size_t bias;
+        size_t weights;
+        size_t columns;
+        size_t packed;
+    } ArenaLayout;
+
+    /**
+     * @struct SparsityCounters
+     * @brief Running totals behind sparsity(), updated with relaxed atomics
+     */
+    typedef struct SparsityCounters
+    {
+        std::atomic<uint64_t> vectors;
+        std::atomic<uint64_t> nonZeros;
+        std::atomic<uint64_t> sparseRuns;
+    } SparsityCounters;
+
+    mutable SparsityCounters _sparsityCounters[MLP_SIZE] = {};
+
+    /**
+     * @brief Per-thread scratch: every thread running a forward pass gets its own workspace,
+     * shared by all networks and grown on demand, so the network itself stays read-only
+     * @param bufferSize floats each buffer must hold
+     * @return the calling thread's workspace
+     */
+    static Workspace &_threadWorkspace(int bufferSize);
+
+
+    /**
+     * @brief Plans the parts of a layer in the arena, one layer after the other so a forward
+     * pass walks it in order: the bias, then for float weights the weights, their columns and
+     * their panels
+     * @param dims dims of the layer's weights
+     * @param copies whether the arena holds the bias and the weights (else they are borrowed
+     * from a model file)
+     * @param floatWeights whether the weights are float (the others have their own layouts)
+     * @param columns whether the layer skips zero inputs: the first one, whose inputs are
+     * images, mostly zero pixels, and the ones after a Relu
+     * @return the offsets of the parts
+     */
+    ArenaLayout _planLayer(MatrixDims dims, bool copies, bool floatWeights, bool columns);
+
+    /**
+     * @brief Copies a matrix into its part of the arena
+     * @param offset the part, ARENA_NONE to keep the matrix where it is
+     * @param matrix the matrix
+     * @return a matrix borrowing the copy (or matrix itself for ARENA_NONE)
+     */
+    Matrix _arenaCopy(size_t offset, const Matrix &matrix);
+
+    /**
+     * @brief Writes the column copy (transpose) of a float layer into the arena
+     * @param layer index of a layer whose weights are in _weightsArr
+     * @param layout the layer's parts
+     * @return the transpose, borrowed in _columnsArr, or nullptr if the layer runs dense
+     */
+    const Matrix *_columnsFor(int layer, const ArenaLayout &layout);
+
+    /**
+     * @brief Writes the gemm() panels of a float layer into the arena (see gemmPackA())
+     * @param layer index of a layer whose weights are in _weightsArr
+     * @param layout the layer's parts
+     * @return the packed weights
+     */
+    const float *_packedFor(int layer, const ArenaLayout &layout);
+
+    /**
+     * @brief Workspace planner: the widest activation any layer produces
+     * @return floats each workspace buffer needs
+     */
+    int _maxActivationSize() const;
+
+    /**
+     * @brief Runs the layers on a row-major batch of cols column vectors
+     * @param workspace scratch the layers write to, holds cols outputs of the widest layer
+     * @param input first layer's input, inputs × cols
+     * @param inputStride distance (in floats) between consecutive rows of input
+     * @param cols number of column vectors
+     * @return the last layer's output (its logits if it is Softmax), a contiguous outputs ×
+     * cols matrix in the workspace
+     */
+    const float *_forward(Workspace &workspace, const float *input, int inputStride,
+                          int cols) const;
+
+    /**
+     * @brief _forward() of a single image: each layer that takesIndexedInput() gets the list of
+     * the non-zeros of its input, made by the previous layer's activation (compactNonZeros()
+     * on the image for the first one)
+     * @param workspace scratch the layers write to
+     * @param input the contiguous image
+     * @return the last layer's output (its logits if it is Softmax), in the workspace
+     */
+    const float *_forwardVector(Workspace &workspace, const float *input) const;
+
+    /**
+     * @brief Packs images as the columns of a row-major size × count matrix
+     * @param images first image of the chunk
+     * @param count number of images
+     * @param size elements per image
+     * @param packed output, size × count
+     */
+    static void _packColumns(const Matrix *images, int count, int size, float *packed);
+
+    /**
+     * @brief The Digit of every column of the last layer's output: softmaxTop() on the logits
+     * of a Softmax layer (no probability vector written), the largest coordinate of any other
+     * @param output the last layer's output, from _forward() or _forwardVector()
+     * @param cols number of column vectors in output
+     * @param results output, cols Digit objects
+     */
+    void _digits(const float *output, int cols, Digit *results) const;
 
     /**
      * @brief Helper function to calculate the index of the Maximum coordinate in the given vector
-     * @param vec a Matrix representing a vector
+     * @param vec a vector
+     * @param size length of vec
+     * @param stride distance (in floats) between consecutive coordinates
      * @return integer: the index of the maximum coordinate value
      */
-    static unsigned int _maxCoordinateIndex(const Matrix &vec);
+    static unsigned int _maxCoordinateIndex(const float *vec, int size, int stride);
 
 
 };
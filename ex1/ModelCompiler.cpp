@@ -0,0 +1,170 @@
+//
+// Created by user on 14/01/2020.
+//
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "FixedMlpNetwork.h"
+#include "MlpNetwork.h"
+
+#define OUTPUT_IDX 1
+#define WEIGHTS_START_IDX 2
+#define BIAS_START_IDX (WEIGHTS_START_IDX + MLP_SIZE)
+#define ARGS_COUNT (BIAS_START_IDX + MLP_SIZE)
+#define VALUES_PER_LINE 5
+#define ERROR_INVALID_PARAMETER "Error: invalid Parameters file: "
+#define ERROR_NOT_FINITE "Error: the parameters must be finite numbers: "
+#define ERROR_WRITE "Error: cannot write the generated file: "
+#define USAGE_MSG "Usage:\n" \
+                  "\t./model_compiler output.cpp w1 w2 w3 w4 b1 b2 b3 b4\n" \
+                  "\t\twrites a translation unit defining compiledMlpNetwork()\n" \
+                  "\t\t(CompiledModel.h), the 8 parameter files of ./mlpnetwork built in"
+
+/**
+ * Reads a raw float file into a matrix of the expected size.
+ * @param path the file
+ * @param mat matrix to fill, already of the expected size
+ * @return true on success
+ */
+bool readParameter(const std::string &path, Matrix &mat)
+{
+    std::ifstream is(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!is.is_open() || is.tellg() != (long int) (mat.getRows() * mat.getCols() * sizeof(float)))
+    {
+        return false;
+    }
+    is.seekg(0, std::ios_base::beg);
+    is >> mat;
+    return true;
+}
+
+/**
+ * Writes a constexpr, BUFFER_ALIGNMENT aligned float array. The values are printed with 9
+ * significant digits, which read back as the same floats.
+ * @param out the generated file
+ * @param name name of the array
+ * @param values the values
+ * @param size number of values
+ */
+void writeArray(std::ostream &out, const std::string &name, const float *values, int size)
+{
+    out << "alignas(BUFFER_ALIGNMENT) constexpr float " << name << "[" << size << "] = {";
+    for (int i = 0; i < size; i++)
+    {
+        out << (i % VALUES_PER_LINE == 0 ? "\n    " : " ") << values[i] << "f"
+            << (i + 1 < size ? "," : "");
+    }
+    out << "\n};\n\n";
+}
+
+/**
+ * Writes one layer's weights, bias and transposed weights (the columns of its sparse input
+ * kernel) as arrays named after the layer.
+ * @param out the generated file
+ * @param layer index of the layer
+ * @param weights the weights
+ * @param bias the bias
+ * @param columns the transpose of the weights
+ */
+template <int Out, int In>
+void writeLayer(std::ostream &out, int layer, const FixedMatrix<Out, In> &weights,
+                const FixedMatrix<Out, 1> &bias, const FixedMatrix<In, Out> &columns)
+{
+    const std::string index = std::to_string(layer);
+    writeArray(out, "weights" + index, weights.data(), Out * In);
+    writeArray(out, "bias" + index, bias.data(), Out);
+    writeArray(out, "columns" + index, columns.data(), In * Out);
+}
+
+/**
+ * Checks that every parameter is finite: inf and nan don't have a literal.
+ * @param mat a parameter matrix
+ * @return true if they all are
+ */
+bool isFinite(const Matrix &mat)
+{
+    for (int i = 0; i < mat.getRows() * mat.getCols(); i++)
+    {
+        if (!std::isfinite(mat.data()[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Program's main: model_compiler output.cpp w1 w2 w3 w4 b1 b2 b3 b4. The generated file
+ * includes CompiledModel.h, every layer of the network being a FixedDense over constexpr arrays.
+ * @param argc count of args
+ * @param argv args values
+ * @return program exit status code
+ */
+int main(int argc, char **argv)
+{
+    if (argc != ARGS_COUNT)
+    {
+        std::cout << USAGE_MSG << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Matrix weights[MLP_SIZE];
+    Matrix biases[MLP_SIZE];
+    for (int i = 0; i < MLP_SIZE; i++)
+    {
+        weights[i] = Matrix(weightsDims[i].rows, weightsDims[i].cols);
+        biases[i] = Matrix(biasDims[i].rows, biasDims[i].cols);
+        const std::string weightsPath(argv[WEIGHTS_START_IDX + i]);
+        const std::string biasPath(argv[BIAS_START_IDX + i]);
+        if (!readParameter(weightsPath, weights[i]) || !readParameter(biasPath, biases[i]))
+        {
+            std::cerr << ERROR_INVALID_PARAMETER << (i + 1) << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!isFinite(weights[i]) || !isFinite(biases[i]))
+        {
+            std::cerr << ERROR_NOT_FINITE << (i + 1) << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    // the fixed shapes check the dims again, and give the transposes
+    const std::unique_ptr<FixedMlpWeights> fixed(new FixedMlpWeights(weights, biases));
+
+    std::ofstream out(argv[OUTPUT_IDX]);
+    out << "// Generated by model_compiler from:\n";
+    for (int i = WEIGHTS_START_IDX; i < ARGS_COUNT; i++)
+    {
+        out << "//     " << argv[i] << "\n";
+    }
+    out << "// Do not edit, run model_compiler again instead.\n\n"
+        << "#include \"CompiledModel.h\"\n\nnamespace\n{\n\n"
+        << std::scientific << std::setprecision(8);
+    writeLayer(out, 0, fixed->weights0, fixed->bias0, fixed->columns0);
+    writeLayer(out, 1, fixed->weights1, fixed->bias1, fixed->columns1);
+    writeLayer(out, 2, fixed->weights2, fixed->bias2, fixed->columns2);
+    writeLayer(out, 3, fixed->weights3, fixed->bias3, fixed->columns3);
+    out << "} // namespace\n\n"
+        << "const FixedMlpNetwork &compiledMlpNetwork()\n{\n";
+    for (int i = 0; i < MLP_SIZE; i++)
+    {
+        out << "    static const FixedLayer" << i << " layer" << i << "(weights" << i << ", bias"
+            << i << ", " << (i == MLP_SIZE - 1 ? "Softmax" : "Relu") << ", &columns" << i
+            << ");\n";
+    }
+    out << "    static const FixedMlpNetwork network(layer0, layer1, layer2, layer3);\n"
+        << "    return network;\n}\n";
+
+    out.close();
+    if (!out)
+    {
+        std::cerr << ERROR_WRITE << argv[OUTPUT_IDX] << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
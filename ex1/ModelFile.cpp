@@ -0,0 +1,537 @@
+//
+// Created by user on 07/01/2020.
+//
+
+#include "ModelFile.h"
+
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(ModelHeader) == 32, "ModelHeader must match the file layout");
+static_assert(sizeof(ModelLayer) == 64, "ModelLayer must match the file layout");
+
+/**
+ * @brief CRC-32 (IEEE 802.3, the zlib one), continued from crc
+ * @param crc checksum of the preceding bytes (0 to start)
+ * @param data bytes to add
+ * @param size number of bytes
+ * @return the updated checksum
+ */
+static uint32_t crc32(uint32_t crc, const void *data, size_t size)
+{
+    static const std::vector<uint32_t> table = []()
+    {
+        std::vector<uint32_t> entries(256);
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                c = (c & 1u) ? 0xEDB88320u ^ (c >> 1u) : c >> 1u;
+            }
+            entries[n] = c;
+        }
+        return entries;
+    }();
+
+    const auto *bytes = (const unsigned char *) data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = table[(crc ^ bytes[i]) & 0xFFu] ^ (crc >> 8u);
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Checksum stored in the header: the header with checksum = 0, then the layer table
+ * @param header the header
+ * @param layers the layer table
+ * @return CRC-32 of both
+ */
+static uint32_t headerChecksum(const ModelHeader &header, const ModelLayer *layers)
+{
+    ModelHeader zeroed = header;
+    zeroed.checksum = 0;
+    const uint32_t crc = crc32(0, &zeroed, sizeof(zeroed));
+    return crc32(crc, layers, sizeof(ModelLayer) * header.layerCount);
+}
+
+/**
+ * @brief Rounds offset up to the next multiple of MODEL_ALIGNMENT
+ */
+static uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+}
+
+/**
+ * @brief Size of the weights block of a layer
+ */
+static uint64_t weightsBytes(const ModelLayer &entry)
+{
+    if (entry.weightsType == ModelInt8)
+    {
+        const uint64_t stride = ((uint64_t) entry.cols + INT8_ROW_ALIGNMENT - 1) /
+                                INT8_ROW_ALIGNMENT * INT8_ROW_ALIGNMENT;
+        return entry.rows * stride;
+    }
+    if (entry.weightsType == ModelFp16 || entry.weightsType == ModelBf16)
+    {
+        const uint64_t stride = ((uint64_t) entry.cols + HALF_ROW_ALIGNMENT - 1) /
+                                HALF_ROW_ALIGNMENT * HALF_ROW_ALIGNMENT;
+        return entry.rows * stride * sizeof(uint16_t);
+    }
+    if (entry.weightsType == ModelCsr)
+    {
+        return (uint64_t) entry.nonZeros * sizeof(float);
+    }
+    return (uint64_t) entry.rows * entry.cols * sizeof(float);
+}
+
+/**
+ * @brief Size of the bias block of a layer
+ */
+static uint64_t biasBytes(const ModelLayer &entry)
+{
+    return (uint64_t) entry.rows * sizeof(float);
+}
+
+/**
+ * @brief Size of the scales block of a layer (row scales, then row sums, or the sparse
+ * indices), 0 if it has none
+ */
+static uint64_t scalesBytes(const ModelLayer &entry)
+{
+    if (entry.weightsType == ModelInt8)
+    {
+        return (uint64_t) entry.rows * (sizeof(float) + sizeof(int32_t));
+    }
+    if (entry.weightsType == ModelCsr)
+    {
+        return ((uint64_t) entry.rows + 1 + entry.nonZeros) * sizeof(int32_t);
+    }
+    return 0;
+}
+
+/**
+ * @brief Whether a block is aligned and lies inside a file of size bytes
+ */
+static bool blockFits(uint64_t offset, uint64_t bytes, size_t size)
+{
+    return offset % MODEL_ALIGNMENT == 0 && offset <= size && bytes <= size - offset;
+}
+
+/**
+ * @struct ModelBlock
+ * @brief A block write() has to store
+ */
+typedef struct ModelBlock
+{
+    const void *data;
+    uint64_t bytes;
+    uint64_t offset;
+} ModelBlock;
+
+/**
+ * @brief Maps path and validates the header and the layer table (magic, version,
+ * checksum, dims that chain, blocks inside the file and aligned). Exits (code 1) on failure
+ * @param path a model file
+ */
+ModelFile::ModelFile(const std::string &path) :
+        _data(nullptr), _size(0), _layers(nullptr), _layerCount(0)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat status{};
+    if (fd < 0 || fstat(fd, &status) != 0)
+    {
+        std::cerr << MODEL_OPEN_ERROR << path << std::endl;
+        std::exit(1);
+    }
+
+    _size = (size_t) status.st_size;
+    if (_size < sizeof(ModelHeader))
+    {
+        close(fd);
+        std::cerr << MODEL_FORMAT_ERROR << path << std::endl;
+        std::exit(1);
+    }
+
+    // shared read-only mapping: pages are read lazily and shared with every other process
+    void *mapped = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        std::cerr << MODEL_OPEN_ERROR << path << std::endl;
+        std::exit(1);
+    }
+    _data = (const unsigned char *) mapped;
+
+    if (!_validate())
+    {
+        std::cerr << MODEL_FORMAT_ERROR << path << std::endl;
+        std::exit(1);
+    }
+}
+
+/**
+ * @brief Destructor. Unmaps the file: matrices borrowed from it must be gone by then
+ */
+ModelFile::~ModelFile()
+{
+    munmap((void *) _data, _size);
+}
+
+/**
+ * @brief layer count getter
+ * @return number of layers
+ */
+int ModelFile::getLayerCount() const
+{
+    return _layerCount;
+}
+
+/**
+ * @brief dims getter
+ * @param layer index of the layer
+ * @return dims of the weights of that layer
+ */
+MatrixDims ModelFile::layerDims(int layer) const
+{
+    return {(int) _layers[layer].rows, (int) _layers[layer].cols};
+}
+
+/**
+ * @brief weights type getter
+ * @param layer index of the layer
+ * @return how the weights of that layer are stored
+ */
+ModelWeightsType ModelFile::weightsType(int layer) const
+{
+    return (ModelWeightsType) _layers[layer].weightsType;
+}
+
+/**
+ * @brief weights of a ModelFp32 layer, borrowed from the mapping (no copy)
+ * @param layer index of the layer
+ * @return rows × cols matrix
+ */
+Matrix ModelFile::weights(int layer) const
+{
+    const ModelLayer &entry = _layers[layer];
+    return Matrix::borrow((const float *) (_data + entry.weightsOffset), (int) entry.rows,
+                          (int) entry.cols);
+}
+
+/**
+ * @brief weights of a ModelInt8 layer, borrowed from the mapping (no copy)
+ * @param layer index of the layer
+ * @return rows × cols quantized matrix
+ */
+QuantizedMatrix ModelFile::quantizedWeights(int layer) const
+{
+    const ModelLayer &entry = _layers[layer];
+    const auto *scales = (const float *) (_data + entry.scalesOffset);
+    return QuantizedMatrix::borrow((const int8_t *) (_data + entry.weightsOffset), scales,
+                                   (const int32_t *) (scales + entry.rows), (int) entry.rows,
+                                   (int) entry.cols);
+}
+
+/**
+ * @brief weights of a ModelFp16 or ModelBf16 layer, borrowed from the mapping (no copy)
+ * @param layer index of the layer
+ * @return rows × cols 16 bit matrix
+ */
+HalfMatrix ModelFile::halfWeights(int layer) const
+{
+    const ModelLayer &entry = _layers[layer];
+    const HalfFormat format = entry.weightsType == ModelBf16 ? HalfBf16 : HalfFp16;
+    return HalfMatrix::borrow((const uint16_t *) (_data + entry.weightsOffset), format,
+                              (int) entry.rows, (int) entry.cols);
+}
+
+/**
+ * @brief weights of a ModelCsr layer, borrowed from the mapping (no copy). The indices are
+ * checked first (see SparseMatrix::isValid()): exits (code 1) if they are not valid
+ * @param layer index of the layer
+ * @return rows × cols sparse matrix
+ */
+SparseMatrix ModelFile::sparseWeights(int layer) const
+{
+    const ModelLayer &entry = _layers[layer];
+    const auto *rowOffsets = (const int32_t *) (_data + entry.scalesOffset);
+    SparseMatrix result = SparseMatrix::borrow(rowOffsets, rowOffsets + entry.rows + 1,
+                                               (const float *) (_data + entry.weightsOffset),
+                                               (int) entry.rows, (int) entry.cols);
+    if (!result.isValid((int) entry.nonZeros))
+    {
+        std::cerr << MODEL_FORMAT_ERROR << "layer " << layer << std::endl;
+        std::exit(1);
+    }
+    return result;
+}
+
+/**
+ * @brief input quantization getter
+ * @param layer index of a ModelInt8 layer
+ * @return how that layer quantizes its inputs
+ */
+InputQuantization ModelFile::inputQuantization(int layer) const
+{
+    return {_layers[layer].inputScale, _layers[layer].inputZeroPoint};
+}
+
+/**
+ * @brief bias of a layer, borrowed from the mapping (no copy)
+ * @param layer index of the layer
+ * @return rows × 1 matrix
+ */
+Matrix ModelFile::bias(int layer) const
+{
+    const ModelLayer &entry = _layers[layer];
+    return Matrix::borrow((const float *) (_data + entry.biasOffset), (int) entry.rows, 1);
+}
+
+/**
+ * @brief activation getter
+ * @param layer index of the layer
+ * @return the activation of that layer
+ */
+ActivationType ModelFile::activation(int layer) const
+{
+    return (ActivationType) _layers[layer].activation;
+}
+
+/**
+ * @brief Checks the checksum of every weights, bias and scales block. Reads the whole file
+ * @return true if all of them match
+ */
+bool ModelFile::verify() const
+{
+    for (int i = 0; i < _layerCount; i++)
+    {
+        const ModelLayer &entry = _layers[i];
+        if (crc32(0, _data + entry.weightsOffset, weightsBytes(entry)) != entry.weightsChecksum ||
+            crc32(0, _data + entry.biasOffset, biasBytes(entry)) != entry.biasChecksum ||
+            (scalesBytes(entry) > 0 &&
+             crc32(0, _data + entry.scalesOffset, scalesBytes(entry)) != entry.scalesChecksum))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Writes a model file
+ * @param path output path
+ * @param layers every layer
+ * @param layerCount number of layers
+ * @return true on success
+ */
+bool ModelFile::write(const std::string &path, const ModelLayerSource layers[], int layerCount)
+{
+    std::vector<ModelLayer> entries(layerCount);
+    std::vector<std::vector<unsigned char>> scales(layerCount);
+    std::vector<ModelBlock> blocks;
+    uint64_t end = sizeof(ModelHeader) + sizeof(ModelLayer) * layerCount;
+
+    for (int i = 0; i < layerCount; i++)
+    {
+        const ModelLayerSource &source = layers[i];
+        const bool quantized = source.quantized != nullptr;
+        int rows = 0;
+        int cols = 0;
+        int nonZeros = 0;
+        const void *weightsData = nullptr;
+        ModelWeightsType type = ModelFp32;
+        if (quantized)
+        {
+            rows = source.quantized->getRows();
+            cols = source.quantized->getCols();
+            weightsData = source.quantized->data();
+            type = ModelInt8;
+        }
+        else if (source.half != nullptr)
+        {
+            rows = source.half->getRows();
+            cols = source.half->getCols();
+            weightsData = source.half->data();
+            type = source.half->getFormat() == HalfBf16 ? ModelBf16 : ModelFp16;
+        }
+        else if (source.sparse != nullptr)
+        {
+            rows = source.sparse->getRows();
+            cols = source.sparse->getCols();
+            nonZeros = source.sparse->getNonZeros();
+            weightsData = source.sparse->values();
+            type = ModelCsr;
+        }
+        else
+        {
+            rows = source.weights->getRows();
+            cols = source.weights->getCols();
+            weightsData = source.weights->data();
+        }
+        if (source.bias->getRows() != rows || source.bias->getCols() != 1)
+        {
+            return false;
+        }
+
+        ModelLayer &entry = entries[i];
+        std::memset(&entry, 0, sizeof(entry));
+        entry.rows = (uint32_t) rows;
+        entry.cols = (uint32_t) cols;
+        entry.activation = (uint32_t) source.activation;
+        entry.weightsType = type;
+        entry.nonZeros = (uint32_t) nonZeros;
+
+        blocks.push_back({weightsData, weightsBytes(entry), alignOffset(end)});
+        entry.weightsOffset = blocks.back().offset;
+        entry.weightsChecksum = crc32(0, weightsData, weightsBytes(entry));
+        end = entry.weightsOffset + weightsBytes(entry);
+
+        blocks.push_back({source.bias->data(), biasBytes(entry), alignOffset(end)});
+        entry.biasOffset = blocks.back().offset;
+        entry.biasChecksum = crc32(0, source.bias->data(), biasBytes(entry));
+        end = entry.biasOffset + biasBytes(entry);
+
+        if (quantized)
+        {
+            // row scales then row sums, as one block
+            scales[i].resize(scalesBytes(entry));
+            std::memcpy(scales[i].data(), source.quantized->scales(), rows * sizeof(float));
+            std::memcpy(scales[i].data() + rows * sizeof(float), source.quantized->rowSums(),
+                        rows * sizeof(int32_t));
+            blocks.push_back({scales[i].data(), scalesBytes(entry), alignOffset(end)});
+            entry.scalesOffset = blocks.back().offset;
+            entry.scalesChecksum = crc32(0, scales[i].data(), scalesBytes(entry));
+            entry.inputScale = source.input.scale;
+            entry.inputZeroPoint = source.input.zeroPoint;
+            end = entry.scalesOffset + scalesBytes(entry);
+        }
+        else if (type == ModelCsr)
+        {
+            // row offsets then columns, as one block
+            scales[i].resize(scalesBytes(entry));
+            std::memcpy(scales[i].data(), source.sparse->rowOffsets(),
+                        (rows + 1) * sizeof(int32_t));
+            std::memcpy(scales[i].data() + (rows + 1) * sizeof(int32_t),
+                        source.sparse->columns(), nonZeros * sizeof(int32_t));
+            blocks.push_back({scales[i].data(), scalesBytes(entry), alignOffset(end)});
+            entry.scalesOffset = blocks.back().offset;
+            entry.scalesChecksum = crc32(0, scales[i].data(), scalesBytes(entry));
+            end = entry.scalesOffset + scalesBytes(entry);
+        }
+    }
+
+    ModelHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.layerCount = (uint32_t) layerCount;
+    header.alignment = MODEL_ALIGNMENT;
+    header.fileSize = end;
+    header.checksum = headerChecksum(header, entries.data());
+
+    std::ofstream os(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!os.is_open())
+    {
+        return false;
+    }
+
+    const char padding[MODEL_ALIGNMENT] = {};
+    os.write((const char *) &header, sizeof(header));
+    os.write((const char *) entries.data(), (std::streamsize) (sizeof(ModelLayer) * layerCount));
+    for (const ModelBlock &block : blocks)
+    {
+        os.write(padding, (std::streamsize) (block.offset - (uint64_t) os.tellp()));
+        os.write((const char *) block.data, (std::streamsize) block.bytes);
+    }
+
+    return os.good();
+}
+
+/**
+ * @brief Writes a float model file
+ * @param path output path
+ * @param weights weights of every layer
+ * @param biases bias of every layer (a column vector with as many rows as the weights)
+ * @param activations activation of every layer
+ * @param layerCount number of layers
+ * @return true on success
+ */
+bool ModelFile::write(const std::string &path, const Matrix weights[], const Matrix biases[],
+                      const ActivationType activations[], int layerCount)
+{
+    std::vector<ModelLayerSource> layers(layerCount);
+    for (int i = 0; i < layerCount; i++)
+    {
+        layers[i] = {&weights[i], nullptr, nullptr, nullptr, {0, 0}, &biases[i], activations[i]};
+    }
+    return write(path, layers.data(), layerCount);
+}
+
+/**
+ * @brief Header and layer table validation. Points _layers at the table on success
+ * @return true if the mapped file is a valid model
+ */
+bool ModelFile::_validate()
+{
+    const auto &header = *(const ModelHeader *) _data;
+    if (std::memcmp(header.magic, MODEL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != MODEL_VERSION || header.alignment != MODEL_ALIGNMENT ||
+        header.fileSize != _size || header.layerCount == 0 ||
+        header.layerCount > (_size - sizeof(ModelHeader)) / sizeof(ModelLayer))
+    {
+        return false;
+    }
+
+    const auto *layers = (const ModelLayer *) (_data + sizeof(ModelHeader));
+    if (headerChecksum(header, layers) != header.checksum)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header.layerCount; i++)
+    {
+        const ModelLayer &entry = layers[i];
+        if (entry.rows == 0 || entry.cols == 0 || entry.rows > INT_MAX / entry.cols ||
+            entry.cols > INT_MAX - INT8_ROW_ALIGNMENT || entry.activation > Softmax ||
+            entry.weightsType > ModelCsr || (i > 0 && entry.cols != layers[i - 1].rows) ||
+            !blockFits(entry.weightsOffset, weightsBytes(entry), _size) ||
+            !blockFits(entry.biasOffset, biasBytes(entry), _size))
+        {
+            return false;
+        }
+        if (entry.weightsType == ModelCsr &&
+            (entry.nonZeros > entry.rows * entry.cols ||
+             !blockFits(entry.scalesOffset, scalesBytes(entry), _size)))
+        {
+            return false;
+        }
+        if (entry.weightsType != ModelCsr && entry.nonZeros != 0)
+        {
+            return false;
+        }
+        if (entry.weightsType == ModelInt8 &&
+            (!blockFits(entry.scalesOffset, scalesBytes(entry), _size) ||
+             !(entry.inputScale >= 0) || entry.inputZeroPoint < 0 ||
+             entry.inputZeroPoint > UINT8_INPUT_MAX))
+        {
+            return false;
+        }
+    }
+
+    _layers = layers;
+    _layerCount = (int) header.layerCount;
+    return true;
+}
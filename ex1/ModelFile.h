@@ -0,0 +1,263 @@
+//ModelFile.h
+#ifndef MODELFILE_H
+#define MODELFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Activation.h"
+#include "AlignedBuffer.h"
+#include "HalfMatrix.h"
+#include "Matrix.h"
+#include "QuantizedMatrix.h"
+#include "SparseMatrix.h"
+
+/*
+ * Single file model container (little-endian, version MODEL_VERSION):
+ *
+ *   ModelHeader                    magic, version, layer count, alignment, file size, checksum
+ *   ModelLayer[layerCount]         dims, activation, weights type, data offsets and checksums
+ *   padding to MODEL_ALIGNMENT
+ *   layer 0 weights, padding, layer 0 bias (rows floats), [padding, layer 0 scales], ...
+ *
+ * Weights are either ModelFp32 (rows × cols floats, row-major), ModelFp16 / ModelBf16 (rows ×
+ * stride 16 bit floats, stride = HalfMatrix::strideFor(cols)), ModelInt8 (rows × stride
+ * int8, stride = QuantizedMatrix::strideFor(cols)), in which case a scales block follows the
+ * bias: rows float row scales then rows int32 row sums, or ModelCsr (the nonZeros float values
+ * of a SparseMatrix), in which case the scales block holds its indices: rows + 1 int32 row
+ * offsets then nonZeros int32 columns.
+ *
+ * Every block starts on a MODEL_ALIGNMENT boundary, so once the file is mapped (page aligned)
+ * the matrices are used in place. The header checksum covers the header and the layer table;
+ * each block has its own checksum, checked by verify() only, so opening a model costs the same
+ * whatever its size.
+ */
+
+#define MODEL_MAGIC "MLPM"
+#define MODEL_VERSION 2
+#define MODEL_ALIGNMENT BUFFER_ALIGNMENT
+
+#define MODEL_OPEN_ERROR "Error: cannot open model file: "
+#define MODEL_FORMAT_ERROR "Error: invalid model file: "
+
+/**
+ * @enum ModelWeightsType
+ * @brief How the weights of a layer are stored
+ */
+enum ModelWeightsType
+{
+    ModelFp32,
+    ModelInt8,
+    ModelFp16,
+    ModelBf16,
+    ModelCsr
+};
+
+/**
+ * @struct ModelHeader
+ * @brief First bytes of a model file
+ * @var checksum - CRC-32 of the header (with checksum = 0) followed by the layer table
+ */
+typedef struct ModelHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t layerCount;
+    uint32_t alignment;
+    uint64_t fileSize;
+    uint32_t checksum;
+    uint32_t reserved;
+} ModelHeader;
+
+/**
+ * @struct ModelLayer
+ * @brief Layer table entry: weights are rows × cols, bias is rows × 1
+ * @var activation - an ActivationType
+ * @var weightsType - a ModelWeightsType
+ * @var weightsOffset, biasOffset, scalesOffset - position of the blocks from the start of the
+ * file (scalesOffset is 0 for all but ModelInt8 and ModelCsr layers)
+ * @var inputScale, inputZeroPoint - the InputQuantization of ModelInt8 layers
+ * @var weightsChecksum, biasChecksum, scalesChecksum - CRC-32 of the blocks
+ * @var nonZeros - number of stored values of ModelCsr layers, 0 for the others
+ */
+typedef struct ModelLayer
+{
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t activation;
+    uint32_t weightsType;
+    uint64_t weightsOffset;
+    uint64_t biasOffset;
+    uint64_t scalesOffset;
+    float inputScale;
+    int32_t inputZeroPoint;
+    uint32_t weightsChecksum;
+    uint32_t biasChecksum;
+    uint32_t scalesChecksum;
+    uint32_t nonZeros;
+} ModelLayer;
+
+/**
+ * @struct ModelLayerSource
+ * @brief What ModelFile::write() stores for one layer
+ * @var weights - float weights, or nullptr
+ * @var quantized - int8 weights, or nullptr
+ * @var half - fp16 or bf16 weights, or nullptr
+ * @var sparse - sparse weights, or nullptr (exactly one of the four is set)
+ * @var input - input quantization of int8 layers
+ * @var bias - column vector with as many rows as the weights
+ * @var activation - the activation of the layer
+ */
+typedef struct ModelLayerSource
+{
+    const Matrix *weights;
+    const QuantizedMatrix *quantized;
+    const HalfMatrix *half;
+    const SparseMatrix *sparse;
+    InputQuantization input;
+    const Matrix *bias;
+    ActivationType activation;
+} ModelLayerSource;
+
+/**
+ * @brief A model file mapped read-only into memory. Layers are handed out as borrowed
+ * matrices over the mapping: nothing is read or copied up front, pages come in on first use and
+ * every process mapping the same file shares them through the page cache.
+ */
+class ModelFile
+{
+public:
+    /**
+     * @brief Maps path and validates the header and the layer table (magic, version,
+     * checksum, dims that chain, blocks inside the file and aligned). Exits (code 1) on failure
+     * @param path a model file
+     */
+    explicit ModelFile(const std::string &path);
+
+    /**
+     * @brief Destructor. Unmaps the file: matrices borrowed from it must be gone by then
+     */
+    ~ModelFile();
+
+    /**
+     * @brief The mapping belongs to this object
+     */
+    ModelFile(const ModelFile &) = delete;
+
+    /**
+     * @brief The mapping belongs to this object
+     */
+    ModelFile &operator=(const ModelFile &) = delete;
+
+    /**
+     * @brief layer count getter
+     * @return number of layers
+     */
+    int getLayerCount() const;
+
+    /**
+     * @brief dims getter
+     * @param layer index of the layer
+     * @return dims of the weights of that layer
+     */
+    MatrixDims layerDims(int layer) const;
+
+    /**
+     * @brief weights type getter
+     * @param layer index of the layer
+     * @return how the weights of that layer are stored
+     */
+    ModelWeightsType weightsType(int layer) const;
+
+    /**
+     * @brief weights of a ModelFp32 layer, borrowed from the mapping (no copy)
+     * @param layer index of the layer
+     * @return rows × cols matrix
+     */
+    Matrix weights(int layer) const;
+
+    /**
+     * @brief weights of a ModelInt8 layer, borrowed from the mapping (no copy)
+     * @param layer index of the layer
+     * @return rows × cols quantized matrix
+     */
+    QuantizedMatrix quantizedWeights(int layer) const;
+
+    /**
+     * @brief weights of a ModelFp16 or ModelBf16 layer, borrowed from the mapping (no copy)
+     * @param layer index of the layer
+     * @return rows × cols 16 bit matrix
+     */
+    HalfMatrix halfWeights(int layer) const;
+
+    /**
+     * @brief weights of a ModelCsr layer, borrowed from the mapping (no copy). The indices are
+     * checked first (see SparseMatrix::isValid()): exits (code 1) if they are not valid
+     * @param layer index of the layer
+     * @return rows × cols sparse matrix
+     */
+    SparseMatrix sparseWeights(int layer) const;
+
+    /**
+     * @brief input quantization getter
+     * @param layer index of a ModelInt8 layer
+     * @return how that layer quantizes its inputs
+     */
+    InputQuantization inputQuantization(int layer) const;
+
+    /**
+     * @brief bias of a layer, borrowed from the mapping (no copy)
+     * @param layer index of the layer
+     * @return rows × 1 matrix
+     */
+    Matrix bias(int layer) const;
+
+    /**
+     * @brief activation getter
+     * @param layer index of the layer
+     * @return the activation of that layer
+     */
+    ActivationType activation(int layer) const;
+
+    /**
+     * @brief Checks the checksum of every weights, bias and scales block. Reads the whole file
+     * @return true if all of them match
+     */
+    bool verify() const;
+
+    /**
+     * @brief Writes a model file
+     * @param path output path
+     * @param layers every layer
+     * @param layerCount number of layers
+     * @return true on success
+     */
+    static bool write(const std::string &path, const ModelLayerSource layers[], int layerCount);
+
+    /**
+     * @brief Writes a float model file
+     * @param path output path
+     * @param weights weights of every layer
+     * @param biases bias of every layer (a column vector with as many rows as the weights)
+     * @param activations activation of every layer
+     * @param layerCount number of layers
+     * @return true on success
+     */
+    static bool write(const std::string &path, const Matrix weights[], const Matrix biases[],
+                      const ActivationType activations[], int layerCount);
+
+private:
+    const unsigned char *_data;
+    size_t _size;
+    const ModelLayer *_layers;
+    int _layerCount;
+
+    /**
+     * @brief Header and layer table validation. Points _layers at the table on success
+     * @return true if the mapped file is a valid model
+     */
+    bool _validate();
+};
+
+#endif //MODELFILE_H
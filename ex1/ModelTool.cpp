@@ -0,0 +1,500 @@
+//
+// Created by user on 07/01/2020.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "BatchScorer.h"
+#include "MlpNetwork.h"
+#include "ModelFile.h"
+
+#define PACK "pack"
+#define VERIFY "verify"
+#define QUANTIZE "quantize"
+#define COMPARE "compare"
+#define CONVERT "convert"
+#define PRUNE "prune"
+#define SCORE "score"
+#define FP16 "fp16"
+#define BF16 "bf16"
+#define PACK_ARGS_COUNT (3 + MLP_SIZE * 2)
+#define VERIFY_ARGS_COUNT 3
+#define QUANTIZE_MIN_ARGS 4
+#define COMPARE_MIN_ARGS 5
+#define CONVERT_MIN_ARGS 5
+#define PRUNE_MIN_ARGS 5
+#define SCORE_MIN_ARGS 4
+#define SCORE_MIN_IMAGES 8192
+#define MIN_LATENCY_SECONDS 0.2
+#define ERROR_INVALID_PARAMETER "Error: invalid Parameters file: "
+#define ERROR_INVALID_IMG "Error: invalid image path or size: "
+#define ERROR_WRITE "Error: cannot write model file: "
+#define ERROR_CHECKSUM "Error: checksum mismatch in model file: "
+#define ERROR_NOT_FLOAT "Error: only float models can be converted: "
+#define ERROR_SPARSITY "Error: sparsity must be a number in [0, 1]: "
+#define USAGE_MSG "Usage:\n" \
+                  "\t./model_tool pack model w1 w2 w3 w4 b1 b2 b3 b4\n" \
+                  "\t\tpacks the 8 parameter files of ./mlpnetwork into one model file\n" \
+                  "\t./model_tool verify model\n" \
+                  "\t\tchecks every checksum of a model file and prints its layers\n" \
+                  "\t./model_tool quantize model int8model [image ...]\n" \
+                  "\t\tint8 weights with per-row scales. With images: static input scales\n" \
+                  "\t\tcalibrated on them and an accuracy report, else dynamic input scales\n" \
+                  "\t./model_tool convert model halfmodel fp16|bf16 [image ...]\n" \
+                  "\t\t16 bit float weights, with an accuracy report if there are images\n" \
+                  "\t./model_tool prune model sparsemodel sparsity [image ...]\n" \
+                  "\t\tsparse (CSR) weights keeping the largest 1 - sparsity of every layer,\n" \
+                  "\t\twith an accuracy report if there are images\n" \
+                  "\t./model_tool compare model othermodel image ...\n" \
+                  "\t\taccuracy delta and latency of othermodel against model\n" \
+                  "\t./model_tool score model image ...\n" \
+                  "\t\tdigit of every image, and the throughput of the images classified on\n" \
+                  "\t\tall cores (the images repeated into a set large enough to time)"
+
+const char *const activationNames[] = {"relu", "softmax"};
+const char *const weightsTypeNames[] = {"fp32", "int8", "fp16", "bf16", "csr"};
+
+/**
+ * Reads a raw float file into a matrix of the expected size.
+ * @param path the file
+ * @param mat matrix to fill, already of the expected size
+ * @return true on success
+ */
+bool readParameter(const std::string &path, Matrix &mat)
+{
+    std::ifstream is(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!is.is_open() || is.tellg() != (long int) (mat.getRows() * mat.getCols() * sizeof(float)))
+    {
+        return false;
+    }
+    is >> mat;
+    return true;
+}
+
+/**
+ * pack command: w1..w4 b1..b4 (dims of MlpNetwork.h) into one model file.
+ * @param argv the command line
+ * @return program exit status code
+ */
+int pack(char **argv)
+{
+    Matrix weights[MLP_SIZE];
+    Matrix biases[MLP_SIZE];
+    ActivationType activations[MLP_SIZE];
+    for (int i = 0; i < MLP_SIZE; i++)
+    {
+        weights[i] = Matrix(weightsDims[i].rows, weightsDims[i].cols);
+        biases[i] = Matrix(biasDims[i].rows, biasDims[i].cols);
+        activations[i] = i == MLP_SIZE - 1 ? Softmax : Relu;
+
+        const std::string weightsPath(argv[3 + i]);
+        const std::string biasPath(argv[3 + MLP_SIZE + i]);
+        if (!readParameter(weightsPath, weights[i]) || !readParameter(biasPath, biases[i]))
+        {
+            std::cerr << ERROR_INVALID_PARAMETER << (i + 1) << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!ModelFile::write(argv[2], weights, biases, activations, MLP_SIZE))
+    {
+        std::cerr << ERROR_WRITE << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * verify command: full checksum pass and a listing of the layers.
+ * @param path the model file
+ * @return program exit status code
+ */
+int verify(const std::string &path)
+{
+    const ModelFile model(path);
+    for (int i = 0; i < model.getLayerCount(); i++)
+    {
+        const MatrixDims weights = model.layerDims(i);
+        std::cout << "layer " << i + 1 << ": " << weights.rows << "x" << weights.cols
+                  << " " << weightsTypeNames[model.weightsType(i)] << " "
+                  << activationNames[model.activation(i)] << std::endl;
+    }
+
+    if (!model.verify())
+    {
+        std::cerr << ERROR_CHECKSUM << path << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "checksums OK" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Reads 28x28 images, vectorized. Exits (code 1) on an invalid image.
+ * @param paths image files
+ * @param count number of images
+ * @return the images
+ */
+std::vector<Matrix> readImages(char **paths, int count)
+{
+    std::vector<Matrix> images;
+    for (int i = 0; i < count; i++)
+    {
+        Matrix image(imgDims.rows, imgDims.cols);
+        if (!readParameter(paths[i], image))
+        {
+            std::cerr << ERROR_INVALID_IMG << paths[i] << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        images.push_back(std::move(image.vectorize()));
+    }
+    return images;
+}
+
+/**
+ * Average single image latency of a network, over the images in a loop.
+ * @param network the network
+ * @param images the images
+ * @return seconds per image
+ */
+double latency(const MlpNetwork &network, const std::vector<Matrix> &images)
+{
+    const auto start = std::chrono::steady_clock::now();
+    long calls = 0;
+    double elapsed = 0;
+    do
+    {
+        for (const Matrix &image : images)
+        {
+            network(image);
+        }
+        calls += (long) images.size();
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < MIN_LATENCY_SECONDS);
+    return elapsed / calls;
+}
+
+/**
+ * compare command: how far the digits of other are from the ones of reference.
+ * @param referencePath the reference model (usually the float one)
+ * @param otherPath the model to evaluate
+ * @param images the images to classify
+ * @return program exit status code
+ */
+int compare(const std::string &referencePath, const std::string &otherPath,
+            const std::vector<Matrix> &images)
+{
+    const ModelFile referenceModel(referencePath);
+    const ModelFile otherModel(otherPath);
+    const MlpNetwork reference(referenceModel);
+    const MlpNetwork other(otherModel);
+    const std::vector<Digit> expected = reference.classifyBatch(images);
+    const std::vector<Digit> actual = other.classifyBatch(images);
+
+    int agreements = 0;
+    double deltaSum = 0;
+    double deltaMax = 0;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        if (expected[i].value == actual[i].value)
+        {
+            agreements++;
+            const double delta = std::fabs(expected[i].probability - actual[i].probability);
+            deltaSum += delta;
+            deltaMax = std::max(deltaMax, delta);
+        }
+    }
+
+    std::ifstream referenceFile(referencePath, std::ios::binary | std::ios::ate);
+    std::ifstream otherFile(otherPath, std::ios::binary | std::ios::ate);
+    std::cout << "int8 kernel: " << gemmInt8Kernel() << ", 16 bit kernel: " << gemmHalfKernel()
+              << std::endl
+              << "images: " << images.size() << std::endl
+              << "top-1 agreement: " << agreements << "/" << images.size() << std::endl
+              << "probability delta (agreeing images): mean "
+              << (agreements > 0 ? deltaSum / agreements : 0) << ", max " << deltaMax
+              << std::endl
+              << "model size: " << referenceFile.tellg() << " -> " << otherFile.tellg()
+              << " bytes" << std::endl
+              << "latency: " << latency(reference, images) * 1e6 << " us -> "
+              << latency(other, images) * 1e6 << " us per image" << std::endl;
+
+    // the latency loop above ran the single image path, which counts the input sparsity
+    for (int i = 0; i < MLP_SIZE; i++)
+    {
+        const LayerSparsity sparsity = other.sparsity(i);
+        if (sparsity.vectors > 0)
+        {
+            std::cout << "layer " << i + 1 << " input density: " << sparsity.density
+                      << ", sparse path: " << sparsity.sparseShare * 100 << "% of "
+                      << sparsity.vectors << " images" << std::endl;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Borrows the weights and biases of a float model.
+ * @param model the model
+ * @param weights output, one matrix per layer
+ * @param biases output, one matrix per layer
+ * @return false if a layer isn't ModelFp32
+ */
+bool readFloatLayers(const ModelFile &model, std::vector<Matrix> &weights,
+                     std::vector<Matrix> &biases)
+{
+    for (int i = 0; i < model.getLayerCount(); i++)
+    {
+        if (model.weightsType(i) != ModelFp32)
+        {
+            return false;
+        }
+        weights[i] = model.weights(i);
+        biases[i] = model.bias(i);
+    }
+    return true;
+}
+
+/**
+ * quantize command: int8 copy of a float model, calibrated on images if there are any.
+ * @param inPath the float model
+ * @param outPath the int8 model to write
+ * @param images calibration images, may be empty
+ * @return program exit status code
+ */
+int quantize(const std::string &inPath, const std::string &outPath,
+             const std::vector<Matrix> &images)
+{
+    const ModelFile model(inPath);
+    const int layerCount = model.getLayerCount();
+    std::vector<Matrix> weights(layerCount);
+    std::vector<Matrix> biases(layerCount);
+    if (!readFloatLayers(model, weights, biases))
+    {
+        std::cerr << ERROR_NOT_FLOAT << inPath << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::vector<Dense> layers;
+    layers.reserve(layerCount);
+    for (int i = 0; i < layerCount; i++)
+    {
+        layers.emplace_back(weights[i], biases[i], model.activation(i));
+    }
+
+    // calibration: the range of every layer's input over the images
+    std::vector<float> minima(layerCount, std::numeric_limits<float>::max());
+    std::vector<float> maxima(layerCount, std::numeric_limits<float>::lowest());
+    for (const Matrix &image : images)
+    {
+        Matrix activation = image;
+        for (int i = 0; i < layerCount; i++)
+        {
+            const float *values = activation.data();
+            const int size = activation.getRows() * activation.getCols();
+            minima[i] = std::min(minima[i], *std::min_element(values, values + size));
+            maxima[i] = std::max(maxima[i], *std::max_element(values, values + size));
+            activation = layers[i](activation);
+        }
+    }
+
+    std::vector<QuantizedMatrix> quantized;
+    std::vector<ModelLayerSource> sources(layerCount);
+    quantized.reserve(layerCount);
+    for (int i = 0; i < layerCount; i++)
+    {
+        quantized.push_back(QuantizedMatrix::quantize(weights[i]));
+        const InputQuantization input = images.empty() ? InputQuantization{0, 0}
+                                                       : calibratedInput(minima[i], maxima[i]);
+        sources[i] = {nullptr, &quantized[i], nullptr, nullptr, input, &biases[i],
+                      model.activation(i)};
+    }
+
+    if (!ModelFile::write(outPath, sources.data(), layerCount))
+    {
+        std::cerr << ERROR_WRITE << outPath << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return images.empty() ? EXIT_SUCCESS : compare(inPath, outPath, images);
+}
+
+/**
+ * convert command: fp16 or bf16 copy of a float model, compared with it if there are images.
+ * @param inPath the float model
+ * @param outPath the 16 bit model to write
+ * @param format fp16 or bf16
+ * @param images images for the accuracy report, may be empty
+ * @return program exit status code
+ */
+int convert(const std::string &inPath, const std::string &outPath, HalfFormat format,
+            const std::vector<Matrix> &images)
+{
+    const ModelFile model(inPath);
+    const int layerCount = model.getLayerCount();
+    std::vector<Matrix> weights(layerCount);
+    std::vector<Matrix> biases(layerCount);
+    if (!readFloatLayers(model, weights, biases))
+    {
+        std::cerr << ERROR_NOT_FLOAT << inPath << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<HalfMatrix> halves;
+    std::vector<ModelLayerSource> sources(layerCount);
+    halves.reserve(layerCount);
+    for (int i = 0; i < layerCount; i++)
+    {
+        halves.push_back(HalfMatrix::convert(weights[i], format));
+        sources[i] = {nullptr, nullptr, &halves[i], nullptr, {0, 0}, &biases[i],
+                      model.activation(i)};
+    }
+
+    if (!ModelFile::write(outPath, sources.data(), layerCount))
+    {
+        std::cerr << ERROR_WRITE << outPath << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return images.empty() ? EXIT_SUCCESS : compare(inPath, outPath, images);
+}
+
+/**
+ * prune command: magnitude pruned sparse copy of a float model, compared with it if there are
+ * images.
+ * @param inPath the float model
+ * @param outPath the sparse model to write
+ * @param sparsity fraction of the weights of every layer to drop
+ * @param images images for the accuracy report, may be empty
+ * @return program exit status code
+ */
+int prune(const std::string &inPath, const std::string &outPath, double sparsity,
+          const std::vector<Matrix> &images)
+{
+    const ModelFile model(inPath);
+    const int layerCount = model.getLayerCount();
+    std::vector<Matrix> weights(layerCount);
+    std::vector<Matrix> biases(layerCount);
+    if (!readFloatLayers(model, weights, biases))
+    {
+        std::cerr << ERROR_NOT_FLOAT << inPath << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<SparseMatrix> pruned;
+    std::vector<ModelLayerSource> sources(layerCount);
+    pruned.reserve(layerCount);
+    for (int i = 0; i < layerCount; i++)
+    {
+        pruned.push_back(SparseMatrix::prune(weights[i], sparsity));
+        sources[i] = {nullptr, nullptr, nullptr, &pruned[i], {0, 0}, &biases[i],
+                      model.activation(i)};
+        std::cout << "layer " << i + 1 << ": " << pruned[i].getNonZeros() << " non-zeros, density "
+                  << pruned[i].density() << std::endl;
+    }
+
+    if (!ModelFile::write(outPath, sources.data(), layerCount))
+    {
+        std::cerr << ERROR_WRITE << outPath << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return images.empty() ? EXIT_SUCCESS : compare(inPath, outPath, images);
+}
+
+/**
+ * score command: the digits of the images and the throughput of BatchScorer on all cores. The
+ * set is repeated up to SCORE_MIN_IMAGES images so the timed run keeps every thread busy.
+ * @param path the model
+ * @param images the images
+ * @return program exit status code
+ */
+int score(const std::string &path, const std::vector<Matrix> &images)
+{
+    const ModelFile model(path);
+    const MlpNetwork network(model);
+
+    std::vector<Matrix> workload;
+    workload.reserve(SCORE_MIN_IMAGES + images.size());
+    while (workload.size() < SCORE_MIN_IMAGES)
+    {
+        workload.insert(workload.end(), images.begin(), images.end());
+    }
+
+    // the first run warms up the workspaces of the pool threads, the second one is timed
+    BatchScorer scorer(network);
+    scorer.score(workload);
+    const ScoreReport report = scorer.score(workload);
+
+    int agreements = 0;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        const Digit digit = report.digits[i];
+        std::cout << "image " << i + 1 << ": " << digit.value << " at probability "
+                  << digit.probability << std::endl;
+        agreements += network(images[i]).value == digit.value ? 1 : 0;
+    }
+    std::cout << "single image path agreement: " << agreements << "/" << images.size()
+              << std::endl
+              << report << std::endl;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Tool's main
+ * @param argc count of args
+ * @param argv args values
+ * @return program exit status code
+ */
+int main(int argc, char **argv)
+{
+    if (argc == PACK_ARGS_COUNT && std::string(argv[1]) == PACK)
+    {
+        return pack(argv);
+    }
+    if (argc == VERIFY_ARGS_COUNT && std::string(argv[1]) == VERIFY)
+    {
+        return verify(argv[2]);
+    }
+    if (argc >= QUANTIZE_MIN_ARGS && std::string(argv[1]) == QUANTIZE)
+    {
+        return quantize(argv[2], argv[3],
+                        readImages(argv + QUANTIZE_MIN_ARGS, argc - QUANTIZE_MIN_ARGS));
+    }
+    if (argc >= CONVERT_MIN_ARGS && std::string(argv[1]) == CONVERT &&
+        (std::string(argv[4]) == FP16 || std::string(argv[4]) == BF16))
+    {
+        return convert(argv[2], argv[3], std::string(argv[4]) == BF16 ? HalfBf16 : HalfFp16,
+                       readImages(argv + CONVERT_MIN_ARGS, argc - CONVERT_MIN_ARGS));
+    }
+    if (argc >= PRUNE_MIN_ARGS && std::string(argv[1]) == PRUNE)
+    {
+        char *end = nullptr;
+        const double sparsity = std::strtod(argv[4], &end);
+        if (end == argv[4] || *end != '\0' || !(sparsity >= 0 && sparsity <= 1))
+        {
+            std::cerr << ERROR_SPARSITY << argv[4] << std::endl;
+            return EXIT_FAILURE;
+        }
+        return prune(argv[2], argv[3], sparsity,
+                     readImages(argv + PRUNE_MIN_ARGS, argc - PRUNE_MIN_ARGS));
+    }
+    if (argc >= SCORE_MIN_ARGS && std::string(argv[1]) == SCORE)
+    {
+        return score(argv[2], readImages(argv + SCORE_MIN_ARGS - 1, argc - SCORE_MIN_ARGS + 1));
+    }
+    if (argc >= COMPARE_MIN_ARGS && std::string(argv[1]) == COMPARE)
+    {
+        return compare(argv[2], argv[3],
+                       readImages(argv + COMPARE_MIN_ARGS - 1, argc - COMPARE_MIN_ARGS + 1));
+    }
+
+    std::cout << USAGE_MSG << std::endl;
+    return EXIT_FAILURE;
+}
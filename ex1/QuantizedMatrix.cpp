@@ -0,0 +1,233 @@
+//
+// Created by user on 08/01/2020.
+//
+
+#include "QuantizedMatrix.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+/**
+ * @brief Static input quantization for values observed in [min, max] (e.g. on a calibration
+ * set): uses the full uint8 range when min >= 0, a symmetric range around 128 otherwise
+ * @param min smallest observed value
+ * @param max largest observed value
+ * @return the quantization parameters
+ */
+InputQuantization calibratedInput(float min, float max)
+{
+    if (min >= 0)
+    {
+        return {max > 0 ? max / UINT8_INPUT_MAX : 1.0f, 0};
+    }
+    const float magnitude = std::max(-min, max);
+    return {magnitude / (UINT8_INPUT_MAX - INPUT_SIGNED_ZERO_POINT), INPUT_SIGNED_ZERO_POINT};
+}
+
+/**
+ * @brief Quantizes the cols column vectors of a row-major k × cols float matrix into uint8 rows
+ * of stride bytes (column j goes to packed + j * stride, padded with zeros up to stride), the
+ * layout gemmInt8() takes as its B operand
+ * @param input the vectors, row-major k × cols
+ * @param inputStride distance (in floats) between consecutive rows of input
+ * @param k elements per vector
+ * @param cols number of vectors
+ * @param params the layer's input quantization (dynamic if scale is 0)
+ * @param packed output, cols × stride bytes
+ * @param stride distance (in bytes) between consecutive vectors in packed, at least k
+ * @param scales output, the scale of every vector
+ * @param zeroPoints output, the zero point of every vector
+ */
+void quantizeColumns(const float *input, const int inputStride, const int k, const int cols,
+                     const InputQuantization &params, uint8_t *packed, const int stride,
+                     float *scales, int32_t *zeroPoints)
+{
+    // a single image is already one contiguous vector, the columns of a batch are gathered
+    std::vector<float> column(cols == 1 && inputStride == 1 ? 0 : k);
+    for (int j = 0; j < cols; j++)
+    {
+        const float *vector = input + j;
+        if (!column.empty())
+        {
+            for (int p = 0; p < k; p++)
+            {
+                column[p] = input[(ptrdiff_t) p * inputStride + j];
+            }
+            vector = column.data();
+        }
+
+        InputQuantization quantization = params;
+        if (quantization.scale <= 0)
+        {
+            float min = 0;
+            float max = 0;
+            valueRange(vector, k, &min, &max);
+            quantization = calibratedInput(min, max);
+        }
+        scales[j] = quantization.scale;
+        zeroPoints[j] = quantization.zeroPoint;
+
+        uint8_t *out = packed + (ptrdiff_t) j * stride;
+        quantizeUint8(out, vector, k, 1 / quantization.scale, (float) quantization.zeroPoint);
+        std::memset(out + k, 0, stride - k);
+    }
+}
+
+/**
+ * @brief Constructs an empty 0×0 matrix
+ */
+QuantizedMatrix::QuantizedMatrix() :
+        _rows(0), _cols(0), _stride(0), _values(nullptr), _scales(nullptr), _rowSums(nullptr)
+{
+
+}
+
+/**
+ * @brief Per-row symmetric quantization of a float matrix: each row is scaled so its
+ * largest magnitude maps to INT8_WEIGHT_MAX
+ * @param weights the float matrix
+ * @return an owning quantized matrix
+ */
+QuantizedMatrix QuantizedMatrix::quantize(const Matrix &weights)
+{
+    QuantizedMatrix result;
+    result._rows = weights.getRows();
+    result._cols = weights.getCols();
+    result._stride = strideFor(result._cols);
+    result._ownedValues.assign((size_t) result._rows * result._stride, 0);
+    result._ownedScales.resize(result._rows);
+    result._ownedRowSums.resize(result._rows);
+
+    for (int i = 0; i < result._rows; i++)
+    {
+        const float *row = weights.data() + (ptrdiff_t) i * result._cols;
+        float magnitude = 0;
+        for (int p = 0; p < result._cols; p++)
+        {
+            magnitude = std::max(magnitude, std::fabs(row[p]));
+        }
+
+        const float scale = magnitude > 0 ? magnitude / INT8_WEIGHT_MAX : 1.0f;
+        int8_t *values = result._ownedValues.data() + (ptrdiff_t) i * result._stride;
+        int32_t sum = 0;
+        for (int p = 0; p < result._cols; p++)
+        {
+            values[p] = (int8_t) std::lrint(row[p] / scale);
+            sum += values[p];
+        }
+        result._ownedScales[i] = scale;
+        result._ownedRowSums[i] = sum;
+    }
+
+    result._values = result._ownedValues.data();
+    result._scales = result._ownedScales.data();
+    result._rowSums = result._ownedRowSums.data();
+    return result;
+}
+
+/**
+ * @brief Non-owning quantized matrix over existing arrays, which must outlive it
+ * @param values rows × stride int8 values, stride = getStride() for cols
+ * @param scales rows scales
+ * @param rowSums rows sums of the values of each row
+ * @param rows rows of the matrix
+ * @param cols cols of the matrix
+ * @return a matrix viewing the arrays
+ */
+QuantizedMatrix QuantizedMatrix::borrow(const int8_t *values, const float *scales,
+                                        const int32_t *rowSums, int rows, int cols)
+{
+    QuantizedMatrix result;
+    result._rows = rows;
+    result._cols = cols;
+    result._stride = strideFor(cols);
+    result._values = values;
+    result._scales = scales;
+    result._rowSums = rowSums;
+    return result;
+}
+
+/**
+ * @brief Row stride of a rows × cols quantized matrix
+ * @param cols cols of the matrix
+ * @return cols rounded up to INT8_ROW_ALIGNMENT
+ */
+int QuantizedMatrix::strideFor(int cols)
+{
+    return (cols + INT8_ROW_ALIGNMENT - 1) / INT8_ROW_ALIGNMENT * INT8_ROW_ALIGNMENT;
+}
+
+/**
+ * @brief rows getter
+ * @return rows of the matrix
+ */
+int QuantizedMatrix::getRows() const
+{
+    return _rows;
+}
+
+/**
+ * @brief cols getter
+ * @return cols of the matrix (without padding)
+ */
+int QuantizedMatrix::getCols() const
+{
+    return _cols;
+}
+
+/**
+ * @brief stride getter
+ * @return distance (in bytes) between consecutive rows
+ */
+int QuantizedMatrix::getStride() const
+{
+    return _stride;
+}
+
+/**
+ * @brief values getter
+ * @return rows × getStride() int8 values
+ */
+const int8_t *QuantizedMatrix::data() const
+{
+    return _values;
+}
+
+/**
+ * @brief scales getter
+ * @return the scale of every row
+ */
+const float *QuantizedMatrix::scales() const
+{
+    return _scales;
+}
+
+/**
+ * @brief row sums getter
+ * @return the sum of the values of every row
+ */
+const int32_t *QuantizedMatrix::rowSums() const
+{
+    return _rowSums;
+}
+
+/**
+ * @brief Back to float (scales[i] * q[i][p]), e.g. to measure the quantization error
+ * @return rows × cols float matrix
+ */
+Matrix QuantizedMatrix::dequantize() const
+{
+    Matrix result(_rows, _cols);
+    for (int i = 0; i < _rows; i++)
+    {
+        const int8_t *values = _values + (ptrdiff_t) i * _stride;
+        float *row = result.data() + (ptrdiff_t) i * _cols;
+        for (int p = 0; p < _cols; p++)
+        {
+            row[p] = _scales[i] * values[p];
+        }
+    }
+    return result;
+}
@@ -0,0 +1,171 @@
+//QuantizedMatrix.h
+#ifndef QUANTIZEDMATRIX_H
+#define QUANTIZEDMATRIX_H
+
+#include <cstdint>
+#include <vector>
+
+#include "GemmInt8.h"
+#include "Matrix.h"
+
+/**
+ * @brief Largest magnitude of a quantized weight (symmetric int8, -128 is never used)
+ */
+#define INT8_WEIGHT_MAX 127
+
+/**
+ * @brief Largest quantized input value (uint8)
+ */
+#define UINT8_INPUT_MAX 255
+
+/**
+ * @brief Zero point of inputs that can be negative: value v is stored as v / scale + 128
+ */
+#define INPUT_SIGNED_ZERO_POINT 128
+
+/**
+ * @struct InputQuantization
+ * @brief How the input vectors of an int8 layer are quantized: v ≈ scale * (q - zeroPoint),
+ * q in [0, 255]. A scale of 0 means dynamic: every vector gets the scale of its own range
+ * @var scale - step between two quantized values, or 0 (dynamic)
+ * @var zeroPoint - 0 for inputs known to be non-negative, INPUT_SIGNED_ZERO_POINT otherwise
+ */
+typedef struct InputQuantization
+{
+    float scale;
+    int32_t zeroPoint;
+} InputQuantization;
+
+/**
+ * @brief Static input quantization for values observed in [min, max] (e.g. on a calibration
+ * set): uses the full uint8 range when min >= 0, a symmetric range around 128 otherwise
+ * @param min smallest observed value
+ * @param max largest observed value
+ * @return the quantization parameters
+ */
+InputQuantization calibratedInput(float min, float max);
+
+/**
+ * @brief Quantizes the cols column vectors of a row-major k × cols float matrix into uint8 rows
+ * of stride bytes (column j goes to packed + j * stride, padded with zeros up to stride), the
+ * layout gemmInt8() takes as its B operand
+ * @param input the vectors, row-major k × cols
+ * @param inputStride distance (in floats) between consecutive rows of input
+ * @param k elements per vector
+ * @param cols number of vectors
+ * @param params the layer's input quantization (dynamic if scale is 0)
+ * @param packed output, cols × stride bytes
+ * @param stride distance (in bytes) between consecutive vectors in packed, at least k
+ * @param scales output, the scale of every vector
+ * @param zeroPoints output, the zero point of every vector
+ */
+void quantizeColumns(const float *input, int inputStride, int k, int cols,
+                     const InputQuantization &params, uint8_t *packed, int stride, float *scales,
+                     int32_t *zeroPoints);
+
+/**
+ * @brief Weight matrix stored as int8 with one scale per row: W[i][p] ≈ scales[i] * q[i][p].
+ * Rows are padded with zeros to a multiple of INT8_ROW_ALIGNMENT bytes and the sum of every
+ * row is kept, which is what gemmInt8() needs to undo the input zero point. The values are
+ * either owned (quantize()) or borrowed from a model file (borrow()).
+ */
+class QuantizedMatrix
+{
+public:
+    /**
+     * @brief Constructs an empty 0×0 matrix
+     */
+    QuantizedMatrix();
+
+    /**
+     * @brief Per-row symmetric quantization of a float matrix: each row is scaled so its
+     * largest magnitude maps to INT8_WEIGHT_MAX
+     * @param weights the float matrix
+     * @return an owning quantized matrix
+     */
+    static QuantizedMatrix quantize(const Matrix &weights);
+
+    /**
+     * @brief Non-owning quantized matrix over existing arrays, which must outlive it
+     * @param values rows × stride int8 values, stride = getStride() for cols
+     * @param scales rows scales
+     * @param rowSums rows sums of the values of each row
+     * @param rows rows of the matrix
+     * @param cols cols of the matrix
+     * @return a matrix viewing the arrays
+     */
+    static QuantizedMatrix borrow(const int8_t *values, const float *scales,
+                                  const int32_t *rowSums, int rows, int cols);
+
+    /**
+     * @brief Row stride of a rows × cols quantized matrix
+     * @param cols cols of the matrix
+     * @return cols rounded up to INT8_ROW_ALIGNMENT
+     */
+    static int strideFor(int cols);
+
+    /**
+     * @brief The owned arrays move with the matrix, views into them stay valid
+     */
+    QuantizedMatrix(QuantizedMatrix &&other) noexcept = default;
+
+    /**
+     * @brief The owned arrays move with the matrix, views into them stay valid
+     */
+    QuantizedMatrix &operator=(QuantizedMatrix &&other) noexcept = default;
+
+    /**
+     * @brief rows getter
+     * @return rows of the matrix
+     */
+    int getRows() const;
+
+    /**
+     * @brief cols getter
+     * @return cols of the matrix (without padding)
+     */
+    int getCols() const;
+
+    /**
+     * @brief stride getter
+     * @return distance (in bytes) between consecutive rows
+     */
+    int getStride() const;
+
+    /**
+     * @brief values getter
+     * @return rows × getStride() int8 values
+     */
+    const int8_t *data() const;
+
+    /**
+     * @brief scales getter
+     * @return the scale of every row
+     */
+    const float *scales() const;
+
+    /**
+     * @brief row sums getter
+     * @return the sum of the values of every row
+     */
+    const int32_t *rowSums() const;
+
+    /**
+     * @brief Back to float (scales[i] * q[i][p]), e.g. to measure the quantization error
+     * @return rows × cols float matrix
+     */
+    Matrix dequantize() const;
+
+private:
+    int _rows;
+    int _cols;
+    int _stride;
+    std::vector<int8_t> _ownedValues;
+    std::vector<float> _ownedScales;
+    std::vector<int32_t> _ownedRowSums;
+    const int8_t *_values;
+    const float *_scales;
+    const int32_t *_rowSums;
+};
+
+#endif //QUANTIZEDMATRIX_H
@@ -0,0 +1,351 @@
+//
+// Created by user on 03/01/2020.
+//
+
+#include "Simd.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+// ------------------------------------------------ scalar ----------------------------------------
+
+/**
+ * @brief Relu on a single float, shared by every tail loop so all paths agree bit for bit
+ */
+static inline float reluScalar(float x)
+{
+    return x >= 0 ? x : 0.0f;
+}
+
+static void fillScalar(float *dst, float value, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        dst[i] = value;
+    }
+}
+
+/**
+ * @brief memmove is already vectorized (and dispatched) by the C library, every table uses it
+ */
+static void copyScalar(float *dst, const float *src, int n)
+{
+    if (dst != src && n > 0)
+    {
+        std::memmove(dst, src, n * sizeof(float));
+    }
+}
+
+static void addScalar(float *dst, const float *a, const float *b, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+static void scaleScalar(float *dst, const float *src, float c, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        dst[i] = c * src[i];
+    }
+}
+
+static void reluScalarArray(float *dst, const float *src, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        dst[i] = reluScalar(src[i]);
+    }
+}
+
+#if SIMD_X86
+
+// ------------------------------------------------ SSE2 ------------------------------------------
+
+__attribute__((target("sse2")))
+static void fillSse2(float *dst, float value, int n)
+{
+    const __m128 v = _mm_set1_ps(value);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm_storeu_ps(dst + i, v);
+    }
+    fillScalar(dst + i, value, n - i);
+}
+
+__attribute__((target("sse2")))
+static void addSse2(float *dst, const float *a, const float *b, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    addScalar(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void scaleSse2(float *dst, const float *src, float c, int n)
+{
+    const __m128 vc = _mm_set1_ps(c);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm_storeu_ps(dst + i, _mm_mul_ps(vc, _mm_loadu_ps(src + i)));
+    }
+    scaleScalar(dst + i, src + i, c, n - i);
+}
+
+/**
+ * @brief x >= 0 ? x : 0 as compare-and-mask (not max) so -0.0 and NaN match the scalar version
+ */
+__attribute__((target("sse2")))
+static void reluSse2(float *dst, const float *src, int n)
+{
+    const __m128 zero = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps(src + i);
+        _mm_storeu_ps(dst + i, _mm_and_ps(_mm_cmpge_ps(x, zero), x));
+    }
+    reluScalarArray(dst + i, src + i, n - i);
+}
+
+// ------------------------------------------------ AVX2 ------------------------------------------
+
+__attribute__((target("avx2")))
+static void fillAvx2(float *dst, float value, int n)
+{
+    const __m256 v = _mm256_set1_ps(value);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(dst + i, v);
+    }
+    fillScalar(dst + i, value, n - i);
+}
+
+__attribute__((target("avx2")))
+static void addAvx2(float *dst, const float *a, const float *b, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 sum = _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        _mm256_storeu_ps(dst + i, sum);
+    }
+    addScalar(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void scaleAvx2(float *dst, const float *src, float c, int n)
+{
+    const __m256 vc = _mm256_set1_ps(c);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(vc, _mm256_loadu_ps(src + i)));
+    }
+    scaleScalar(dst + i, src + i, c, n - i);
+}
+
+__attribute__((target("avx2")))
+static void reluAvx2(float *dst, const float *src, int n)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(src + i);
+        _mm256_storeu_ps(dst + i, _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GE_OQ), x));
+    }
+    reluScalarArray(dst + i, src + i, n - i);
+}
+
+// ------------------------------------------------ AVX-512 ---------------------------------------
+
+/**
+ * @brief Mask of the first n (< 16) lanes, used for the tails
+ */
+__attribute__((target("avx512f")))
+static inline __mmask16 tailMask(int n)
+{
+    return (__mmask16) ((1u << n) - 1u);
+}
+
+__attribute__((target("avx512f")))
+static void fillAvx512(float *dst, float value, int n)
+{
+    const __m512 v = _mm512_set1_ps(value);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        _mm512_storeu_ps(dst + i, v);
+    }
+    if (i < n)
+    {
+        _mm512_mask_storeu_ps(dst + i, tailMask(n - i), v);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void addAvx512(float *dst, const float *a, const float *b, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m512 sum = _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        _mm512_storeu_ps(dst + i, sum);
+    }
+    if (i < n)
+    {
+        const __mmask16 mask = tailMask(n - i);
+        const __m512 sum = _mm512_add_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                                         _mm512_maskz_loadu_ps(mask, b + i));
+        _mm512_mask_storeu_ps(dst + i, mask, sum);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void scaleAvx512(float *dst, const float *src, float c, int n)
+{
+    const __m512 vc = _mm512_set1_ps(c);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        _mm512_storeu_ps(dst + i, _mm512_mul_ps(vc, _mm512_loadu_ps(src + i)));
+    }
+    if (i < n)
+    {
+        const __mmask16 mask = tailMask(n - i);
+        const __m512 x = _mm512_maskz_loadu_ps(mask, src + i);
+        _mm512_mask_storeu_ps(dst + i, mask, _mm512_mul_ps(vc, x));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void reluAvx512(float *dst, const float *src, int n)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m512 x = _mm512_loadu_ps(src + i);
+        const __mmask16 positive = _mm512_cmp_ps_mask(x, zero, _CMP_GE_OQ);
+        _mm512_storeu_ps(dst + i, _mm512_maskz_mov_ps(positive, x));
+    }
+    if (i < n)
+    {
+        const __mmask16 mask = tailMask(n - i);
+        const __m512 x = _mm512_maskz_loadu_ps(mask, src + i);
+        _mm512_mask_storeu_ps(dst + i, mask,
+                              _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x, zero, _CMP_GE_OQ), x));
+    }
+}
+
+#endif // SIMD_X86
+
+// ------------------------------------------------ dispatch --------------------------------------
+
+/**
+ * @brief Reads SIMD_ENV_VAR
+ * @return the strongest instruction set the user allows
+ */
+static SimdIsa isaCap()
+{
+    const char *cap = std::getenv(SIMD_ENV_VAR);
+    if (cap == nullptr)
+    {
+        return SimdAvx512;
+    }
+    if (std::strcmp(cap, "scalar") == 0)
+    {
+        return SimdScalar;
+    }
+    if (std::strcmp(cap, "sse2") == 0)
+    {
+        return SimdSse2;
+    }
+    if (std::strcmp(cap, "avx2") == 0)
+    {
+        return SimdAvx2;
+    }
+    return SimdAvx512;
+}
+
+/**
+ * @brief Asks CPUID (through the compiler's cpu model, which also checks that the OS saves the
+ * wide registers) for the best supported instruction set
+ */
+static SimdIsa detectIsa()
+{
+    SimdIsa best = SimdScalar;
+#if SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        best = SimdAvx512;
+    }
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        best = SimdAvx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        best = SimdSse2;
+    }
+#endif
+    const SimdIsa cap = isaCap();
+    return best < cap ? best : cap;
+}
+
+/**
+ * @brief The instruction set this process runs on: the best one CPUID reports (capped by
+ * SIMD_ENV_VAR). Detected once, on first use
+ * @return the active instruction set
+ */
+SimdIsa simdIsa()
+{
+    static const SimdIsa isa = detectIsa();
+    return isa;
+}
+
+/**
+ * @brief Builds the kernel table of an instruction set
+ */
+static SimdKernels makeKernels(SimdIsa isa)
+{
+    switch (isa)
+    {
+#if SIMD_X86
+        case SimdAvx512:
+            return {SimdAvx512, "avx512", fillAvx512, copyScalar, addAvx512, scaleAvx512,
+                    reluAvx512};
+        case SimdAvx2:
+            return {SimdAvx2, "avx2", fillAvx2, copyScalar, addAvx2, scaleAvx2, reluAvx2};
+        case SimdSse2:
+            return {SimdSse2, "sse2", fillSse2, copyScalar, addSse2, scaleSse2, reluSse2};
+#endif
+        default:
+            return {SimdScalar, "scalar", fillScalar, copyScalar, addScalar, scaleScalar,
+                    reluScalarArray};
+    }
+}
+
+/**
+ * @brief The kernel table for simdIsa(). Selected once, on first use
+ * @return ref to the active kernels
+ */
+const SimdKernels &simdKernels()
+{
+    static const SimdKernels kernels = makeKernels(simdIsa());
+    return kernels;
+}
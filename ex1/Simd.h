@@ -0,0 +1,69 @@
+//Simd.h
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#else
+#define SIMD_X86 0
+#endif
+
+/**
+ * @brief Environment variable that caps the instruction set picked at startup. One of
+ * scalar, sse2, avx2, avx512. Handy for comparing the paths on one machine
+ */
+#define SIMD_ENV_VAR "MLP_SIMD"
+
+/**
+ * @enum SimdIsa
+ * @brief Instruction set levels the kernels are compiled for, from weakest to strongest.
+ * SimdAvx2 also implies FMA.
+ */
+enum SimdIsa
+{
+    SimdScalar,
+    SimdSse2,
+    SimdAvx2,
+    SimdAvx512
+};
+
+/**
+ * @struct SimdKernels
+ * @brief Elementwise float kernels for one instruction set. All kernels give bit-identical
+ * results on every instruction set (no FMA, no reassociation). dst may be equal to a source.
+ */
+typedef struct SimdKernels
+{
+    SimdIsa isa;
+    const char *name;
+
+    /** dst[i] = value */
+    void (*fill)(float *dst, float value, int n);
+
+    /** dst[i] = src[i] */
+    void (*copy)(float *dst, const float *src, int n);
+
+    /** dst[i] = a[i] + b[i] */
+    void (*add)(float *dst, const float *a, const float *b, int n);
+
+    /** dst[i] = c * src[i] */
+    void (*scale)(float *dst, const float *src, float c, int n);
+
+    /** dst[i] = src[i] >= 0 ? src[i] : 0 */
+    void (*relu)(float *dst, const float *src, int n);
+} SimdKernels;
+
+/**
+ * @brief The instruction set this process runs on: the best one CPUID reports (capped by
+ * SIMD_ENV_VAR). Detected once, on first use
+ * @return the active instruction set
+ */
+SimdIsa simdIsa();
+
+/**
+ * @brief The kernel table for simdIsa(). Selected once, on first use
+ * @return ref to the active kernels
+ */
+const SimdKernels &simdKernels();
+
+#endif //SIMD_H
@@ -0,0 +1,74 @@
+//SimdReduce.h
+#ifndef SIMDREDUCE_H
+#define SIMDREDUCE_H
+
+#include <cstdint>
+
+#include "Simd.h"
+
+#if SIMD_X86
+
+#include <immintrin.h>
+
+// the horizontal sums of the SIMD kernels (one per dot product they reduce), each compiled for
+// the instruction set of its register type so that kernels of that level or above inline it
+
+/**
+ * @brief Sum of the 4 lanes of an SSE register
+ */
+__attribute__((target("sse3")))
+inline float horizontalSum(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_movehdup_ps(v));
+    return _mm_cvtss_f32(v);
+}
+
+/**
+ * @brief Sum of the 8 lanes of an AVX register
+ */
+__attribute__((target("avx")))
+inline float horizontalSum(__m256 v)
+{
+    return horizontalSum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+/**
+ * @brief Sum of the 16 lanes of an AVX-512 register. Goes through memory: GCC 12 reports a
+ * bogus maybe-uninitialized (fatal under -Werror) for the zmm extract and shuffle intrinsics
+ */
+__attribute__((target("avx512f")))
+inline float horizontalSum(__m512 v)
+{
+    alignas(__m512) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    return horizontalSum(_mm256_add_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes + 8)));
+}
+
+/**
+ * @brief Sum of the 8 int32 lanes of an AVX register
+ */
+__attribute__((target("avx2")))
+inline int32_t horizontalSum(__m256i v)
+{
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+/**
+ * @brief Sum of the 16 int32 lanes of an AVX-512 register, through memory like the float one
+ */
+__attribute__((target("avx512f")))
+inline int32_t horizontalSum(__m512i v)
+{
+    alignas(__m512i) int32_t lanes[16];
+    _mm512_store_si512(lanes, v);
+    return horizontalSum(_mm256_add_epi32(_mm256_load_si256((const __m256i *) lanes),
+                                          _mm256_load_si256((const __m256i *) (lanes + 8))));
+}
+
+#endif // SIMD_X86
+
+#endif //SIMDREDUCE_H
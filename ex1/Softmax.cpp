@@ -0,0 +1,524 @@
+//
+// Created by user on 12/01/2020.
+//
+
+#include "Softmax.h"
+#include "AlignedBuffer.h"
+#include "Simd.h"
+#include "SimdReduce.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Range reduction and polynomial of softmaxExp() (Cephes expf): ln 2 is split in a part
+ * exact in float and a correction, so x - n * ln 2 loses no bits
+ */
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_LN2_HIGH 0.693359375f
+#define EXP_LN2_LOW (-2.12194440e-4f)
+#define EXP_P0 1.9875691500e-4f
+#define EXP_P1 1.3981999507e-3f
+#define EXP_P2 8.3334519073e-3f
+#define EXP_P3 4.1665795894e-2f
+#define EXP_P4 1.6666665459e-1f
+#define EXP_P5 5.0000001201e-1f
+
+/**
+ * @brief An instruction set's sum of exp(values[i] - shift), also writing the exponentials to
+ * dst unless it is nullptr (dst may be values)
+ */
+typedef float (*ExpSumKernel)(const float *values, int n, float shift, float *dst);
+
+/**
+ * @brief An instruction set's softmax() of the first cols columns, rows ld floats apart
+ */
+typedef void (*ColumnsKernel)(float *values, int rows, int cols, int ld);
+
+/**
+ * @brief An instruction set's softmaxTop() of the first cols columns, rows ld floats apart
+ */
+typedef void (*TopColumnsKernel)(const float *logits, int rows, int cols, int ld,
+                                 Digit *results);
+
+/**
+ * @struct SoftmaxKernels
+ * @brief The kernels of one instruction set
+ */
+typedef struct SoftmaxKernels
+{
+    ExpSumKernel expSum;
+    ColumnsKernel columns;
+    TopColumnsKernel topColumns;
+} SoftmaxKernels;
+
+/**
+ * @brief Fast exponential: exp(x) = 2^n * exp(r), n = round(x / ln 2), |r| <= ln(2) / 2, exp(r)
+ * being a degree 7 polynomial (Cephes expf). The scalar version of the SIMD exponential of the
+ * softmax kernels, relative error below SOFTMAX_EXP_MAX_ERROR
+ * @param x the exponent, clamped to [SOFTMAX_EXP_MIN, SOFTMAX_EXP_MAX]
+ * @return exp(x)
+ */
+float softmaxExp(float x)
+{
+    x = std::fmin(std::fmax(x, SOFTMAX_EXP_MIN), SOFTMAX_EXP_MAX);
+    const float n = std::floor(x * EXP_LOG2E + 0.5f);
+    float r = x - n * EXP_LN2_HIGH;
+    r = r - n * EXP_LN2_LOW;
+
+    float y = EXP_P0;
+    y = y * r + EXP_P1;
+    y = y * r + EXP_P2;
+    y = y * r + EXP_P3;
+    y = y * r + EXP_P4;
+    y = y * r + EXP_P5;
+    y = y * (r * r) + r + 1.0f;
+
+    // 2^n built in the exponent field, n in [-126, 127]
+    const uint32_t bits = (uint32_t) ((int32_t) n + 127) << 23;
+    float power;
+    std::memcpy(&power, &bits, sizeof(power));
+    return y * power;
+}
+
+/**
+ * @brief Portable sum of exponentials: softmaxExp() per entry
+ */
+static float portableExpSum(const float *values, int n, float shift, float *dst)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++)
+    {
+        const float e = softmaxExp(values[i] - shift);
+        if (dst != nullptr)
+        {
+            dst[i] = e;
+        }
+        sum += e;
+    }
+    return sum;
+}
+
+/**
+ * @brief Portable column softmax: max, exponentials and scale down each column in turn
+ */
+static void portableColumns(float *values, int rows, int cols, int ld)
+{
+    for (int j = 0; j < cols; j++)
+    {
+        float *column = values + j;
+        float max = column[0];
+        for (int i = 1; i < rows; i++)
+        {
+            max = std::fmax(max, column[(ptrdiff_t) i * ld]);
+        }
+
+        float sum = 0.0f;
+        for (int i = 0; i < rows; i++)
+        {
+            float &value = column[(ptrdiff_t) i * ld];
+            value = softmaxExp(value - max);
+            sum += value;
+        }
+
+        const float scale = 1.0f / sum;
+        for (int i = 0; i < rows; i++)
+        {
+            column[(ptrdiff_t) i * ld] *= scale;
+        }
+    }
+}
+
+/**
+ * @brief Portable top class: argmax, then the sum of exponentials of each column
+ */
+static void portableTopColumns(const float *logits, int rows, int cols, int ld, Digit *results)
+{
+    for (int j = 0; j < cols; j++)
+    {
+        const float *column = logits + j;
+        unsigned int index = 0;
+        for (int i = 1; i < rows; i++)
+        {
+            if (column[(ptrdiff_t) i * ld] > column[(ptrdiff_t) index * ld])
+            {
+                index = i;
+            }
+        }
+
+        const float max = column[(ptrdiff_t) index * ld];
+        float sum = 0.0f;
+        for (int i = 0; i < rows; i++)
+        {
+            sum += softmaxExp(column[(ptrdiff_t) i * ld] - max);
+        }
+        results[j] = {index, 1.0f / sum};
+    }
+}
+
+#if SIMD_X86
+
+/**
+ * @brief softmaxExp() on 8 lanes, the polynomial evaluated with FMAs
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256 avx2Exp(__m256 x)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(SOFTMAX_EXP_MIN)),
+                      _mm256_set1_ps(SOFTMAX_EXP_MAX));
+    const __m256 n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(EXP_LOG2E),
+                                                     _mm256_set1_ps(0.5f)));
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_LN2_HIGH), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_LN2_LOW), r);
+
+    __m256 y = _mm256_set1_ps(EXP_P0);
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(EXP_P1));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(EXP_P2));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(EXP_P3));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(EXP_P4));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(EXP_P5));
+    y = _mm256_add_ps(_mm256_fmadd_ps(y, _mm256_mul_ps(r, r), r), _mm256_set1_ps(1.0f));
+
+    const __m256i exponent = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(exponent, 23)));
+}
+
+/**
+ * @brief AVX2 sum of exponentials, 8 entries per vector and a masked tail
+ */
+__attribute__((target("avx2,fma")))
+static float avx2ExpSum(const float *values, int n, float shift, float *dst)
+{
+    const __m256 vshift = _mm256_set1_ps(shift);
+    __m256 sum = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 e = avx2Exp(_mm256_sub_ps(_mm256_loadu_ps(values + i), vshift));
+        if (dst != nullptr)
+        {
+            _mm256_storeu_ps(dst + i, e);
+        }
+        sum = _mm256_add_ps(sum, e);
+    }
+    if (i < n)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - i),
+                                                _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        const __m256 x = _mm256_maskload_ps(values + i, mask);
+        const __m256 e = _mm256_and_ps(avx2Exp(_mm256_sub_ps(x, vshift)),
+                                       _mm256_castsi256_ps(mask));
+        if (dst != nullptr)
+        {
+            _mm256_maskstore_ps(dst + i, mask, e);
+        }
+        sum = _mm256_add_ps(sum, e);
+    }
+    return horizontalSum(sum);
+}
+
+/**
+ * @brief AVX2 column softmax: 8 columns per register, each lane running the column's max, sum
+ * and scale on its own. The last (up to 7) columns run portableColumns()
+ */
+__attribute__((target("avx2,fma")))
+static void avx2Columns(float *values, int rows, int cols, int ld)
+{
+    int j = 0;
+    for (; j + 8 <= cols; j += 8)
+    {
+        float *block = values + j;
+        __m256 max = _mm256_loadu_ps(block);
+        for (int i = 1; i < rows; i++)
+        {
+            max = _mm256_max_ps(max, _mm256_loadu_ps(block + (ptrdiff_t) i * ld));
+        }
+
+        __m256 sum = _mm256_setzero_ps();
+        for (int i = 0; i < rows; i++)
+        {
+            float *row = block + (ptrdiff_t) i * ld;
+            const __m256 e = avx2Exp(_mm256_sub_ps(_mm256_loadu_ps(row), max));
+            _mm256_storeu_ps(row, e);
+            sum = _mm256_add_ps(sum, e);
+        }
+
+        const __m256 scale = _mm256_div_ps(_mm256_set1_ps(1.0f), sum);
+        for (int i = 0; i < rows; i++)
+        {
+            float *row = block + (ptrdiff_t) i * ld;
+            _mm256_storeu_ps(row, _mm256_mul_ps(_mm256_loadu_ps(row), scale));
+        }
+    }
+
+    portableColumns(values + j, rows, cols - j, ld);
+}
+
+/**
+ * @brief AVX2 top class: 8 columns per register, the running argmax kept per lane with
+ * blends. The last (up to 7) columns run portableTopColumns()
+ */
+__attribute__((target("avx2,fma")))
+static void avx2TopColumns(const float *logits, int rows, int cols, int ld, Digit *results)
+{
+    int j = 0;
+    for (; j + 8 <= cols; j += 8)
+    {
+        const float *block = logits + j;
+        __m256 max = _mm256_loadu_ps(block);
+        __m256i index = _mm256_setzero_si256();
+        for (int i = 1; i < rows; i++)
+        {
+            const __m256 x = _mm256_loadu_ps(block + (ptrdiff_t) i * ld);
+            const __m256 greater = _mm256_cmp_ps(x, max, _CMP_GT_OQ);
+            max = _mm256_blendv_ps(max, x, greater);
+            index = _mm256_blendv_epi8(index, _mm256_set1_epi32(i), _mm256_castps_si256(greater));
+        }
+
+        __m256 sum = _mm256_setzero_ps();
+        for (int i = 0; i < rows; i++)
+        {
+            const __m256 x = _mm256_loadu_ps(block + (ptrdiff_t) i * ld);
+            sum = _mm256_add_ps(sum, avx2Exp(_mm256_sub_ps(x, max)));
+        }
+
+        alignas(BUFFER_ALIGNMENT) int32_t indices[8];
+        alignas(BUFFER_ALIGNMENT) float probabilities[8];
+        _mm256_store_si256((__m256i *) indices, index);
+        _mm256_store_ps(probabilities, _mm256_div_ps(_mm256_set1_ps(1.0f), sum));
+        for (int l = 0; l < 8; l++)
+        {
+            results[j + l] = {(unsigned int) indices[l], probabilities[l]};
+        }
+    }
+
+    portableTopColumns(logits + j, rows, cols - j, ld, results + j);
+}
+
+/**
+ * @brief Full mask for the zmm intrinsics whose unmasked forms GCC 12 flags as reading an
+ * uninitialized register (maybe-uninitialized, fatal under -Werror)
+ */
+#define SOFTMAX_ALL_LANES ((__mmask16) 0xFFFF)
+
+/**
+ * @brief softmaxExp() on 16 lanes, the polynomial evaluated with FMAs and 2^n applied by
+ * vscalefps
+ */
+__attribute__((target("avx512f")))
+static inline __m512 avx512Exp(__m512 x)
+{
+    x = _mm512_maskz_min_ps(SOFTMAX_ALL_LANES,
+                            _mm512_maskz_max_ps(SOFTMAX_ALL_LANES, x,
+                                                _mm512_set1_ps(SOFTMAX_EXP_MIN)),
+                            _mm512_set1_ps(SOFTMAX_EXP_MAX));
+    const __m512 n = _mm512_maskz_roundscale_ps(SOFTMAX_ALL_LANES,
+                                                _mm512_fmadd_ps(x, _mm512_set1_ps(EXP_LOG2E),
+                                                                _mm512_set1_ps(0.5f)),
+                                                _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(EXP_LN2_HIGH), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(EXP_LN2_LOW), r);
+
+    __m512 y = _mm512_set1_ps(EXP_P0);
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(EXP_P1));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(EXP_P2));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(EXP_P3));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(EXP_P4));
+    y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(EXP_P5));
+    y = _mm512_add_ps(_mm512_fmadd_ps(y, _mm512_mul_ps(r, r), r), _mm512_set1_ps(1.0f));
+    return _mm512_maskz_scalef_ps(SOFTMAX_ALL_LANES, y, n);
+}
+
+/**
+ * @brief AVX-512 sum of exponentials, 16 entries per vector and a masked tail
+ */
+__attribute__((target("avx512f")))
+static float avx512ExpSum(const float *values, int n, float shift, float *dst)
+{
+    const __m512 vshift = _mm512_set1_ps(shift);
+    __m512 sum = _mm512_setzero_ps();
+    for (int i = 0; i < n; i += 16)
+    {
+        const __mmask16 mask = n - i >= 16 ? (__mmask16) 0xFFFF
+                                           : (__mmask16) ((1u << (n - i)) - 1u);
+        const __m512 x = _mm512_maskz_loadu_ps(mask, values + i);
+        const __m512 e = _mm512_maskz_mov_ps(mask, avx512Exp(_mm512_sub_ps(x, vshift)));
+        if (dst != nullptr)
+        {
+            _mm512_mask_storeu_ps(dst + i, mask, e);
+        }
+        sum = _mm512_add_ps(sum, e);
+    }
+    return horizontalSum(sum);
+}
+
+/**
+ * @brief AVX-512 column softmax: avx2Columns() with 16 columns per register, the rest on AVX2
+ */
+__attribute__((target("avx512f")))
+static void avx512Columns(float *values, int rows, int cols, int ld)
+{
+    int j = 0;
+    for (; j + 16 <= cols; j += 16)
+    {
+        float *block = values + j;
+        __m512 max = _mm512_loadu_ps(block);
+        for (int i = 1; i < rows; i++)
+        {
+            max = _mm512_maskz_max_ps(SOFTMAX_ALL_LANES, max,
+                                      _mm512_loadu_ps(block + (ptrdiff_t) i * ld));
+        }
+
+        __m512 sum = _mm512_setzero_ps();
+        for (int i = 0; i < rows; i++)
+        {
+            float *row = block + (ptrdiff_t) i * ld;
+            const __m512 e = avx512Exp(_mm512_sub_ps(_mm512_loadu_ps(row), max));
+            _mm512_storeu_ps(row, e);
+            sum = _mm512_add_ps(sum, e);
+        }
+
+        const __m512 scale = _mm512_div_ps(_mm512_set1_ps(1.0f), sum);
+        for (int i = 0; i < rows; i++)
+        {
+            float *row = block + (ptrdiff_t) i * ld;
+            _mm512_storeu_ps(row, _mm512_mul_ps(_mm512_loadu_ps(row), scale));
+        }
+    }
+
+    avx2Columns(values + j, rows, cols - j, ld);
+}
+
+/**
+ * @brief AVX-512 top class: avx2TopColumns() with 16 columns per register and mask moves, the
+ * rest on AVX2
+ */
+__attribute__((target("avx512f")))
+static void avx512TopColumns(const float *logits, int rows, int cols, int ld, Digit *results)
+{
+    int j = 0;
+    for (; j + 16 <= cols; j += 16)
+    {
+        const float *block = logits + j;
+        __m512 max = _mm512_loadu_ps(block);
+        __m512i index = _mm512_setzero_si512();
+        for (int i = 1; i < rows; i++)
+        {
+            const __m512 x = _mm512_loadu_ps(block + (ptrdiff_t) i * ld);
+            const __mmask16 greater = _mm512_cmp_ps_mask(x, max, _CMP_GT_OQ);
+            max = _mm512_mask_mov_ps(max, greater, x);
+            index = _mm512_mask_mov_epi32(index, greater, _mm512_set1_epi32(i));
+        }
+
+        __m512 sum = _mm512_setzero_ps();
+        for (int i = 0; i < rows; i++)
+        {
+            const __m512 x = _mm512_loadu_ps(block + (ptrdiff_t) i * ld);
+            sum = _mm512_add_ps(sum, avx512Exp(_mm512_sub_ps(x, max)));
+        }
+
+        alignas(BUFFER_ALIGNMENT) int32_t indices[16];
+        alignas(BUFFER_ALIGNMENT) float probabilities[16];
+        _mm512_store_si512(indices, index);
+        _mm512_store_ps(probabilities, _mm512_div_ps(_mm512_set1_ps(1.0f), sum));
+        for (int l = 0; l < 16; l++)
+        {
+            results[j + l] = {(unsigned int) indices[l], probabilities[l]};
+        }
+    }
+
+    avx2TopColumns(logits + j, rows, cols - j, ld, results + j);
+}
+
+#endif // SIMD_X86
+
+/**
+ * @brief The kernels for simdIsa(), selected once
+ */
+static const SoftmaxKernels &activeSoftmaxKernels()
+{
+    static const SoftmaxKernels kernels = []() -> SoftmaxKernels
+    {
+        switch (simdIsa())
+        {
+#if SIMD_X86
+            case SimdAvx512:
+                return {avx512ExpSum, avx512Columns, avx512TopColumns};
+            case SimdAvx2:
+                return {avx2ExpSum, avx2Columns, avx2TopColumns};
+#endif
+            default:
+                return {portableExpSum, portableColumns, portableTopColumns};
+        }
+    }();
+    return kernels;
+}
+
+/**
+ * @brief Numerically stable softmax, in place, of every column of a row-major rows × cols
+ * buffer: exp(x - max) with the max of the column subtracted first (no overflow for any
+ * finite logits), then a single scale by 1 / sum. A single column is vectorized along its
+ * rows, wider buffers one SIMD lane per column (AVX2 / AVX-512)
+ * @param values the buffer, replaced by the softmax of its columns
+ * @param rows rows of the buffer (the classes)
+ * @param cols cols of the buffer (the vectors)
+ */
+void softmax(float *values, int rows, int cols)
+{
+    if (rows <= 0 || cols <= 0)
+    {
+        return;
+    }
+
+    const SoftmaxKernels &kernels = activeSoftmaxKernels();
+    if (cols == 1)
+    {
+        float max = values[0];
+        for (int i = 1; i < rows; i++)
+        {
+            max = std::fmax(max, values[i]);
+        }
+        const float sum = kernels.expSum(values, rows, max, values);
+        simdKernels().scale(values, values, 1.0f / sum, rows);
+        return;
+    }
+    kernels.columns(values, rows, cols, cols);
+}
+
+/**
+ * @brief The most probable class of every column and its softmax probability, without
+ * writing the probabilities: the argmax of the logits (the first one on ties), with
+ * probability exp(0) / sum exp(x - max) = 1 / sum exp(x - max), the value softmax() gives it
+ * @param logits row-major rows × cols buffer, one vector per column
+ * @param rows rows of the buffer (the classes)
+ * @param cols cols of the buffer (the vectors)
+ * @param results output, cols Digit objects
+ */
+void softmaxTop(const float *logits, int rows, int cols, Digit *results)
+{
+    if (rows <= 0 || cols <= 0)
+    {
+        return;
+    }
+
+    const SoftmaxKernels &kernels = activeSoftmaxKernels();
+    if (cols == 1)
+    {
+        unsigned int index = 0;
+        for (int i = 1; i < rows; i++)
+        {
+            if (logits[i] > logits[index])
+            {
+                index = i;
+            }
+        }
+        results[0] = {index, 1.0f / kernels.expSum(logits, rows, logits[index], nullptr)};
+        return;
+    }
+    kernels.topColumns(logits, rows, cols, cols, results);
+}
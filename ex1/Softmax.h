@@ -0,0 +1,60 @@
+//Softmax.h
+#ifndef SOFTMAX_H
+#define SOFTMAX_H
+
+#include "Digit.h"
+
+/**
+ * @brief softmaxExp() clamps its input to [SOFTMAX_EXP_MIN, SOFTMAX_EXP_MAX], where the 2^n of
+ * the range reduction stays a normal float. exp(SOFTMAX_EXP_MIN) ≈ 1.2e-38 stands for every
+ * smaller exponential: the softmax only takes the exponential of x - max <= 0, and terms that
+ * small don't move a sum that contains exp(0) = 1
+ */
+#define SOFTMAX_EXP_MIN (-87.33654f)
+
+/**
+ * @brief Upper clamp of softmaxExp(), exp(88) ≈ 1.65e38 (see SOFTMAX_EXP_MIN)
+ */
+#define SOFTMAX_EXP_MAX 88.0f
+
+/**
+ * @brief Bound on the relative error of softmaxExp() and of the SIMD exponentials of the
+ * softmax kernels against the exact exp, over [SOFTMAX_EXP_MIN, SOFTMAX_EXP_MAX]: 2^-23, one
+ * ulp (8.2e-8 measured, the FMA and plain evaluations alike). A probability adds the rounding
+ * of x - max, of the sum and of the scale: about SOFTMAX_EXP_MAX_ERROR + (rows + 1) * 2^-24
+ * relative when x - max is exact
+ */
+#define SOFTMAX_EXP_MAX_ERROR 1.2e-7f
+
+/**
+ * @brief Fast exponential: exp(x) = 2^n * exp(r), n = round(x / ln 2), |r| <= ln(2) / 2, exp(r)
+ * being a degree 7 polynomial (Cephes expf). The scalar version of the SIMD exponential of the
+ * softmax kernels, relative error below SOFTMAX_EXP_MAX_ERROR
+ * @param x the exponent, clamped to [SOFTMAX_EXP_MIN, SOFTMAX_EXP_MAX]
+ * @return exp(x)
+ */
+float softmaxExp(float x);
+
+/**
+ * @brief Numerically stable softmax, in place, of every column of a row-major rows × cols
+ * buffer: exp(x - max) with the max of the column subtracted first (no overflow for any
+ * finite logits), then a single scale by 1 / sum. A single column is vectorized along its
+ * rows, wider buffers one SIMD lane per column (AVX2 / AVX-512)
+ * @param values the buffer, replaced by the softmax of its columns
+ * @param rows rows of the buffer (the classes)
+ * @param cols cols of the buffer (the vectors)
+ */
+void softmax(float *values, int rows, int cols);
+
+/**
+ * @brief The most probable class of every column and its softmax probability, without
+ * writing the probabilities: the argmax of the logits (the first one on ties), with
+ * probability exp(0) / sum exp(x - max) = 1 / sum exp(x - max), the value softmax() gives it
+ * @param logits row-major rows × cols buffer, one vector per column
+ * @param rows rows of the buffer (the classes)
+ * @param cols cols of the buffer (the vectors)
+ * @param results output, cols Digit objects
+ */
+void softmaxTop(const float *logits, int rows, int cols, Digit *results);
+
+#endif //SOFTMAX_H
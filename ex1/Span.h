@@ -0,0 +1,99 @@
+//Span.h
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <cstdlib>
+#include <iostream>
+
+#define SPAN_ACCESS_ERROR "Cannot access span in this index."
+
+/**
+ * @brief Bounds checking of the fast path accessors (Span, Matrix::row() and
+ * Matrix::rowSpan()): 1 exits (code 1) on out of range indices, 0 doesn't check at all. On in
+ * debug builds and off when NDEBUG is defined, unless set beforehand (e.g. -DMATRIX_CHECKED_ROWS=1
+ * for a checked release build)
+ */
+#ifndef MATRIX_CHECKED_ROWS
+#ifdef NDEBUG
+#define MATRIX_CHECKED_ROWS 0
+#else
+#define MATRIX_CHECKED_ROWS 1
+#endif
+#endif
+
+/**
+ * @brief A pointer and a length: a row or all the elements of a matrix, for loops that must
+ * not pay a check per element. Non-owning, the elements must outlive it
+ * @tparam T float, or const float for read-only access
+ */
+template <typename T>
+class Span
+{
+public:
+    /**
+     * @brief Constructor
+     * @param data first element
+     * @param size number of elements
+     */
+    Span(T *data, const int size) : _data(data), _size(size)
+    {
+
+    }
+
+    /**
+     * @brief data getter
+     * @return pointer to the first element
+     */
+    T *data() const
+    {
+        return _data;
+    }
+
+    /**
+     * @brief size getter
+     * @return number of elements
+     */
+    int size() const
+    {
+        return _size;
+    }
+
+    /**
+     * @brief begin of range for loops
+     * @return pointer to the first element
+     */
+    T *begin() const
+    {
+        return _data;
+    }
+
+    /**
+     * @brief end of range for loops
+     * @return pointer past the last element
+     */
+    T *end() const
+    {
+        return _data + _size;
+    }
+
+    /**
+     * @brief Element access, checked only under MATRIX_CHECKED_ROWS
+     * @param k index
+     * @return ref to element k
+     */
+    T &operator[](const int k) const
+    {
+        if (MATRIX_CHECKED_ROWS && (k < 0 || k >= _size))
+        {
+            std::cerr << SPAN_ACCESS_ERROR << std::endl;
+            std::exit(1);
+        }
+        return _data[k];
+    }
+
+private:
+    T *_data;
+    int _size;
+};
+
+#endif //SPAN_H
@@ -0,0 +1,139 @@
+//
+// Created by user on 10/01/2020.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "Gemm.h"
+#include "Matrix.h"
+#include "SparseMatrix.h"
+#include "Spmm.h"
+
+#define USAGE_MSG "Usage:\n" \
+                  "\t./sparse_bench [m k n]\n" \
+                  "\twithout arguments runs 128x784 (the first layer) with n = 1 and n = 256"
+#define MIN_BENCH_SECONDS 0.2
+#define DEFAULT_M 128
+#define DEFAULT_K 784
+#define DEFAULT_BATCH 256
+
+const double benchDensities[] = {1.0, 0.7, 0.5, 0.4, 0.3, 0.2, 0.1, 0.05, 0.02, 0.01};
+
+/**
+ * Fills a matrix with pseudo random values in [-1, 1].
+ * @param mat matrix to fill
+ */
+void randomFill(Matrix &mat)
+{
+    for (int k = 0; k < mat.getRows() * mat.getCols(); k++)
+    {
+        mat[k] = (float) std::rand() / (float) RAND_MAX * 2.0f - 1.0f;
+    }
+}
+
+/**
+ * Runs func until at least MIN_BENCH_SECONDS passed.
+ * @param func the code to time
+ * @return average seconds per call
+ */
+template <typename Func>
+double timeIt(Func func)
+{
+    auto start = std::chrono::steady_clock::now();
+    int calls = 0;
+    double elapsed = 0;
+    do
+    {
+        func();
+        calls++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    return elapsed / calls;
+}
+
+/**
+ * Times dense gemm() against spmm() on magnitude pruned copies of a random m×k matrix, one
+ * result row per density, then prints the highest density at which the sparse product wins.
+ * @param m rows of A
+ * @param k cols of A
+ * @param n cols of B (1: gemv against spmv)
+ */
+void benchShape(int m, int k, int n)
+{
+    Matrix a(m, k);
+    Matrix b(k, n);
+    randomFill(a);
+    randomFill(b);
+    Matrix dense(m, n);
+    Matrix sparse(m, n);
+
+    std::cout << m << "x" << k << " * " << k << "x" << n << std::endl;
+    double crossover = 0;
+    for (const double density : benchDensities)
+    {
+        const SparseMatrix pruned = SparseMatrix::prune(a, 1.0 - density);
+        const Matrix prunedDense = pruned.toDense();
+        const double denseSeconds = timeIt([&]()
+                                           {
+                                               gemm(m, n, k, prunedDense.data(), k, b.data(), n,
+                                                    dense.data(), n, false);
+                                           });
+        const double sparseSeconds = timeIt([&]()
+                                            {
+                                                spmm(m, n, pruned.rowOffsets(), pruned.columns(),
+                                                     pruned.values(), b.data(), n, sparse.data(),
+                                                     n, false);
+                                            });
+
+        float maxError = 0;
+        for (int q = 0; q < m * n; q++)
+        {
+            maxError = std::fmax(maxError, std::fabs(dense[q] - sparse[q]));
+        }
+        if (crossover == 0 && sparseSeconds < denseSeconds)
+        {
+            crossover = pruned.density();
+        }
+
+        std::cout << "\tdensity " << pruned.density() << "\tdense: " << denseSeconds * 1e6
+                  << " us\tsparse: " << sparseSeconds * 1e6 << " us\tspeedup: "
+                  << denseSeconds / sparseSeconds << "x\tmax error: " << maxError << std::endl;
+    }
+
+    if (crossover > 0)
+    {
+        std::cout << "\tsparse is faster from density " << crossover << " down" << std::endl;
+    }
+    else
+    {
+        std::cout << "\tsparse is never faster" << std::endl;
+    }
+}
+
+/**
+ * Benchmark's main
+ * @param argc count of args
+ * @param argv args values
+ * @return program exit status code
+ */
+int main(int argc, char **argv)
+{
+    if (argc == 4)
+    {
+        benchShape(std::atoi(argv[1]), std::atoi(argv[2]), std::atoi(argv[3]));
+        return EXIT_SUCCESS;
+    }
+    if (argc != 1)
+    {
+        std::cout << USAGE_MSG << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    benchShape(DEFAULT_M, DEFAULT_K, 1);
+    benchShape(DEFAULT_M, DEFAULT_K, DEFAULT_BATCH);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,456 @@
+//
+// Created by user on 11/01/2020.
+//
+
+#include "SparseInput.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Vectors of y the column kernels keep in registers while the columns stream through
+ */
+#define SPARSE_INPUT_VECTORS 8
+
+/**
+ * @brief An instruction set's compactNonZeros()
+ */
+typedef int (*CompactKernel)(const float *x, int n, int32_t *indices);
+
+/**
+ * @brief An instruction set's reluCompact()
+ */
+typedef int (*ReluCompactKernel)(float *values, int n, int32_t *indices);
+
+/**
+ * @brief An instruction set's gemvSparseInput()
+ */
+typedef void (*ColumnsKernel)(int m, const float *columns, int ldcolumns, const float *x,
+                              const int32_t *indices, int count, float *y, bool accumulate);
+
+/**
+ * @struct SparseInputKernels
+ * @brief The kernels of one instruction set
+ */
+typedef struct SparseInputKernels
+{
+    CompactKernel compact;
+    ReluCompactKernel reluCompact;
+    ColumnsKernel columns;
+} SparseInputKernels;
+
+/**
+ * @brief Portable compaction: one compare per entry
+ */
+static int portableCompact(const float *x, int n, int32_t *indices)
+{
+    int count = 0;
+    for (int j = 0; j < n; j++)
+    {
+        if (!(x[j] == 0.0f))
+        {
+            indices[count++] = j;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Portable fused Relu and compaction
+ */
+static int portableReluCompact(float *values, int n, int32_t *indices)
+{
+    int count = 0;
+    for (int j = 0; j < n; j++)
+    {
+        values[j] = values[j] >= 0 ? values[j] : 0.0f;
+        if (values[j] > 0)
+        {
+            indices[count++] = j;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Portable column kernel: one scalar axpy per listed entry
+ */
+static void portableColumns(int m, const float *columns, int ldcolumns, const float *x,
+                            const int32_t *indices, int count, float *y, bool accumulate)
+{
+    if (!accumulate)
+    {
+        std::fill(y, y + m, 0.0f);
+    }
+    for (int q = 0; q < count; q++)
+    {
+        const float value = x[indices[q]];
+        const float *column = columns + (ptrdiff_t) indices[q] * ldcolumns;
+        for (int i = 0; i < m; i++)
+        {
+            y[i] += value * column[i];
+        }
+    }
+}
+
+#if SIMD_X86
+
+/**
+ * @brief AVX2 compaction: a compare per 8 entries, the set bits of its mask walked out
+ */
+__attribute__((target("avx2")))
+static int avx2Compact(const float *x, int n, int32_t *indices)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    int count = 0;
+    int j = 0;
+    for (; j + 8 <= n; j += 8)
+    {
+        auto mask = (unsigned) _mm256_movemask_ps(
+                _mm256_cmp_ps(_mm256_loadu_ps(x + j), zero, _CMP_NEQ_UQ));
+        while (mask != 0)
+        {
+            indices[count++] = j + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    for (; j < n; j++)
+    {
+        if (!(x[j] == 0.0f))
+        {
+            indices[count++] = j;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief AVX-512 compaction: a compare per 16 entries, the lane indices of the non-zeros
+ * written with one compress store
+ */
+__attribute__((target("avx512f")))
+static int avx512Compact(const float *x, int n, int32_t *indices)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    int count = 0;
+    for (int j = 0; j < n; j += 16)
+    {
+        const __mmask16 valid = n - j >= 16 ? (__mmask16) 0xFFFF
+                                            : (__mmask16) ((1u << (unsigned) (n - j)) - 1u);
+        const __mmask16 nonZero = _mm512_mask_cmp_ps_mask(
+                valid, _mm512_maskz_loadu_ps(valid, x + j), zero, _CMP_NEQ_UQ);
+        _mm512_mask_compressstoreu_epi32(indices + count, nonZero,
+                                         _mm512_add_epi32(lanes, _mm512_set1_epi32(j)));
+        count += __builtin_popcount(nonZero);
+    }
+    return count;
+}
+
+/**
+ * @brief AVX2 fused Relu and compaction: the Relu mask of the compare zeroes the vector, the
+ * positive lanes are walked out of a second compare
+ */
+__attribute__((target("avx2")))
+static int avx2ReluCompact(float *values, int n, int32_t *indices)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    int count = 0;
+    int j = 0;
+    for (; j + 8 <= n; j += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(values + j);
+        _mm256_storeu_ps(values + j, _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GE_OQ), x));
+        auto mask = (unsigned) _mm256_movemask_ps(_mm256_cmp_ps(x, zero, _CMP_GT_OQ));
+        while (mask != 0)
+        {
+            indices[count++] = j + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    for (; j < n; j++)
+    {
+        values[j] = values[j] >= 0 ? values[j] : 0.0f;
+        if (values[j] > 0)
+        {
+            indices[count++] = j;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief AVX-512 fused Relu and compaction: masked moves for the Relu, the lane indices of the
+ * positive entries written with one compress store
+ */
+__attribute__((target("avx512f")))
+static int avx512ReluCompact(float *values, int n, int32_t *indices)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    int count = 0;
+    for (int j = 0; j < n; j += 16)
+    {
+        const __mmask16 valid = n - j >= 16 ? (__mmask16) 0xFFFF
+                                            : (__mmask16) ((1u << (unsigned) (n - j)) - 1u);
+        const __m512 x = _mm512_maskz_loadu_ps(valid, values + j);
+        _mm512_mask_storeu_ps(values + j, valid,
+                              _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x, zero, _CMP_GE_OQ), x));
+        const __mmask16 positive = _mm512_mask_cmp_ps_mask(valid, x, zero, _CMP_GT_OQ);
+        _mm512_mask_compressstoreu_epi32(indices + count, positive,
+                                         _mm512_add_epi32(lanes, _mm512_set1_epi32(j)));
+        count += __builtin_popcount(positive);
+    }
+    return count;
+}
+
+/**
+ * @brief Lane mask of the first n entries of an 8 lane vector (all of them for n >= 8)
+ */
+__attribute__((target("avx2")))
+static inline __m256i avx2LaneMask(int n)
+{
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+/**
+ * @brief AVX2 column kernel on up to VECTORS × 8 rows: that many entries of y stay in
+ * registers while every listed column adds x[j] times the same entries of column j. The
+ * vectors past rows are masked
+ */
+template <int VECTORS>
+__attribute__((target("avx2,fma")))
+static void avx2ColumnsBlock(int rows, const float *columns, int ldcolumns, const float *x,
+                             const int32_t *indices, int count, float *y, bool accumulate)
+{
+    __m256i masks[VECTORS];
+    __m256 acc[VECTORS];
+    for (int v = 0; v < VECTORS; v++)
+    {
+        masks[v] = avx2LaneMask(rows - v * 8);
+        acc[v] = accumulate ? _mm256_maskload_ps(y + v * 8, masks[v]) : _mm256_setzero_ps();
+    }
+    for (int q = 0; q < count; q++)
+    {
+        const __m256 value = _mm256_set1_ps(x[indices[q]]);
+        const float *column = columns + (ptrdiff_t) indices[q] * ldcolumns;
+        for (int v = 0; v < VECTORS; v++)
+        {
+            acc[v] = _mm256_fmadd_ps(value, _mm256_maskload_ps(column + v * 8, masks[v]),
+                                     acc[v]);
+        }
+    }
+    for (int v = 0; v < VECTORS; v++)
+    {
+        _mm256_maskstore_ps(y + v * 8, masks[v], acc[v]);
+    }
+}
+
+/**
+ * @brief AVX2 column kernel: blocks of SPARSE_INPUT_VECTORS × 8 rows, the last one with just
+ * the vectors it needs (rounded up to a power of two)
+ */
+__attribute__((target("avx2,fma")))
+static void avx2Columns(int m, const float *columns, int ldcolumns, const float *x,
+                        const int32_t *indices, int count, float *y, bool accumulate)
+{
+    const int block = SPARSE_INPUT_VECTORS * 8;
+    for (int i = 0; i < m; i += block)
+    {
+        const int rows = std::min(block, m - i);
+        const int vectors = (rows + 7) / 8;
+        if (vectors > SPARSE_INPUT_VECTORS / 2)
+        {
+            avx2ColumnsBlock<SPARSE_INPUT_VECTORS>(rows, columns + i, ldcolumns, x, indices,
+                                                   count, y + i, accumulate);
+        }
+        else if (vectors > SPARSE_INPUT_VECTORS / 4)
+        {
+            avx2ColumnsBlock<SPARSE_INPUT_VECTORS / 2>(rows, columns + i, ldcolumns, x, indices,
+                                                       count, y + i, accumulate);
+        }
+        else if (vectors > 1)
+        {
+            avx2ColumnsBlock<SPARSE_INPUT_VECTORS / 4>(rows, columns + i, ldcolumns, x, indices,
+                                                       count, y + i, accumulate);
+        }
+        else
+        {
+            avx2ColumnsBlock<1>(rows, columns + i, ldcolumns, x, indices, count, y + i,
+                                accumulate);
+        }
+    }
+}
+
+/**
+ * @brief AVX-512 column kernel on up to VECTORS × 16 rows: avx2ColumnsBlock with 16 lane
+ * registers and mask registers
+ */
+template <int VECTORS>
+__attribute__((target("avx512f")))
+static void avx512ColumnsBlock(int rows, const float *columns, int ldcolumns, const float *x,
+                               const int32_t *indices, int count, float *y, bool accumulate)
+{
+    __mmask16 masks[VECTORS];
+    __m512 acc[VECTORS];
+    for (int v = 0; v < VECTORS; v++)
+    {
+        const int remaining = std::max(0, std::min(16, rows - v * 16));
+        masks[v] = remaining == 16 ? (__mmask16) 0xFFFF
+                                   : (__mmask16) ((1u << (unsigned) remaining) - 1u);
+        acc[v] = accumulate ? _mm512_maskz_loadu_ps(masks[v], y + v * 16) : _mm512_setzero_ps();
+    }
+    for (int q = 0; q < count; q++)
+    {
+        const __m512 value = _mm512_set1_ps(x[indices[q]]);
+        const float *column = columns + (ptrdiff_t) indices[q] * ldcolumns;
+        for (int v = 0; v < VECTORS; v++)
+        {
+            acc[v] = _mm512_fmadd_ps(value, _mm512_maskz_loadu_ps(masks[v], column + v * 16),
+                                     acc[v]);
+        }
+    }
+    for (int v = 0; v < VECTORS; v++)
+    {
+        _mm512_mask_storeu_ps(y + v * 16, masks[v], acc[v]);
+    }
+}
+
+/**
+ * @brief AVX-512 column kernel: avx2Columns with 16 lane blocks
+ */
+__attribute__((target("avx512f")))
+static void avx512Columns(int m, const float *columns, int ldcolumns, const float *x,
+                          const int32_t *indices, int count, float *y, bool accumulate)
+{
+    const int block = SPARSE_INPUT_VECTORS * 16;
+    for (int i = 0; i < m; i += block)
+    {
+        const int rows = std::min(block, m - i);
+        const int vectors = (rows + 15) / 16;
+        if (vectors > SPARSE_INPUT_VECTORS / 2)
+        {
+            avx512ColumnsBlock<SPARSE_INPUT_VECTORS>(rows, columns + i, ldcolumns, x, indices,
+                                                     count, y + i, accumulate);
+        }
+        else if (vectors > SPARSE_INPUT_VECTORS / 4)
+        {
+            avx512ColumnsBlock<SPARSE_INPUT_VECTORS / 2>(rows, columns + i, ldcolumns, x,
+                                                         indices, count, y + i, accumulate);
+        }
+        else if (vectors > 1)
+        {
+            avx512ColumnsBlock<SPARSE_INPUT_VECTORS / 4>(rows, columns + i, ldcolumns, x,
+                                                         indices, count, y + i, accumulate);
+        }
+        else
+        {
+            avx512ColumnsBlock<1>(rows, columns + i, ldcolumns, x, indices, count, y + i,
+                                  accumulate);
+        }
+    }
+}
+
+#endif // SIMD_X86
+
+/**
+ * @brief The kernels for simdIsa(), selected once
+ */
+static const SparseInputKernels &activeSparseInputKernels()
+{
+    static const SparseInputKernels kernels = []() -> SparseInputKernels
+    {
+        switch (simdIsa())
+        {
+#if SIMD_X86
+            case SimdAvx512:
+                return {avx512Compact, avx512ReluCompact, avx512Columns};
+            case SimdAvx2:
+                return {avx2Compact, avx2ReluCompact, avx2Columns};
+#endif
+            default:
+                return {portableCompact, portableReluCompact, portableColumns};
+        }
+    }();
+    return kernels;
+}
+
+/**
+ * @brief The density below which layers go through the columns of their non-zero inputs:
+ * SPARSE_INPUT_ENV_VAR if set to a valid fraction, else SPARSE_INPUT_MAX_DENSITY
+ * @return the threshold
+ */
+double sparseInputMaxDensity()
+{
+    static const double density = []()
+    {
+        const char *value = std::getenv(SPARSE_INPUT_ENV_VAR);
+        if (value == nullptr)
+        {
+            return SPARSE_INPUT_MAX_DENSITY;
+        }
+        char *end = nullptr;
+        const double parsed = std::strtod(value, &end);
+        return end != value && *end == '\0' && parsed >= 0 && parsed <= 1
+               ? parsed : SPARSE_INPUT_MAX_DENSITY;
+    }();
+    return density;
+}
+
+/**
+ * @brief Indices of the non-zero entries of x (NaNs count as non-zero), in increasing order.
+ * A SIMD compare per vector, the matching lane indices written with one compress store
+ * (AVX-512) or walked out of the compare mask (AVX2)
+ * @param x the vector
+ * @param n length of x
+ * @param indices output, room for n indices
+ * @return the number of indices written
+ */
+int compactNonZeros(const float *x, int n, int32_t *indices)
+{
+    return n > 0 ? activeSparseInputKernels().compact(x, n, indices) : 0;
+}
+
+/**
+ * @brief Relu in place (bit for bit the one of simdKernels()) that also lists the entries left
+ * non-zero, in increasing order, in the same pass
+ * @param values the vector, replaced by Relu(values)
+ * @param n length of values
+ * @param indices output, room for n indices
+ * @return the number of indices written
+ */
+int reluCompact(float *values, int n, int32_t *indices)
+{
+    return n > 0 ? activeSparseInputKernels().reluCompact(values, n, indices) : 0;
+}
+
+/**
+ * @brief Matrix times vector for a vector with few non-zeros: y = A * x, or y += A * x, reading
+ * only the columns of A that meet a non-zero of x. A is m×k, given column by column (the rows of
+ * its k×m transpose), so every listed entry adds x[j] times one contiguous column to y. Blocks
+ * of y stay in registers while the columns stream through
+ * @param m rows of A, length of y
+ * @param columns pointer to the transpose of A: column j of A starts at columns + j * ldcolumns
+ * @param ldcolumns distance (in floats) between consecutive columns of A
+ * @param x pointer to x
+ * @param indices entries of x to use, typically from compactNonZeros() (the others are taken
+ * as zeros)
+ * @param count number of indices
+ * @param y pointer to the contiguous vector y. Must not alias columns or x
+ * @param accumulate true: y += A * x, false: y = A * x (y doesn't have to be initialized)
+ */
+void gemvSparseInput(int m, const float *columns, int ldcolumns, const float *x,
+                     const int32_t *indices, int count, float *y, bool accumulate)
+{
+    if (m <= 0)
+    {
+        return;
+    }
+    activeSparseInputKernels().columns(m, columns, ldcolumns, x, indices, count, y, accumulate);
+}
@@ -0,0 +1,65 @@
+//SparseInput.h
+#ifndef SPARSEINPUT_H
+#define SPARSEINPUT_H
+
+#include <cstdint>
+
+/**
+ * @brief Above this fraction of non-zero inputs Dense::forward() runs the plain gemv(): the
+ * column kernel does the same work per input, so it only wins by skipping inputs
+ */
+#define SPARSE_INPUT_MAX_DENSITY 0.5
+
+/**
+ * @brief Environment variable that overrides SPARSE_INPUT_MAX_DENSITY: a fraction in [0, 1],
+ * 0 turning the column kernels off. Read once
+ */
+#define SPARSE_INPUT_ENV_VAR "MLP_SPARSE_DENSITY"
+
+/**
+ * @brief The density below which layers go through the columns of their non-zero inputs:
+ * SPARSE_INPUT_ENV_VAR if set to a valid fraction, else SPARSE_INPUT_MAX_DENSITY
+ * @return the threshold
+ */
+double sparseInputMaxDensity();
+
+/**
+ * @brief Indices of the non-zero entries of x (NaNs count as non-zero), in increasing order.
+ * A SIMD compare per vector, the matching lane indices written with one compress store
+ * (AVX-512) or walked out of the compare mask (AVX2)
+ * @param x the vector
+ * @param n length of x
+ * @param indices output, room for n indices
+ * @return the number of indices written
+ */
+int compactNonZeros(const float *x, int n, int32_t *indices);
+
+/**
+ * @brief Relu in place (bit for bit the one of simdKernels()) that also lists the entries left
+ * non-zero, in increasing order, in the same pass
+ * @param values the vector, replaced by Relu(values)
+ * @param n length of values
+ * @param indices output, room for n indices
+ * @return the number of indices written
+ */
+int reluCompact(float *values, int n, int32_t *indices);
+
+/**
+ * @brief Matrix times vector for a vector with few non-zeros: y = A * x, or y += A * x, reading
+ * only the columns of A that meet a non-zero of x. A is m×k, given column by column (the rows of
+ * its k×m transpose), so every listed entry adds x[j] times one contiguous column to y. Blocks
+ * of y stay in registers while the columns stream through
+ * @param m rows of A, length of y
+ * @param columns pointer to the transpose of A: column j of A starts at columns + j * ldcolumns
+ * @param ldcolumns distance (in floats) between consecutive columns of A
+ * @param x pointer to x
+ * @param indices entries of x to use, typically from compactNonZeros() (the others are taken
+ * as zeros)
+ * @param count number of indices
+ * @param y pointer to the contiguous vector y. Must not alias columns or x
+ * @param accumulate true: y += A * x, false: y = A * x (y doesn't have to be initialized)
+ */
+void gemvSparseInput(int m, const float *columns, int ldcolumns, const float *x,
+                     const int32_t *indices, int count, float *y, bool accumulate);
+
+#endif //SPARSEINPUT_H
@@ -0,0 +1,224 @@
+//
+// Created by user on 10/01/2020.
+//
+
+#include "SparseMatrix.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+
+/**
+ * @brief Constructs an empty 0×0 matrix
+ */
+SparseMatrix::SparseMatrix() :
+        _rows(0), _cols(0), _ownedRowOffsets(1, 0), _rowOffsets(_ownedRowOffsets.data()),
+        _columns(nullptr), _values(nullptr)
+{
+
+}
+
+/**
+ * @brief Compresses a float matrix, keeping its non-zero values
+ * @param dense the float matrix
+ * @return an owning sparse matrix
+ */
+SparseMatrix SparseMatrix::fromDense(const Matrix &dense)
+{
+    return _compress(dense, 0.0f);
+}
+
+/**
+ * @brief Magnitude pruning: keeps the values of largest magnitude, dropping (at least
+ * rounded down) sparsity * rows * cols of the others. Ties at the threshold are kept
+ * @param dense the float matrix
+ * @param sparsity fraction of the values to drop, in [0, 1]
+ * @return an owning sparse matrix
+ */
+SparseMatrix SparseMatrix::prune(const Matrix &dense, double sparsity)
+{
+    const int size = dense.getRows() * dense.getCols();
+    const auto dropped = (int) (std::min(std::max(sparsity, 0.0), 1.0) * size);
+    if (dropped == 0)
+    {
+        return fromDense(dense);
+    }
+    if (dropped == size)
+    {
+        return _compress(dense, INFINITY);
+    }
+
+    // the threshold is the smallest magnitude that survives
+    std::vector<float> magnitudes(size);
+    for (int k = 0; k < size; k++)
+    {
+        magnitudes[k] = std::fabs(dense.data()[k]);
+    }
+    std::nth_element(magnitudes.begin(), magnitudes.begin() + dropped, magnitudes.end());
+    return _compress(dense, std::max(magnitudes[dropped], FLT_MIN));
+}
+
+/**
+ * @brief Non-owning matrix over existing arrays, which must outlive it
+ * @param rowOffsets rows + 1 offsets into columns and values
+ * @param columns column of every non-zero
+ * @param values every non-zero
+ * @param rows rows of the matrix
+ * @param cols cols of the matrix
+ * @return a matrix viewing the arrays
+ */
+SparseMatrix SparseMatrix::borrow(const int32_t *rowOffsets, const int32_t *columns,
+                                  const float *values, int rows, int cols)
+{
+    SparseMatrix result;
+    result._rows = rows;
+    result._cols = cols;
+    result._ownedRowOffsets.clear();
+    result._rowOffsets = rowOffsets;
+    result._columns = columns;
+    result._values = values;
+    return result;
+}
+
+/**
+ * @brief rows getter
+ * @return rows of the matrix
+ */
+int SparseMatrix::getRows() const
+{
+    return _rows;
+}
+
+/**
+ * @brief cols getter
+ * @return cols of the matrix
+ */
+int SparseMatrix::getCols() const
+{
+    return _cols;
+}
+
+/**
+ * @brief non-zeros getter
+ * @return number of stored values
+ */
+int SparseMatrix::getNonZeros() const
+{
+    return _rowOffsets[_rows];
+}
+
+/**
+ * @brief Fraction of the values that are stored
+ * @return getNonZeros() / (rows * cols)
+ */
+double SparseMatrix::density() const
+{
+    return _rows * _cols > 0 ? (double) getNonZeros() / ((double) _rows * _cols) : 0;
+}
+
+/**
+ * @brief row offsets getter
+ * @return rows + 1 offsets: the values of row i are [rowOffsets()[i], rowOffsets()[i + 1])
+ */
+const int32_t *SparseMatrix::rowOffsets() const
+{
+    return _rowOffsets;
+}
+
+/**
+ * @brief columns getter
+ * @return the column of every stored value
+ */
+const int32_t *SparseMatrix::columns() const
+{
+    return _columns;
+}
+
+/**
+ * @brief values getter
+ * @return every stored value, row by row
+ */
+const float *SparseMatrix::values() const
+{
+    return _values;
+}
+
+/**
+ * @brief Structure check, for arrays that come from a file: offsets start at 0, never
+ * decrease and end at the count of values; columns are in range and increase along a row
+ * @param nonZeros number of values the arrays hold
+ * @return true if spmm() can run on the matrix
+ */
+bool SparseMatrix::isValid(int nonZeros) const
+{
+    if (_rowOffsets[0] != 0 || _rowOffsets[_rows] != nonZeros)
+    {
+        return false;
+    }
+    for (int i = 0; i < _rows; i++)
+    {
+        if (_rowOffsets[i + 1] < _rowOffsets[i] || _rowOffsets[i + 1] > nonZeros)
+        {
+            return false;
+        }
+        int32_t previous = -1;
+        for (int32_t q = _rowOffsets[i]; q < _rowOffsets[i + 1]; q++)
+        {
+            if (_columns[q] <= previous || _columns[q] >= _cols)
+            {
+                return false;
+            }
+            previous = _columns[q];
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Back to a dense float matrix
+ * @return rows × cols float matrix, zeros where nothing is stored
+ */
+Matrix SparseMatrix::toDense() const
+{
+    Matrix result(_rows, _cols);
+    for (int i = 0; i < _rows; i++)
+    {
+        float *row = result.data() + (ptrdiff_t) i * _cols;
+        for (int32_t q = _rowOffsets[i]; q < _rowOffsets[i + 1]; q++)
+        {
+            row[_columns[q]] = _values[q];
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Compresses the values of dense whose magnitude is at least threshold (all non-zeros
+ * for a threshold of 0)
+ */
+SparseMatrix SparseMatrix::_compress(const Matrix &dense, float threshold)
+{
+    SparseMatrix result;
+    result._rows = dense.getRows();
+    result._cols = dense.getCols();
+    result._ownedRowOffsets.assign(1, 0);
+    for (int i = 0; i < result._rows; i++)
+    {
+        const float *row = dense.data() + (ptrdiff_t) i * result._cols;
+        for (int p = 0; p < result._cols; p++)
+        {
+            if (row[p] != 0 && std::fabs(row[p]) >= threshold)
+            {
+                result._ownedColumns.push_back(p);
+                result._ownedValues.push_back(row[p]);
+            }
+        }
+        result._ownedRowOffsets.push_back((int32_t) result._ownedValues.size());
+    }
+
+    result._rowOffsets = result._ownedRowOffsets.data();
+    result._columns = result._ownedColumns.data();
+    result._values = result._ownedValues.data();
+    return result;
+}
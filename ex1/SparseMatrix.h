@@ -0,0 +1,134 @@
+//SparseMatrix.h
+#ifndef SPARSEMATRIX_H
+#define SPARSEMATRIX_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Matrix.h"
+
+/**
+ * @brief Weight matrix in compressed sparse row (CSR) form: only the non-zeros are stored, row
+ * by row, with their columns, and spmm() multiplies in time proportional to their number. The
+ * arrays are either owned (fromDense(), prune()) or borrowed from a model file (borrow()).
+ */
+class SparseMatrix
+{
+public:
+    /**
+     * @brief Constructs an empty 0×0 matrix
+     */
+    SparseMatrix();
+
+    /**
+     * @brief Compresses a float matrix, keeping its non-zero values
+     * @param dense the float matrix
+     * @return an owning sparse matrix
+     */
+    static SparseMatrix fromDense(const Matrix &dense);
+
+    /**
+     * @brief Magnitude pruning: keeps the values of largest magnitude, dropping (at least
+     * rounded down) sparsity * rows * cols of the others. Ties at the threshold are kept
+     * @param dense the float matrix
+     * @param sparsity fraction of the values to drop, in [0, 1]
+     * @return an owning sparse matrix
+     */
+    static SparseMatrix prune(const Matrix &dense, double sparsity);
+
+    /**
+     * @brief Non-owning matrix over existing arrays, which must outlive it
+     * @param rowOffsets rows + 1 offsets into columns and values
+     * @param columns column of every non-zero
+     * @param values every non-zero
+     * @param rows rows of the matrix
+     * @param cols cols of the matrix
+     * @return a matrix viewing the arrays
+     */
+    static SparseMatrix borrow(const int32_t *rowOffsets, const int32_t *columns,
+                               const float *values, int rows, int cols);
+
+    /**
+     * @brief The owned arrays move with the matrix, views into them stay valid
+     */
+    SparseMatrix(SparseMatrix &&other) noexcept = default;
+
+    /**
+     * @brief The owned arrays move with the matrix, views into them stay valid
+     */
+    SparseMatrix &operator=(SparseMatrix &&other) noexcept = default;
+
+    /**
+     * @brief rows getter
+     * @return rows of the matrix
+     */
+    int getRows() const;
+
+    /**
+     * @brief cols getter
+     * @return cols of the matrix
+     */
+    int getCols() const;
+
+    /**
+     * @brief non-zeros getter
+     * @return number of stored values
+     */
+    int getNonZeros() const;
+
+    /**
+     * @brief Fraction of the values that are stored
+     * @return getNonZeros() / (rows * cols)
+     */
+    double density() const;
+
+    /**
+     * @brief row offsets getter
+     * @return rows + 1 offsets: the values of row i are [rowOffsets()[i], rowOffsets()[i + 1])
+     */
+    const int32_t *rowOffsets() const;
+
+    /**
+     * @brief columns getter
+     * @return the column of every stored value
+     */
+    const int32_t *columns() const;
+
+    /**
+     * @brief values getter
+     * @return every stored value, row by row
+     */
+    const float *values() const;
+
+    /**
+     * @brief Structure check, for arrays that come from a file: offsets start at 0, never
+     * decrease and end at the count of values; columns are in range and increase along a row
+     * @param nonZeros number of values the arrays hold
+     * @return true if spmm() can run on the matrix
+     */
+    bool isValid(int nonZeros) const;
+
+    /**
+     * @brief Back to a dense float matrix
+     * @return rows × cols float matrix, zeros where nothing is stored
+     */
+    Matrix toDense() const;
+
+private:
+    int _rows;
+    int _cols;
+    std::vector<int32_t> _ownedRowOffsets;
+    std::vector<int32_t> _ownedColumns;
+    std::vector<float> _ownedValues;
+    const int32_t *_rowOffsets;
+    const int32_t *_columns;
+    const float *_values;
+
+    /**
+     * @brief Compresses the values of dense whose magnitude is at least threshold (all non-zeros
+     * for a threshold of 0)
+     */
+    static SparseMatrix _compress(const Matrix &dense, float threshold);
+};
+
+#endif //SPARSEMATRIX_H
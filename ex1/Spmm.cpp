@@ -0,0 +1,279 @@
+//
+// Created by user on 10/01/2020.
+//
+
+#include "Spmm.h"
+#include "Simd.h"
+#include "SimdReduce.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Registers of C a SpMM kernel keeps per row: every non-zero is one broadcast and this
+ * many FMAs against consecutive vectors of a row of B
+ */
+#define SPMM_VECTORS 4
+
+/**
+ * @brief A SpMV: y = A * x, or y += A * x, x contiguous (see spmm())
+ */
+typedef void (*SpmvKernel)(int m, const int32_t *rowOffsets, const int32_t *columns,
+                           const float *values, const float *x, float *y, int incy,
+                           bool accumulate);
+
+/**
+ * @brief A SpMM over the columns [0, n) of B and C (see spmm())
+ */
+typedef void (*SpmmKernel)(int m, int n, const int32_t *rowOffsets, const int32_t *columns,
+                           const float *values, const float *b, int ldb, float *c, int ldc,
+                           bool accumulate);
+
+/**
+ * @struct SparseKernels
+ * @brief The kernels of one instruction set
+ */
+typedef struct SparseKernels
+{
+    SpmvKernel spmv;
+    SpmmKernel spmm;
+} SparseKernels;
+
+/**
+ * @brief Portable SpMV: one scalar dot product per row
+ */
+static void portableSpmv(int m, const int32_t *rowOffsets, const int32_t *columns,
+                         const float *values, const float *x, float *y, int incy, bool accumulate)
+{
+    for (int i = 0; i < m; i++)
+    {
+        float dot = 0.0f;
+        for (int32_t q = rowOffsets[i]; q < rowOffsets[i + 1]; q++)
+        {
+            dot += values[q] * x[columns[q]];
+        }
+        float &yi = y[(ptrdiff_t) i * incy];
+        yi = accumulate ? yi + dot : dot;
+    }
+}
+
+/**
+ * @brief Portable SpMM: one contiguous axpy per non-zero, over a row of B and a row of C
+ */
+static void portableSpmm(int m, int n, const int32_t *rowOffsets, const int32_t *columns,
+                         const float *values, const float *b, int ldb, float *c, int ldc,
+                         bool accumulate)
+{
+    for (int i = 0; i < m; i++)
+    {
+        float *cRow = c + (ptrdiff_t) i * ldc;
+        if (!accumulate)
+        {
+            std::fill(cRow, cRow + n, 0.0f);
+        }
+        for (int32_t q = rowOffsets[i]; q < rowOffsets[i + 1]; q++)
+        {
+            const float value = values[q];
+            const float *bRow = b + (ptrdiff_t) columns[q] * ldb;
+            for (int j = 0; j < n; j++)
+            {
+                cRow[j] += value * bRow[j];
+            }
+        }
+    }
+}
+
+#if SIMD_X86
+
+/**
+ * @brief AVX2 SpMV: 8 entries of x gathered per vgatherdps, 2 accumulators per row and a
+ * masked gather for the last (up to 7) non-zeros of the row. Also the AVX-512 SpMV: 16 lane
+ * gathers are no faster per element and the zmm horizontal sums cost more on short rows
+ */
+__attribute__((target("avx2,fma")))
+static void avx2Spmv(int m, const int32_t *rowOffsets, const int32_t *columns,
+                     const float *values, const float *x, float *y, int incy, bool accumulate)
+{
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (int i = 0; i < m; i++)
+    {
+        const int32_t end = rowOffsets[i + 1];
+        int32_t q = rowOffsets[i];
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        for (; q + 16 <= end; q += 16)
+        {
+            const __m256i index0 = _mm256_loadu_si256((const __m256i *) (columns + q));
+            const __m256i index1 = _mm256_loadu_si256((const __m256i *) (columns + q + 8));
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(values + q),
+                                   _mm256_i32gather_ps(x, index0, sizeof(float)), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(values + q + 8),
+                                   _mm256_i32gather_ps(x, index1, sizeof(float)), acc1);
+        }
+        if (q + 8 <= end)
+        {
+            const __m256i index = _mm256_loadu_si256((const __m256i *) (columns + q));
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(values + q),
+                                   _mm256_i32gather_ps(x, index, sizeof(float)), acc0);
+            q += 8;
+        }
+        if (q < end)
+        {
+            const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(end - q), lanes);
+            const __m256i index = _mm256_maskload_epi32(columns + q, mask);
+            const __m256 gathered = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), x, index,
+                                                             _mm256_castsi256_ps(mask),
+                                                             sizeof(float));
+            acc1 = _mm256_fmadd_ps(_mm256_maskload_ps(values + q, mask), gathered, acc1);
+        }
+
+        const float dot = horizontalSum(_mm256_add_ps(acc0, acc1));
+        float &yi = y[(ptrdiff_t) i * incy];
+        yi = accumulate ? yi + dot : dot;
+    }
+}
+
+/**
+ * @brief AVX2 SpMM: SPMM_VECTORS × 8 columns of a row of C stay in registers while every
+ * non-zero of the row adds its value times the same columns of its row of B
+ */
+__attribute__((target("avx2,fma")))
+static void avx2Spmm(int m, int n, const int32_t *rowOffsets, const int32_t *columns,
+                     const float *values, const float *b, int ldb, float *c, int ldc,
+                     bool accumulate)
+{
+    const int block = SPMM_VECTORS * 8;
+    const int blocked = n / block * block;
+    for (int i = 0; i < m; i++)
+    {
+        float *cRow = c + (ptrdiff_t) i * ldc;
+        for (int j = 0; j < blocked; j += block)
+        {
+            __m256 acc[SPMM_VECTORS];
+            for (int v = 0; v < SPMM_VECTORS; v++)
+            {
+                acc[v] = accumulate ? _mm256_loadu_ps(cRow + j + v * 8) : _mm256_setzero_ps();
+            }
+            for (int32_t q = rowOffsets[i]; q < rowOffsets[i + 1]; q++)
+            {
+                const __m256 value = _mm256_set1_ps(values[q]);
+                const float *bRow = b + (ptrdiff_t) columns[q] * ldb + j;
+                for (int v = 0; v < SPMM_VECTORS; v++)
+                {
+                    acc[v] = _mm256_fmadd_ps(value, _mm256_loadu_ps(bRow + v * 8), acc[v]);
+                }
+            }
+            for (int v = 0; v < SPMM_VECTORS; v++)
+            {
+                _mm256_storeu_ps(cRow + j + v * 8, acc[v]);
+            }
+        }
+    }
+
+    portableSpmm(m, n - blocked, rowOffsets, columns, values, b + blocked, ldb, c + blocked, ldc,
+                 accumulate);
+}
+
+/**
+ * @brief AVX-512 SpMM: avx2Spmm with 16 lane registers
+ */
+__attribute__((target("avx512f")))
+static void avx512Spmm(int m, int n, const int32_t *rowOffsets, const int32_t *columns,
+                       const float *values, const float *b, int ldb, float *c, int ldc,
+                       bool accumulate)
+{
+    const int block = SPMM_VECTORS * 16;
+    const int blocked = n / block * block;
+    for (int i = 0; i < m; i++)
+    {
+        float *cRow = c + (ptrdiff_t) i * ldc;
+        for (int j = 0; j < blocked; j += block)
+        {
+            __m512 acc[SPMM_VECTORS];
+            for (int v = 0; v < SPMM_VECTORS; v++)
+            {
+                acc[v] = accumulate ? _mm512_loadu_ps(cRow + j + v * 16) : _mm512_setzero_ps();
+            }
+            for (int32_t q = rowOffsets[i]; q < rowOffsets[i + 1]; q++)
+            {
+                const __m512 value = _mm512_set1_ps(values[q]);
+                const float *bRow = b + (ptrdiff_t) columns[q] * ldb + j;
+                for (int v = 0; v < SPMM_VECTORS; v++)
+                {
+                    acc[v] = _mm512_fmadd_ps(value, _mm512_loadu_ps(bRow + v * 16), acc[v]);
+                }
+            }
+            for (int v = 0; v < SPMM_VECTORS; v++)
+            {
+                _mm512_storeu_ps(cRow + j + v * 16, acc[v]);
+            }
+        }
+    }
+
+    avx2Spmm(m, n - blocked, rowOffsets, columns, values, b + blocked, ldb, c + blocked, ldc,
+             accumulate);
+}
+
+#endif // SIMD_X86
+
+/**
+ * @brief The kernels for simdIsa(), selected once
+ */
+static const SparseKernels &activeSparseKernels()
+{
+    static const SparseKernels kernels = []() -> SparseKernels
+    {
+        switch (simdIsa())
+        {
+#if SIMD_X86
+            case SimdAvx512:
+                return {avx2Spmv, avx512Spmm};
+            case SimdAvx2:
+                return {avx2Spmv, avx2Spmm};
+#endif
+            default:
+                return {portableSpmv, portableSpmm};
+        }
+    }();
+    return kernels;
+}
+
+/**
+ * @brief Sparse (CSR) times dense matrix multiplication: C = A * B, or C += A * B.
+ * A is m×k in compressed sparse row form: the non-zeros of row i are values[q] at column
+ * columns[q] for q in [rowOffsets[i], rowOffsets[i + 1]). B is k×n and C is m×n, row-major
+ * floats. A single contiguous column (n == 1, ldb == 1) is a SpMV that gathers the entries of x
+ * the row needs (AVX2 / AVX-512 gathers); wider products add value * (row of B) into a block of
+ * C held in registers, once per non-zero. Either way the work is proportional to the number of
+ * non-zeros, not to m * k.
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param rowOffsets m + 1 offsets into columns and values, rowOffsets[0] == 0
+ * @param columns column of every non-zero, in [0, k)
+ * @param values every non-zero
+ * @param b pointer to B
+ * @param ldb distance (in floats) between consecutive rows of B
+ * @param c pointer to C. Must not alias B
+ * @param ldc distance (in floats) between consecutive rows of C
+ * @param accumulate true: C += A * B, false: C = A * B (C doesn't have to be initialized)
+ */
+void spmm(int m, int n, const int32_t *rowOffsets, const int32_t *columns, const float *values,
+          const float *b, int ldb, float *c, int ldc, bool accumulate)
+{
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+
+    const SparseKernels &kernels = activeSparseKernels();
+    if (n == 1 && ldb == 1)
+    {
+        kernels.spmv(m, rowOffsets, columns, values, b, c, ldc, accumulate);
+        return;
+    }
+    kernels.spmm(m, n, rowOffsets, columns, values, b, ldb, c, ldc, accumulate);
+}
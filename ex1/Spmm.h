@@ -0,0 +1,29 @@
+//Spmm.h
+#ifndef SPMM_H
+#define SPMM_H
+
+#include <cstdint>
+
+/**
+ * @brief Sparse (CSR) times dense matrix multiplication: C = A * B, or C += A * B.
+ * A is m×k in compressed sparse row form: the non-zeros of row i are values[q] at column
+ * columns[q] for q in [rowOffsets[i], rowOffsets[i + 1]). B is k×n and C is m×n, row-major
+ * floats. A single contiguous column (n == 1, ldb == 1) is a SpMV that gathers the entries of x
+ * the row needs (AVX2 / AVX-512 gathers); wider products add value * (row of B) into a block of
+ * C held in registers, once per non-zero. Either way the work is proportional to the number of
+ * non-zeros, not to m * k.
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param rowOffsets m + 1 offsets into columns and values, rowOffsets[0] == 0
+ * @param columns column of every non-zero, in [0, k)
+ * @param values every non-zero
+ * @param b pointer to B
+ * @param ldb distance (in floats) between consecutive rows of B
+ * @param c pointer to C. Must not alias B
+ * @param ldc distance (in floats) between consecutive rows of C
+ * @param accumulate true: C += A * B, false: C = A * B (C doesn't have to be initialized)
+ */
+void spmm(int m, int n, const int32_t *rowOffsets, const int32_t *columns, const float *values,
+          const float *b, int ldb, float *c, int ldc, bool accumulate);
+
+#endif //SPMM_H
@@ -0,0 +1,148 @@
+//
+// Created by user on 06/01/2020.
+//
+
+#include "ThreadPool.h"
+
+/**
+ * @brief Set on every thread while it runs pool tasks, so nested parallelFor() calls run
+ * inline instead of waiting on a pool that is busy with their own parent
+ */
+static thread_local bool insidePool = false;
+
+/**
+ * @brief Constructor. Starts threads - 1 workers
+ * @param threads threads running the tasks, the caller included (values below 1 count as 1)
+ */
+ThreadPool::ThreadPool(int threads) :
+        _task(nullptr), _taskCount(0), _nextTask(0), _busyWorkers(0), _generation(0),
+        _stopping(false)
+{
+    for (int i = 1; i < threads; i++)
+    {
+        _workers.emplace_back(&ThreadPool::_workerLoop, this);
+    }
+}
+
+/**
+ * @brief Destructor. Stops and joins the workers
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    for (std::thread &worker : _workers)
+    {
+        worker.join();
+    }
+}
+
+/**
+ * @brief Runs task(0) ... task(tasks - 1) on the pool's threads and returns once all of them
+ * are done. Calls from several threads are served one after the other. A call made from
+ * inside a task runs inline on that thread
+ * @param tasks number of tasks
+ * @param task the work, called once per task index
+ */
+void ThreadPool::parallelFor(int tasks, const std::function<void(int)> &task)
+{
+    if (_workers.empty() || tasks <= 1 || insidePool)
+    {
+        for (int i = 0; i < tasks; i++)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(_submitMutex);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _task = &task;
+        _taskCount = tasks;
+        _nextTask = 0;
+        _busyWorkers = (int) _workers.size();
+        _generation++;
+    }
+    _wake.notify_all();
+
+    insidePool = true;
+    _drain();
+    insidePool = false;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return _busyWorkers == 0; });
+    _task = nullptr;
+}
+
+/**
+ * @brief thread count getter
+ * @return threads running the tasks, the caller included
+ */
+int ThreadPool::getThreadCount() const
+{
+    return (int) _workers.size() + 1;
+}
+
+/**
+ * @brief Whether the calling thread is running a task of some pool, where a parallelFor() would
+ * run inline
+ * @return true inside a task
+ */
+bool ThreadPool::insideTask()
+{
+    return insidePool;
+}
+
+/**
+ * @brief Threads the machine runs at once (at least 1)
+ * @return std::thread::hardware_concurrency(), or 1 when unknown
+ */
+int ThreadPool::hardwareThreads()
+{
+    const unsigned int threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : (int) threads;
+}
+
+/**
+ * @brief A worker's life: waits for a parallelFor(), helps drain it, reports, repeats
+ */
+void ThreadPool::_workerLoop()
+{
+    insidePool = true;
+    unsigned long seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&]() { return _stopping || _generation != seen; });
+            if (_stopping)
+            {
+                return;
+            }
+            seen = _generation;
+        }
+
+        _drain();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_busyWorkers == 0)
+        {
+            _done.notify_one();
+        }
+    }
+}
+
+/**
+ * @brief Runs tasks of the current parallelFor() until none are left
+ */
+void ThreadPool::_drain()
+{
+    for (int i = _nextTask++; i < _taskCount; i = _nextTask++)
+    {
+        (*_task)(i);
+    }
+}
@@ -0,0 +1,93 @@
+//ThreadPool.h
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads, started once and reused for every parallelFor(). The
+ * calling thread works too, so a pool of n threads starts n - 1 workers. Tasks are handed out
+ * one at a time from a shared counter, so uneven tasks still balance across the threads.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @brief Constructor. Starts threads - 1 workers
+     * @param threads threads running the tasks, the caller included (values below 1 count as 1)
+     */
+    explicit ThreadPool(int threads);
+
+    /**
+     * @brief Destructor. Stops and joins the workers
+     */
+    ~ThreadPool();
+
+    /**
+     * @brief The workers belong to this pool
+     */
+    ThreadPool(const ThreadPool &) = delete;
+
+    /**
+     * @brief The workers belong to this pool
+     */
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * @brief Runs task(0) ... task(tasks - 1) on the pool's threads and returns once all of them
+     * are done. Calls from several threads are served one after the other. A call made from
+     * inside a task runs inline on that thread
+     * @param tasks number of tasks
+     * @param task the work, called once per task index
+     */
+    void parallelFor(int tasks, const std::function<void(int)> &task);
+
+    /**
+     * @brief thread count getter
+     * @return threads running the tasks, the caller included
+     */
+    int getThreadCount() const;
+
+    /**
+     * @brief Whether the calling thread is running a task of some pool, where a parallelFor()
+     * would run inline
+     * @return true inside a task
+     */
+    static bool insideTask();
+
+    /**
+     * @brief Threads the machine runs at once (at least 1)
+     * @return std::thread::hardware_concurrency(), or 1 when unknown
+     */
+    static int hardwareThreads();
+
+private:
+    std::vector<std::thread> _workers;
+    std::mutex _submitMutex;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const std::function<void(int)> *_task;
+    int _taskCount;
+    std::atomic<int> _nextTask;
+    int _busyWorkers;
+    unsigned long _generation;
+    bool _stopping;
+
+    /**
+     * @brief A worker's life: waits for a parallelFor(), helps drain it, reports, repeats
+     */
+    void _workerLoop();
+
+    /**
+     * @brief Runs tasks of the current parallelFor() until none are left
+     */
+    void _drain();
+};
+
+#endif //THREADPOOL_H
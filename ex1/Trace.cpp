@@ -0,0 +1,338 @@
+//
+// Created by user on 14/01/2020.
+//
+
+#include "Trace.h"
+
+#if MLP_TRACE
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <new>
+#include <utility>
+
+/**
+ * @brief Heap allocations of the calling thread, counted by the operator new below
+ */
+static thread_local uint64_t allocationCount = 0;
+
+/**
+ * @brief The innermost live TraceScope of the calling thread
+ */
+static thread_local TraceScope *currentScope = nullptr;
+
+/**
+ * @brief Counting replacement of the global operator new (new[], nothrow new and delete[]
+ * forward to these)
+ */
+void *operator new(std::size_t size)
+{
+    allocationCount++;
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+/**
+ * @brief Counterpart of the operator new above
+ */
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+/**
+ * @brief Sized counterpart of the operator new above
+ */
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+/**
+ * @brief Small id of the calling thread for the trace (0 for the first thread that traces)
+ */
+static int traceThread()
+{
+    static std::atomic<int> nextThread(0);
+    static thread_local const int thread = nextThread++;
+    return thread;
+}
+
+/**
+ * @brief The tracer. Starts enabled when TRACE_ENV_VAR is set
+ * @return the process wide instance
+ */
+Tracer &Tracer::instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+/**
+ * @brief Constructor. Reads TRACE_ENV_VAR
+ */
+Tracer::Tracer() : _dropped(0), _enabled(false), _epoch(std::chrono::steady_clock::now())
+{
+    const char *path = std::getenv(TRACE_ENV_VAR);
+    if (path != nullptr && *path != '\0')
+    {
+        _path = path;
+        _enabled = true;
+    }
+}
+
+/**
+ * @brief Destructor. Writes the trace and the summary when TRACE_ENV_VAR is set
+ */
+Tracer::~Tracer()
+{
+    if (_path.empty())
+    {
+        return;
+    }
+    if (!writeChromeTrace(_path))
+    {
+        std::cerr << TRACE_FILE_ERROR << _path << std::endl;
+    }
+    printSummary(std::cerr);
+}
+
+/**
+ * @brief Whether scopes are recorded
+ * @return true if they are
+ */
+bool Tracer::isEnabled() const
+{
+    return _enabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Starts or stops recording (events already recorded are kept)
+ * @param enabled true to record
+ */
+void Tracer::setEnabled(const bool enabled)
+{
+    _enabled.store(enabled, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Appends an event. Thread safe. The allocations of the log itself aren't counted
+ * @param event the finished scope
+ */
+void Tracer::record(const TraceEvent &event)
+{
+    const uint64_t allocations = allocationCount;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_events.size() < TRACE_MAX_EVENTS)
+        {
+            _events.push_back(event);
+        }
+        else
+        {
+            _dropped++;
+        }
+    }
+    allocationCount = allocations;
+}
+
+/**
+ * @brief Drops the recorded events
+ */
+void Tracer::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _events.clear();
+    _dropped = 0;
+}
+
+/**
+ * @brief Copy of the recorded events, in the order they finished
+ * @return the events
+ */
+std::vector<TraceEvent> Tracer::events() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _events;
+}
+
+/**
+ * @brief Nanoseconds since the tracer started
+ * @return the timestamp
+ */
+int64_t Tracer::now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - _epoch).count();
+}
+
+/**
+ * @brief The name of an event as displayed: name, then the layer index if any
+ */
+static std::string eventName(const TraceEvent &event)
+{
+    std::string name = event.name;
+    if (event.index >= 0)
+    {
+        name += " " + std::to_string(event.index);
+    }
+    return name;
+}
+
+/**
+ * @brief Writes the events as Chrome trace-event JSON (chrome://tracing, Perfetto): one
+ * complete ("X") event per scope, timestamps in microseconds, its FLOPs, bytes and allocations
+ * as args
+ * @param path output file
+ * @return false if the file can't be written
+ */
+bool Tracer::writeChromeTrace(const std::string &path) const
+{
+    const std::vector<TraceEvent> log = events();
+    std::ofstream os(path);
+    if (!os.is_open())
+    {
+        return false;
+    }
+
+    // names and categories are string literals of the code: nothing to escape
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    os << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < log.size(); i++)
+    {
+        const TraceEvent &event = log[i];
+        os << (i == 0 ? "\n" : ",\n")
+           << "{\"name\":\"" << eventName(event) << "\",\"cat\":\"" << event.category
+           << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+           << ",\"ts\":" << (double) event.start / 1e3
+           << ",\"dur\":" << (double) event.duration / 1e3
+           << ",\"args\":{\"flops\":" << std::setprecision(0) << event.flops
+           << ",\"bytes\":" << event.bytes << std::setprecision(3)
+           << ",\"allocations\":" << event.allocations << "}}";
+    }
+    os << "\n]}" << std::endl;
+    return os.good();
+}
+
+/**
+ * @brief Prints a table of the events grouped by category, name and layer (ordered that way):
+ * calls, total and mean time, GFLOP/s, GB/s and allocations per call. Times, FLOPs and bytes of
+ * a row include the scopes nested in it
+ * @param os output stream
+ */
+void Tracer::printSummary(std::ostream &os) const
+{
+    struct Row
+    {
+        uint64_t calls, allocations;
+        double nanoseconds, flops, bytes;
+    };
+
+    uint64_t dropped;
+    std::vector<TraceEvent> log;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        log = _events;
+        dropped = _dropped;
+    }
+
+    std::map<std::pair<std::string, std::string>, Row> rows;
+    for (const TraceEvent &event : log)
+    {
+        Row &row = rows[{event.category, eventName(event)}];
+        row.calls++;
+        row.allocations += event.allocations;
+        row.nanoseconds += (double) event.duration;
+        row.flops += event.flops;
+        row.bytes += event.bytes;
+    }
+
+    const std::ios_base::fmtflags flags = os.flags();
+    const std::streamsize precision = os.precision();
+    os << std::left << std::setw(10) << "category" << std::setw(24) << "scope" << std::right
+       << std::setw(10) << "calls" << std::setw(12) << "total ms" << std::setw(12) << "mean us"
+       << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s" << std::setw(12) << "allocs/call"
+       << std::endl;
+    os << std::fixed;
+    for (const auto &entry : rows)
+    {
+        const Row &row = entry.second;
+        const double seconds = std::max(row.nanoseconds, 1.0) / 1e9;
+        os << std::left << std::setw(10) << entry.first.first << std::setw(24)
+           << entry.first.second << std::right << std::setw(10) << row.calls
+           << std::setprecision(3) << std::setw(12) << row.nanoseconds / 1e6
+           << std::setw(12) << row.nanoseconds / 1e3 / (double) row.calls
+           << std::setprecision(2) << std::setw(10) << row.flops / seconds / 1e9
+           << std::setw(10) << row.bytes / seconds / 1e9
+           << std::setw(12) << (double) row.allocations / (double) row.calls << std::endl;
+    }
+    if (dropped > 0)
+    {
+        os << dropped << " events dropped (over " << TRACE_MAX_EVENTS << ")" << std::endl;
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+/**
+ * @brief Constructor. Starts the clock (nothing when the tracer is disabled)
+ * @param category see TRACE_SCOPE()
+ * @param name see TRACE_SCOPE()
+ * @param index see TRACE_SCOPE()
+ * @param flops see TRACE_SCOPE()
+ * @param bytes see TRACE_SCOPE()
+ */
+TraceScope::TraceScope(const char *category, const char *name, const int index,
+                       const double flops, const double bytes) :
+        _category(category), _name(name), _index(index), _flops(flops), _bytes(bytes), _start(0),
+        _allocations(0), _parent(nullptr), _active(Tracer::instance().isEnabled())
+{
+    if (!_active)
+    {
+        return;
+    }
+    _parent = currentScope;
+    currentScope = this;
+    _allocations = allocationCount;
+    _start = Tracer::instance().now();
+}
+
+/**
+ * @brief Destructor. Records the event and adds its FLOPs and bytes to the enclosing scope
+ */
+TraceScope::~TraceScope()
+{
+    if (!_active)
+    {
+        return;
+    }
+    Tracer &tracer = Tracer::instance();
+    const int64_t end = tracer.now();
+    const uint64_t allocations = allocationCount - _allocations;
+    currentScope = _parent;
+    if (_parent != nullptr)
+    {
+        _parent->_flops += _flops;
+        _parent->_bytes += _bytes;
+    }
+    tracer.record({_category, _name, _index, traceThread(), _start, end - _start, _flops, _bytes,
+                   allocations});
+}
+
+/**
+ * @brief Heap allocations (operator new) made by the calling thread so far
+ * @return the count
+ */
+uint64_t TraceScope::threadAllocations()
+{
+    return allocationCount;
+}
+
+#endif // MLP_TRACE
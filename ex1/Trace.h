@@ -0,0 +1,197 @@
+//Trace.h
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * @brief Execution tracing: 1 records every TRACE_SCOPE() (wall time, FLOPs, bytes touched and
+ * heap allocations) for a Chrome trace and a summary table, 0 (the default) compiles the scopes
+ * to nothing. Set at build time (-DMLP_TRACE=1, the MLP_TRACE CMake option or make TRACE=1)
+ */
+#ifndef MLP_TRACE
+#define MLP_TRACE 0
+#endif
+
+/**
+ * @brief Path of the Chrome trace written when the program exits. Recording only starts when it
+ * is set (the summary goes to stderr at the same time)
+ */
+#define TRACE_ENV_VAR "MLP_TRACE_FILE"
+
+/**
+ * @brief Events kept at most: a long run keeps its first TRACE_MAX_EVENTS scopes and counts the
+ * others as dropped
+ */
+#define TRACE_MAX_EVENTS (1 << 20)
+
+#define TRACE_FILE_ERROR "Error: cannot write the trace file: "
+
+#if MLP_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+/**
+ * @brief Traces the rest of the enclosing block as one event
+ * @param category "network", "layer" or "op" (the cat of the Chrome event)
+ * @param name a string literal
+ * @param index layer index shown after the name, -1 for none
+ * @param flops floating point (or integer multiply-add) operations of the block itself
+ * @param bytes bytes the block itself reads and writes
+ */
+#define TRACE_SCOPE(category, name, index, flops, bytes) \
+    const TraceScope TRACE_CONCAT(_traceScope, __LINE__)((category), (name), (index), \
+                                                          (double) (flops), (double) (bytes))
+
+/**
+ * @struct TraceEvent
+ * @brief One finished scope. flops, bytes and allocations include the scopes nested in it
+ */
+typedef struct TraceEvent
+{
+    const char *category, *name;
+    int index, thread;
+    int64_t start, duration;
+    double flops, bytes;
+    uint64_t allocations;
+} TraceEvent;
+
+/**
+ * @brief The process wide event log, shared by all threads
+ */
+class Tracer
+{
+public:
+    /**
+     * @brief The tracer. Starts enabled when TRACE_ENV_VAR is set
+     * @return the process wide instance
+     */
+    static Tracer &instance();
+
+    /**
+     * @brief Whether scopes are recorded
+     * @return true if they are
+     */
+    bool isEnabled() const;
+
+    /**
+     * @brief Starts or stops recording (events already recorded are kept)
+     * @param enabled true to record
+     */
+    void setEnabled(bool enabled);
+
+    /**
+     * @brief Appends an event. Thread safe
+     * @param event the finished scope
+     */
+    void record(const TraceEvent &event);
+
+    /**
+     * @brief Drops the recorded events
+     */
+    void clear();
+
+    /**
+     * @brief Copy of the recorded events, in the order they finished
+     * @return the events
+     */
+    std::vector<TraceEvent> events() const;
+
+    /**
+     * @brief Nanoseconds since the tracer started
+     * @return the timestamp
+     */
+    int64_t now() const;
+
+    /**
+     * @brief Writes the events as Chrome trace-event JSON (chrome://tracing, Perfetto): one
+     * complete event per scope, its FLOPs, bytes and allocations as args
+     * @param path output file
+     * @return false if the file can't be written
+     */
+    bool writeChromeTrace(const std::string &path) const;
+
+    /**
+     * @brief Prints a table of the events grouped by name and layer: calls, total and mean
+     * time, GFLOP/s, GB/s and allocations per call
+     * @param os output stream
+     */
+    void printSummary(std::ostream &os) const;
+
+private:
+    /**
+     * @brief Constructor. Reads TRACE_ENV_VAR
+     */
+    Tracer();
+
+    /**
+     * @brief Destructor. Writes the trace and the summary when TRACE_ENV_VAR is set
+     */
+    ~Tracer();
+
+    Tracer(const Tracer &) = delete;
+    Tracer &operator=(const Tracer &) = delete;
+
+    mutable std::mutex _mutex;
+    std::vector<TraceEvent> _events;
+    uint64_t _dropped;
+    std::atomic<bool> _enabled;
+    std::string _path;
+    std::chrono::steady_clock::time_point _epoch;
+};
+
+/**
+ * @brief RAII event of TRACE_SCOPE(): timed from construction to destruction. Passes its
+ * FLOPs and bytes on to the enclosing scope of the same thread
+ */
+class TraceScope
+{
+public:
+    /**
+     * @brief Constructor. Starts the clock (nothing when the tracer is disabled)
+     * @param category see TRACE_SCOPE()
+     * @param name see TRACE_SCOPE()
+     * @param index see TRACE_SCOPE()
+     * @param flops see TRACE_SCOPE()
+     * @param bytes see TRACE_SCOPE()
+     */
+    TraceScope(const char *category, const char *name, int index, double flops, double bytes);
+
+    /**
+     * @brief Destructor. Records the event
+     */
+    ~TraceScope();
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+    /**
+     * @brief Heap allocations (operator new) made by the calling thread so far
+     * @return the count
+     */
+    static uint64_t threadAllocations();
+
+private:
+    const char *_category, *_name;
+    int _index;
+    double _flops, _bytes;
+    int64_t _start;
+    uint64_t _allocations;
+    TraceScope *_parent;
+    bool _active;
+};
+
+#else
+
+#define TRACE_SCOPE(category, name, index, flops, bytes) ((void) 0)
+
+#endif // MLP_TRACE
+
+#endif //TRACE_H
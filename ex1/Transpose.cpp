@@ -0,0 +1,168 @@
+//
+// Created by user on 14/01/2020.
+//
+
+#include "Transpose.h"
+#include "Simd.h"
+
+#include <cstddef>
+
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Transposes one full TRANSPOSE_TILE × TRANSPOSE_TILE tile of A into B
+ */
+typedef void (*TransposeTile)(const float *a, int lda, float *b, int ldb);
+
+/**
+ * @brief Plain tile: read row by row, written col by col
+ */
+static void portableTile(const float *a, int lda, float *b, int ldb)
+{
+    for (int i = 0; i < TRANSPOSE_TILE; i++)
+    {
+        for (int j = 0; j < TRANSPOSE_TILE; j++)
+        {
+            b[(ptrdiff_t) j * ldb + i] = a[(ptrdiff_t) i * lda + j];
+        }
+    }
+}
+
+#if SIMD_X86
+
+/**
+ * @brief 8 × 8 tile in registers: the rows are interleaved in pairs (unpack), the pairs in
+ * quads (shuffle) and the 128 bit halves swapped across the quads (permute), 24 shuffles for 64
+ * elements
+ */
+__attribute__((target("avx2")))
+static void avx2Tile(const float *a, int lda, float *b, int ldb)
+{
+    __m256 r[TRANSPOSE_TILE];
+    for (int i = 0; i < TRANSPOSE_TILE; i++)
+    {
+        r[i] = _mm256_loadu_ps(a + (ptrdiff_t) i * lda);
+    }
+
+    const __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    const __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    const __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+    const __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    const __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+    const __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    const __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+    const __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+    const __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    _mm256_storeu_ps(b, _mm256_permute2f128_ps(s0, s4, 0x20));
+    _mm256_storeu_ps(b + ldb, _mm256_permute2f128_ps(s1, s5, 0x20));
+    _mm256_storeu_ps(b + 2 * (ptrdiff_t) ldb, _mm256_permute2f128_ps(s2, s6, 0x20));
+    _mm256_storeu_ps(b + 3 * (ptrdiff_t) ldb, _mm256_permute2f128_ps(s3, s7, 0x20));
+    _mm256_storeu_ps(b + 4 * (ptrdiff_t) ldb, _mm256_permute2f128_ps(s0, s4, 0x31));
+    _mm256_storeu_ps(b + 5 * (ptrdiff_t) ldb, _mm256_permute2f128_ps(s1, s5, 0x31));
+    _mm256_storeu_ps(b + 6 * (ptrdiff_t) ldb, _mm256_permute2f128_ps(s2, s6, 0x31));
+    _mm256_storeu_ps(b + 7 * (ptrdiff_t) ldb, _mm256_permute2f128_ps(s3, s7, 0x31));
+}
+
+#endif // SIMD_X86
+
+/**
+ * @brief The tile kernel for simdIsa(), selected once. AVX-512 CPUs run the AVX2 one: a tile
+ * is a few dozen shuffles, the transpose is bound by memory
+ */
+static TransposeTile activeTile()
+{
+    static const TransposeTile tile = []() -> TransposeTile
+    {
+        switch (simdIsa())
+        {
+#if SIMD_X86
+            case SimdAvx512:
+            case SimdAvx2:
+                return avx2Tile;
+#endif
+            default:
+                return portableTile;
+        }
+    }();
+    return tile;
+}
+
+/**
+ * @brief A leaf block, at most TRANSPOSE_LEAF × TRANSPOSE_LEAF: full tiles through the kernel,
+ * the ragged right and bottom edges element by element
+ */
+static void transposeLeaf(int rows, int cols, const float *a, int lda, float *b, int ldb,
+                          TransposeTile tile)
+{
+    const int fullRows = rows / TRANSPOSE_TILE * TRANSPOSE_TILE;
+    const int fullCols = cols / TRANSPOSE_TILE * TRANSPOSE_TILE;
+    for (int i = 0; i < fullRows; i += TRANSPOSE_TILE)
+    {
+        for (int j = 0; j < fullCols; j += TRANSPOSE_TILE)
+        {
+            tile(a + (ptrdiff_t) i * lda + j, lda, b + (ptrdiff_t) j * ldb + i, ldb);
+        }
+    }
+
+    for (int i = 0; i < rows; i++)
+    {
+        // the full tiles covered cols [0, fullCols) of the first fullRows rows
+        for (int j = i < fullRows ? fullCols : 0; j < cols; j++)
+        {
+            b[(ptrdiff_t) j * ldb + i] = a[(ptrdiff_t) i * lda + j];
+        }
+    }
+}
+
+/**
+ * @brief The recursion: splits the longer side in two (at a tile boundary when it can) until
+ * the block is a leaf
+ */
+static void transposeRecursive(int rows, int cols, const float *a, int lda, float *b, int ldb,
+                               TransposeTile tile)
+{
+    if (rows <= TRANSPOSE_LEAF && cols <= TRANSPOSE_LEAF)
+    {
+        transposeLeaf(rows, cols, a, lda, b, ldb, tile);
+        return;
+    }
+
+    if (rows >= cols)
+    {
+        const int half = (rows / 2 + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE * TRANSPOSE_TILE;
+        transposeRecursive(half, cols, a, lda, b, ldb, tile);
+        transposeRecursive(rows - half, cols, a + (ptrdiff_t) half * lda, lda, b + half, ldb,
+                           tile);
+        return;
+    }
+
+    const int half = (cols / 2 + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE * TRANSPOSE_TILE;
+    transposeRecursive(rows, half, a, lda, b, ldb, tile);
+    transposeRecursive(rows, cols - half, a + half, lda, b + (ptrdiff_t) half * ldb, ldb, tile);
+}
+
+/**
+ * @brief Cache-oblivious out of place transpose: B = A^T. A is rows × cols with leading
+ * dimension lda, B is cols × rows with leading dimension ldb. Recursive halving down to
+ * TRANSPOSE_LEAF blocks, each one walked in TRANSPOSE_TILE × TRANSPOSE_TILE tiles transposed in
+ * registers (AVX2 and AVX-512 CPUs, see simdIsa()), the ragged edges element by element
+ */
+void transposeMatrix(int rows, int cols, const float *a, int lda, float *b, int ldb)
+{
+    if (rows <= 0 || cols <= 0)
+    {
+        return;
+    }
+    transposeRecursive(rows, cols, a, lda, b, ldb, activeTile());
+}
@@ -0,0 +1,30 @@
+//Transpose.h
+#ifndef TRANSPOSE_H
+#define TRANSPOSE_H
+
+/**
+ * @brief transposeMatrix() halves the larger side of the matrix until both are at most this
+ * long: the blocks that fit, whatever the cache sizes, are transposed while they are in cache
+ */
+#define TRANSPOSE_LEAF 32
+
+/**
+ * @brief Edge of the square tiles of the SIMD kernel (one AVX register per row)
+ */
+#define TRANSPOSE_TILE 8
+
+/**
+ * @brief Cache-oblivious out of place transpose: B = A^T. A is rows × cols with leading
+ * dimension lda, B is cols × rows with leading dimension ldb. Recursive halving down to
+ * TRANSPOSE_LEAF blocks, each one walked in TRANSPOSE_TILE × TRANSPOSE_TILE tiles transposed in
+ * registers (AVX2 and AVX-512 CPUs, see simdIsa()), the ragged edges element by element
+ * @param rows rows of A
+ * @param cols cols of A
+ * @param a pointer to A
+ * @param lda distance (in floats) between consecutive rows of A
+ * @param b pointer to B. Must not overlap A
+ * @param ldb distance (in floats) between consecutive rows of B
+ */
+void transposeMatrix(int rows, int cols, const float *a, int lda, float *b, int ldb);
+
+#endif //TRANSPOSE_H
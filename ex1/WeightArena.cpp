@@ -0,0 +1,128 @@
+//
+// Created by user on 14/01/2020.
+//
+
+#include "WeightArena.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <sys/mman.h>
+
+#include "AlignedBuffer.h"
+
+/**
+ * @brief Constructor of an empty arena
+ */
+WeightArena::WeightArena() : _data(nullptr), _size(0), _mappedBytes(0), _hugePages(false)
+{
+
+}
+
+/**
+ * @brief Destructor, frees the memory
+ */
+WeightArena::~WeightArena()
+{
+    if (_mappedBytes > 0)
+    {
+        munmap(_data, _mappedBytes);
+    }
+    else
+    {
+        std::free(_data);
+    }
+}
+
+/**
+ * @brief Plans a part of the arena, rounded up to whole BUFFER_ALIGNMENT blocks so the next
+ * part is aligned too. Only before allocate()
+ * @param floats size of the part
+ * @return its offset, for data()
+ */
+size_t WeightArena::reserve(const size_t floats)
+{
+    const size_t block = BUFFER_ALIGNMENT / sizeof(float);
+    const size_t offset = _size;
+    _size += (floats + block - 1) / block * block;
+    return offset;
+}
+
+/**
+ * @brief Allocates the planned parts, zero filled: huge pages from ARENA_HUGE_PAGE_MIN on
+ * (explicit ones, else transparent ones, else plain pages), an aligned heap block below. Throws
+ * std::bad_alloc if there is no memory
+ */
+void WeightArena::allocate()
+{
+    const size_t bytes = _size * sizeof(float);
+    if (bytes == 0)
+    {
+        return;
+    }
+
+    if (bytes >= ARENA_HUGE_PAGE_MIN)
+    {
+        const size_t mapped = (bytes + ARENA_HUGE_PAGE_SIZE - 1) / ARENA_HUGE_PAGE_SIZE
+                              * ARENA_HUGE_PAGE_SIZE;
+        void *memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        _hugePages = memory != MAP_FAILED;
+#endif
+        if (memory == MAP_FAILED)
+        {
+            memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1, 0);
+#ifdef MADV_HUGEPAGE
+            _hugePages = memory != MAP_FAILED && madvise(memory, mapped, MADV_HUGEPAGE) == 0;
+#endif
+        }
+        if (memory != MAP_FAILED)
+        {
+            // anonymous mappings are zero filled and page aligned
+            _data = static_cast<float *>(memory);
+            _mappedBytes = mapped;
+            return;
+        }
+    }
+
+    void *memory = nullptr;
+    if (posix_memalign(&memory, BUFFER_ALIGNMENT, bytes) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    std::memset(memory, 0, bytes);
+    _data = static_cast<float *>(memory);
+}
+
+/**
+ * @brief A part of the arena. Only after allocate()
+ * @param offset the part's offset, from reserve()
+ * @return pointer to the part, BUFFER_ALIGNMENT aligned
+ */
+float *WeightArena::data(const size_t offset) const
+{
+    return _data + offset;
+}
+
+/**
+ * @brief size getter
+ * @return floats planned in the arena, alignment padding included
+ */
+size_t WeightArena::size() const
+{
+    return _size;
+}
+
+/**
+ * @brief Whether the arena is on huge pages (transparent ones being a request the kernel may
+ * not always honour)
+ * @return true if it was mapped with MAP_HUGETLB or advised MADV_HUGEPAGE
+ */
+bool WeightArena::usesHugePages() const
+{
+    return _hugePages;
+}
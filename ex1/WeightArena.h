@@ -0,0 +1,93 @@
+//WeightArena.h
+#ifndef WEIGHTARENA_H
+#define WEIGHTARENA_H
+
+#include <cstddef>
+
+/**
+ * @brief Huge page size the arena asks for: 2MB, the x86-64 one
+ */
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * @brief Arenas from this size on are mapped on huge pages (rounded up to ARENA_HUGE_PAGE_SIZE);
+ * smaller ones would waste most of the page and stay on the heap
+ */
+#define ARENA_HUGE_PAGE_MIN (ARENA_HUGE_PAGE_SIZE / 2)
+
+/**
+ * @brief Offset standing for a part that isn't in the arena
+ */
+#define ARENA_NONE ((size_t) -1)
+
+/**
+ * @brief A network's read-only parameters in one allocation: every part reserved in it starts
+ * on a BUFFER_ALIGNMENT boundary, in the order it was reserved. Planned first (reserve()), then
+ * allocated once (allocate()), so the parts never move. Large arenas use huge pages when the
+ * system has them: explicit ones (MAP_HUGETLB) if any are reserved, else transparent ones
+ * (MADV_HUGEPAGE)
+ */
+class WeightArena
+{
+public:
+    /**
+     * @brief Constructor of an empty arena
+     */
+    WeightArena();
+
+    /**
+     * @brief The arena owns its memory
+     */
+    WeightArena(const WeightArena &) = delete;
+
+    /**
+     * @brief The arena owns its memory
+     */
+    WeightArena &operator=(const WeightArena &) = delete;
+
+    /**
+     * @brief Destructor, frees the memory
+     */
+    ~WeightArena();
+
+    /**
+     * @brief Plans a part of the arena. Only before allocate()
+     * @param floats size of the part
+     * @return its offset, for data()
+     */
+    size_t reserve(size_t floats);
+
+    /**
+     * @brief Allocates the planned parts, zero filled. Throws std::bad_alloc if there is no
+     * memory
+     */
+    void allocate();
+
+    /**
+     * @brief A part of the arena. Only after allocate()
+     * @param offset the part's offset, from reserve()
+     * @return pointer to the part, BUFFER_ALIGNMENT aligned
+     */
+    float *data(size_t offset) const;
+
+    /**
+     * @brief size getter
+     * @return floats planned in the arena, alignment padding included
+     */
+    size_t size() const;
+
+    /**
+     * @brief Whether the arena is on huge pages (transparent ones being a request the kernel
+     * may not always honour)
+     * @return true if it was mapped with MAP_HUGETLB or advised MADV_HUGEPAGE
+     */
+    bool usesHugePages() const;
+
+private:
+    float *_data;
+    size_t _size;
+    size_t _mappedBytes;
+    bool _hugePages;
+};
+
+#endif //WEIGHTARENA_H
@@ -0,0 +1,80 @@
+//
+// Created by user on 05/01/2020.
+//
+
+#include "Workspace.h"
+
+/**
+ * @brief Constructor. Allocates both buffers
+ * @param bufferSize floats each buffer must hold (the widest layer output)
+ */
+Workspace::Workspace(int bufferSize) : _bufferSize(0), _stride(0)
+{
+    reserve(bufferSize);
+}
+
+/**
+ * @brief Grows both buffers to hold at least bufferSize floats (e.g. a batch of layer
+ * outputs). No-op when they are already large enough. Previous content is lost on growth
+ * @param bufferSize floats each buffer must hold
+ */
+void Workspace::reserve(int bufferSize)
+{
+    if (bufferSize <= _bufferSize)
+    {
+        return;
+    }
+
+    // round each buffer up to whole cache lines so the second one stays aligned too
+    const int lineFloats = BUFFER_ALIGNMENT / sizeof(float);
+    _bufferSize = bufferSize;
+    _stride = (bufferSize + lineFloats - 1) / lineFloats * lineFloats;
+    _storage.reserve((size_t) _stride * WORKSPACE_BUFFERS);
+}
+
+/**
+ * @brief ping-pong buffer getter
+ * @param layer index of the layer about to write its output
+ * @return the buffer that layer writes to
+ */
+float *Workspace::buffer(int layer)
+{
+    return _storage.data() + (size_t) (layer % WORKSPACE_BUFFERS) * _stride;
+}
+
+/**
+ * @brief ping-pong index buffer getter: the lists of non-zero entries that single vector
+ * passes hand from a layer to the next, alternating like buffer()
+ * @param layer index of the layer about to write its list, -1 for the network input
+ * @param size indices needed. Grows the list on first use, like reserve()
+ * @return the list that layer writes to
+ */
+int32_t *Workspace::indices(int layer, int size)
+{
+    std::vector<int32_t> &list = _indices[(layer + WORKSPACE_BUFFERS) % WORKSPACE_BUFFERS];
+    if (list.size() < (size_t) size)
+    {
+        list.resize(size);
+    }
+    return list.data();
+}
+
+/**
+ * @brief Grow-only staging area, separate from the ping-pong buffers (e.g. to pack a batch
+ * of images before the first layer)
+ * @param size floats needed
+ * @return an aligned buffer of at least size floats
+ */
+float *Workspace::staging(size_t size)
+{
+    return _staging.reserve(size);
+}
+
+/**
+ * @brief buffer size getter
+ * @return floats available in each buffer
+ */
+int Workspace::getBufferSize() const
+{
+    return _bufferSize;
+}
@@ -0,0 +1,72 @@
+//Workspace.h
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "AlignedBuffer.h"
+
+#define WORKSPACE_BUFFERS 2
+
+/**
+ * @brief Preallocated scratch memory for a forward pass: two aligned activation buffers that
+ * the layers alternate between (layer i reads buffer (i - 1) % 2 and writes buffer i % 2).
+ * Allocated once, so inference itself never touches the heap.
+ */
+class Workspace
+{
+public:
+    /**
+     * @brief Constructor. Allocates both buffers
+     * @param bufferSize floats each buffer must hold (the widest layer output)
+     */
+    explicit Workspace(int bufferSize);
+
+    /**
+     * @brief Grows both buffers to hold at least bufferSize floats (e.g. a batch of layer
+     * outputs). No-op when they are already large enough. Previous content is lost on growth
+     * @param bufferSize floats each buffer must hold
+     */
+    void reserve(int bufferSize);
+
+    /**
+     * @brief ping-pong buffer getter
+     * @param layer index of the layer about to write its output
+     * @return the buffer that layer writes to
+     */
+    float *buffer(int layer);
+
+    /**
+     * @brief ping-pong index buffer getter: the lists of non-zero entries that single vector
+     * passes hand from a layer to the next, alternating like buffer()
+     * @param layer index of the layer about to write its list, -1 for the network input
+     * @param size indices needed. Grows the list on first use, like reserve()
+     * @return the list that layer writes to
+     */
+    int32_t *indices(int layer, int size);
+
+    /**
+     * @brief Grow-only staging area, separate from the ping-pong buffers (e.g. to pack a batch
+     * of images before the first layer)
+     * @param size floats needed
+     * @return an aligned buffer of at least size floats
+     */
+    float *staging(size_t size);
+
+    /**
+     * @brief buffer size getter
+     * @return floats available in each buffer
+     */
+    int getBufferSize() const;
+
+private:
+    AlignedBuffer _storage;
+    AlignedBuffer _staging;
+    std::vector<int32_t> _indices[WORKSPACE_BUFFERS];
+    int _bufferSize;
+    int _stride;
+};
+
+#endif //WORKSPACE_H
@@ -4,20 +4,31 @@
 #include "Activation.h"
 #include "Dense.h"
 #include "MlpNetwork.h"
+#include "ModelFile.h"
+
+#ifdef MLP_COMPILED_MODEL
+#include "CompiledModel.h"
+#endif
 
 #define QUIT "q"
 #define INSERT_IMAGE_PATH "Please insert image path:"
 #define ERROR_INAVLID_PARAMETER "Error: invalid Parameters file for layer: "
 #define ERROR_INVALID_INPUT "Error: Failed to retrieve input. Exiting.."
 #define ERROR_INVALID_IMG "Error: invalid image path or size: "
+#define ERROR_INVALID_MODEL "Error: the model doesn't take 28x28 images"
 #define USAGE_MSG "Usage:\n" \
                   "\t./mlpnetwork w1 w2 w3 w4 b1 b2 b3 b4\n" \
                   "\twi - the i'th layer's weights\n" \
-                  "\tbi - the i'th layer's biases"
+                  "\tbi - the i'th layer's biases\n" \
+                  "\t./mlpnetwork model\n" \
+                  "\tmodel - a single model file (see model_tool)\n" \
+                  "\t./mlpnetwork_compiled\n" \
+                  "\tthe network built in by model_compiler (MLP_COMPILED_MODEL builds)"
 
 
 #define ARGS_START_IDX 1
 #define ARGS_COUNT (ARGS_START_IDX + (MLP_SIZE * 2))
+#define MODEL_ARGS_COUNT (ARGS_START_IDX + 1)
 #define WEIGHTS_START_IDX ARGS_START_IDX
 #define BIAS_START_IDX (ARGS_START_IDX + MLP_SIZE)
 
@@ -102,9 +113,10 @@ void loadParameters(char *paths[ARGS_COUNT], Matrix weights[MLP_SIZE], Matrix bi
  *                  print image & netowrk prediction
  *             }
  * Exits (code == 1) on fatal errors: unable to read user input path.
- * @param mlp MlpNetwork to use in order to predict img.
+ * @param mlp MlpNetwork (or FixedMlpNetwork) to use in order to predict img.
  */
-void mlpCli(MlpNetwork &mlp)
+template <typename Network>
+void mlpCli(const Network &mlp)
 {
     Matrix img(imgDims.rows, imgDims.cols);
     std::string imgPath;
@@ -121,8 +133,8 @@ void mlpCli(MlpNetwork &mlp)
     {
         if(readFileToMatrix(imgPath, img))
         {
-            Matrix imgVec = img;
-            Digit output = mlp(imgVec.vectorize());
+            // a vector view of the image's own elements, no copy
+            Digit output = mlp(MatrixView(img).vectorized());
             std::cout << "Image processed:" << std::endl
                       << img << std::endl;
             std::cout << "Mlp result: " << output.value <<
@@ -151,6 +163,30 @@ void mlpCli(MlpNetwork &mlp)
  */
 int main(int argc, char **argv)
 {
+#ifdef MLP_COMPILED_MODEL
+    if(argc == ARGS_START_IDX)
+    {
+        // the weights are constants of the program, there is nothing to load
+        mlpCli(compiledMlpNetwork());
+        return EXIT_SUCCESS;
+    }
+#endif
+
+    if(argc == MODEL_ARGS_COUNT)
+    {
+        // the weights stay in the mapped file, the network reads them in place
+        ModelFile model(argv[ARGS_START_IDX]);
+        if(model.layerDims(0).cols != imgDims.rows * imgDims.cols)
+        {
+            std::cerr << ERROR_INVALID_MODEL << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        MlpNetwork mlp(model);
+        mlpCli(mlp);
+        return EXIT_SUCCESS;
+    }
+
     if(argc != ARGS_COUNT)
     {
         usage();